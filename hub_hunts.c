@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "hub_hunts.h"
+#include "treasure_store.h"
+
+int hub_list_hunts(HuntCache* cache, FILE* out) {
+    double threshold = store_compact_threshold();
+    int count = hunt_cache_list(cache);
+    int hunt_count = 0;
+
+    if (count == -1) {
+        fprintf(out, "opendir: %s\n", strerror(errno));
+        return -1;
+    }
+
+    fprintf(out, "Available Hunts:\n");
+    fprintf(out, "---------------\n");
+
+    // Directory entries and headers come from the cache; only hunts that
+    // changed since the last listing are read again.
+    for (int i = 0; i < cache->hunt_count; i++) {
+        CachedHunt* hunt = cache->hunts[i];
+
+        if (hunt->name_too_long) {
+            fprintf(out, "Hunt name too long: %s\n", hunt->hunt_id);
+            continue;
+        }
+        if (!hunt_cache_header(cache, hunt)) {
+            continue;
+        }
+
+        // Opportunistically drop tombstones while we are walking the hunts
+        if (hunt->hdr.slot_count > 0 && (double)hunt->hdr.dead_count / hunt->hdr.slot_count > threshold) {
+            store_maybe_compact(hunt->hunt_id);
+        }
+
+        fprintf(out, "Hunt: %s - Total treasures: %d\n", hunt->hunt_id, (int)hunt->hdr.record_count);
+        hunt_count++;
+    }
+
+    if (hunt_count == 0) {
+        fprintf(out, "No hunts found.\n");
+    }
+    return 1;
+}
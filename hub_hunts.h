@@ -0,0 +1,17 @@
+#ifndef HUB_HUNTS_H
+#define HUB_HUNTS_H
+
+#include <stdio.h>
+
+#include "hunt_cache.h"
+
+// The hub's list_hunts answer, kept out of treasure_hub.c so treasure_bench
+// can time the same listing against a cache of its own.
+
+// Prints every hunt in the working directory with its treasure count, from
+// the headers cached in cache, compacting hunts past the dead threshold on
+// the way. Call hunt_cache_sync first. Returns 1, or -1 if the directory
+// cannot be listed; that error goes to out too, for the hub's client.
+int hub_list_hunts(HuntCache* cache, FILE* out);
+
+#endif
@@ -0,0 +1,799 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "treasure_store.h"
+
+// Load driver for treasure_hub. Starts the hub in --script mode with its
+// stdin and stdout on pipes, starts the monitor, and replays a weighted mix
+// of list_hunts, list_treasures and view_treasure against the hunts in the
+// working directory.
+//
+// Two ways to apply load:
+//   --concurrency C  closed loop: keep C requests in flight (default 8)
+//   --rate R         open loop: send R requests per second on a fixed
+//                    schedule. A request that finds --max-outstanding
+//                    requests in flight is dropped instead of sent, and
+//                    latency is measured from the scheduled time, so a hub
+//                    that falls behind is not hidden by a driver that waits.
+//
+// The hub prints answers in the order requests were given, each ending with
+// "Task done!", so answers are matched to requests first in, first out. An
+// answer containing an "Error:" line counts as an error, and one that comes
+// later than --timeout as timed out; neither is part of the latencies.
+//
+// --check HUNT runs a consistency check instead of load: with one monitor
+// worker, it views a treasure of HUNT, then adds a treasure and removes the
+// viewed one from outside the hub, lists the hunts, and expects the hub to
+// show the new treasure and not the removed one. It changes HUNT.
+
+#define LOAD_DEFAULT_CONCURRENCY 8
+#define LOAD_DEFAULT_DURATION 10.0
+#define LOAD_DEFAULT_TIMEOUT_MS 5000
+#define LOAD_DEFAULT_MAX_OUTSTANDING 1024
+#define LOAD_MAX_HUNTS 1024
+#define LOAD_MAX_WORKERS 64          // MAX_MONITOR_WORKERS in treasure_hub.c
+#define LOAD_LINE_MAX 4096
+#define LOAD_STARTUP_SECONDS 10.0
+
+typedef enum {
+    LOAD_LIST_HUNTS,
+    LOAD_LIST_TREASURES,
+    LOAD_VIEW_TREASURE,
+    LOAD_KINDS
+} LoadKind;
+
+static const char* const kind_names[LOAD_KINDS] = {
+    "list_hunts", "list_treasures", "view_treasure"
+};
+
+typedef struct {
+    double sent;                // when the request was (or was due to be) sent
+    LoadKind kind;
+    int error;
+} InFlight;
+
+typedef struct {
+    int64_t sent;
+    int64_t ok;
+    int64_t errors;
+    int64_t timed_out;
+    double* latencies;          // seconds, ok answers only
+    int64_t latency_count;
+    int64_t latency_capacity;
+} KindStats;
+
+typedef struct {
+    char hunt_id[MAX_PATH];
+    int64_t next_id;
+} LoadHunt;
+
+// Driver state shared by the send and receive paths.
+typedef struct {
+    pid_t hub_pid;
+    int to_hub;
+    int from_hub;
+    char* out;                  // commands not yet taken by the pipe
+    size_t out_len;
+    size_t out_cap;
+    char line[LOAD_LINE_MAX];
+    size_t line_len;
+    InFlight* ring;             // requests in flight, oldest first
+    int ring_cap;
+    int ring_head;
+    int ring_count;
+    int monitors_started;
+    int start_failed;
+    int hub_closed;
+    KindStats stats[LOAD_KINDS];
+    LoadHunt* hunts;
+    int hunt_count;
+    int weights[LOAD_KINDS];
+    int weight_total;
+    uint64_t rng;
+    double timeout;
+    int64_t dropped;
+    const char* expect;         // answer line ask_hub looks for
+    int expect_seen;
+} LoadDriver;
+
+int json_output = 0;
+
+double now_seconds(void);
+uint64_t load_random(LoadDriver* driver);
+int parse_mix(LoadDriver* driver, const char* mix);
+int discover_hunts(LoadDriver* driver);
+int start_hub(LoadDriver* driver, const char* hub_path);
+int queue_command(LoadDriver* driver, const char* command);
+int flush_commands(LoadDriver* driver);
+int send_request(LoadDriver* driver, double sent);
+int read_hub(LoadDriver* driver);
+void handle_line(LoadDriver* driver, const char* line);
+int pump(LoadDriver* driver, double until);
+void stop_hub(LoadDriver* driver);
+void print_report(LoadDriver* driver, double elapsed, int workers);
+int ask_hub(LoadDriver* driver, LoadKind kind, const char* command, const char* expect);
+int check_hunt(LoadDriver* driver, const char* hunt_id);
+
+int main(int argc, char* argv[]) {
+    const char* hub_path = "./treasure_hub";
+    const char* mix = "list_hunts:1,list_treasures:2,view_treasure:7";
+    const char* check = NULL;
+    double duration = LOAD_DEFAULT_DURATION;
+    double rate = 0;
+    int64_t max_requests = 0;
+    int concurrency = LOAD_DEFAULT_CONCURRENCY;
+    int max_outstanding = LOAD_DEFAULT_MAX_OUTSTANDING;
+    int timeout_ms = LOAD_DEFAULT_TIMEOUT_MS;
+    int workers = 0;
+    int usage_error = 0;
+    int64_t issued = 0;
+    double start, end, deadline, next_send;
+    LoadDriver driver;
+    char command[32];
+
+    memset(&driver, 0, sizeof(driver));
+    driver.rng = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hub") == 0 && i + 1 < argc) {
+            hub_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mix") == 0 && i + 1 < argc) {
+            mix = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0) {
+            rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            concurrency = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-outstanding") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            max_outstanding = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 1) {
+            max_requests = (int64_t)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            timeout_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            driver.rng = strtoull(argv[++i], NULL, 10) * 0x9e3779b97f4a7c15ull + 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_output = 1;
+        } else if (strcmp(argv[i], "--check") == 0 && i + 1 < argc) {
+            check = argv[++i];
+        } else {
+            usage_error = 1;
+        }
+    }
+
+    if (usage_error || !parse_mix(&driver, mix)) {
+        fprintf(stderr, "Usage: %s [--hub PATH] [--workers N] [--mix kind:weight,...]\n", argv[0]);
+        fprintf(stderr, "       %*s [--concurrency C | --rate R [--max-outstanding N]]\n", (int)strlen(argv[0]), "");
+        fprintf(stderr, "       %*s [--duration S] [--requests N] [--timeout MS] [--seed S] [--json]\n",
+            (int)strlen(argv[0]), "");
+        fprintf(stderr, "       %s --check HUNT [--hub PATH] [--timeout MS]\n", argv[0]);
+        fprintf(stderr, "Kinds: list_hunts, list_treasures, view_treasure\n");
+        return 1;
+    }
+
+    if (check != NULL) {
+        // Every request has to reach the same monitor cache.
+        workers = 1;
+        concurrency = 1;
+    }
+    if (!discover_hunts(&driver)) {
+        return 1;
+    }
+    if (driver.hunt_count == 0 &&
+        (driver.weights[LOAD_LIST_TREASURES] > 0 || driver.weights[LOAD_VIEW_TREASURE] > 0)) {
+        fprintf(stderr, "No hunts in the working directory for list_treasures or view_treasure\n");
+        return 1;
+    }
+
+    driver.timeout = timeout_ms / 1000.0;
+    driver.ring_cap = rate > 0 ? max_outstanding : concurrency;
+    driver.ring = malloc((size_t)driver.ring_cap * sizeof(InFlight));
+    if (driver.ring == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!start_hub(&driver, hub_path)) {
+        return 1;
+    }
+
+    // Same default as the hub: one worker per core. Wait for all of them
+    // before the clock starts.
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? (int)cores : 1;
+    }
+    if (workers > LOAD_MAX_WORKERS) {
+        workers = LOAD_MAX_WORKERS;
+    }
+    snprintf(command, sizeof(command), "start_monitor %d", workers);
+    queue_command(&driver, command);
+    deadline = now_seconds() + LOAD_STARTUP_SECONDS;
+    while (!driver.start_failed && driver.monitors_started < workers && now_seconds() < deadline) {
+        if (!pump(&driver, deadline)) {
+            break;
+        }
+    }
+    if (driver.monitors_started < workers || driver.start_failed) {
+        fprintf(stderr, "The hub did not start its monitor\n");
+        stop_hub(&driver);
+        return 1;
+    }
+
+    if (check != NULL) {
+        int passed = check_hunt(&driver, check);
+
+        stop_hub(&driver);
+        free(driver.ring);
+        free(driver.hunts);
+        free(driver.out);
+        return passed ? 0 : 1;
+    }
+
+    start = now_seconds();
+    end = start + duration;
+    next_send = start;
+
+    while (!driver.hub_closed) {
+        double now = now_seconds();
+
+        if (now >= end || (max_requests > 0 && issued >= max_requests)) {
+            break;
+        }
+        if (rate > 0) {
+            // Open loop: everything that is due goes out now.
+            while (next_send <= now && (max_requests == 0 || issued < max_requests)) {
+                if (driver.ring_count < driver.ring_cap) {
+                    send_request(&driver, next_send);
+                } else {
+                    driver.dropped++;
+                }
+                issued++;
+                next_send = start + (double)issued / rate;
+            }
+            if (!pump(&driver, next_send < end ? next_send : end)) {
+                break;
+            }
+        } else {
+            while (driver.ring_count < driver.ring_cap && (max_requests == 0 || issued < max_requests)) {
+                send_request(&driver, now);
+                issued++;
+            }
+            if (!pump(&driver, end)) {
+                break;
+            }
+        }
+    }
+
+    // Let what is in flight finish, up to the timeout.
+    deadline = now_seconds() + driver.timeout;
+    while (driver.ring_count > 0 && !driver.hub_closed && now_seconds() < deadline) {
+        if (!pump(&driver, deadline)) {
+            break;
+        }
+    }
+    end = now_seconds();
+    while (driver.ring_count > 0) {
+        InFlight* request = &driver.ring[driver.ring_head];
+        driver.stats[request->kind].timed_out++;
+        driver.ring_head = (driver.ring_head + 1) % driver.ring_cap;
+        driver.ring_count--;
+    }
+
+    stop_hub(&driver);
+    print_report(&driver, end - start, workers);
+
+    for (int k = 0; k < LOAD_KINDS; k++) {
+        free(driver.stats[k].latencies);
+    }
+    free(driver.ring);
+    free(driver.hunts);
+    free(driver.out);
+    return 0;
+}
+
+double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+// xorshift64*, as in treasure_bench.
+uint64_t load_random(LoadDriver* driver) {
+    driver->rng ^= driver->rng >> 12;
+    driver->rng ^= driver->rng << 25;
+    driver->rng ^= driver->rng >> 27;
+    return driver->rng * 0x2545f4914f6cdd1dull;
+}
+
+// Parses "kind:weight,..."; kinds left out get weight 0.
+int parse_mix(LoadDriver* driver, const char* mix) {
+    char buf[256];
+    char* saveptr;
+
+    snprintf(buf, sizeof(buf), "%s", mix);
+    memset(driver->weights, 0, sizeof(driver->weights));
+    driver->weight_total = 0;
+
+    for (char* item = strtok_r(buf, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        char* colon = strchr(item, ':');
+        int weight = colon ? atoi(colon + 1) : 1;
+        int kind;
+
+        if (colon) {
+            *colon = '\0';
+        }
+        for (kind = 0; kind < LOAD_KINDS; kind++) {
+            if (strcmp(item, kind_names[kind]) == 0) {
+                break;
+            }
+        }
+        if (kind == LOAD_KINDS || weight < 0) {
+            fprintf(stderr, "Invalid mix entry: %s\n", item);
+            return 0;
+        }
+        driver->weights[kind] = weight;
+    }
+    for (int kind = 0; kind < LOAD_KINDS; kind++) {
+        driver->weight_total += driver->weights[kind];
+    }
+    return driver->weight_total > 0;
+}
+
+// Hunts are the subdirectories with a readable treasures.dat; their next_id
+// bounds the IDs view_treasure asks for.
+int discover_hunts(LoadDriver* driver) {
+    DIR* dir = opendir(".");
+    struct dirent* entry;
+    struct stat st;
+    StoreHeader hdr;
+    int fd;
+
+    if (dir == NULL) {
+        perror("opendir");
+        return 0;
+    }
+    driver->hunts = calloc(LOAD_MAX_HUNTS, sizeof(LoadHunt));
+    if (driver->hunts == NULL) {
+        perror("calloc");
+        closedir(dir);
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL && driver->hunt_count < LOAD_MAX_HUNTS) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) + 14 >= MAX_PATH ||
+            stat(entry->d_name, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        fd = store_open(entry->d_name, O_RDONLY, &hdr);
+        if (fd == -1) {
+            continue;
+        }
+        close(fd);
+        snprintf(driver->hunts[driver->hunt_count].hunt_id, MAX_PATH, "%s", entry->d_name);
+        driver->hunts[driver->hunt_count].next_id = hdr.next_id;
+        driver->hunt_count++;
+    }
+    closedir(dir);
+    return 1;
+}
+
+int start_hub(LoadDriver* driver, const char* hub_path) {
+    int in_pipe[2];
+    int out_pipe[2];
+
+    if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1) {
+        perror("pipe");
+        return 0;
+    }
+
+    driver->hub_pid = fork();
+    if (driver->hub_pid == -1) {
+        perror("fork");
+        return 0;
+    }
+    if (driver->hub_pid == 0) {
+        dup2(in_pipe[0], STDIN_FILENO);
+        dup2(out_pipe[1], STDOUT_FILENO);
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        execl(hub_path, hub_path, "--script", (char*)NULL);
+        perror(hub_path);
+        _exit(127);
+    }
+
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    driver->to_hub = in_pipe[1];
+    driver->from_hub = out_pipe[0];
+    fcntl(driver->to_hub, F_SETFL, fcntl(driver->to_hub, F_GETFL) | O_NONBLOCK);
+    fcntl(driver->from_hub, F_SETFL, fcntl(driver->from_hub, F_GETFL) | O_NONBLOCK);
+    return 1;
+}
+
+int queue_command(LoadDriver* driver, const char* command) {
+    size_t len = strlen(command);
+
+    if (driver->out_len + len + 1 > driver->out_cap) {
+        size_t cap = driver->out_cap ? driver->out_cap * 2 : 4096;
+        char* grown;
+
+        while (cap < driver->out_len + len + 1) {
+            cap *= 2;
+        }
+        grown = realloc(driver->out, cap);
+        if (grown == NULL) {
+            return 0;
+        }
+        driver->out = grown;
+        driver->out_cap = cap;
+    }
+    memcpy(driver->out + driver->out_len, command, len);
+    driver->out[driver->out_len + len] = '\n';
+    driver->out_len += len + 1;
+    return flush_commands(driver);
+}
+
+// Writes as much of the queued commands as the pipe takes. Returns 0 if the
+// hub has gone away.
+int flush_commands(LoadDriver* driver) {
+    while (driver->out_len > 0) {
+        ssize_t n = write(driver->to_hub, driver->out, driver->out_len);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            driver->hub_closed = 1;
+            return 0;
+        }
+        memmove(driver->out, driver->out + n, driver->out_len - (size_t)n);
+        driver->out_len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Picks a request from the mix and queues it, recording sent as its start.
+int send_request(LoadDriver* driver, double sent) {
+    char command[MAX_PATH + 64];
+    int pick = (int)(load_random(driver) % (uint64_t)driver->weight_total);
+    LoadKind kind = LOAD_LIST_HUNTS;
+    InFlight* request;
+
+    for (int k = 0; k < LOAD_KINDS; k++) {
+        if (pick < driver->weights[k]) {
+            kind = (LoadKind)k;
+            break;
+        }
+        pick -= driver->weights[k];
+    }
+
+    if (kind == LOAD_LIST_HUNTS) {
+        snprintf(command, sizeof(command), "list_hunts");
+    } else {
+        const LoadHunt* hunt = &driver->hunts[load_random(driver) % (uint64_t)driver->hunt_count];
+        if (kind == LOAD_LIST_TREASURES) {
+            snprintf(command, sizeof(command), "list_treasures %s", hunt->hunt_id);
+        } else {
+            int64_t span = hunt->next_id > 1 ? hunt->next_id - 1 : 1;
+            snprintf(command, sizeof(command), "view_treasure %s %lld", hunt->hunt_id,
+                (long long)(1 + (int64_t)(load_random(driver) % (uint64_t)span)));
+        }
+    }
+
+    request = &driver->ring[(driver->ring_head + driver->ring_count) % driver->ring_cap];
+    request->sent = sent;
+    request->kind = kind;
+    request->error = 0;
+    driver->ring_count++;
+    driver->stats[kind].sent++;
+    return queue_command(driver, command);
+}
+
+static void record_latency(KindStats* stats, double latency) {
+    if (stats->latency_count == stats->latency_capacity) {
+        int64_t capacity = stats->latency_capacity ? stats->latency_capacity * 2 : 1024;
+        double* grown = realloc(stats->latencies, (size_t)capacity * sizeof(double));
+        if (grown == NULL) {
+            return;
+        }
+        stats->latencies = grown;
+        stats->latency_capacity = capacity;
+    }
+    stats->latencies[stats->latency_count++] = latency;
+}
+
+void handle_line(LoadDriver* driver, const char* line) {
+    InFlight* request = driver->ring_count > 0 ? &driver->ring[driver->ring_head] : NULL;
+
+    if (driver->expect != NULL && strcmp(line, driver->expect) == 0) {
+        driver->expect_seen = 1;
+    }
+    if (strncmp(line, "Monitor started with PID:", 25) == 0) {
+        driver->monitors_started++;
+    } else if (strcmp(line, "Error: Could not start monitor") == 0) {
+        driver->start_failed = 1;
+    } else if (strncmp(line, "Error:", 6) == 0) {
+        if (request != NULL) {
+            request->error = 1;
+        }
+    } else if (strcmp(line, "Task done!") == 0) {
+        double latency;
+        KindStats* stats;
+
+        // Answers to requests already given up on at the end of a run.
+        if (request == NULL) {
+            return;
+        }
+        latency = now_seconds() - request->sent;
+        stats = &driver->stats[request->kind];
+        if (latency > driver->timeout) {
+            stats->timed_out++;
+        } else if (request->error) {
+            stats->errors++;
+        } else {
+            stats->ok++;
+            record_latency(stats, latency);
+        }
+        driver->ring_head = (driver->ring_head + 1) % driver->ring_cap;
+        driver->ring_count--;
+    }
+}
+
+// Reads what the hub has written and handles every complete line. Returns
+// 0 once the hub has closed its output.
+int read_hub(LoadDriver* driver) {
+    char buf[64 * 1024];
+    ssize_t n;
+
+    while ((n = read(driver->from_hub, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                driver->line[driver->line_len] = '\0';
+                handle_line(driver, driver->line);
+                driver->line_len = 0;
+            } else if (driver->line_len < LOAD_LINE_MAX - 1) {
+                // Only the start of a line matters; the rest is dropped.
+                driver->line[driver->line_len++] = buf[i];
+            }
+        }
+    }
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        driver->hub_closed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Moves commands out and answers in until the given time. Returns 0 if the
+// hub has gone away.
+int pump(LoadDriver* driver, double until) {
+    struct pollfd fds[2];
+
+    do {
+        double wait = until - now_seconds();
+        int timeout_ms = wait > 0 ? (int)ceil(wait * 1000) : 0;
+        int ready;
+
+        fds[0].fd = driver->from_hub;
+        fds[0].events = POLLIN;
+        fds[1].fd = driver->to_hub;
+        fds[1].events = driver->out_len > 0 ? POLLOUT : 0;
+
+        ready = poll(fds, driver->out_len > 0 ? 2 : 1, timeout_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return 0;
+        }
+        if (fds[0].revents && !read_hub(driver)) {
+            return 0;
+        }
+        if (driver->out_len > 0 && (fds[1].revents & (POLLOUT | POLLERR)) && !flush_commands(driver)) {
+            return 0;
+        }
+        // Closed loop refills after every answer.
+        if (ready > 0 && fds[0].revents) {
+            return 1;
+        }
+    } while (now_seconds() < until);
+    return 1;
+}
+
+// Closes the hub's input, which makes it finish what is queued and stop the
+// monitor, then reaps it. A hub stuck on timed-out requests is killed.
+void stop_hub(LoadDriver* driver) {
+    double deadline = now_seconds() + driver->timeout + 2.0;
+    int status;
+
+    close(driver->to_hub);
+    driver->out_len = 0;
+    while (!driver->hub_closed && now_seconds() < deadline) {
+        pump(driver, deadline);
+    }
+    if (!driver->hub_closed) {
+        kill(driver->hub_pid, SIGTERM);
+    }
+    close(driver->from_hub);
+    waitpid(driver->hub_pid, &status, 0);
+}
+
+// Sends one command and waits for its answer. Returns 1 if the answer had
+// the line expect (which may be NULL), 0 if not, -1 if no answer came.
+int ask_hub(LoadDriver* driver, LoadKind kind, const char* command, const char* expect) {
+    double deadline = now_seconds() + driver->timeout;
+    InFlight* request = &driver->ring[(driver->ring_head + driver->ring_count) % driver->ring_cap];
+
+    request->sent = now_seconds();
+    request->kind = kind;
+    request->error = 0;
+    driver->ring_count++;
+    driver->expect = expect;
+    driver->expect_seen = 0;
+    if (!queue_command(driver, command)) {
+        return -1;
+    }
+    while (driver->ring_count > 0 && now_seconds() < deadline) {
+        if (!pump(driver, deadline)) {
+            break;
+        }
+    }
+    driver->expect = NULL;
+    if (driver->ring_count > 0) {
+        fprintf(stderr, "No answer to: %s\n", command);
+        return -1;
+    }
+    return driver->expect_seen;
+}
+
+// The hub's cached copy of a hunt has to follow changes made by other
+// processes, including after list_hunts has already read the new header.
+int check_hunt(LoadDriver* driver, const char* hunt_id) {
+    char command[MAX_PATH + 64];
+    char expect[64];
+    const TreasureRecord* record;
+    StoreIter it;
+    Treasure added;
+    int old_id, seen_old, seen_new;
+
+    if (store_iter_open(&it, hunt_id) != 1) {
+        fprintf(stderr, "Cannot read hunt: %s\n", hunt_id);
+        return 0;
+    }
+    record = store_iter_next(&it);
+    if (record == NULL) {
+        store_iter_close(&it);
+        fprintf(stderr, "Hunt has no treasures: %s\n", hunt_id);
+        return 0;
+    }
+    old_id = record->treasure_id;
+    memset(&added, 0, sizeof(added));
+    memcpy(added.username, record->username, MAX_USERNAME);
+    added.latitude = record->latitude;
+    added.longitude = record->longitude;
+    added.value = record->value;
+    store_iter_close(&it);
+    snprintf(added.clue, sizeof(added.clue), "hub_load check");
+
+    snprintf(command, sizeof(command), "view_treasure %s %d", hunt_id, old_id);
+    snprintf(expect, sizeof(expect), "Treasure ID: %d", old_id);
+    if (ask_hub(driver, LOAD_VIEW_TREASURE, command, expect) != 1) {
+        fprintf(stderr, "Check failed: hub does not show treasure %d\n", old_id);
+        return 0;
+    }
+
+    if (store_append(hunt_id, &added) != 1 || store_remove(hunt_id, old_id) != 1) {
+        perror("Failed to change the hunt");
+        return 0;
+    }
+    if (ask_hub(driver, LOAD_LIST_HUNTS, "list_hunts", NULL) == -1) {
+        return 0;
+    }
+
+    seen_old = ask_hub(driver, LOAD_VIEW_TREASURE, command, expect);
+    snprintf(command, sizeof(command), "view_treasure %s %d", hunt_id, added.treasure_id);
+    snprintf(expect, sizeof(expect), "Treasure ID: %d", added.treasure_id);
+    seen_new = ask_hub(driver, LOAD_VIEW_TREASURE, command, expect);
+    if (seen_old != 0 || seen_new != 1) {
+        fprintf(stderr, "Check failed: removed treasure %d %s, added treasure %d %s\n",
+            old_id, seen_old == 0 ? "hidden" : "still shown",
+            added.treasure_id, seen_new == 1 ? "shown" : "not shown");
+        return 0;
+    }
+    printf("Check passed: hub followed the add of %d and the removal of %d in %s\n",
+        added.treasure_id, old_id, hunt_id);
+    return 1;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples, in milliseconds.
+static double percentile_ms(const double* sorted, int64_t count, double p) {
+    int64_t rank = (int64_t)ceil(p * (double)count);
+
+    if (count == 0) {
+        return 0;
+    }
+    return sorted[rank > 0 ? rank - 1 : 0] * 1000.0;
+}
+
+static void print_row(const char* name, const KindStats* stats, double elapsed) {
+    double rate = elapsed > 0 ? (double)stats->ok / elapsed : 0;
+    double p50 = percentile_ms(stats->latencies, stats->latency_count, 0.50);
+    double p90 = percentile_ms(stats->latencies, stats->latency_count, 0.90);
+    double p99 = percentile_ms(stats->latencies, stats->latency_count, 0.99);
+    double max = percentile_ms(stats->latencies, stats->latency_count, 1.0);
+
+    if (json_output) {
+        printf("{\"load\": \"%s\", \"sent\": %lld, \"ok\": %lld, \"errors\": %lld, \"timed_out\": %lld, "
+            "\"ok_per_sec\": %.1f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}\n",
+            name, (long long)stats->sent, (long long)stats->ok, (long long)stats->errors,
+            (long long)stats->timed_out, rate, p50, p90, p99, max);
+    } else {
+        printf("%-15s | %8lld | %8lld | %6lld | %9lld | %10.1f | %9.3f | %9.3f | %9.3f | %9.3f\n",
+            name, (long long)stats->sent, (long long)stats->ok, (long long)stats->errors,
+            (long long)stats->timed_out, rate, p50, p90, p99, max);
+    }
+}
+
+void print_report(LoadDriver* driver, double elapsed, int workers) {
+    KindStats total;
+
+    memset(&total, 0, sizeof(total));
+    for (int k = 0; k < LOAD_KINDS; k++) {
+        KindStats* stats = &driver->stats[k];
+        qsort(stats->latencies, (size_t)stats->latency_count, sizeof(double), compare_doubles);
+        total.sent += stats->sent;
+        total.ok += stats->ok;
+        total.errors += stats->errors;
+        total.timed_out += stats->timed_out;
+        for (int64_t i = 0; i < stats->latency_count; i++) {
+            record_latency(&total, stats->latencies[i]);
+        }
+    }
+    qsort(total.latencies, (size_t)total.latency_count, sizeof(double), compare_doubles);
+
+    if (json_output) {
+        printf("{\"load\": \"config\", \"workers\": %d, \"hunts\": %d, \"seconds\": %.3f, \"dropped\": %lld}\n",
+            workers, driver->hunt_count, elapsed, (long long)driver->dropped);
+    } else {
+        printf("Workers: %d, hunts: %d, elapsed: %.3f s, dropped: %lld\n\n",
+            workers, driver->hunt_count, elapsed, (long long)driver->dropped);
+        printf("%-15s | %8s | %8s | %6s | %9s | %10s | %9s | %9s | %9s | %9s\n",
+            "Request", "Sent", "OK", "Errors", "Timed out", "OK/s", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)");
+        printf("-------------------------------------------------------------------------------------------------------------\n");
+    }
+    for (int k = 0; k < LOAD_KINDS; k++) {
+        if (driver->stats[k].sent > 0) {
+            print_row(kind_names[k], &driver->stats[k], elapsed);
+        }
+    }
+    print_row("total", &total, elapsed);
+    free(total.latencies);
+}
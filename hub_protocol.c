@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "hub_protocol.h"
+
+#define READ_CHUNK (64 * 1024)
+
+static int reserve(char** buf, size_t* cap, size_t needed) {
+    size_t new_cap = *cap ? *cap : READ_CHUNK;
+    char* grown;
+
+    if (needed <= *cap) {
+        return 1;
+    }
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    grown = realloc(*buf, new_cap);
+    if (grown == NULL) {
+        return 0;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return 1;
+}
+
+long frame_reader_fill(FrameReader* reader, int fd) {
+    ssize_t n;
+
+    // Drop frames already handed out before reading more.
+    if (reader->start > 0) {
+        memmove(reader->buf, reader->buf + reader->start, reader->len - reader->start);
+        reader->len -= reader->start;
+        reader->start = 0;
+    }
+    if (!reserve(&reader->buf, &reader->cap, reader->len + READ_CHUNK)) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    do {
+        n = read(fd, reader->buf + reader->len, reader->cap - reader->len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n > 0) {
+        reader->len += (size_t)n;
+    }
+    return (long)n;
+}
+
+int frame_reader_next(FrameReader* reader, HubFrameHeader* hdr, const char** payload) {
+    size_t available = reader->len - reader->start;
+
+    if (available < sizeof(*hdr)) {
+        return 0;
+    }
+    memcpy(hdr, reader->buf + reader->start, sizeof(*hdr));
+    if (hdr->length > HUB_MAX_PAYLOAD) {
+        return -1;
+    }
+    if (available < sizeof(*hdr) + hdr->length) {
+        return 0;
+    }
+
+    *payload = reader->buf + reader->start + sizeof(*hdr);
+    reader->start += sizeof(*hdr) + hdr->length;
+    return 1;
+}
+
+void frame_reader_free(FrameReader* reader) {
+    free(reader->buf);
+    memset(reader, 0, sizeof(*reader));
+}
+
+int frame_queue(FrameWriter* writer, uint32_t request_id, uint16_t type, uint16_t status,
+    const void* payload, uint32_t length) {
+    HubFrameHeader hdr;
+
+    if (length > HUB_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    // Reclaim space once everything queued so far has gone out.
+    if (writer->sent == writer->len) {
+        writer->sent = writer->len = 0;
+    }
+    if (!reserve(&writer->buf, &writer->cap, writer->len + sizeof(hdr) + length)) {
+        return 0;
+    }
+
+    hdr.length = length;
+    hdr.request_id = request_id;
+    hdr.type = type;
+    hdr.status = status;
+    memcpy(writer->buf + writer->len, &hdr, sizeof(hdr));
+    if (length > 0) {
+        memcpy(writer->buf + writer->len + sizeof(hdr), payload, length);
+    }
+    writer->len += sizeof(hdr) + length;
+    return 1;
+}
+
+int frame_flush(FrameWriter* writer, int fd) {
+    while (writer->sent < writer->len) {
+        ssize_t n = write(fd, writer->buf + writer->sent, writer->len - writer->sent);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        writer->sent += (size_t)n;
+    }
+    return 1;
+}
+
+void frame_writer_free(FrameWriter* writer) {
+    free(writer->buf);
+    memset(writer, 0, sizeof(*writer));
+}
+
+static int write_all(int fd, const void* data, size_t length) {
+    const char* p = data;
+
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += n;
+        length -= (size_t)n;
+    }
+    return 1;
+}
+
+int frame_send(int fd, uint32_t request_id, uint16_t type, uint16_t status,
+    const void* payload, uint32_t length) {
+    char buf[sizeof(HubFrameHeader) + HUB_MAX_PAYLOAD];
+    HubFrameHeader hdr;
+
+    if (length > HUB_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    // Header and payload go out in one write.
+    hdr.length = length;
+    hdr.request_id = request_id;
+    hdr.type = type;
+    hdr.status = status;
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (length > 0) {
+        memcpy(buf + sizeof(hdr), payload, length);
+    }
+    return write_all(fd, buf, sizeof(hdr) + length);
+}
+
+int frame_send_response(int fd, uint32_t request_id, const char* text, size_t length, uint16_t status) {
+    while (length > 0) {
+        uint32_t chunk = length > HUB_MAX_PAYLOAD ? HUB_MAX_PAYLOAD : (uint32_t)length;
+        if (!frame_send(fd, request_id, HUB_RESP_DATA, 0, text, chunk)) {
+            return 0;
+        }
+        text += chunk;
+        length -= chunk;
+    }
+    return frame_send(fd, request_id, HUB_RESP_END, status, NULL, 0);
+}
@@ -0,0 +1,77 @@
+#ifndef HUB_PROTOCOL_H
+#define HUB_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Framed request/response protocol between treasure_hub and its monitor,
+// carried over a Unix socketpair. Every frame is a fixed header followed by
+// length bytes of payload. Requests carry an ID chosen by the hub; the
+// monitor answers with zero or more HUB_RESP_DATA frames holding output text
+// and one HUB_RESP_END frame, all tagged with the same ID. The hub can keep
+// sending requests without waiting for answers.
+
+#define HUB_MAX_PAYLOAD (64 * 1024)
+
+typedef enum {
+    HUB_REQ_LIST_HUNTS = 1,
+    HUB_REQ_LIST_TREASURES,     // payload: hunt_id
+    HUB_REQ_VIEW_TREASURE,      // payload: int32 treasure_id, then hunt_id
+    HUB_REQ_SHUTDOWN,           // answered after every earlier request
+    HUB_REQ_NEARBY,             // payload: double latitude, longitude, radius_m, then hunt_id
+    HUB_REQ_BBOX,               // payload: double min_lat, min_lon, max_lat, max_lon, then hunt_id
+    HUB_REQ_SEARCH_CLUES,       // payload: hunt_id, NUL, then the query
+    HUB_REQ_LIST_USER,          // payload: hunt_id, NUL, then the username
+    HUB_REQ_FILTER,             // payload: hunt_id, NUL, then the conditions
+    HUB_REQ_STATS,              // no payload; answered by the worker it was sent to
+    HUB_RESP_DATA = 100,
+    HUB_RESP_END
+} HubFrameType;
+
+typedef struct {
+    uint32_t length;
+    uint32_t request_id;
+    uint16_t type;
+    uint16_t status;            // HUB_RESP_END: 0 on success
+} HubFrameHeader;
+
+// Accumulates bytes from a socket until whole frames are available.
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    size_t start;               // first byte not yet handed out
+} FrameReader;
+
+// Outgoing frames waiting for a non-blocking socket to accept them.
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    size_t sent;
+} FrameWriter;
+
+// Reads whatever the socket has. Returns bytes read, 0 on EOF, -1 on error
+// (errno EAGAIN when a non-blocking socket is empty).
+long frame_reader_fill(FrameReader* reader, int fd);
+// Returns 1 and points at the next complete frame, 0 if none is buffered,
+// -1 if the stream is corrupt. The payload is valid until the next fill.
+int frame_reader_next(FrameReader* reader, HubFrameHeader* hdr, const char** payload);
+void frame_reader_free(FrameReader* reader);
+
+int frame_queue(FrameWriter* writer, uint32_t request_id, uint16_t type, uint16_t status,
+    const void* payload, uint32_t length);
+// Writes as much as the socket takes. Returns 1 when everything queued has
+// been sent, 0 if some remains, -1 on error.
+int frame_flush(FrameWriter* writer, int fd);
+void frame_writer_free(FrameWriter* writer);
+
+// Blocking write of a whole frame. Returns 1 on success.
+int frame_send(int fd, uint32_t request_id, uint16_t type, uint16_t status,
+    const void* payload, uint32_t length);
+
+// Sends text as HUB_RESP_DATA frames of at most HUB_MAX_PAYLOAD bytes,
+// followed by HUB_RESP_END with status. Returns 1 on success.
+int frame_send_response(int fd, uint32_t request_id, const char* text, size_t length, uint16_t status);
+
+#endif
@@ -0,0 +1,638 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "hunt_cache.h"
+#include "treasure_stats.h"
+
+#define ROOT_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+#define HUNT_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | \
+                     IN_DELETE_SELF | IN_MOVE_SELF)
+
+int hunt_cache_init(HuntCache* cache) {
+    const char* env = getenv("TREASURE_CACHE_MB");
+    long mb = env ? atol(env) : HUNT_CACHE_DEFAULT_MB;
+
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = (size_t)(mb > 0 ? mb : HUNT_CACHE_DEFAULT_MB) * 1024 * 1024;
+
+    cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (cache->inotify_fd != -1 && inotify_add_watch(cache->inotify_fd, ".", ROOT_EVENTS | IN_ONLYDIR) == -1) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+    return 1;
+}
+
+static void free_records(CachedHunt* hunt) {
+    free(hunt->records);
+    free(hunt->dead);
+    free(hunt->id_slots);
+    hunt->records = NULL;
+    hunt->dead = NULL;
+    hunt->id_slots = NULL;
+    hunt->slot_capacity = 0;
+    columns_free(&hunt->columns);
+    hunt->columns_valid = 0;
+}
+
+static void unload(HuntCache* cache, CachedHunt* hunt) {
+    if (!hunt->loaded) {
+        return;
+    }
+    if (hunt->lru_prev) {
+        hunt->lru_prev->lru_next = hunt->lru_next;
+    } else {
+        cache->lru_head = hunt->lru_next;
+    }
+    if (hunt->lru_next) {
+        hunt->lru_next->lru_prev = hunt->lru_prev;
+    } else {
+        cache->lru_tail = hunt->lru_prev;
+    }
+    hunt->lru_prev = hunt->lru_next = NULL;
+
+    free_records(hunt);
+    cache->used -= hunt->bytes;
+    hunt->bytes = 0;
+    hunt->loaded = 0;
+}
+
+static void destroy(HuntCache* cache, CachedHunt* hunt) {
+    unload(cache, hunt);
+    if (hunt->wd != -1 && cache->inotify_fd != -1) {
+        inotify_rm_watch(cache->inotify_fd, hunt->wd);
+    }
+    free(hunt);
+}
+
+void hunt_cache_free(HuntCache* cache) {
+    for (int i = 0; i < cache->hunt_count; i++) {
+        destroy(cache, cache->hunts[i]);
+    }
+    free(cache->hunts);
+    if (cache->inotify_fd != -1) {
+        close(cache->inotify_fd);
+    }
+    memset(cache, 0, sizeof(*cache));
+    cache->inotify_fd = -1;
+}
+
+// Hunts are looked up by name with a linear search; there are hundreds at
+// most and the search is dwarfed by the work a request does.
+static CachedHunt* find_entry(HuntCache* cache, const char* hunt_id) {
+    for (int i = 0; i < cache->hunt_count; i++) {
+        if (strcmp(cache->hunts[i]->hunt_id, hunt_id) == 0) {
+            return cache->hunts[i];
+        }
+    }
+    return NULL;
+}
+
+static CachedHunt* find_watch(HuntCache* cache, int wd) {
+    for (int i = 0; i < cache->hunt_count; i++) {
+        if (cache->hunts[i]->wd == wd) {
+            return cache->hunts[i];
+        }
+    }
+    return NULL;
+}
+
+static void invalidate(CachedHunt* hunt, HuntChange change) {
+    hunt->header_valid = 0;
+    if (change > hunt->change) {
+        hunt->change = change;
+    }
+}
+
+static void invalidate_all(HuntCache* cache) {
+    cache->list_valid = 0;
+    for (int i = 0; i < cache->hunt_count; i++) {
+        invalidate(cache->hunts[i], HUNT_REPLACED);
+    }
+}
+
+static void handle_event(HuntCache* cache, const struct inotify_event* event) {
+    CachedHunt* hunt;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        invalidate_all(cache);
+        return;
+    }
+
+    hunt = find_watch(cache, event->wd);
+    if (hunt == NULL) {
+        // Working directory: a hunt directory appeared, vanished or was renamed.
+        if (event->len > 0) {
+            cache->list_valid = 0;
+            hunt = find_entry(cache, event->name);
+            if (hunt != NULL) {
+                invalidate(hunt, HUNT_REPLACED);
+            }
+        }
+        return;
+    }
+
+    if (event->mask & IN_IGNORED) {
+        hunt->wd = -1;
+        invalidate(hunt, HUNT_REPLACED);
+        return;
+    }
+    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+        cache->list_valid = 0;
+        invalidate(hunt, HUNT_REPLACED);
+        return;
+    }
+    if (event->len == 0) {
+        return;
+    }
+
+    if (strcmp(event->name, TREASURES_FILENAME) == 0) {
+        // Anything but an in-place write means a different file now.
+        invalidate(hunt, (event->mask & IN_MODIFY) ? HUNT_APPENDED : HUNT_REPLACED);
+        if (!(event->mask & IN_MODIFY)) {
+            cache->list_valid = 0;
+        }
+    } else if (strncmp(event->name, "deletes-", 8) == 0 ||
+               strcmp(event->name, LEGACY_DELETES_FILENAME) == 0) {
+        invalidate(hunt, HUNT_APPENDED);
+    }
+}
+
+void hunt_cache_sync(HuntCache* cache) {
+    char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    if (cache->inotify_fd == -1) {
+        // No change notifications: revalidate everything on each request.
+        cache->list_valid = 0;
+        for (int i = 0; i < cache->hunt_count; i++) {
+            invalidate(cache->hunts[i], HUNT_APPENDED);
+        }
+        return;
+    }
+
+    while ((n = read(cache->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            handle_event(cache, event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static CachedHunt* add_entry(HuntCache* cache, const char* hunt_id) {
+    CachedHunt* hunt;
+
+    if (cache->hunt_count == cache->hunt_capacity) {
+        int capacity = cache->hunt_capacity ? cache->hunt_capacity * 2 : 64;
+        CachedHunt** grown = realloc(cache->hunts, (size_t)capacity * sizeof(CachedHunt*));
+        if (grown == NULL) {
+            return NULL;
+        }
+        cache->hunts = grown;
+        cache->hunt_capacity = capacity;
+    }
+
+    hunt = calloc(1, sizeof(CachedHunt));
+    if (hunt == NULL) {
+        return NULL;
+    }
+    snprintf(hunt->hunt_id, MAX_PATH, "%s", hunt_id);
+    hunt->name_too_long = strlen(hunt_id) + 14 >= MAX_PATH;
+    hunt->wd = -1;
+    if (cache->inotify_fd != -1 && !hunt->name_too_long) {
+        hunt->wd = inotify_add_watch(cache->inotify_fd, hunt_id, HUNT_EVENTS | IN_ONLYDIR);
+    }
+    hunt->change = HUNT_REPLACED;
+    cache->hunts[cache->hunt_count++] = hunt;
+    return hunt;
+}
+
+static int is_directory(const char* name) {
+    struct stat st;
+    return stat(name, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+CachedHunt* hunt_cache_find(HuntCache* cache, const char* hunt_id) {
+    CachedHunt* hunt = find_entry(cache, hunt_id);
+
+    if (hunt != NULL && (hunt->wd != -1 || is_directory(hunt_id))) {
+        return hunt;
+    }
+    if (hunt == NULL && is_directory(hunt_id)) {
+        return add_entry(cache, hunt_id);
+    }
+    return NULL;
+}
+
+int hunt_cache_list(HuntCache* cache) {
+    DIR* dir;
+    struct dirent* entry;
+    int kept = 0;
+
+    if (cache->list_valid) {
+        return cache->hunt_count;
+    }
+
+    dir = opendir(".");
+    if (dir == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < cache->hunt_count; i++) {
+        cache->hunts[i]->listed = 0;
+    }
+
+    // Existing entries keep their loaded records; only new names are added.
+    while ((entry = readdir(dir)) != NULL) {
+        CachedHunt* hunt;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (!is_directory(entry->d_name)) {
+            continue;
+        }
+        hunt = find_entry(cache, entry->d_name);
+        if (hunt == NULL) {
+            hunt = add_entry(cache, entry->d_name);
+        }
+        if (hunt == NULL) {
+            closedir(dir);
+            return -1;
+        }
+        hunt->listed = 1;
+    }
+    closedir(dir);
+
+    // Drop hunts that are gone, keeping readdir order for the rest.
+    for (int i = 0; i < cache->hunt_count; i++) {
+        if (cache->hunts[i]->listed) {
+            cache->hunts[kept++] = cache->hunts[i];
+        } else {
+            destroy(cache, cache->hunts[i]);
+        }
+    }
+    cache->hunt_count = kept;
+    cache->list_valid = cache->inotify_fd != -1;
+    return cache->hunt_count;
+}
+
+int hunt_cache_header(HuntCache* cache, CachedHunt* hunt) {
+    struct stat st;
+    int fd;
+
+    (void)cache;
+    if (hunt->header_valid) {
+        return hunt->is_hunt;
+    }
+
+    hunt->is_hunt = 0;
+    if (!hunt->name_too_long) {
+        fd = store_open(hunt->hunt_id, O_RDONLY, &hunt->hdr);
+        if (fd != -1) {
+            if (fstat(fd, &st) == 0) {
+                hunt->is_hunt = 1;
+                hunt->size = (off_t)store_data_size(&hunt->hdr);
+                hunt->mtime = st.st_mtime;
+                // A different inode means the file was replaced, even if the
+                // event that said so has not been read yet.
+                if (hunt->loaded && (st.st_ino != hunt->ino || st.st_dev != hunt->dev)) {
+                    invalidate(hunt, HUNT_REPLACED);
+                }
+                hunt->dev = st.st_dev;
+                hunt->ino = st.st_ino;
+            }
+            close(fd);
+        }
+    }
+    hunt->header_valid = hunt->wd != -1;
+    return hunt->is_hunt;
+}
+
+int hunt_cache_is_dead(const CachedHunt* hunt, int64_t slot) {
+    return hunt->dead[slot / 8] & (1u << (slot % 8));
+}
+
+static void index_slot(CachedHunt* hunt, int64_t slot) {
+    uint32_t pos = (uint32_t)hunt->records[slot].treasure_id & hunt->id_mask;
+
+    while (hunt->id_slots[pos] != 0) {
+        if (hunt->records[hunt->id_slots[pos] - 1].treasure_id == hunt->records[slot].treasure_id) {
+            break;
+        }
+        pos = (pos + 1) & hunt->id_mask;
+    }
+    hunt->id_slots[pos] = (int32_t)slot + 1;
+}
+
+static size_t entry_bytes(const CachedHunt* hunt) {
+    return (size_t)hunt->slot_capacity * sizeof(TreasureRecord) +
+        (size_t)(hunt->slot_capacity + 7) / 8 +
+        ((size_t)hunt->id_mask + 1) * sizeof(int32_t) +
+        columns_bytes(&hunt->columns);
+}
+
+// Sizes the arrays for slots records, keeping the first valid ones.
+static int reserve_slots(CachedHunt* hunt, int64_t slots, int64_t valid) {
+    int64_t capacity = hunt->slot_capacity ? hunt->slot_capacity : 256;
+    uint32_t mask = 255;
+    TreasureRecord* records;
+    uint8_t* dead;
+    int32_t* id_slots;
+
+    if (slots <= hunt->slot_capacity) {
+        return 1;
+    }
+    while (capacity < slots) {
+        capacity *= 2;
+    }
+    while ((int64_t)mask + 1 < capacity * 2) {
+        mask = mask * 2 + 1;
+    }
+
+    records = realloc(hunt->records, (size_t)capacity * sizeof(TreasureRecord));
+    if (records == NULL) {
+        return 0;
+    }
+    hunt->records = records;
+
+    dead = realloc(hunt->dead, (size_t)(capacity + 7) / 8);
+    if (dead == NULL) {
+        return 0;
+    }
+    memset(dead + (hunt->slot_capacity + 7) / 8, 0, (size_t)(capacity + 7) / 8 - (size_t)(hunt->slot_capacity + 7) / 8);
+    hunt->dead = dead;
+
+    // The id map is rebuilt at the new size.
+    id_slots = calloc((size_t)mask + 1, sizeof(int32_t));
+    if (id_slots == NULL) {
+        return 0;
+    }
+    free(hunt->id_slots);
+    hunt->id_slots = id_slots;
+    hunt->id_mask = mask;
+    for (int64_t slot = 0; slot < valid; slot++) {
+        index_slot(hunt, slot);
+    }
+    hunt->slot_capacity = capacity;
+    return 1;
+}
+
+static int read_deletes(CachedHunt* hunt, int64_t from, int64_t to) {
+    uint32_t* slots;
+    ssize_t len = (ssize_t)((to - from) * (int64_t)sizeof(uint32_t));
+    int fd;
+
+    if (to <= from) {
+        return 1;
+    }
+    // The tombstones of one generation are only ever appended to, and a
+    // compaction changes clue_gen, which reloads instead of refreshing.
+    fd = store_open_deletes(hunt->hunt_id, hunt->hdr.clue_gen);
+    if (fd == -1) {
+        return 0;
+    }
+    slots = malloc((size_t)len);
+    if (slots == NULL || pread(fd, slots, (size_t)len, (off_t)from * sizeof(uint32_t)) != len) {
+        free(slots);
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    stats_add_read((size_t)len, 0);
+
+    for (int64_t i = 0; i < to - from; i++) {
+        if (slots[i] < (uint64_t)hunt->slot_capacity) {
+            hunt->dead[slots[i] / 8] |= (uint8_t)(1u << (slots[i] % 8));
+        }
+    }
+    free(slots);
+    return 1;
+}
+
+// Brings a loaded hunt from loaded_hdr up to hunt->hdr by reading only the
+// records appended and the tombstones added since. Returns 0 if that is not
+// possible and the hunt has to be reloaded.
+static int refresh(CachedHunt* hunt) {
+    const StoreHeader* old_hdr = &hunt->loaded_hdr;
+    int64_t from = old_hdr->slot_count;
+    int64_t to = hunt->hdr.slot_count;
+    StoreSnapshot snap;
+
+    if (to < from || hunt->hdr.dead_count < old_hdr->dead_count || hunt->hdr.clue_gen != old_hdr->clue_gen) {
+        return 0;
+    }
+
+    if (to > from) {
+        if (!store_snapshot_open(&snap, hunt->hunt_id)) {
+            return 0;
+        }
+        if (snap.hdr.clue_gen != old_hdr->clue_gen || snap.hdr.slot_count < from) {
+            store_snapshot_close(&snap);
+            return 0;
+        }
+        hunt->hdr = snap.hdr;
+        to = hunt->hdr.slot_count;
+        if (!reserve_slots(hunt, to, from) ||
+            store_snapshot_read(&snap, from, to - from, hunt->records + from) != to - from) {
+            store_snapshot_close(&snap);
+            return 0;
+        }
+        store_snapshot_close(&snap);
+        for (int64_t slot = from; slot < to; slot++) {
+            hunt->dead[slot / 8] &= (uint8_t)~(1u << (slot % 8));
+            index_slot(hunt, slot);
+        }
+    }
+
+    return read_deletes(hunt, old_hdr->dead_count, hunt->hdr.dead_count);
+}
+
+// Reads one segment straight into its slots of the hunt's record array.
+// Slots that cannot be read are zeroed, and with no ID count as removed.
+static int load_part(const StorePart* part, void* arg) {
+    CachedHunt* hunt = arg;
+    TreasureRecord* records = hunt->records + part->first_slot;
+    int64_t count = part->end_slot - part->first_slot;
+    int64_t n = store_snapshot_read(part->snap, part->first_slot, count, records);
+
+    memset(records + n, 0, (size_t)(count - n) * sizeof(TreasureRecord));
+    return 1;
+}
+
+static int reload(CachedHunt* hunt) {
+    StoreSnapshot snap;
+    struct stat st;
+
+    free_records(hunt);
+
+    if (!store_snapshot_open(&snap, hunt->hunt_id)) {
+        return 0;
+    }
+    // Segments are read in parallel; tombstones and the ID index are filled
+    // in afterwards, in slot order.
+    if (!reserve_slots(hunt, snap.hdr.slot_count, 0) ||
+        store_scan_parts(&snap, 0, snap.segment_count, 0, load_part, hunt) != 1) {
+        store_snapshot_close(&snap);
+        return 0;
+    }
+    for (int64_t slot = 0; slot < snap.hdr.slot_count; slot++) {
+        if (store_snapshot_is_dead(&snap, slot) || hunt->records[slot].treasure_id == 0) {
+            hunt->dead[slot / 8] |= (uint8_t)(1u << (slot % 8));
+        } else {
+            hunt->dead[slot / 8] &= (uint8_t)~(1u << (slot % 8));
+            index_slot(hunt, slot);
+        }
+    }
+    // Keep the header of the snapshot that was read, which may be newer than
+    // the one the hunt was validated against.
+    hunt->hdr = snap.hdr;
+    hunt->size = (off_t)store_data_size(&snap.hdr);
+    if (fstat(snap.fd, &st) == 0) {
+        hunt->dev = st.st_dev;
+        hunt->ino = st.st_ino;
+        hunt->mtime = st.st_mtime;
+    }
+    store_snapshot_close(&snap);
+    return 1;
+}
+
+static void touch(HuntCache* cache, CachedHunt* hunt) {
+    if (cache->lru_head == hunt) {
+        return;
+    }
+    if (hunt->lru_prev) {
+        hunt->lru_prev->lru_next = hunt->lru_next;
+    }
+    if (hunt->lru_next) {
+        hunt->lru_next->lru_prev = hunt->lru_prev;
+    } else if (cache->lru_tail == hunt) {
+        cache->lru_tail = hunt->lru_prev;
+    }
+    hunt->lru_prev = NULL;
+    hunt->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = hunt;
+    }
+    cache->lru_head = hunt;
+    if (cache->lru_tail == NULL) {
+        cache->lru_tail = hunt;
+    }
+}
+
+int hunt_cache_load(HuntCache* cache, CachedHunt* hunt) {
+    HuntChange change = hunt->change;
+    int ok;
+
+    if (hunt->loaded && change == HUNT_FRESH && hunt->header_valid) {
+        cache->hits++;
+        touch(cache, hunt);
+        return 1;
+    }
+
+    // Clear the flag first so events raised while reading re-mark the hunt.
+    hunt->change = HUNT_FRESH;
+    hunt->header_valid = 0;
+    if (!hunt_cache_header(cache, hunt)) {
+        unload(cache, hunt);
+        return 0;
+    }
+    if (hunt->change == HUNT_REPLACED) {
+        change = HUNT_REPLACED;
+        hunt->change = HUNT_FRESH;
+    }
+
+    // Compare with the header the records were read at: listings refresh
+    // hunt->hdr on their own, so it can be ahead of the records.
+    if (hunt->loaded && change != HUNT_REPLACED &&
+        memcmp(&hunt->loaded_hdr, &hunt->hdr, sizeof(hunt->hdr)) == 0) {
+        cache->hits++;
+        ok = 1;
+    } else if (hunt->loaded && change != HUNT_REPLACED && refresh(hunt)) {
+        cache->refreshes++;
+        ok = 1;
+    } else {
+        cache->misses++;
+        ok = reload(hunt);
+    }
+
+    if (!ok) {
+        if (hunt->loaded) {
+            unload(cache, hunt);
+        } else {
+            free_records(hunt);
+        }
+        hunt->header_valid = 0;
+        return 0;
+    }
+
+    if (hunt->loaded) {
+        cache->used -= hunt->bytes;
+    }
+    hunt->loaded_hdr = hunt->hdr;
+    hunt->loaded = 1;
+    hunt->bytes = entry_bytes(hunt);
+    cache->used += hunt->bytes;
+    touch(cache, hunt);
+
+    // Evict from the cold end, but never the hunt being served.
+    while (cache->used > cache->budget && cache->lru_tail != NULL && cache->lru_tail != hunt) {
+        unload(cache, cache->lru_tail);
+    }
+    return 1;
+}
+
+const TreasureRecord* hunt_cache_lookup(const CachedHunt* hunt, int treasure_id) {
+    uint32_t pos = (uint32_t)treasure_id & hunt->id_mask;
+    int32_t slot;
+
+    if (!hunt->loaded || hunt->id_slots == NULL) {
+        return NULL;
+    }
+    while ((slot = hunt->id_slots[pos]) != 0) {
+        if (hunt->records[slot - 1].treasure_id == treasure_id) {
+            return hunt_cache_is_dead(hunt, slot - 1) ? NULL : &hunt->records[slot - 1];
+        }
+        pos = (pos + 1) & hunt->id_mask;
+    }
+    return NULL;
+}
+
+const HuntColumns* hunt_cache_columns(HuntCache* cache, CachedHunt* hunt) {
+    int64_t from = hunt->columns_slots;
+
+    if (!hunt->loaded) {
+        return NULL;
+    }
+    // Appends extend the columns; removals and compactions rebuild them.
+    if (!hunt->columns_valid || hunt->columns_dead != hunt->hdr.dead_count ||
+        hunt->columns_slots > hunt->hdr.slot_count) {
+        columns_clear(&hunt->columns);
+        from = 0;
+    } else if (from == hunt->hdr.slot_count) {
+        return &hunt->columns;
+    }
+
+    hunt->columns_valid = 0;
+    for (int64_t slot = from; slot < hunt->hdr.slot_count; slot++) {
+        if (!hunt_cache_is_dead(hunt, slot) && !columns_append(&hunt->columns, &hunt->records[slot], slot)) {
+            return NULL;
+        }
+    }
+    hunt->columns_valid = 1;
+    hunt->columns_slots = hunt->hdr.slot_count;
+    hunt->columns_dead = hunt->hdr.dead_count;
+
+    cache->used -= hunt->bytes;
+    hunt->bytes = entry_bytes(hunt);
+    cache->used += hunt->bytes;
+    return &hunt->columns;
+}
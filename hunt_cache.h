@@ -0,0 +1,119 @@
+#ifndef HUNT_CACHE_H
+#define HUNT_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+#include "treasure_columns.h"
+
+// In-memory copy of hunts for the long-lived hub monitor. Each hunt keeps
+// its hot records, a tombstone bitmap and a treasure_id -> slot map, so
+// list_treasures and view_treasure do not touch treasures.dat while it is
+// unchanged. Clue text is still read from the clue heap on demand.
+//
+// Changes are picked up through inotify. The working directory is watched
+// for hunts appearing and disappearing, and each hunt directory is watched
+// for writes to treasures.dat and its tombstones. The directory is watched
+// rather than the file itself because compaction replaces treasures.dat by
+// rename. Plain appends and removals are applied incrementally; a replaced
+// file is reloaded. Without inotify every request revalidates the header.
+//
+// A loaded hunt can also carry a columnar copy of its live records for the
+// filter and per-user commands. It is built on first use, extended in place
+// by appends and rebuilt after removals.
+//
+// Loaded hunts are kept under a memory budget (TREASURE_CACHE_MB, default
+// 64) and the least recently used ones are dropped first.
+
+#define HUNT_CACHE_DEFAULT_MB 64
+
+typedef enum {
+    HUNT_FRESH,
+    HUNT_APPENDED,      // treasures.dat or its tombstones written in place
+    HUNT_REPLACED       // treasures.dat created, renamed over or deleted
+} HuntChange;
+
+typedef struct CachedHunt {
+    char hunt_id[MAX_PATH];
+    int wd;                     // inotify watch on the hunt directory, or -1
+    int listed;                 // still present in the working directory
+    int name_too_long;
+
+    int header_valid;
+    int is_hunt;                // directory has a readable treasures.dat
+    StoreHeader hdr;            // latest header seen, for listings
+    StoreHeader loaded_hdr;     // header the loaded records were read at
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+
+    int loaded;
+    HuntChange change;
+    TreasureRecord* records;    // every slot, live or dead
+    int64_t slot_capacity;
+    uint8_t* dead;
+    int32_t* id_slots;          // slot + 1, 0 when empty
+    uint32_t id_mask;
+    size_t bytes;
+
+    HuntColumns columns;
+    int columns_valid;
+    int64_t columns_slots;      // slots the columns cover
+    int64_t columns_dead;       // dead_count when they were built
+
+    struct CachedHunt* lru_prev;
+    struct CachedHunt* lru_next;
+} CachedHunt;
+
+typedef struct {
+    int inotify_fd;
+    size_t budget;
+    size_t used;
+    int list_valid;
+    CachedHunt** hunts;         // subdirectories of the working directory
+    int hunt_count;
+    int hunt_capacity;
+    CachedHunt* lru_head;       // loaded hunts, most recently used first
+    CachedHunt* lru_tail;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refreshes;
+} HuntCache;
+
+int hunt_cache_init(HuntCache* cache);
+void hunt_cache_free(HuntCache* cache);
+
+// Applies pending inotify events. Call before serving each request.
+void hunt_cache_sync(HuntCache* cache);
+
+// Refreshes the list of subdirectories if needed and returns how many there
+// are in cache->hunts, or -1 on error.
+int hunt_cache_list(HuntCache* cache);
+
+// Returns the entry for hunt_id, creating and watching it if needed, or NULL
+// if the directory does not exist.
+CachedHunt* hunt_cache_find(HuntCache* cache, const char* hunt_id);
+
+// Makes hunt->hdr current without touching the loaded records. Returns 1 if
+// the hunt has a treasures.dat.
+int hunt_cache_header(HuntCache* cache, CachedHunt* hunt);
+
+// Makes the records of hunt current and marks it most recently used; hdr
+// and loaded_hdr then describe them. Returns 1 on success, 0 if it cannot
+// be read.
+int hunt_cache_load(HuntCache* cache, CachedHunt* hunt);
+
+// Record for treasure_id in a loaded hunt, or NULL.
+const TreasureRecord* hunt_cache_lookup(const CachedHunt* hunt, int treasure_id);
+
+// Whether a slot of a loaded hunt has been removed.
+int hunt_cache_is_dead(const CachedHunt* hunt, int64_t slot);
+
+// Columns of the live records of a hunt just loaded with hunt_cache_load,
+// or NULL if memory ran out. Valid until the next call to hunt_cache_load.
+const HuntColumns* hunt_cache_columns(HuntCache* cache, CachedHunt* hunt);
+
+#endif
@@ -1,91 +1,260 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 
-#define MAX_USERNAME 50
-#define MAX_CLUE_TEXT 500
+#include "treasure_store.h"
+#include "treasure_columns.h"
+#include "treasure_scoring.h"
 
 typedef struct {
-    int treasure_id;
-    char username[MAX_USERNAME];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE_TEXT];
-    int value;
-} Treasure;
+    char hunt_id[MAX_PATH];
+    int status;             // score_hunt result, 0 until scored
+    HuntTotals totals;
+} HuntResult;
 
 typedef struct {
-    char username[MAX_USERNAME];
-    int total_score;
-    int treasures_count;
-} UserScore;
-
-int compare_scores(const void* a, const void* b) {
-    const UserScore* score_a = (const UserScore*)a;
-    const UserScore* score_b = (const UserScore*)b;
-    return score_b->total_score - score_a->total_score;
+    HuntResult* hunts;
+    int hunt_count;
+    int next_hunt;          // next unclaimed index, advanced atomically
+} GlobalJob;
+
+typedef struct {
+    pthread_t thread;
+    GlobalJob* job;
+    ScoreTable partial;
+    int failed;
+} ScoreWorker;
+
+static double elapsed_ms(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_nsec - start->tv_nsec) / 1e6;
 }
 
-void store_Calculator(const char* hunt_id, int pipe_fd) {
-    char path[256];
-    snprintf(path, sizeof(path), "%s/treasures.dat", hunt_id);
+static int compare_hunt_ids(const void* a, const void* b) {
+    return strcmp(((const HuntResult*)a)->hunt_id, ((const HuntResult*)b)->hunt_id);
+}
 
-    int fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        dprintf(pipe_fd, "Error: Could not open %s\n", path);
-        return;
+// Finds hunts the same way the hub's list_hunts does: directories in the current
+// directory that contain a treasures.dat. Returns the number found, or -1.
+int discover_hunts(HuntResult** hunts_out) {
+    DIR* dir;
+    struct dirent* entry;
+    struct stat st;
+    char path[MAX_PATH * 2];
+    HuntResult* hunts = NULL;
+    int count = 0;
+    int capacity = 0;
+
+    dir = opendir(".");
+    if (dir == NULL) {
+        perror("opendir");
+        return -1;
     }
 
-    Treasure treasure;
-    UserScore users[100];
-    int user_count = 0;
-    memset(users, 0, sizeof(users));
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (stat(entry->d_name, &st) != 0 || !S_ISDIR(st.st_mode) ||
+            strlen(entry->d_name) + 14 >= MAX_PATH) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/treasures.dat", entry->d_name);
+        if (access(path, F_OK) == -1) {
+            continue;
+        }
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        int found = 0;
-        for (int i = 0; i < user_count; i++) {
-            if (strcmp(users[i].username, treasure.username) == 0) {
-                users[i].total_score += treasure.value;
-                users[i].treasures_count++;
-                found = 1;
-                break;
+        if (count == capacity) {
+            int new_capacity = capacity ? capacity * 2 : 64;
+            HuntResult* grown = realloc(hunts, (size_t)new_capacity * sizeof(HuntResult));
+            if (grown == NULL) {
+                perror("realloc");
+                free(hunts);
+                closedir(dir);
+                return -1;
             }
+            hunts = grown;
+            capacity = new_capacity;
         }
 
-        if (!found && user_count < 100) {
-            strncpy(users[user_count].username, treasure.username, MAX_USERNAME - 1);
-            users[user_count].username[MAX_USERNAME - 1] = '\0';
-            users[user_count].total_score = treasure.value;
-            users[user_count].treasures_count = 1;
-            user_count++;
+        memset(&hunts[count], 0, sizeof(HuntResult));
+        snprintf(hunts[count].hunt_id, MAX_PATH, "%s", entry->d_name);
+        count++;
+    }
+
+    closedir(dir);
+    if (count > 1) {
+        qsort(hunts, (size_t)count, sizeof(HuntResult), compare_hunt_ids);
+    }
+    *hunts_out = hunts;
+    return count;
+}
+
+// Workers claim hunts from a shared counter and fold them into their own
+// table, so no locking is needed until the partials are merged.
+void* score_worker(void* arg) {
+    ScoreWorker* worker = (ScoreWorker*)arg;
+    GlobalJob* job = worker->job;
+    int index;
+
+    while ((index = __atomic_fetch_add(&job->next_hunt, 1, __ATOMIC_RELAXED)) < job->hunt_count) {
+        HuntResult* hunt = &job->hunts[index];
+        hunt->status = score_hunt(hunt->hunt_id, &worker->partial, &hunt->totals);
+        if (hunt->status == -1) {
+            worker->failed = 1;
+            break;
         }
     }
+    return NULL;
+}
 
-    close(fd);
-    qsort(users, user_count, sizeof(UserScore), compare_scores);
+int default_job_count(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
 
-    dprintf(pipe_fd, "Hunt: %s - User Scores\n", hunt_id);
-    dprintf(pipe_fd, "---------------------------\n");
+// Scores every hunt in the current directory on a pool of jobs threads and
+// writes per-hunt totals, the merged leaderboard and phase timings to pipe_fd.
+void global_Calculator(int jobs, int top, int pipe_fd) {
+    struct timespec t_start, t_discovered, t_scored, t_merged, t_printed;
+    GlobalJob job;
+    ScoreWorker* workers;
+    ScoreTable global;
+    HuntTotals overall = { 0, 0 };
+    int failed = 0;
+    int started = 0;
 
-    if (user_count == 0) {
-        dprintf(pipe_fd, "No users found in this hunt.\n");
-    } else {
-        dprintf(pipe_fd, "%-20s | %-12s | %s\n", "Username", "Total Score", "Treasures");
-        dprintf(pipe_fd, "----------------------------------------------------\n");
-        for (int i = 0; i < user_count; i++) {
-            dprintf(pipe_fd, "%-20s | %-12d | %d\n",
-                users[i].username,
-                users[i].total_score,
-                users[i].treasures_count);
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    memset(&job, 0, sizeof(job));
+    job.hunt_count = discover_hunts(&job.hunts);
+    if (job.hunt_count < 0) {
+        dprintf(pipe_fd, "Error: Could not list hunts\n");
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_discovered);
+
+    if (jobs > job.hunt_count) {
+        jobs = job.hunt_count > 0 ? job.hunt_count : 1;
+    }
+    // Pick the kernels before the workers share them.
+    column_kernels();
+    // Hunts are spread over the jobs already; each scans its segments itself.
+    scoring_set_scan_threads(1);
+
+    workers = calloc((size_t)jobs, sizeof(ScoreWorker));
+    if (workers == NULL || !score_table_init(&global)) {
+        dprintf(pipe_fd, "Error: Out of memory\n");
+        free(workers);
+        free(job.hunts);
+        return;
+    }
+
+    for (int i = 0; i < jobs; i++) {
+        workers[i].job = &job;
+        if (!score_table_init(&workers[i].partial)) {
+            failed = 1;
+            break;
+        }
+        if (pthread_create(&workers[i].thread, NULL, score_worker, &workers[i]) != 0) {
+            // The threads already running will claim the remaining hunts.
+            score_table_free(&workers[i].partial);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_scored);
+
+    if (started == 0) {
+        failed = 1;
+    }
+
+    for (int i = 0; i < started; i++) {
+        if (!failed && !score_table_merge(&global, &workers[i].partial)) {
+            failed = 1;
+        }
+        score_table_free(&workers[i].partial);
+    }
+    free(workers);
+    clock_gettime(CLOCK_MONOTONIC, &t_merged);
+
+    if (failed) {
+        dprintf(pipe_fd, "Error: Could not score all hunts\n");
+        score_table_free(&global);
+        free(job.hunts);
+        return;
+    }
+
+    dprintf(pipe_fd, "Global leaderboard - %d hunts, %d workers\n", job.hunt_count, started);
+    dprintf(pipe_fd, "---------------------------\n");
+    dprintf(pipe_fd, "%-20s | %-12s | %s\n", "Hunt", "Total Score", "Treasures");
+    dprintf(pipe_fd, "----------------------------------------------------\n");
+    for (int i = 0; i < job.hunt_count; i++) {
+        HuntResult* hunt = &job.hunts[i];
+        if (hunt->status != 1) {
+            dprintf(pipe_fd, "%-20s | could not open treasures.dat\n", hunt->hunt_id);
+            continue;
         }
+        dprintf(pipe_fd, "%-20s | %-12lld | %lld\n", hunt->hunt_id,
+            (long long)hunt->totals.total_score, (long long)hunt->totals.treasures);
+        overall.treasures += hunt->totals.treasures;
+        overall.total_score += hunt->totals.total_score;
     }
+    dprintf(pipe_fd, "%-20s | %-12lld | %lld\n\n", "All hunts",
+        (long long)overall.total_score, (long long)overall.treasures);
+
+    print_scores(&global, top, pipe_fd);
+    clock_gettime(CLOCK_MONOTONIC, &t_printed);
+
+    dprintf(pipe_fd, "\nUsers: %d\n", global.user_count);
+    dprintf(pipe_fd, "Timing: discover %.3f ms, score %.3f ms, merge %.3f ms, output %.3f ms\n",
+        elapsed_ms(&t_start, &t_discovered), elapsed_ms(&t_discovered, &t_scored),
+        elapsed_ms(&t_scored, &t_merged), elapsed_ms(&t_merged, &t_printed));
+
+    score_table_free(&global);
+    free(job.hunts);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <hunt_id>\n", argv[0]);
+    const char* hunt_arg = NULL;
+    const char* user_arg = NULL;
+    int all_hunts = 0;
+    int jobs = default_job_count();
+    int top = 0;
+    int usage_error = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--all") == 0) {
+            all_hunts = 1;
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scan") == 0) {
+            scoring_set_sidecar(0);
+        } else if (strcmp(argv[i], "--user") == 0 && i + 1 < argc) {
+            user_arg = argv[++i];
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            top = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && hunt_arg == NULL) {
+            hunt_arg = argv[i];
+        } else {
+            usage_error = 1;
+        }
+    }
+
+    if (usage_error || all_hunts == (hunt_arg != NULL) || (all_hunts && user_arg != NULL)) {
+        fprintf(stderr, "Usage: %s <hunt_id> [--top K] [--scan]\n", argv[0]);
+        fprintf(stderr, "       %s <hunt_id> --user <username> [--scan]\n", argv[0]);
+        fprintf(stderr, "       %s --all [--jobs N] [--top K] [--scan]\n", argv[0]);
         return 1;
     }
 
@@ -109,11 +278,22 @@ int main(int argc, char* argv[]) {
         close(pipe_to_child[1]); // close write end of input pipe
         close(pipe_to_parent[0]); // close read end of output pipe
 
+        if (all_hunts) {
+            close(pipe_to_child[0]);
+            global_Calculator(jobs, top, pipe_to_parent[1]);
+            close(pipe_to_parent[1]);
+            exit(0);
+        }
+
         char hunt_id[100];
         read(pipe_to_child[0], hunt_id, sizeof(hunt_id));
         close(pipe_to_child[0]);
 
-        store_Calculator(hunt_id, pipe_to_parent[1]);
+        if (user_arg != NULL) {
+            user_Calculator(hunt_id, user_arg, pipe_to_parent[1]);
+        } else {
+            store_Calculator(hunt_id, top, pipe_to_parent[1]);
+        }
         close(pipe_to_parent[1]);
         exit(0);
     } else {
@@ -122,7 +302,9 @@ int main(int argc, char* argv[]) {
         close(pipe_to_parent[1]); // close write end of output pipe
 
         // Send hunt_id to child
-        write(pipe_to_child[1], argv[1], strlen(argv[1]) + 1);
+        if (!all_hunts) {
+            write(pipe_to_child[1], hunt_arg, strlen(hunt_arg) + 1);
+        }
         close(pipe_to_child[1]);
 
         // Read output from child
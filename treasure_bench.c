@@ -0,0 +1,760 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "treasure_store.h"
+#include "treasure_log.h"
+#include "treasure_columns.h"
+#include "treasure_ops.h"
+#include "hub_hunts.h"
+#include "treasure_scoring.h"
+#include "treasure_spatial.h"
+#include "treasure_stats.h"
+
+// Benchmarks the store operations behind treasure_manager, treasure_hub and
+// score_calculator on synthetic hunts, without the interactive menus.
+//
+// A main hunt of --records treasures and --hunts small hunts are generated
+// in a scratch directory with a fixed seed, then each operation is timed on
+// its own. Every call is timed separately for the p50/p99 latencies, and the
+// bytes read are the rchar delta of /proc/self/io over the run, so reads
+// served through mmap (TREASURE_SCAN_BACKEND=mmap) do not show up there.
+// Store and log policies come from the usual environment variables.
+//
+// --json prints one JSON object per line instead of a table, so results of
+// two commits can be compared with a script.
+//
+// --check runs nearby queries on the generated hunt instead of timing
+// anything, and fails unless they match a full scan and use the spatial
+// sidecar, including for radii of hundreds of km.
+
+#define BENCH_DEFAULT_RECORDS 100000
+#define BENCH_DEFAULT_HUNTS 8
+#define BENCH_DEFAULT_OPS 1000
+#define BENCH_DEFAULT_SCANS 5
+#define BENCH_DEFAULT_USERS 1000
+#define BENCH_DEFAULT_DIR "treasure_bench.data"
+#define BENCH_MAIN_HUNT "bench_main"
+#define BENCH_SMALL_RECORDS 1000
+#define BENCH_MARKER ".treasure_bench"
+#define BENCH_BATCH 4096
+#define BENCH_CHECK_RADII_KM { 1, 50, 300, 1000 }
+
+typedef struct {
+    uint64_t state;
+} BenchRng;
+
+// Draws treasures with skewed distributions: a few users own most of the
+// treasures (Zipf, s = 1.1), values are log-normal around 20, and most
+// treasures are clustered around a handful of cities.
+typedef struct {
+    BenchRng rng;
+    int users;
+    double* user_cdf;
+} BenchGenerator;
+
+typedef struct {
+    const char* hunt_id;
+    int64_t records;
+    int first_id;
+    uint8_t* removed;           // by id - first_id
+    BenchGenerator gen;
+    FILE* devnull;
+    HuntCache hunts;            // the hub monitor's view of the hunts
+} BenchContext;
+
+typedef int (*BenchOp)(BenchContext* ctx, int64_t i);
+
+typedef struct {
+    const char* name;
+    int64_t ops;
+    double seconds;
+    double p50_us;
+    double p99_us;
+    double bytes_read;          // per op, -1 when /proc/self/io is missing
+} BenchResult;
+
+int json_output = 0;
+
+uint64_t rng_next(BenchRng* rng);
+double rng_uniform(BenchRng* rng);
+double rng_normal(BenchRng* rng);
+int generator_init(BenchGenerator* gen, uint64_t seed, int users);
+void generator_free(BenchGenerator* gen);
+void generate_treasure(BenchGenerator* gen, Treasure* treasure);
+int generate_hunt(BenchGenerator* gen, const char* hunt_id, int64_t records, BenchResult* result);
+int prepare_dir(const char* dir, int reuse, int64_t records, int hunts);
+int remove_dir(const char* dir);
+int64_t read_bytes(void);
+int run_bench(BenchContext* ctx, const char* name, int64_t ops, BenchOp op, BenchResult* result);
+void print_header(const BenchContext* ctx, int hunts, uint64_t seed);
+void print_result(const BenchContext* ctx, const BenchResult* result);
+int op_add_treasure(BenchContext* ctx, int64_t i);
+int op_view_treasure(BenchContext* ctx, int64_t i);
+int op_list_treasures(BenchContext* ctx, int64_t i);
+int op_remove_treasure(BenchContext* ctx, int64_t i);
+int op_count_treasures(BenchContext* ctx, int64_t i);
+int op_list_all_hunts(BenchContext* ctx, int64_t i);
+int op_score_scan(BenchContext* ctx, int64_t i);
+int op_score_sidecar(BenchContext* ctx, int64_t i);
+int check_spatial(BenchContext* ctx);
+
+int main(int argc, char* argv[]) {
+    const char* dir = BENCH_DEFAULT_DIR;
+    int64_t records = BENCH_DEFAULT_RECORDS;
+    int64_t ops = BENCH_DEFAULT_OPS;
+    int64_t scans = BENCH_DEFAULT_SCANS;
+    int hunts = BENCH_DEFAULT_HUNTS;
+    int users = BENCH_DEFAULT_USERS;
+    uint64_t seed = 1;
+    int keep = 0;
+    int reuse = 0;
+    int check = 0;
+    int passed = 1;
+    int usage_error = 0;
+    int prepared;
+    char cwd[4096];
+    BenchContext ctx;
+    BenchResult result;
+    StoreIter it;
+    const TreasureRecord* record;
+    int64_t live = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--records") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 1) {
+            records = (int64_t)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--hunts") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            hunts = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 1) {
+            ops = (int64_t)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scans") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 1) {
+            scans = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--users") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 1) {
+            users = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keep = 1;
+        } else if (strcmp(argv[i], "--reuse") == 0) {
+            reuse = keep = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_output = 1;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = 1;
+        } else {
+            usage_error = 1;
+        }
+    }
+
+    // Treasure IDs are int, so the main hunt stays below INT_MAX.
+    if (usage_error || records > 100000000) {
+        fprintf(stderr, "Usage: %s [--records N] [--hunts N] [--ops N] [--scans N] [--users N]\n", argv[0]);
+        fprintf(stderr, "       %*s [--seed S] [--dir DIR] [--keep | --reuse] [--json] [--check]\n", (int)strlen(argv[0]), "");
+        return 1;
+    }
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd");
+        return 1;
+    }
+    prepared = prepare_dir(dir, reuse, records, hunts);
+    if (prepared == -1) {
+        return 1;
+    }
+    if (chdir(dir) != 0) {
+        perror("chdir");
+        return 1;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.hunt_id = BENCH_MAIN_HUNT;
+    ctx.records = records;
+    ctx.devnull = fopen("/dev/null", "w");
+    if (ctx.devnull == NULL || !generator_init(&ctx.gen, seed, users) || !hunt_cache_init(&ctx.hunts)) {
+        perror("Failed to set up the benchmark");
+        return 1;
+    }
+
+    print_header(&ctx, hunts, seed);
+
+    // The small hunts only give list_all_hunts something to walk.
+    if (!prepared) {
+        char hunt_id[MAX_PATH];
+
+        if (!generate_hunt(&ctx.gen, BENCH_MAIN_HUNT, records, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        for (int i = 0; i < hunts; i++) {
+            snprintf(hunt_id, sizeof(hunt_id), "bench_%03d", i);
+            if (!generate_hunt(&ctx.gen, hunt_id, records < BENCH_SMALL_RECORDS ? records : BENCH_SMALL_RECORDS, NULL)) {
+                return 1;
+            }
+        }
+    }
+
+    // IDs of a new hunt start at 1. A reused hunt may have lost some of them
+    // to the removals of earlier runs.
+    ctx.first_id = 1;
+    ctx.removed = malloc((size_t)records);
+    if (ctx.removed == NULL || !store_iter_open(&it, BENCH_MAIN_HUNT)) {
+        perror("Failed to open the generated hunt");
+        return 1;
+    }
+    memset(ctx.removed, 1, (size_t)records);
+    while ((record = store_iter_next(&it)) != NULL) {
+        if (record->treasure_id >= ctx.first_id && record->treasure_id - ctx.first_id < records) {
+            ctx.removed[record->treasure_id - ctx.first_id] = 0;
+            live++;
+        }
+    }
+    store_iter_close(&it);
+
+    if (check) {
+        passed = check_spatial(&ctx);
+    } else {
+        // Reads first, while the hunt is as generated; writes last.
+        if (!run_bench(&ctx, "count_treasures", ops, op_count_treasures, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "list_all_hunts", scans, op_list_all_hunts, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "view_treasure", ops, op_view_treasure, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "list_treasures", scans, op_list_treasures, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "score_scan", scans, op_score_scan, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "score_sidecar", ops, op_score_sidecar, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        if (!run_bench(&ctx, "add_treasure", ops, op_add_treasure, &result)) {
+            return 1;
+        }
+        print_result(&ctx, &result);
+        // At most a tenth of what is left, so the removals keep finding live
+        // treasures and reused hunts do not run dry.
+        if (live > 0 && !run_bench(&ctx, "remove_treasure", ops < live / 10 + 1 ? ops : live / 10 + 1,
+                op_remove_treasure, &result)) {
+            return 1;
+        }
+        if (live > 0) {
+            print_result(&ctx, &result);
+        }
+    }
+
+    log_close();
+    fclose(ctx.devnull);
+    hunt_cache_free(&ctx.hunts);
+    generator_free(&ctx.gen);
+    free(ctx.removed);
+
+    if (chdir(cwd) != 0) {
+        perror("chdir");
+        return 1;
+    }
+    if (!keep && !remove_dir(dir)) {
+        return 1;
+    }
+    return passed ? 0 : 1;
+}
+
+// xorshift64*: small, fast and the same on every platform, so a seed always
+// generates the same hunts.
+uint64_t rng_next(BenchRng* rng) {
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545f4914f6cdd1dull;
+}
+
+double rng_uniform(BenchRng* rng) {
+    return (double)(rng_next(rng) >> 11) / 9007199254740992.0;
+}
+
+double rng_normal(BenchRng* rng) {
+    double u = rng_uniform(rng);
+    double v = rng_uniform(rng);
+
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * M_PI * v);
+}
+
+int generator_init(BenchGenerator* gen, uint64_t seed, int users) {
+    double total = 0;
+
+    gen->rng.state = seed * 0x9e3779b97f4a7c15ull + 1;
+    gen->users = users;
+    gen->user_cdf = malloc((size_t)users * sizeof(double));
+    if (gen->user_cdf == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < users; i++) {
+        total += 1.0 / pow(i + 1, 1.1);
+        gen->user_cdf[i] = total;
+    }
+    for (int i = 0; i < users; i++) {
+        gen->user_cdf[i] /= total;
+    }
+    return 1;
+}
+
+void generator_free(BenchGenerator* gen) {
+    free(gen->user_cdf);
+    gen->user_cdf = NULL;
+}
+
+static const char* const name_parts[] = {
+    "anna", "bogdan", "cris", "dan", "elena", "florin", "gabi", "horia",
+    "ioana", "jon", "katy", "liviu", "maria", "nicu", "oana", "petru"
+};
+
+static const char* const clue_words[] = {
+    "under", "the", "old", "oak", "tree", "near", "river", "bridge", "stone",
+    "behind", "church", "north", "gate", "red", "door", "hill", "lake",
+    "tower", "garden", "fountain", "market", "square", "clock", "bench",
+    "library", "statue", "east", "west", "south", "path", "forest", "cave"
+};
+
+static const double cities[][2] = {
+    { 44.4268, 26.1025 }, { 46.7712, 23.6236 }, { 47.1585, 27.6014 },
+    { 45.7489, 21.2087 }, { 44.1598, 28.6348 }, { 45.6427, 25.5887 },
+    { 48.8566, 2.3522 }, { 51.5072, -0.1276 }
+};
+
+#define COUNT_OF(array) (sizeof(array) / sizeof((array)[0]))
+
+void generate_treasure(BenchGenerator* gen, Treasure* treasure) {
+    double pick = rng_uniform(&gen->rng);
+    int lo = 0, hi = gen->users - 1;
+    int words;
+    size_t len = 0;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (gen->user_cdf[mid] < pick) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    memset(treasure, 0, sizeof(Treasure));
+    snprintf(treasure->username, MAX_USERNAME, "%s_%s%d",
+        name_parts[lo % COUNT_OF(name_parts)], name_parts[(lo / COUNT_OF(name_parts)) % COUNT_OF(name_parts)], lo);
+
+    if (rng_uniform(&gen->rng) < 0.8) {
+        const double* city = cities[rng_next(&gen->rng) % COUNT_OF(cities)];
+        treasure->latitude = city[0] + rng_normal(&gen->rng) * 0.05;
+        treasure->longitude = city[1] + rng_normal(&gen->rng) * 0.05;
+    } else {
+        treasure->latitude = rng_uniform(&gen->rng) * 180.0 - 90.0;
+        treasure->longitude = rng_uniform(&gen->rng) * 360.0 - 180.0;
+    }
+
+    treasure->value = (int)exp(3.0 + rng_normal(&gen->rng));
+    if (treasure->value < 1) {
+        treasure->value = 1;
+    } else if (treasure->value > 10000) {
+        treasure->value = 10000;
+    }
+
+    words = 3 + (int)(rng_next(&gen->rng) % 10);
+    for (int i = 0; i < words; i++) {
+        const char* word = clue_words[rng_next(&gen->rng) % COUNT_OF(clue_words)];
+        len += (size_t)snprintf(treasure->clue + len, MAX_CLUE_TEXT - len, "%s%s", i ? " " : "", word);
+    }
+}
+
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const double* sorted, int64_t count, double p) {
+    int64_t rank = (int64_t)ceil(p * (double)count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void summarize(BenchResult* result, double* samples, int64_t count, int64_t bytes) {
+    qsort(samples, (size_t)count, sizeof(double), compare_doubles);
+    result->ops = count;
+    result->p50_us = percentile(samples, count, 0.50) * 1e6;
+    result->p99_us = percentile(samples, count, 0.99) * 1e6;
+    result->bytes_read = bytes < 0 ? -1 : (double)bytes / (double)count;
+}
+
+// Appends records treasures to hunt_id in batches. Fills result (one op per
+// batch) if it is not NULL. Returns 1 on success.
+int generate_hunt(BenchGenerator* gen, const char* hunt_id, int64_t records, BenchResult* result) {
+    Treasure* batch = malloc(BENCH_BATCH * sizeof(Treasure));
+    double* samples = malloc((size_t)((records + BENCH_BATCH - 1) / BENCH_BATCH) * sizeof(double));
+    int64_t batches = 0;
+    int64_t bytes = read_bytes();
+    struct timespec start, op_start;
+
+    if (batch == NULL || samples == NULL) {
+        perror("malloc");
+        free(batch);
+        free(samples);
+        return 0;
+    }
+    if (mkdir(hunt_id, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create hunt directory");
+        free(batch);
+        free(samples);
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int64_t done = 0; done < records; ) {
+        int count = records - done < BENCH_BATCH ? (int)(records - done) : BENCH_BATCH;
+
+        for (int i = 0; i < count; i++) {
+            generate_treasure(gen, &batch[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &op_start);
+        if (!store_append_batch(hunt_id, batch, count)) {
+            perror("Failed to append treasures");
+            free(batch);
+            free(samples);
+            return 0;
+        }
+        samples[batches++] = seconds_since(&op_start);
+        done += count;
+    }
+
+    if (result != NULL) {
+        result->name = "append_batch";
+        result->seconds = seconds_since(&start);
+        summarize(result, samples, batches, bytes < 0 ? -1 : read_bytes() - bytes);
+    }
+    free(batch);
+    free(samples);
+    return 1;
+}
+
+// Makes dir ready for a run. Returns 1 if --reuse found hunts generated
+// with the same sizes, 0 if they have to be generated, -1 on error. Only
+// directories with the benchmark's marker file are ever deleted.
+int prepare_dir(const char* dir, int reuse, int64_t records, int hunts) {
+    char path[MAX_PATH];
+    char expected[64];
+    char found[64] = "";
+    struct stat st;
+    FILE* marker;
+
+    if (stat(dir, &st) == 0) {
+        snprintf(path, sizeof(path), "%s/%s", dir, BENCH_MARKER);
+        marker = fopen(path, "r");
+        if (marker == NULL) {
+            fprintf(stderr, "%s exists and was not created by the benchmark\n", dir);
+            return -1;
+        }
+        if (fgets(found, sizeof(found), marker) == NULL) {
+            found[0] = '\0';
+        }
+        fclose(marker);
+
+        snprintf(expected, sizeof(expected), "%lld %d\n", (long long)records, hunts);
+        if (reuse && strcmp(found, expected) == 0) {
+            return 1;
+        }
+        if (!remove_dir(dir)) {
+            return -1;
+        }
+    }
+
+    if (mkdir(dir, 0755) != 0) {
+        perror("Failed to create benchmark directory");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, BENCH_MARKER);
+    marker = fopen(path, "w");
+    if (marker == NULL) {
+        perror("Failed to create benchmark marker");
+        return -1;
+    }
+    fprintf(marker, "%lld %d\n", (long long)records, hunts);
+    fclose(marker);
+    return 0;
+}
+
+// Removes dir and everything under it without following symlinks.
+int remove_dir(const char* dir) {
+    DIR* d = opendir(dir);
+    struct dirent* entry;
+    struct stat st;
+    char path[MAX_PATH * 2];
+    int ok = 1;
+
+    if (d == NULL) {
+        perror(dir);
+        return 0;
+    }
+    while (ok && (entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            ok = remove_dir(path);
+        } else if (unlink(path) != 0) {
+            perror(path);
+            ok = 0;
+        }
+    }
+    closedir(d);
+    if (ok && rmdir(dir) != 0) {
+        perror(dir);
+        ok = 0;
+    }
+    return ok;
+}
+
+// Bytes this process has read through read-like system calls, or -1.
+int64_t read_bytes(void) {
+    char buf[512];
+    char* field;
+    ssize_t len;
+    int fd = open("/proc/self/io", O_RDONLY);
+
+    if (fd == -1) {
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    buf[len] = '\0';
+    field = strstr(buf, "rchar:");
+    return field ? strtoll(field + 6, NULL, 10) : -1;
+}
+
+// Calls op ops times, timing each call. Returns 0 if an op failed.
+int run_bench(BenchContext* ctx, const char* name, int64_t ops, BenchOp op, BenchResult* result) {
+    double* samples = malloc((size_t)ops * sizeof(double));
+    int64_t bytes;
+    int64_t overhead;
+    struct timespec start, op_start;
+
+    if (samples == NULL) {
+        perror("malloc");
+        return 0;
+    }
+
+    // Reading /proc/self/io counts towards rchar itself.
+    overhead = read_bytes();
+    bytes = read_bytes();
+    overhead = bytes - overhead;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int64_t i = 0; i < ops; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &op_start);
+        if (!op(ctx, i)) {
+            fprintf(stderr, "%s failed: %s\n", name, strerror(errno));
+            free(samples);
+            return 0;
+        }
+        samples[i] = seconds_since(&op_start);
+    }
+    result->name = name;
+    result->seconds = seconds_since(&start);
+    summarize(result, samples, ops, bytes < 0 ? -1 : read_bytes() - bytes - overhead);
+    free(samples);
+    return 1;
+}
+
+void print_header(const BenchContext* ctx, int hunts, uint64_t seed) {
+    const char* sync = store_sync_policy() == SYNC_NONE ? "none" : "group";
+    const char* scan = store_scan_backend() == SCAN_MMAP ? "mmap" : "block";
+    const char* log_flush = log_flush_policy() == LOG_FLUSH_SYNC ? "sync" :
+        log_flush_policy() == LOG_FLUSH_ALWAYS ? "always" : "batch";
+
+    if (json_output) {
+        printf("{\"bench\": \"config\", \"records\": %lld, \"hunts\": %d, \"users\": %d, \"seed\": %llu, "
+            "\"sync\": \"%s\", \"scan\": \"%s\", \"log_flush\": \"%s\", \"kernels\": \"%s\"}\n",
+            (long long)ctx->records, hunts, ctx->gen.users, (unsigned long long)seed,
+            sync, scan, log_flush, column_kernels()->name);
+        return;
+    }
+    printf("Records: %lld, hunts: %d, users: %d, seed: %llu\n",
+        (long long)ctx->records, hunts, ctx->gen.users, (unsigned long long)seed);
+    printf("Sync: %s, scan: %s, log flush: %s, kernels: %s\n\n", sync, scan, log_flush, column_kernels()->name);
+    printf("%-16s | %8s | %12s | %12s | %12s | %14s\n",
+        "Operation", "Ops", "Ops/s", "p50 (us)", "p99 (us)", "Bytes read/op");
+    printf("------------------------------------------------------------------------------------\n");
+}
+
+void print_result(const BenchContext* ctx, const BenchResult* result) {
+    double rate = result->seconds > 0 ? (double)result->ops / result->seconds : 0;
+
+    if (json_output) {
+        printf("{\"bench\": \"%s\", \"records\": %lld, \"ops\": %lld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+            "\"p50_us\": %.2f, \"p99_us\": %.2f, \"bytes_read_per_op\": %.0f}\n",
+            result->name, (long long)ctx->records, (long long)result->ops, result->seconds, rate,
+            result->p50_us, result->p99_us, result->bytes_read);
+    } else {
+        printf("%-16s | %8lld | %12.1f | %12.2f | %12.2f | %14.0f\n",
+            result->name, (long long)result->ops, rate, result->p50_us, result->p99_us, result->bytes_read);
+    }
+    fflush(stdout);
+}
+
+// Each op runs the function behind the matching treasure_manager,
+// treasure_hub or score_calculator command, minus the prompts, with output
+// going to /dev/null.
+
+int op_add_treasure(BenchContext* ctx, int64_t i) {
+    Treasure treasure;
+
+    (void)i;
+    generate_treasure(&ctx->gen, &treasure);
+    return ops_add_treasure(ctx->hunt_id, &treasure, ctx->devnull) == 1;
+}
+
+// Some of the IDs drawn may have been removed by an earlier --reuse run.
+int op_view_treasure(BenchContext* ctx, int64_t i) {
+    int id = ctx->first_id + (int)(rng_next(&ctx->gen.rng) % (uint64_t)ctx->records);
+
+    (void)i;
+    return ops_view_treasure(ctx->hunt_id, id, ctx->devnull) != -1;
+}
+
+int op_list_treasures(BenchContext* ctx, int64_t i) {
+    (void)i;
+    return ops_list_treasures(ctx->hunt_id, ctx->devnull) == 1;
+}
+
+// Removes distinct random treasures from the generated range.
+int op_remove_treasure(BenchContext* ctx, int64_t i) {
+    int64_t index;
+
+    (void)i;
+    do {
+        index = (int64_t)(rng_next(&ctx->gen.rng) % (uint64_t)ctx->records);
+    } while (ctx->removed[index]);
+    ctx->removed[index] = 1;
+
+    return ops_remove_treasure(ctx->hunt_id, ctx->first_id + (int)index, ctx->devnull) == 1;
+}
+
+// No command counts a single hunt; this times the store call the listings
+// are built on.
+int op_count_treasures(BenchContext* ctx, int64_t i) {
+    (void)i;
+    fprintf(ctx->devnull, "Hunt: %s - Total treasures: %d\n", ctx->hunt_id, store_count(ctx->hunt_id));
+    return 1;
+}
+
+// A list_hunts request to a hub monitor that has been running all along, so
+// only hunts that changed since the last request are read again.
+int op_list_all_hunts(BenchContext* ctx, int64_t i) {
+    (void)i;
+    hunt_cache_sync(&ctx->hunts);
+    return hub_list_hunts(&ctx->hunts, ctx->devnull) == 1;
+}
+
+// score_calculator <hunt> --scan: a full scan of the segments, which also
+// rewrites the scores sidecar that score_sidecar then reads.
+int op_score_scan(BenchContext* ctx, int64_t i) {
+    (void)i;
+    scoring_set_sidecar(0);
+    return store_Calculator(ctx->hunt_id, 0, fileno(ctx->devnull)) == 1;
+}
+
+// score_calculator <hunt>, answered from the sidecar.
+int op_score_sidecar(BenchContext* ctx, int64_t i) {
+    (void)i;
+    scoring_set_sidecar(1);
+    return store_Calculator(ctx->hunt_id, 0, fileno(ctx->devnull)) == 1;
+}
+
+// Nearby queries around every city, from a street to a few countries wide,
+// must find what a scan of the hunt finds. Once the first query has built
+// the spatial sidecar they should read only the records they return; one
+// that fell back to a scan reads the whole hunt.
+int check_spatial(BenchContext* ctx) {
+    static const double radii_km[] = BENCH_CHECK_RADII_KM;
+    SpatialMatch* matches;
+    int passed = 1;
+
+    if (spatial_nearby(ctx->hunt_id, cities[0][0], cities[0][1], radii_km[0] * 1000.0, &matches) == -1) {
+        perror("Failed to query the hunt");
+        return 0;
+    }
+    free(matches);
+
+    for (size_t c = 0; c < COUNT_OF(cities); c++) {
+        for (size_t r = 0; r < COUNT_OF(radii_km); r++) {
+            double radius_m = radii_km[r] * 1000.0;
+            StatsIO before, after;
+            StoreIter it;
+            const TreasureRecord* record;
+            int64_t expected = 0, expected_ids = 0, found_ids = 0, read;
+            int count;
+            int ok;
+
+            stats_get_io(&before);
+            count = spatial_nearby(ctx->hunt_id, cities[c][0], cities[c][1], radius_m, &matches);
+            stats_get_io(&after);
+            if (count == -1) {
+                perror("Failed to query the hunt");
+                return 0;
+            }
+            for (int i = 0; i < count; i++) {
+                found_ids += matches[i].record.treasure_id;
+            }
+            free(matches);
+
+            if (!store_iter_open(&it, ctx->hunt_id)) {
+                perror("Failed to open the generated hunt");
+                return 0;
+            }
+            while ((record = store_iter_next(&it)) != NULL) {
+                if (spatial_distance(cities[c][0], cities[c][1], record->latitude, record->longitude) <= radius_m) {
+                    expected++;
+                    expected_ids += record->treasure_id;
+                }
+            }
+            store_iter_close(&it);
+
+            read = (int64_t)(after.records_read - before.records_read);
+            ok = count == expected && found_ids == expected_ids && read <= count;
+            printf("%-4s nearby %8.4f %9.4f %5.0f km: %d found, %lld expected, %lld records read\n",
+                ok ? "ok" : "FAIL", cities[c][0], cities[c][1], radii_km[r], count,
+                (long long)expected, (long long)read);
+            passed = passed && ok;
+        }
+    }
+    return passed;
+}
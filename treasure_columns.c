@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "treasure_columns.h"
+#include "treasure_scores.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define COLUMNS_INITIAL_ROWS 256
+#define COLUMNS_INITIAL_USERS 64
+
+void columns_init(HuntColumns* cols) {
+    memset(cols, 0, sizeof(*cols));
+}
+
+void columns_free(HuntColumns* cols) {
+    free(cols->ids);
+    free(cols->values);
+    free(cols->latitudes);
+    free(cols->longitudes);
+    free(cols->user_ids);
+    free(cols->slots);
+    free(cols->usernames);
+    free(cols->user_hashes);
+    free(cols->user_table);
+    columns_init(cols);
+}
+
+void columns_clear(HuntColumns* cols) {
+    cols->count = 0;
+    cols->user_count = 0;
+    if (cols->user_table != NULL) {
+        memset(cols->user_table, 0, ((size_t)cols->user_mask + 1) * sizeof(uint32_t));
+    }
+}
+
+size_t columns_bytes(const HuntColumns* cols) {
+    size_t row = 3 * sizeof(int32_t) + 2 * sizeof(double) + sizeof(int64_t);
+    size_t user = MAX_USERNAME + sizeof(uint32_t);
+
+    return (size_t)cols->capacity * row + (size_t)cols->user_capacity * user +
+        (cols->user_table != NULL ? ((size_t)cols->user_mask + 1) * sizeof(uint32_t) : 0);
+}
+
+static int grow(void** array, size_t count, size_t size) {
+    void* grown = realloc(*array, count * size);
+
+    if (grown == NULL) {
+        return 0;
+    }
+    *array = grown;
+    return 1;
+}
+
+static int reserve_rows(HuntColumns* cols, int64_t rows) {
+    int64_t capacity = cols->capacity ? cols->capacity : COLUMNS_INITIAL_ROWS;
+
+    if (rows <= cols->capacity) {
+        return 1;
+    }
+    while (capacity < rows) {
+        capacity *= 2;
+    }
+    if (!grow((void**)&cols->ids, (size_t)capacity, sizeof(int32_t)) ||
+        !grow((void**)&cols->values, (size_t)capacity, sizeof(int32_t)) ||
+        !grow((void**)&cols->latitudes, (size_t)capacity, sizeof(double)) ||
+        !grow((void**)&cols->longitudes, (size_t)capacity, sizeof(double)) ||
+        !grow((void**)&cols->user_ids, (size_t)capacity, sizeof(uint32_t)) ||
+        !grow((void**)&cols->slots, (size_t)capacity, sizeof(int64_t))) {
+        return 0;
+    }
+    cols->capacity = capacity;
+    return 1;
+}
+
+static int grow_user_table(HuntColumns* cols) {
+    uint32_t mask = cols->user_table ? cols->user_mask * 2 + 1 : COLUMNS_INITIAL_USERS * 2 - 1;
+    uint32_t* table = calloc((size_t)mask + 1, sizeof(uint32_t));
+
+    if (table == NULL) {
+        return 0;
+    }
+    for (uint32_t user = 0; user < cols->user_count; user++) {
+        uint32_t pos = cols->user_hashes[user] & mask;
+        while (table[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        table[pos] = user + 1;
+    }
+    free(cols->user_table);
+    cols->user_table = table;
+    cols->user_mask = mask;
+    return 1;
+}
+
+// Returns the user id of username, interning it if needed, or -1.
+static int64_t intern_user(HuntColumns* cols, const char* username) {
+    size_t len;
+    uint32_t hash = scores_hash(username, &len);
+    uint32_t pos;
+    uint32_t id;
+
+    if (cols->user_table == NULL && !grow_user_table(cols)) {
+        return -1;
+    }
+    pos = hash & cols->user_mask;
+    while ((id = cols->user_table[pos]) != 0) {
+        if (cols->user_hashes[id - 1] == hash && strncmp(cols->usernames[id - 1], username, MAX_USERNAME) == 0) {
+            return id - 1;
+        }
+        pos = (pos + 1) & cols->user_mask;
+    }
+
+    if (cols->user_count == cols->user_capacity) {
+        uint32_t capacity = cols->user_capacity ? cols->user_capacity * 2 : COLUMNS_INITIAL_USERS;
+        if (!grow((void**)&cols->usernames, capacity, MAX_USERNAME) ||
+            !grow((void**)&cols->user_hashes, capacity, sizeof(uint32_t))) {
+            return -1;
+        }
+        cols->user_capacity = capacity;
+    }
+    id = cols->user_count++;
+    memset(cols->usernames[id], 0, MAX_USERNAME);
+    memcpy(cols->usernames[id], username, len < MAX_USERNAME ? len : MAX_USERNAME - 1);
+    cols->user_hashes[id] = hash;
+    cols->user_table[pos] = id + 1;
+
+    // Keep the load factor under 3/4.
+    if (cols->user_count * 4 > (cols->user_mask + 1) * 3 && !grow_user_table(cols)) {
+        return -1;
+    }
+    return id;
+}
+
+int64_t columns_find_user(const HuntColumns* cols, const char* username) {
+    size_t len;
+    uint32_t hash = scores_hash(username, &len);
+    uint32_t pos;
+    uint32_t id;
+
+    if (cols->user_table == NULL) {
+        return -1;
+    }
+    pos = hash & cols->user_mask;
+    while ((id = cols->user_table[pos]) != 0) {
+        if (cols->user_hashes[id - 1] == hash && strncmp(cols->usernames[id - 1], username, MAX_USERNAME) == 0) {
+            return id - 1;
+        }
+        pos = (pos + 1) & cols->user_mask;
+    }
+    return -1;
+}
+
+int columns_append(HuntColumns* cols, const TreasureRecord* record, int64_t slot) {
+    int64_t user;
+    int64_t row = cols->count;
+
+    if (!reserve_rows(cols, row + 1) || (user = intern_user(cols, record->username)) == -1) {
+        return 0;
+    }
+    cols->ids[row] = record->treasure_id;
+    cols->values[row] = record->value;
+    cols->latitudes[row] = record->latitude;
+    cols->longitudes[row] = record->longitude;
+    cols->user_ids[row] = (uint32_t)user;
+    cols->slots[row] = slot;
+    cols->count++;
+    return 1;
+}
+
+int columns_load(HuntColumns* cols, const char* hunt_id, StoreHeader* hdr) {
+    StoreIter it;
+    const TreasureRecord* record;
+
+    columns_clear(cols);
+    if (!store_iter_open(&it, hunt_id)) {
+        return 0;
+    }
+    if (!reserve_rows(cols, it.hdr.record_count)) {
+        store_iter_close(&it);
+        return -1;
+    }
+    while ((record = store_iter_next(&it)) != NULL) {
+        if (!columns_append(cols, record, it.slot - 1)) {
+            store_iter_close(&it);
+            return -1;
+        }
+    }
+    if (hdr != NULL) {
+        *hdr = it.hdr;
+    }
+    store_iter_close(&it);
+    return 1;
+}
+
+int columns_load_part(HuntColumns* cols, const StorePart* part) {
+    StoreIter it;
+    const TreasureRecord* record;
+
+    columns_clear(cols);
+    if (!reserve_rows(cols, part->end_slot - part->first_slot)) {
+        return -1;
+    }
+    store_iter_part(&it, part);
+    while ((record = store_iter_next(&it)) != NULL) {
+        if (!columns_append(cols, record, it.slot - 1)) {
+            store_iter_close(&it);
+            return -1;
+        }
+    }
+    store_iter_close(&it);
+    return 1;
+}
+
+int column_range_from_filter(const ZoneFilter* filter, ColumnRange* range) {
+    if (filter->min_value > filter->max_value || filter->min_id > filter->max_id ||
+        filter->min_value > INT32_MAX || filter->max_value < INT32_MIN ||
+        filter->min_id > INT32_MAX || filter->max_id < INT32_MIN) {
+        return 0;
+    }
+    range->min_value = filter->min_value < INT32_MIN ? INT32_MIN : (int32_t)filter->min_value;
+    range->max_value = filter->max_value > INT32_MAX ? INT32_MAX : (int32_t)filter->max_value;
+    range->min_id = filter->min_id < INT32_MIN ? INT32_MIN : (int32_t)filter->min_id;
+    range->max_id = filter->max_id > INT32_MAX ? INT32_MAX : (int32_t)filter->max_id;
+    return 1;
+}
+
+// Scalar kernels: the fallback, and the tail of every vector loop.
+
+static inline int in_range(int32_t id, int32_t value, const ColumnRange* range) {
+    return (value >= range->min_value) & (value <= range->max_value) &
+        (id >= range->min_id) & (id <= range->max_id);
+}
+
+static int64_t select_range_scalar(const int32_t* ids, const int32_t* values, int64_t n,
+    const ColumnRange* range, uint32_t* rows) {
+    int64_t k = 0;
+
+    // Branch-free: every row is written, only matches advance k.
+    for (int64_t i = 0; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += in_range(ids[i], values[i], range);
+    }
+    return k;
+}
+
+static int64_t select_equal_scalar(const uint32_t* column, int64_t n, uint32_t key, uint32_t* rows) {
+    int64_t k = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += column[i] == key;
+    }
+    return k;
+}
+
+static int64_t count_range_scalar(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    int64_t k = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        k += in_range(ids[i], values[i], range);
+    }
+    return k;
+}
+
+static int64_t sum_scalar(const int32_t* values, int64_t n) {
+    int64_t total = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        total += values[i];
+    }
+    return total;
+}
+
+static int64_t sum_range_scalar(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    int64_t total = 0;
+
+    for (int64_t i = 0; i < n; i++) {
+        total += in_range(ids[i], values[i], range) ? values[i] : 0;
+    }
+    return total;
+}
+
+// Grouped sums stay scalar at every level: neither SSE4.1 nor AVX2 can
+// scatter, and rows of the same user in one vector would conflict anyway.
+// Two interleaved passes over separate halves of the rows keep consecutive
+// updates to the same user from waiting on each other.
+static void group_sum_scalar(const uint32_t* groups, const int32_t* values, int64_t n,
+    int64_t* sums, int64_t* counts) {
+    int64_t half = n / 2;
+
+    for (int64_t i = 0; i < half; i++) {
+        uint32_t a = groups[i];
+        uint32_t b = groups[half + i];
+        sums[a] += values[i];
+        counts[a]++;
+        sums[b] += values[half + i];
+        counts[b]++;
+    }
+    for (int64_t i = 2 * half; i < n; i++) {
+        sums[groups[i]] += values[i];
+        counts[groups[i]]++;
+    }
+}
+
+static const ColumnKernels scalar_kernels = {
+    "scalar",
+    select_range_scalar,
+    select_equal_scalar,
+    count_range_scalar,
+    sum_scalar,
+    sum_range_scalar,
+    group_sum_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+// SSE4.1: four rows per step.
+
+__attribute__((target("sse4.1")))
+static inline __m128i out_of_range_sse4(const int32_t* ids, const int32_t* values, const ColumnRange* range) {
+    __m128i v = _mm_loadu_si128((const __m128i*)values);
+    __m128i id = _mm_loadu_si128((const __m128i*)ids);
+    __m128i low = _mm_or_si128(_mm_cmpgt_epi32(_mm_set1_epi32(range->min_value), v),
+        _mm_cmpgt_epi32(_mm_set1_epi32(range->min_id), id));
+    __m128i high = _mm_or_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32(range->max_value)),
+        _mm_cmpgt_epi32(id, _mm_set1_epi32(range->max_id)));
+
+    return _mm_or_si128(low, high);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i widen_sum_sse4(__m128i acc, __m128i v) {
+    acc = _mm_add_epi64(acc, _mm_cvtepi32_epi64(v));
+    return _mm_add_epi64(acc, _mm_cvtepi32_epi64(_mm_srli_si128(v, 8)));
+}
+
+__attribute__((target("sse4.1")))
+static inline int64_t horizontal_sum_sse4(__m128i acc) {
+    return _mm_extract_epi64(acc, 0) + _mm_extract_epi64(acc, 1);
+}
+
+__attribute__((target("sse4.1")))
+static int64_t select_range_sse4(const int32_t* ids, const int32_t* values, int64_t n,
+    const ColumnRange* range, uint32_t* rows) {
+    int64_t i = 0, k = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        unsigned bits = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(out_of_range_sse4(ids + i, values + i, range))) & 0xf;
+        while (bits != 0) {
+            rows[k++] = (uint32_t)(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += in_range(ids[i], values[i], range);
+    }
+    return k;
+}
+
+__attribute__((target("sse4.1")))
+static int64_t select_equal_sse4(const uint32_t* column, int64_t n, uint32_t key, uint32_t* rows) {
+    __m128i keys = _mm_set1_epi32((int)key);
+    int64_t i = 0, k = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(column + i)), keys);
+        unsigned bits = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (bits != 0) {
+            rows[k++] = (uint32_t)(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += column[i] == key;
+    }
+    return k;
+}
+
+__attribute__((target("sse4.1,popcnt")))
+static int64_t count_range_sse4(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    int64_t i = 0, k = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        unsigned bits = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(out_of_range_sse4(ids + i, values + i, range))) & 0xf;
+        k += __builtin_popcount(bits);
+    }
+    return k + count_range_scalar(ids + i, values + i, n - i, range);
+}
+
+__attribute__((target("sse4.1")))
+static int64_t sum_sse4(const int32_t* values, int64_t n) {
+    __m128i acc = _mm_setzero_si128();
+    int64_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        acc = widen_sum_sse4(acc, _mm_loadu_si128((const __m128i*)(values + i)));
+    }
+    return horizontal_sum_sse4(acc) + sum_scalar(values + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static int64_t sum_range_sse4(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    __m128i acc = _mm_setzero_si128();
+    int64_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+        acc = widen_sum_sse4(acc, _mm_andnot_si128(out_of_range_sse4(ids + i, values + i, range), v));
+    }
+    return horizontal_sum_sse4(acc) + sum_range_scalar(ids + i, values + i, n - i, range);
+}
+
+static const ColumnKernels sse4_kernels = {
+    "sse4",
+    select_range_sse4,
+    select_equal_sse4,
+    count_range_sse4,
+    sum_sse4,
+    sum_range_sse4,
+    group_sum_scalar
+};
+
+// AVX2: eight rows per step.
+
+__attribute__((target("avx2")))
+static inline __m256i out_of_range_avx2(const int32_t* ids, const int32_t* values, const ColumnRange* range) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)values);
+    __m256i id = _mm256_loadu_si256((const __m256i*)ids);
+    __m256i low = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(range->min_value), v),
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(range->min_id), id));
+    __m256i high = _mm256_or_si256(_mm256_cmpgt_epi32(v, _mm256_set1_epi32(range->max_value)),
+        _mm256_cmpgt_epi32(id, _mm256_set1_epi32(range->max_id)));
+
+    return _mm256_or_si256(low, high);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i widen_sum_avx2(__m256i acc, __m256i v) {
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+}
+
+__attribute__((target("avx2")))
+static inline int64_t horizontal_sum_avx2(__m256i acc) {
+    __m128i pair = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+
+    return _mm_extract_epi64(pair, 0) + _mm_extract_epi64(pair, 1);
+}
+
+__attribute__((target("avx2")))
+static int64_t select_range_avx2(const int32_t* ids, const int32_t* values, int64_t n,
+    const ColumnRange* range, uint32_t* rows) {
+    int64_t i = 0, k = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        unsigned bits = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(out_of_range_avx2(ids + i, values + i, range))) & 0xff;
+        while (bits != 0) {
+            rows[k++] = (uint32_t)(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += in_range(ids[i], values[i], range);
+    }
+    return k;
+}
+
+__attribute__((target("avx2")))
+static int64_t select_equal_avx2(const uint32_t* column, int64_t n, uint32_t key, uint32_t* rows) {
+    __m256i keys = _mm256_set1_epi32((int)key);
+    int64_t i = 0, k = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(column + i)), keys);
+        unsigned bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        while (bits != 0) {
+            rows[k++] = (uint32_t)(i + __builtin_ctz(bits));
+            bits &= bits - 1;
+        }
+    }
+    for (; i < n; i++) {
+        rows[k] = (uint32_t)i;
+        k += column[i] == key;
+    }
+    return k;
+}
+
+__attribute__((target("avx2,popcnt")))
+static int64_t count_range_avx2(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    int64_t i = 0, k = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        unsigned bits = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(out_of_range_avx2(ids + i, values + i, range))) & 0xff;
+        k += __builtin_popcount(bits);
+    }
+    return k + count_range_scalar(ids + i, values + i, n - i, range);
+}
+
+__attribute__((target("avx2")))
+static int64_t sum_avx2(const int32_t* values, int64_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    int64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        acc = widen_sum_avx2(acc, _mm256_loadu_si256((const __m256i*)(values + i)));
+    }
+    return horizontal_sum_avx2(acc) + sum_scalar(values + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static int64_t sum_range_avx2(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range) {
+    __m256i acc = _mm256_setzero_si256();
+    int64_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(values + i));
+        acc = widen_sum_avx2(acc, _mm256_andnot_si256(out_of_range_avx2(ids + i, values + i, range), v));
+    }
+    return horizontal_sum_avx2(acc) + sum_range_scalar(ids + i, values + i, n - i, range);
+}
+
+static const ColumnKernels avx2_kernels = {
+    "avx2",
+    select_range_avx2,
+    select_equal_avx2,
+    count_range_avx2,
+    sum_avx2,
+    sum_range_avx2,
+    group_sum_scalar
+};
+
+#endif
+
+static const ColumnKernels* selected_kernels = NULL;
+
+const ColumnKernels* column_kernels(void) {
+    const char* env;
+
+    if (selected_kernels != NULL) {
+        return selected_kernels;
+    }
+
+    env = getenv("TREASURE_SIMD");
+    selected_kernels = &scalar_kernels;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (env && strcmp(env, "scalar") == 0) {
+        return selected_kernels;
+    }
+    if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt")) {
+        selected_kernels = &sse4_kernels;
+    }
+    if ((env == NULL || strcmp(env, "sse4") != 0) &&
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        selected_kernels = &avx2_kernels;
+    }
+#else
+    (void)env;
+#endif
+    return selected_kernels;
+}
@@ -0,0 +1,83 @@
+#ifndef TREASURE_COLUMNS_H
+#define TREASURE_COLUMNS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure_store.h"
+#include "treasure_zones.h"
+
+// Columnar in-memory copy of a hunt's live records: one array per field, so
+// filters and aggregates stream through the 4-byte columns they need instead
+// of striding over 96-byte records. Usernames are interned to dense user ids
+// (0 .. user_count - 1), which makes grouping by user an array index.
+//
+// The kernels below run over those arrays. They come in AVX2, SSE4.1 and
+// scalar versions, picked once at run time from what the CPU supports.
+// TREASURE_SIMD ("avx2", "sse4" or "scalar") can force a lower level, e.g. to
+// compare results or timings.
+
+typedef struct {
+    int64_t count;              // rows
+    int64_t capacity;
+    int32_t* ids;
+    int32_t* values;
+    double* latitudes;
+    double* longitudes;
+    uint32_t* user_ids;
+    int64_t* slots;             // treasures.dat slot of each row
+
+    char (*usernames)[MAX_USERNAME];    // by user id
+    uint32_t* user_hashes;
+    uint32_t user_count;
+    uint32_t user_capacity;
+    uint32_t* user_table;       // open addressing, user id + 1, 0 is empty
+    uint32_t user_mask;
+} HuntColumns;
+
+void columns_init(HuntColumns* cols);
+void columns_free(HuntColumns* cols);
+// Drops every row and user but keeps the allocations.
+void columns_clear(HuntColumns* cols);
+// Appends a record read from slot. Returns 1 on success, 0 if memory ran out.
+int columns_append(HuntColumns* cols, const TreasureRecord* record, int64_t slot);
+// Loads the live records of one snapshot of hunt_id. Fills *hdr with the
+// snapshot's header if hdr is not NULL. Returns 1 on success, 0 (with errno
+// set) if the hunt cannot be opened, -1 if memory ran out.
+int columns_load(HuntColumns* cols, const char* hunt_id, StoreHeader* hdr);
+// Loads the live records of one part of a pinned snapshot. Returns 1 on
+// success, -1 if memory ran out.
+int columns_load_part(HuntColumns* cols, const StorePart* part);
+// User id of username, or -1 if no row has it.
+int64_t columns_find_user(const HuntColumns* cols, const char* username);
+size_t columns_bytes(const HuntColumns* cols);
+
+// Inclusive bounds on value and treasure_id.
+typedef struct {
+    int32_t min_value;
+    int32_t max_value;
+    int32_t min_id;
+    int32_t max_id;
+} ColumnRange;
+
+// Clamps a zone filter to the int32 columns. Returns 0 if nothing can match.
+int column_range_from_filter(const ZoneFilter* filter, ColumnRange* range);
+
+typedef struct {
+    const char* name;
+    // Writes the indices of rows inside range to rows; returns how many.
+    int64_t (*select_range)(const int32_t* ids, const int32_t* values, int64_t n,
+        const ColumnRange* range, uint32_t* rows);
+    // Writes the indices of rows whose column equals key to rows.
+    int64_t (*select_equal)(const uint32_t* column, int64_t n, uint32_t key, uint32_t* rows);
+    int64_t (*count_range)(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range);
+    int64_t (*sum)(const int32_t* values, int64_t n);
+    int64_t (*sum_range)(const int32_t* ids, const int32_t* values, int64_t n, const ColumnRange* range);
+    // Adds each row's value to sums[group] and 1 to counts[group].
+    void (*group_sum)(const uint32_t* groups, const int32_t* values, int64_t n,
+        int64_t* sums, int64_t* counts);
+} ColumnKernels;
+
+const ColumnKernels* column_kernels(void);
+
+#endif
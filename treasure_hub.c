@@ -1,461 +1,1316 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <dirent.h>
 #include <errno.h>
 #include <time.h>
 
-#define MAX_PATH 256
-#define MAX_USERNAME 50
-#define MAX_CLUE_TEXT 500
+#include "treasure_store.h"
+#include "hub_protocol.h"
+#include "hunt_cache.h"
+#include "hub_hunts.h"
+#include "treasure_spatial.h"
+#include "treasure_search.h"
+#include "treasure_users.h"
+#include "treasure_zones.h"
+#include "treasure_stats.h"
+
 #define MAX_COMMAND 1024
 #define DELAY_MS 500000
 
+#define MAX_MONITOR_WORKERS 64
+
+// One monitor worker: a forked monitor_process and the hub's end of its
+// socketpair. Requests routed to a worker wait in its own out queue.
+typedef struct {
+    pid_t pid;
+    int fd;
+    FrameReader in;
+    FrameWriter out;
+    int outstanding;            // requests sent but not yet answered
+    uint32_t shutdown_id;       // nonzero once stop_monitor asked it to exit
+} MonitorWorker;
+
+// A request the hub has sent and not yet printed. Answers are collected here
+// so output from different workers never interleaves, and printed in the
+// order the commands were given.
 typedef struct {
-    int treasure_id;
-    char username[MAX_USERNAME];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE_TEXT];
-    int value;
-} Treasure;
-
-pid_t monitor_pid = -1;
+    uint32_t id;
+    uint16_t type;
+    int worker;
+    int target;                 // worker it must go to, or -1 for any
+    int continued;              // more answers to the same command follow
+    int retried;
+    int done;
+    char* payload;
+    uint32_t payload_len;
+    char* text;
+    size_t text_len;
+} PendingRequest;
+
+MonitorWorker workers[MAX_MONITOR_WORKERS];
+int worker_count = 0;
 int monitor_running = 0;
-int received_signal = 0;
 int exit_requested = 0;
+int stopping = 0;
+int script_mode = 0;            // --script: no banner or prompts
+
+PendingRequest* pending = NULL;     // ordered by id
+int pending_count = 0;
+int pending_capacity = 0;
+uint32_t next_request_id = 1;
+
+// Each monitor worker keeps its own cache of the hunts it has served.
+HuntCache monitor_cache;
+
+// Per-request counters of a monitor worker, reported by the stats command.
+StatsOp monitor_stats[HUB_REQ_STATS] = {
+    [HUB_REQ_LIST_HUNTS] = { .name = "list_hunts" },
+    [HUB_REQ_LIST_TREASURES] = { .name = "list_treasures" },
+    [HUB_REQ_VIEW_TREASURE] = { .name = "view_treasure" },
+    [HUB_REQ_NEARBY] = { .name = "nearby" },
+    [HUB_REQ_BBOX] = { .name = "bbox" },
+    [HUB_REQ_SEARCH_CLUES] = { .name = "search_clues" },
+    [HUB_REQ_LIST_USER] = { .name = "list_user" },
+    [HUB_REQ_FILTER] = { .name = "filter" },
+};
 
 
-void parent_signal_handler(int signum);
 void process_command(const char* command);
-void start_monitor();
+int send_request(uint16_t type, const void* payload, uint32_t length);
+int send_request_to(int target, int continued, uint16_t type, const void* payload, uint32_t length);
+int dispatch(PendingRequest* request);
+int pump_monitor(int timeout_ms);
+void read_worker(int index);
+void worker_exited(int index);
+void print_completed();
+void queue_message(const char* format, ...);
+int spawn_worker(int index);
+void start_monitor(int count);
 void stop_monitor();
-void monitor_process();
-void monitor_signal_handler(int signum);
-void list_all_hunts();
-void list_hunt_treasures(const char* hunt_id);
-void view_hunt_treasure(const char* hunt_id, int treasure_id);
-int count_treasures(const char* hunt_id);
-int does_hunt_exist(const char* hunt_id);
+void monitor_process(int fd);
+void handle_request(int fd, const HubFrameHeader* hdr, const char* payload);
+void list_hunt_treasures(const char* hunt_id, FILE* out);
+void view_hunt_treasure(const char* hunt_id, int treasure_id, FILE* out);
+void find_hunt_nearby(const char* hunt_id, const double* args, FILE* out);
+void find_hunt_bbox(const char* hunt_id, const double* args, FILE* out);
+void search_hunt_clues(const char* hunt_id, const char* query, FILE* out);
+void list_hunt_user(const char* hunt_id, const char* username, FILE* out);
+void filter_hunt(const char* hunt_id, char* conditions, FILE* out);
+void print_monitor_stats(FILE* out);
 
 
 void run_menu();
 
-int main() {
-    struct sigaction sa;
-
-    sa.sa_handler = parent_signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
+int main(int argc, char* argv[]) {
+    // --script reads commands from a file (or stdin) without the banner and
+    // prompts, so the output is only what the commands print. Every request
+    // still ends with "Task done!" in the order it was given, which is what
+    // scripts and hub_load match answers on.
+    if (argc > 1 && strcmp(argv[1], "--script") == 0 && argc <= 3) {
+        script_mode = 1;
+        if (argc == 3 && strcmp(argv[2], "-") != 0) {
+            int fd = open(argv[2], O_RDONLY);
+            if (fd == -1 || dup2(fd, STDIN_FILENO) == -1) {
+                perror(argv[2]);
+                return 1;
+            }
+            close(fd);
+        }
+    } else if (argc > 1) {
+        fprintf(stderr, "Usage: %s [--script [file|-]]\n", argv[0]);
+        return 1;
+    }
 
-    sigaction(SIGUSR1, &sa, NULL);
-    sigaction(SIGUSR2, &sa, NULL);
+    // A monitor that dies mid-write must not take the hub down with it.
+    signal(SIGPIPE, SIG_IGN);
 
     run_menu();
 
     return 0;
 }
 
-void run_menu() {
-    printf("Treasure Hub - Interactive Interface\n");
-    printf("------------------------------------\n");
-    printf("Available commands:\n");
-    printf("  start_monitor\n");
-    printf("  list_hunts\n");
-    printf("  list_treasures <hunt_id>\n");
-    printf("  view_treasure <hunt_id> <treasure_id>\n");
-    printf("  stop_monitor\n");
-    printf("  exit\n");
-
-    char command[MAX_COMMAND];
-
-    while (1) {
+static void print_prompt() {
+    if (!script_mode) {
         printf("\n> ");
-        if (fgets(command, MAX_COMMAND, stdin) == NULL) {
+    }
+    fflush(stdout);
+}
+
+void run_menu() {
+    if (!script_mode) {
+        printf("Treasure Hub - Interactive Interface\n");
+        printf("------------------------------------\n");
+        printf("Available commands:\n");
+        printf("  start_monitor [workers]\n");
+        printf("  list_hunts\n");
+        printf("  list_treasures <hunt_id>\n");
+        printf("  view_treasure <hunt_id> <treasure_id>\n");
+        printf("  nearby <hunt_id> <latitude> <longitude> <radius_m>\n");
+        printf("  bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+        printf("  search_clues <hunt_id> <terms> [OR <terms>...]\n");
+        printf("  list_user <hunt_id> <username>\n");
+        printf("  filter <hunt_id> <value|id><op><number>...\n");
+        printf("  stats\n");
+        printf("  stop_monitor\n");
+        printf("  exit\n");
+    }
+
+    // Commands are read with read() rather than fgets so poll() sees every
+    // line that is waiting, which lets a burst of piped commands go out
+    // back to back while earlier answers are still coming in.
+    char input[MAX_COMMAND * 4];
+    size_t input_len = 0;
+    int input_open = 1;
+
+    print_prompt();
+
+    while (input_open) {
+        struct pollfd fds[MAX_MONITOR_WORKERS + 1];
+        int nfds = 0;
+
+        fds[nfds].fd = STDIN_FILENO;
+        fds[nfds].events = POLLIN;
+        nfds++;
+        for (int i = 0; i < worker_count; i++) {
+            fds[nfds].fd = workers[i].fd;
+            fds[nfds].events = POLLIN | (workers[i].out.sent < workers[i].out.len ? POLLOUT : 0);
+            nfds++;
+        }
+
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        for (int i = 1; i < nfds; i++) {
+            if (fds[i].revents) {
+                pump_monitor(0);
+                break;
+            }
+        }
+        if (!(fds[0].revents & (POLLIN | POLLHUP))) {
+            continue;
+        }
+
+        ssize_t n = read(STDIN_FILENO, input + input_len, sizeof(input) - input_len - 1);
+        if (n <= 0) {
+            // Treat a trailing line without a newline as a command too.
+            input_open = 0;
+            if (input_len == 0) {
+                break;
+            }
+            input[input_len++] = '\n';
+        } else {
+            input_len += (size_t)n;
+        }
+
+        char* line = input;
+        char* newline;
+        while ((newline = memchr(line, '\n', input_len - (size_t)(line - input))) != NULL) {
+            *newline = '\0';
+            if (newline - line >= MAX_COMMAND) {
+                line[MAX_COMMAND - 1] = '\0';
+            }
+            // Scripts may have blank lines and # comments.
+            if (!script_mode || (line[strspn(line, " \t")] != '\0' && line[0] != '#')) {
+                process_command(line);
+                print_prompt();
+            }
+            line = newline + 1;
+        }
+
+        input_len -= (size_t)(line - input);
+        memmove(input, line, input_len);
+        if (input_len == sizeof(input) - 1) {
+            // Overlong line: drop it rather than stall.
+            input_len = 0;
+        }
+    }
+
+    // End of input: let every outstanding request finish, then shut down.
+    while (monitor_running && pending_count > 0) {
+        pump_monitor(-1);
+    }
+    if (monitor_running) {
+        stop_monitor();
+    }
+}
+
+static PendingRequest* find_pending(uint32_t id) {
+    int lo = 0;
+    int hi = pending_count - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (pending[mid].id == id) {
+            return &pending[mid];
+        }
+        if (pending[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+static void complete_request(PendingRequest* request, const char* error) {
+    if (error != NULL) {
+        free(request->text);
+        request->text = strdup(error);
+        request->text_len = request->text ? strlen(error) : 0;
+    }
+    request->done = 1;
+}
+
+// Routes a request to an idle worker, or to the one with the shortest queue.
+// A request with a target only goes to that worker.
+int dispatch(PendingRequest* request) {
+    int best = -1;
+
+    if (request->target >= 0) {
+        if (request->target < worker_count && workers[request->target].shutdown_id == 0) {
+            best = request->target;
+        }
+    }
+    for (int i = 0; i < worker_count && request->target < 0; i++) {
+        if (workers[i].shutdown_id != 0) {
+            continue;
+        }
+        if (best == -1 || workers[i].outstanding < workers[best].outstanding) {
+            best = i;
+        }
+        if (workers[i].outstanding == 0) {
             break;
         }
+    }
+    if (best == -1 ||
+        !frame_queue(&workers[best].out, request->id, request->type, 0, request->payload, request->payload_len)) {
+        return 0;
+    }
+
+    request->worker = best;
+    workers[best].outstanding++;
+    if (frame_flush(&workers[best].out, workers[best].fd) == -1) {
+        perror("Failed to send request to monitor");
+    }
+    return 1;
+}
+
+static int reserve_pending() {
+    if (pending_count == pending_capacity) {
+        int capacity = pending_capacity ? pending_capacity * 2 : 64;
+        PendingRequest* grown = realloc(pending, (size_t)capacity * sizeof(PendingRequest));
+        if (grown == NULL) {
+            return 0;
+        }
+        pending = grown;
+        pending_capacity = capacity;
+    }
+    return 1;
+}
 
-        command[strcspn(command, "\n")] = '\0';
-        process_command(command);
+int send_request(uint16_t type, const void* payload, uint32_t length) {
+    return send_request_to(-1, 0, type, payload, length);
+}
+
+// Sends a request to one worker. A continued request is part of a command
+// that sends more, and its answer is printed without "Task done!".
+int send_request_to(int target, int continued, uint16_t type, const void* payload, uint32_t length) {
+    PendingRequest* request;
+
+    if (!reserve_pending()) {
+        printf("Error: Could not queue request\n");
+        return 0;
     }
+
+    request = &pending[pending_count];
+    memset(request, 0, sizeof(*request));
+    request->id = next_request_id++;
+    request->type = type;
+    request->target = target;
+    request->continued = continued;
+    request->payload_len = length;
+    // Kept so the request can be resent if its worker dies.
+    request->payload = malloc(length + 1);
+    if (request->payload == NULL) {
+        printf("Error: Could not queue request\n");
+        return 0;
+    }
+    if (length > 0) {
+        memcpy(request->payload, payload, length);
+    }
+    pending_count++;
+
+    if (!dispatch(request)) {
+        complete_request(request, "Error: Could not send request to monitor\n");
+        print_completed();
+    }
+    return 1;
 }
 
-void parent_signal_handler(int signum) {
-    //If SIGUSR1 → the monitor has completed a task 
-    if (signum == SIGUSR1) {
-        printf("Task done!\n");
-    //If SIGUSR2 → the monitor has terminated
-    } else if (signum == SIGUSR2) {
-        monitor_running = 0;
+// Queues a message of the hub's own as an answered request with an ID of its
+// own, so it is printed after the answers to every earlier command instead
+// of overtaking them.
+void queue_message(const char* format, ...) {
+    PendingRequest* request;
+    va_list args;
+    char* text;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    text = len >= 0 ? malloc((size_t)len + 1) : NULL;
+    if (text == NULL) {
+        return;
+    }
+    va_start(args, format);
+    vsnprintf(text, (size_t)len + 1, format, args);
+    va_end(args);
+
+    if (!reserve_pending()) {
+        fputs(text, stdout);
+        free(text);
+        return;
+    }
+    request = &pending[pending_count++];
+    memset(request, 0, sizeof(*request));
+    request->id = next_request_id++;
+    request->worker = -1;
+    request->target = -1;
+    request->continued = 1;
+    request->text = text;
+    request->text_len = (size_t)len;
+    complete_request(request, NULL);
+    print_completed();
+}
+
+// Prints finished requests from the front of the queue, stopping at the
+// first one still in progress.
+void print_completed() {
+    int printed = 0;
+
+    while (printed < pending_count && pending[printed].done) {
+        PendingRequest* request = &pending[printed];
+        if (request->text_len > 0) {
+            fwrite(request->text, 1, request->text_len, stdout);
+        }
+        if (!request->continued) {
+            printf("Task done!\n");
+        }
+        free(request->text);
+        free(request->payload);
+        printed++;
+    }
+
+    if (printed > 0) {
+        pending_count -= printed;
+        memmove(pending, pending + printed, (size_t)pending_count * sizeof(PendingRequest));
+        fflush(stdout);
+    }
+}
+
+// Moves queued requests out and answers in for every worker, waiting up to
+// timeout_ms (-1 waits indefinitely) for any of them to be ready.
+int pump_monitor(int timeout_ms) {
+    struct pollfd fds[MAX_MONITOR_WORKERS];
+    int count = worker_count;
+
+    if (count <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        fds[i].fd = workers[i].fd;
+        fds[i].events = POLLIN | (workers[i].out.sent < workers[i].out.len ? POLLOUT : 0);
+    }
+    if (poll(fds, count, timeout_ms) <= 0) {
+        return 0;
+    }
+
+    // A worker that exits during the loop may be replaced in its slot or
+    // swapped with the last one; anything missed is picked up next poll.
+    for (int i = 0; i < count && i < worker_count; i++) {
+        if (fds[i].revents & POLLOUT) {
+            frame_flush(&workers[i].out, workers[i].fd);
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            read_worker(i);
+        }
+    }
+
+    print_completed();
+    return 1;
+}
+
+void read_worker(int index) {
+    MonitorWorker* worker = &workers[index];
+    HubFrameHeader hdr;
+    const char* payload;
+    PendingRequest* request;
+    int result;
+    long n = frame_reader_fill(&worker->in, worker->fd);
+
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        worker_exited(index);
+        return;
+    }
+
+    while ((result = frame_reader_next(&worker->in, &hdr, &payload)) == 1) {
+        if (hdr.request_id == worker->shutdown_id) {
+            continue;
+        }
+        request = find_pending(hdr.request_id);
+        if (request == NULL || request->done || request->worker != index) {
+            continue;
+        }
+
+        if (hdr.type == HUB_RESP_DATA) {
+            char* grown = realloc(request->text, request->text_len + hdr.length);
+            if (grown != NULL) {
+                memcpy(grown + request->text_len, payload, hdr.length);
+                request->text = grown;
+                request->text_len += hdr.length;
+            }
+        } else if (hdr.type == HUB_RESP_END) {
+            worker->outstanding--;
+            complete_request(request, NULL);
+        }
+    }
+
+    if (result == -1) {
+        queue_message("Error: Corrupt response from monitor worker %d\n", worker->pid);
+        kill(worker->pid, SIGKILL);
+        worker_exited(index);
+    }
+}
+
+// Reaps a worker whose end of the channel has closed. Outside stop_monitor
+// a replacement is started and its unanswered requests are sent again;
+// a request gets one retry, so one that keeps killing workers fails instead.
+void worker_exited(int index) {
+    MonitorWorker* worker = &workers[index];
+    int status;
+    int stopped = worker->shutdown_id != 0;
+
+    waitpid(worker->pid, &status, 0);
+
+    if (WIFEXITED(status)) {
+        queue_message("Monitor worker %d terminated with exit status: %d\n", worker->pid, WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        queue_message("Monitor worker %d terminated by signal: %d\n", worker->pid, WTERMSIG(status));
+    }
+
+    close(worker->fd);
+    frame_reader_free(&worker->in);
+    frame_writer_free(&worker->out);
+    worker->fd = -1;
+    worker->pid = -1;
+    worker->outstanding = 0;
+    worker->shutdown_id = 0;
+
+    if (stopped || stopping || !spawn_worker(index)) {
+        // Fail anything that was waiting on this worker.
+        for (int i = 0; i < pending_count; i++) {
+            if (!pending[i].done && pending[i].worker == index) {
+                complete_request(&pending[i], "Error: Monitor worker exited before answering\n");
+            }
+        }
+        // Close the gap so the remaining workers stay contiguous.
+        worker_count--;
+        if (index != worker_count) {
+            workers[index] = workers[worker_count];
+            for (int i = 0; i < pending_count; i++) {
+                if (pending[i].worker == worker_count) {
+                    pending[i].worker = index;
+                }
+                if (pending[i].target == worker_count) {
+                    pending[i].target = index;
+                }
+            }
+        }
+        monitor_running = worker_count > 0;
+        return;
+    }
+
+    queue_message("Restarted monitor worker with PID: %d\n", workers[index].pid);
+    for (int i = 0; i < pending_count; i++) {
+        PendingRequest* request = &pending[i];
+        if (request->done || request->worker != index) {
+            continue;
+        }
+        if (request->retried) {
+            complete_request(request, "Error: Monitor worker died while handling this request\n");
+            continue;
+        }
+        request->retried = 1;
+        free(request->text);
+        request->text = NULL;
+        request->text_len = 0;
+        if (!dispatch(request)) {
+            complete_request(request, "Error: Could not send request to monitor\n");
+        }
     }
 }
 
 void process_command(const char* command) {
-    if (strcmp(command, "start_monitor") == 0) {
-        start_monitor();
+    if (strncmp(command, "start_monitor", 13) == 0) {
+        int count = 0;
+        if (command[13] != '\0' && (sscanf(command, "start_monitor %d", &count) != 1 || count <= 0)) {
+            queue_message("Usage: start_monitor [workers]\n");
+            return;
+        }
+        start_monitor(count);
     } else if (strcmp(command, "list_hunts") == 0) {
         if (!monitor_running) {
-            printf("Error: Monitor is not running. Start monitor first.\n");
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
             return;
         }
-        kill(monitor_pid, SIGUSR1);
-        pause();
+        send_request(HUB_REQ_LIST_HUNTS, NULL, 0);
     } else if (strncmp(command, "list_treasures", 14) == 0) {
         if (!monitor_running) {
-            printf("Error: Monitor is not running. Start monitor first.\n");
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
             return;
         }
 
         char hunt_id[MAX_PATH];
         if (sscanf(command, "list_treasures %255s", hunt_id) != 1) {
-            printf("Usage: list_treasures <hunt_id>\n");
+            queue_message("Usage: list_treasures <hunt_id>\n");
             return;
         }
 
-        FILE* tmp = fopen("temp_command.txt", "w");
-        if (tmp) {
-            fprintf(tmp, "%s", hunt_id);
-            fclose(tmp);
-            kill(monitor_pid, SIGUSR2);
-            pause();
-        } else {
-            perror("Failed to create temporary file");
-        }
+        send_request(HUB_REQ_LIST_TREASURES, hunt_id, (uint32_t)strlen(hunt_id));
     } else if (strncmp(command, "view_treasure", 13) == 0) {
         if (!monitor_running) {
-            printf("Error: Monitor is not running. Start monitor first.\n");
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
             return;
         }
 
         char hunt_id[MAX_PATH];
         int treasure_id;
         if (sscanf(command, "view_treasure %255s %d", hunt_id, &treasure_id) != 2) {
-            printf("Usage: view_treasure <hunt_id> <treasure_id>\n");
+            queue_message("Usage: view_treasure <hunt_id> <treasure_id>\n");
             return;
         }
 
-        FILE* tmp = fopen("temp_command.txt", "w");
-        if (tmp) {
-            fprintf(tmp, "%s %d", hunt_id, treasure_id);
-            fclose(tmp);
-            kill(monitor_pid, SIGINT);
-            pause();
-        } else {
-            perror("Failed to create temporary file");
+        char payload[sizeof(int32_t) + MAX_PATH];
+        int32_t id = treasure_id;
+        size_t len = strlen(hunt_id);
+        memcpy(payload, &id, sizeof(id));
+        memcpy(payload + sizeof(id), hunt_id, len);
+        send_request(HUB_REQ_VIEW_TREASURE, payload, (uint32_t)(sizeof(id) + len));
+    } else if (strncmp(command, "nearby", 6) == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+
+        char hunt_id[MAX_PATH];
+        double args[3];
+        if (sscanf(command, "nearby %255s %lf %lf %lf", hunt_id, &args[0], &args[1], &args[2]) != 4) {
+            queue_message("Usage: nearby <hunt_id> <latitude> <longitude> <radius_m>\n");
+            return;
+        }
+
+        char payload[sizeof(args) + MAX_PATH];
+        size_t len = strlen(hunt_id);
+        memcpy(payload, args, sizeof(args));
+        memcpy(payload + sizeof(args), hunt_id, len);
+        send_request(HUB_REQ_NEARBY, payload, (uint32_t)(sizeof(args) + len));
+    } else if (strncmp(command, "bbox", 4) == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+
+        char hunt_id[MAX_PATH];
+        double args[4];
+        if (sscanf(command, "bbox %255s %lf %lf %lf %lf", hunt_id, &args[0], &args[1], &args[2], &args[3]) != 5) {
+            queue_message("Usage: bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>\n");
+            return;
+        }
+
+        char payload[sizeof(args) + MAX_PATH];
+        size_t len = strlen(hunt_id);
+        memcpy(payload, args, sizeof(args));
+        memcpy(payload + sizeof(args), hunt_id, len);
+        send_request(HUB_REQ_BBOX, payload, (uint32_t)(sizeof(args) + len));
+    } else if (strncmp(command, "search_clues", 12) == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+
+        char hunt_id[MAX_PATH];
+        int query_start = 0;
+        if (sscanf(command, "search_clues %255s %n", hunt_id, &query_start) != 1 || command[query_start] == '\0') {
+            queue_message("Usage: search_clues <hunt_id> <terms> [OR <terms>...]\n");
+            return;
+        }
+
+        char payload[MAX_PATH + MAX_COMMAND];
+        size_t len = strlen(hunt_id) + 1;
+        size_t query_len = strlen(command + query_start);
+        memcpy(payload, hunt_id, len);
+        memcpy(payload + len, command + query_start, query_len);
+        send_request(HUB_REQ_SEARCH_CLUES, payload, (uint32_t)(len + query_len));
+    } else if (strncmp(command, "list_user", 9) == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+
+        char hunt_id[MAX_PATH];
+        char username[MAX_USERNAME];
+        if (sscanf(command, "list_user %255s %49s", hunt_id, username) != 2) {
+            queue_message("Usage: list_user <hunt_id> <username>\n");
+            return;
+        }
+
+        char payload[MAX_PATH + MAX_USERNAME];
+        size_t len = strlen(hunt_id) + 1;
+        size_t user_len = strlen(username);
+        memcpy(payload, hunt_id, len);
+        memcpy(payload + len, username, user_len);
+        send_request(HUB_REQ_LIST_USER, payload, (uint32_t)(len + user_len));
+    } else if (strncmp(command, "filter", 6) == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+
+        char hunt_id[MAX_PATH];
+        int conditions_start = 0;
+        if (sscanf(command, "filter %255s %n", hunt_id, &conditions_start) != 1 || command[conditions_start] == '\0') {
+            queue_message("Usage: filter <hunt_id> <value|id><op><number>...\n");
+            return;
+        }
+
+        char payload[MAX_PATH + MAX_COMMAND];
+        size_t len = strlen(hunt_id) + 1;
+        size_t conditions_len = strlen(command + conditions_start);
+        memcpy(payload, hunt_id, len);
+        memcpy(payload + len, command + conditions_start, conditions_len);
+        send_request(HUB_REQ_FILTER, payload, (uint32_t)(len + conditions_len));
+    } else if (strcmp(command, "stats") == 0) {
+        if (!monitor_running) {
+            queue_message("Error: Monitor is not running. Start monitor first.\n");
+            return;
+        }
+        // Every worker keeps its own counters, so each one is asked; the
+        // answers print together and end with a single "Task done!".
+        int last = -1;
+        for (int i = 0; i < worker_count; i++) {
+            if (workers[i].shutdown_id == 0) {
+                last = i;
+            }
+        }
+        for (int i = 0; i <= last; i++) {
+            if (workers[i].shutdown_id == 0) {
+                send_request_to(i, i < last, HUB_REQ_STATS, NULL, 0);
+            }
         }
     } else if (strcmp(command, "stop_monitor") == 0) {
         stop_monitor();
     } else if (strcmp(command, "exit") == 0) {
         if (monitor_running) {
-            printf("Error: Monitor is still running. Stop monitor first.\n");
+            queue_message("Error: Monitor is still running. Stop monitor first.\n");
         } else {
             exit(0);
         }
     } else {
-        printf("Unknown command: %s\n", command);
-        printf("Available commands: start_monitor, list_hunts, list_treasures <hunt_id>, view_treasure <hunt_id> <treasure_id>, stop_monitor, exit\n");
+        queue_message("Unknown command: %s\n", command);
+        queue_message("Available commands: start_monitor [workers], list_hunts, list_treasures <hunt_id>, view_treasure <hunt_id> <treasure_id>, nearby <hunt_id> <latitude> <longitude> <radius_m>, bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>, search_clues <hunt_id> <terms>, list_user <hunt_id> <username>, filter <hunt_id> <conditions>, stats, stop_monitor, exit\n");
     }
 }
 
-void start_monitor() {
-    if (monitor_running) {
-        printf("Monitor is already running.\n");
-        return;
+// Forks the monitor for slot index and connects it with a socketpair.
+int spawn_worker(int index) {
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+        perror("socketpair");
+        return 0;
     }
 
+    // Flush before forking so buffered output is not printed twice.
+    fflush(stdout);
     pid_t pid = fork();
 
     if (pid < 0) {
         perror("fork");
-        exit(1);
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
         // child makes the work in the monitor_process function
     } else if (pid == 0) {
-        monitor_process();
+        // Drop the hub's ends of the other workers' channels, or they would
+        // not see end-of-file when the hub goes away.
+        for (int i = 0; i < worker_count; i++) {
+            if (i != index && workers[i].fd != -1) {
+                close(workers[i].fd);
+            }
+        }
+        close(fds[0]);
+        monitor_process(fds[1]);
         exit(0);
-    } else {
-        // parent process Waits for user input, sends signals to monitor
-        monitor_pid = pid;
-        monitor_running = 1;
-        printf("Monitor started with PID: %d\n", monitor_pid);
+    }
+
+    // parent keeps its end non-blocking and polls it alongside stdin
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    memset(&workers[index], 0, sizeof(MonitorWorker));
+    workers[index].fd = fds[0];
+    workers[index].pid = pid;
+    return 1;
+}
+
+static int default_worker_count() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+void start_monitor(int count) {
+    if (monitor_running) {
+        queue_message("Monitor is already running.\n");
+        return;
+    }
+
+    if (count <= 0) {
+        count = default_worker_count();
+    }
+    if (count > MAX_MONITOR_WORKERS) {
+        count = MAX_MONITOR_WORKERS;
+    }
 
-        pause();
+    stopping = 0;
+    worker_count = 0;
+    for (int i = 0; i < count; i++) {
+        workers[i].fd = -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (!spawn_worker(i)) {
+            break;
+        }
+        worker_count++;
+        queue_message("Monitor started with PID: %d\n", workers[i].pid);
+    }
+
+    monitor_running = worker_count > 0;
+    if (!monitor_running) {
+        queue_message("Error: Could not start monitor\n");
     }
 }
 
 void stop_monitor() {
     if (!monitor_running) {
-        printf("Monitor is not running.\n");
+        queue_message("Monitor is not running.\n");
         return;
     }
 
-    kill(monitor_pid, SIGTERM);
-
-    printf("Waiting for monitor to terminate...\n");
+    // Each worker answers its queue in order, so the shutdown request queued
+    // behind it lets in-flight work finish before the worker exits.
+    stopping = 1;
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].shutdown_id == 0) {
+            workers[i].shutdown_id = next_request_id++;
+            frame_queue(&workers[i].out, workers[i].shutdown_id, HUB_REQ_SHUTDOWN, 0, NULL, 0);
+            frame_flush(&workers[i].out, workers[i].fd);
+        }
+    }
 
-    int status;
-    waitpid(monitor_pid, &status, 0);
+    queue_message("Waiting for monitor to terminate...\n");
+    fflush(stdout);
 
-    if (WIFEXITED(status)) {
-        printf("Monitor terminated with exit status: %d\n", WEXITSTATUS(status));
-    } else if (WIFSIGNALED(status)) {
-        printf("Monitor terminated by signal: %d\n", WTERMSIG(status));
+    while (monitor_running) {
+        pump_monitor(-1);
     }
-
-    monitor_running = 0;
-    monitor_pid = -1;
+    print_completed();
+    stopping = 0;
 }
-// perform a task based on the signal received
-void monitor_process() {
-    struct sigaction sa;
-
-    sa.sa_handler = monitor_signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    //When signal SIGUSR1 occurs, run monitor_signal_handler with the specified mask and flags.
-    sigaction(SIGUSR1, &sa, NULL);
-    sigaction(SIGUSR2, &sa, NULL);
-    sigaction(SIGINT, &sa, NULL);
-    sigaction(SIGTERM, &sa, NULL);
-
-    //Send SIGUSR1 to the parent process to indicate that the monitor is ready.
-    kill(getppid(), SIGUSR1);
 
-    char hunt_id[MAX_PATH];
-    int treasure_id;
+// Serves requests from the hub in arrival order until asked to shut down or
+// the hub goes away.
+void monitor_process(int fd) {
+    FrameReader in;
+    HubFrameHeader hdr;
+    const char* payload;
+    uint32_t shutdown_id = 0;
+    int result = 0;
+
+    // Ctrl-C in the terminal is meant for the hub; the monitor follows it
+    // out through end-of-file on the channel.
+    signal(SIGINT, SIG_IGN);
+    memset(&in, 0, sizeof(in));
+    hunt_cache_init(&monitor_cache);
 
     while (!exit_requested) {
-        //Wait for a signal to be received
-        pause();
-
-        if (received_signal == SIGUSR1) {
-            list_all_hunts();
-            kill(getppid(), SIGUSR1);
-        } else if (received_signal == SIGUSR2) {
-            
-            FILE* tmp = fopen("temp_command.txt", "r");
-            if (tmp) {
-                if (fscanf(tmp, "%255s", hunt_id) == 1) {
-                    fclose(tmp);
-                    //
-                    list_hunt_treasures(hunt_id);
-                } else {
-                    fclose(tmp);
-                    printf("Error reading hunt ID from temporary file\n");
-                }
-            }
-            //
-            kill(getppid(), SIGUSR1);//The child tells the parent, "I finished processing your request (signal)."
-        } else if (received_signal == SIGINT) {
-            FILE* tmp = fopen("temp_command.txt", "r");
-            if (tmp) {
-                if (fscanf(tmp, "%255s %d", hunt_id, &treasure_id) == 2) {
-                    fclose(tmp);
-                    view_hunt_treasure(hunt_id, treasure_id);
-                } else {
-                    fclose(tmp);
-                    printf("Error reading parameters from temporary file\n");
-                }
+        while (!exit_requested && (result = frame_reader_next(&in, &hdr, &payload)) == 1) {
+            if (hdr.type == HUB_REQ_SHUTDOWN) {
+                shutdown_id = hdr.request_id;
+                exit_requested = 1;
+            } else {
+                handle_request(fd, &hdr, payload);
             }
-            kill(getppid(), SIGUSR1);
-        } else if (received_signal == SIGTERM) {
-            exit_requested = 1;
         }
-
-        received_signal = 0;
+        if (exit_requested || result == -1 || frame_reader_fill(&in, fd) <= 0) {
+            break;
+        }
     }
 
     usleep(DELAY_MS);
 
-    kill(getppid(), SIGUSR2);
+    if (shutdown_id != 0) {
+        frame_send_response(fd, shutdown_id, NULL, 0, 0);
+    }
+    frame_reader_free(&in);
+    hunt_cache_free(&monitor_cache);
+    close(fd);
     exit(0);
 }
-//Record which signal it received
-void monitor_signal_handler(int signum) {
-    received_signal = signum;
-}
 
-void list_all_hunts() {
-    DIR* dir;
-    struct dirent* entry;
-    struct stat st;
-    char path[MAX_PATH * 2];
-
-    dir = opendir(".");// Open the current directory
-    if (dir == NULL) {
-        perror("opendir");
+// Runs one request with its output captured in memory and sends it back
+// tagged with the request ID.
+void handle_request(int fd, const HubFrameHeader* hdr, const char* payload) {
+    char hunt_id[MAX_PATH];
+    char* text = NULL;
+    size_t text_len = 0;
+    uint16_t status = 0;
+    int32_t treasure_id;
+    double args[4];
+    size_t len;
+    StatsTimer timer;
+    uint64_t hits = monitor_cache.hits;
+    uint64_t misses = monitor_cache.misses;
+    uint64_t refreshes = monitor_cache.refreshes;
+    FILE* out = open_memstream(&text, &text_len);
+
+    if (out == NULL) {
+        frame_send_response(fd, hdr->request_id, "Error: Out of memory\n", 21, 1);
         return;
     }
 
-    printf("Available Hunts:\n");
-    printf("---------------\n");
-    int hunt_count = 0;
-
-   while ((entry = readdir(dir)) != NULL) { // Read each entry in the directory
-    // Skip the current and parent directory entries
-    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-        continue;
+    if (hdr->type == HUB_REQ_STATS) {
+        print_monitor_stats(out);
+        fclose(out);
+        frame_send_response(fd, hdr->request_id, text, text_len, 0);
+        free(text);
+        return;
     }
 
-    // Check if the entry is a directory
-    if (stat(entry->d_name, &st) == 0 && S_ISDIR(st.st_mode)) {
-        
-        // Check if the combined path length will fit in MAX_PATH buffer
-        if (strlen(entry->d_name) + 14 < MAX_PATH) {
-            // Construct a path like "<dirname>/treasures.dat"
-            snprintf(path, MAX_PATH * 2, "%s/treasures.dat", entry->d_name);
-
-            // Check if the file "treasures.dat" exists in that directory
-            if (access(path, F_OK) != -1) {
-                // Count treasures in this hunt directory
-                int count = count_treasures(entry->d_name);
-                printf("Hunt: %s - Total treasures: %d\n", entry->d_name, count);
-                hunt_count++;
-            }
-        } else {
-            printf("Hunt name too long: %s\n", entry->d_name);
+    stats_begin(&timer);
+    hunt_cache_sync(&monitor_cache);
+
+    if (hdr->type == HUB_REQ_LIST_HUNTS) {
+        hub_list_hunts(&monitor_cache, out);
+    } else if (hdr->type == HUB_REQ_LIST_TREASURES && hdr->length < MAX_PATH) {
+        memcpy(hunt_id, payload, hdr->length);
+        hunt_id[hdr->length] = '\0';
+        list_hunt_treasures(hunt_id, out);
+    } else if (hdr->type == HUB_REQ_VIEW_TREASURE && hdr->length >= sizeof(treasure_id) &&
+               hdr->length - sizeof(treasure_id) < MAX_PATH) {
+        memcpy(&treasure_id, payload, sizeof(treasure_id));
+        len = hdr->length - sizeof(treasure_id);
+        memcpy(hunt_id, payload + sizeof(treasure_id), len);
+        hunt_id[len] = '\0';
+        view_hunt_treasure(hunt_id, treasure_id, out);
+    } else if (hdr->type == HUB_REQ_NEARBY && hdr->length >= 3 * sizeof(double) &&
+               hdr->length - 3 * sizeof(double) < MAX_PATH) {
+        memcpy(args, payload, 3 * sizeof(double));
+        len = hdr->length - 3 * sizeof(double);
+        memcpy(hunt_id, payload + 3 * sizeof(double), len);
+        hunt_id[len] = '\0';
+        find_hunt_nearby(hunt_id, args, out);
+    } else if (hdr->type == HUB_REQ_BBOX && hdr->length >= 4 * sizeof(double) &&
+               hdr->length - 4 * sizeof(double) < MAX_PATH) {
+        memcpy(args, payload, 4 * sizeof(double));
+        len = hdr->length - 4 * sizeof(double);
+        memcpy(hunt_id, payload + 4 * sizeof(double), len);
+        hunt_id[len] = '\0';
+        find_hunt_bbox(hunt_id, args, out);
+    } else if (hdr->type == HUB_REQ_SEARCH_CLUES && hdr->length < MAX_PATH + MAX_COMMAND &&
+               (len = strnlen(payload, hdr->length)) < hdr->length && len < MAX_PATH) {
+        char query[MAX_COMMAND];
+        size_t query_len = hdr->length - len - 1;
+
+        memcpy(hunt_id, payload, len + 1);
+        if (query_len >= sizeof(query)) {
+            query_len = sizeof(query) - 1;
+        }
+        memcpy(query, payload + len + 1, query_len);
+        query[query_len] = '\0';
+        search_hunt_clues(hunt_id, query, out);
+    } else if (hdr->type == HUB_REQ_LIST_USER && hdr->length < MAX_PATH + MAX_USERNAME &&
+               (len = strnlen(payload, hdr->length)) < hdr->length && len < MAX_PATH &&
+               hdr->length - len - 1 < MAX_USERNAME) {
+        char username[MAX_USERNAME];
+
+        memcpy(hunt_id, payload, len + 1);
+        memcpy(username, payload + len + 1, hdr->length - len - 1);
+        username[hdr->length - len - 1] = '\0';
+        list_hunt_user(hunt_id, username, out);
+    } else if (hdr->type == HUB_REQ_FILTER && hdr->length < MAX_PATH + MAX_COMMAND &&
+               (len = strnlen(payload, hdr->length)) < hdr->length && len < MAX_PATH) {
+        char conditions[MAX_COMMAND];
+        size_t conditions_len = hdr->length - len - 1;
+
+        memcpy(hunt_id, payload, len + 1);
+        if (conditions_len >= sizeof(conditions)) {
+            conditions_len = sizeof(conditions) - 1;
         }
+        memcpy(conditions, payload + len + 1, conditions_len);
+        conditions[conditions_len] = '\0';
+        filter_hunt(hunt_id, conditions, out);
+    } else {
+        fprintf(out, "Error: Malformed request\n");
+        status = 1;
     }
-}
 
+    if (status == 0) {
+        StatsOp* op = &monitor_stats[hdr->type];
 
-    if (hunt_count == 0) {
-        printf("No hunts found.\n");
+        stats_end(op, &timer);
+        op->cache_hits += monitor_cache.hits - hits;
+        op->cache_misses += monitor_cache.misses - misses;
+        op->cache_refreshes += monitor_cache.refreshes - refreshes;
     }
 
-    closedir(dir);
+    fclose(out);
+    frame_send_response(fd, hdr->request_id, text, text_len, status);
+    free(text);
 }
 
-void list_hunt_treasures(const char* hunt_id) {
-    char path[MAX_PATH];
-    int fd;
-    Treasure treasure;
-    struct stat file_stat;
+void print_monitor_stats(FILE* out) {
+    fprintf(out, "Monitor worker %d:\n", (int)getpid());
+    stats_print(out, monitor_stats, HUB_REQ_STATS, 1);
+    fprintf(out, "Cache: %d hunts, %zu of %zu bytes used\n",
+        monitor_cache.hunt_count, monitor_cache.used, monitor_cache.budget);
+}
+
+void list_hunt_treasures(const char* hunt_id, FILE* out) {
+    CachedHunt* hunt;
     char time_str[50];
 
-    if (!does_hunt_exist(hunt_id)) {
-        printf("Hunt does not exist: %s\n", hunt_id);
+    if (strlen(hunt_id) + 14 >= MAX_PATH) {
+        fprintf(out, "Hunt ID too long: %s\n", hunt_id);
         return;
     }
 
-    if (strlen(hunt_id) + 14 >= MAX_PATH) {
-        printf("Hunt ID too long: %s\n", hunt_id);
+    hunt = hunt_cache_find(&monitor_cache, hunt_id);
+    if (hunt == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
         return;
     }
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
-
-    if (stat(path, &file_stat) == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt: %s\n", hunt_id);
-            printf("No treasures found in this hunt\n");
+    if (!hunt_cache_load(&monitor_cache, hunt)) {
+        if (!hunt->is_hunt) {
+            fprintf(out, "Hunt: %s\n", hunt_id);
+            fprintf(out, "No treasures found in this hunt\n");
             return;
         }
-        perror("Failed to get file information");
+        fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
         return;
     }
 
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&file_stat.st_mtime));
-
-    printf("Hunt: %s\n", hunt_id);
-    printf("File size: %ld bytes\n", (long)file_stat.st_size);
-    printf("Last modification time: %s\n", time_str);
-    printf("\nTreasures:\n");
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&hunt->mtime));
 
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        perror("Failed to open treasures file");
-        return;
-    }
+    fprintf(out, "Hunt: %s\n", hunt_id);
+    fprintf(out, "File size: %ld bytes\n", (long)hunt->size);
+    fprintf(out, "Last modification time: %s\n", time_str);
+    fprintf(out, "\nTreasures:\n");
 
     int count = 0;
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        printf("ID: %d, User: %s, Value: %d\n",
-            treasure.treasure_id, treasure.username, treasure.value);
+    for (int64_t slot = 0; slot < hunt->hdr.slot_count; slot++) {
+        if (hunt_cache_is_dead(hunt, slot)) {
+            continue;
+        }
+        const TreasureRecord* treasure = &hunt->records[slot];
+        fprintf(out, "ID: %d, User: %s, Value: %d\n",
+            treasure->treasure_id, treasure->username, treasure->value);
         count++;
     }
 
-    close(fd);
-
     if (count == 0) {
-        printf("No treasures found in this hunt\n");
+        fprintf(out, "No treasures found in this hunt\n");
     }
 }
 
-void view_hunt_treasure(const char* hunt_id, int treasure_id) {
-    char path[MAX_PATH];
-    int fd;
+void view_hunt_treasure(const char* hunt_id, int treasure_id, FILE* out) {
+    CachedHunt* hunt;
+    const TreasureRecord* record;
     Treasure treasure;
     int found = 0;
 
-    if (!does_hunt_exist(hunt_id)) {
-        printf("Hunt does not exist: %s\n", hunt_id);
+    if (strlen(hunt_id) + 14 >= MAX_PATH) {
+        fprintf(out, "Hunt ID too long: %s\n", hunt_id);
         return;
     }
 
-    if (strlen(hunt_id) + 14 >= MAX_PATH) {
-        printf("Hunt ID too long: %s\n", hunt_id);
+    hunt = hunt_cache_find(&monitor_cache, hunt_id);
+    if (hunt == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
         return;
     }
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
+    if (hunt_cache_load(&monitor_cache, hunt) && (record = hunt_cache_lookup(hunt, treasure_id)) != NULL) {
+        memset(&treasure, 0, sizeof(treasure));
+        treasure.treasure_id = record->treasure_id;
+        memcpy(treasure.username, record->username, MAX_USERNAME);
+        treasure.latitude = record->latitude;
+        treasure.longitude = record->longitude;
+        treasure.value = record->value;
+        found = store_read_clue(hunt_id, hunt->hdr.clue_gen, record, treasure.clue);
+        if (!found) {
+            // The heap was swapped by a compaction not yet seen; go to disk.
+            found = store_lookup(hunt_id, treasure_id, &treasure);
+        }
+    } else if (hunt->is_hunt && !hunt->loaded) {
+        found = store_lookup(hunt_id, treasure_id, &treasure);
+    }
 
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        perror("Failed to open treasures file");
+    if (found == -1) {
+        fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
         return;
     }
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.treasure_id == treasure_id) {
-            printf("Treasure ID: %d\n", treasure.treasure_id);
-            printf("Username: %s\n", treasure.username);
-            printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-            printf("Clue: %s\n", treasure.clue);
-            printf("Value: %d\n", treasure.value);
-            found = 1;
-            break;
+    if (found) {
+        fprintf(out, "Treasure ID: %d\n", treasure.treasure_id);
+        fprintf(out, "Username: %s\n", treasure.username);
+        fprintf(out, "Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
+        fprintf(out, "Clue: %s\n", treasure.clue);
+        fprintf(out, "Value: %d\n", treasure.value);
+    } else {
+        fprintf(out, "Treasure not found with ID: %d\n", treasure_id);
+    }
+}
+
+static void print_hunt_matches(const char* hunt_id, const SpatialMatch* matches, int count, int with_distance,
+    FILE* out) {
+    if (count == -1) {
+        fprintf(out, "Failed to search treasures: %s\n", strerror(errno));
+        return;
+    }
+
+    fprintf(out, "Hunt: %s\n", hunt_id);
+    for (int i = 0; i < count; i++) {
+        const TreasureRecord* treasure = &matches[i].record;
+
+        fprintf(out, "ID: %d, User: %s, Value: %d, Location: %.6f, %.6f",
+            treasure->treasure_id, treasure->username, treasure->value,
+            treasure->latitude, treasure->longitude);
+        if (with_distance) {
+            fprintf(out, ", Distance: %.0f m", matches[i].distance_m);
         }
+        fprintf(out, "\n");
+    }
+    if (count == 0) {
+        fprintf(out, "No treasures found in this area\n");
     }
+}
 
-    close(fd);
+// Spatial queries read the store's grid sidecar, not the record cache.
+void find_hunt_nearby(const char* hunt_id, const double* args, FILE* out) {
+    SpatialMatch* matches = NULL;
+    int count;
 
-    if (!found) {
-        printf("Treasure not found with ID: %d\n", treasure_id);
+    if (hunt_cache_find(&monitor_cache, hunt_id) == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
+        return;
     }
+
+    count = spatial_nearby(hunt_id, args[0], args[1], args[2], &matches);
+    print_hunt_matches(hunt_id, matches, count, 1, out);
+    free(matches);
 }
 
-int does_hunt_exist(const char* hunt_id) {
-    struct stat st;
-    if (stat(hunt_id, &st) == 0 && S_ISDIR(st.st_mode)) {
-        return 1;
+void find_hunt_bbox(const char* hunt_id, const double* args, FILE* out) {
+    SpatialMatch* matches = NULL;
+    int count;
+
+    if (hunt_cache_find(&monitor_cache, hunt_id) == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
+        return;
     }
-    return 0;
+
+    count = spatial_bbox(hunt_id, args[0], args[1], args[2], args[3], &matches);
+    print_hunt_matches(hunt_id, matches, count, 0, out);
+    free(matches);
 }
 
-int count_treasures(const char* hunt_id) {
-    char path[MAX_PATH];
-    int fd;
-    Treasure treasure;
-    int count = 0;
+void search_hunt_clues(const char* hunt_id, const char* query, FILE* out) {
+    SearchMatch* matches = NULL;
+    int count;
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
+    if (hunt_cache_find(&monitor_cache, hunt_id) == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
+        return;
+    }
 
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        return 0;
+    count = search_clues(hunt_id, query, &matches);
+    if (count == -1) {
+        fprintf(out, "Failed to search treasures: %s\n", strerror(errno));
+        return;
     }
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        count++;
+    fprintf(out, "Hunt: %s\n", hunt_id);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "ID: %d, User: %s, Value: %d, Clue: %s\n",
+            matches[i].record.treasure_id, matches[i].record.username,
+            matches[i].record.value, matches[i].clue);
     }
+    if (count == 0) {
+        fprintf(out, "No treasures found matching the search\n");
+    }
+    free(matches);
+}
 
-    close(fd);
-    return count;
+// Columns of a hunt from the monitor's cache, or NULL if it cannot be loaded
+// and the caller should fall back to the on-disk indexes. *rows gets room
+// for one row index per column row.
+static const HuntColumns* cached_columns(CachedHunt* hunt, uint32_t** rows) {
+    const HuntColumns* cols;
+
+    if (!hunt_cache_load(&monitor_cache, hunt) || (cols = hunt_cache_columns(&monitor_cache, hunt)) == NULL) {
+        return NULL;
+    }
+    *rows = malloc((size_t)(cols->count > 0 ? cols->count : 1) * sizeof(uint32_t));
+    return *rows != NULL ? cols : NULL;
 }
 
+void list_hunt_user(const char* hunt_id, const char* username, FILE* out) {
+    TreasureRecord* records = NULL;
+    const HuntColumns* cols;
+    CachedHunt* hunt;
+    uint32_t* rows = NULL;
+    int64_t total = 0;
+    int count;
+
+    hunt = hunt_cache_find(&monitor_cache, hunt_id);
+    if (hunt == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
+        return;
+    }
+
+    if ((cols = cached_columns(hunt, &rows)) != NULL) {
+        const ColumnKernels* kernels = column_kernels();
+        int64_t user = columns_find_user(cols, username);
+
+        count = user == -1 ? 0 : (int)kernels->select_equal(cols->user_ids, cols->count, (uint32_t)user, rows);
+        fprintf(out, "Hunt: %s\n", hunt_id);
+        fprintf(out, "Treasures of %s:\n", username);
+        for (int i = 0; i < count; i++) {
+            const TreasureRecord* record = &hunt->records[cols->slots[rows[i]]];
+            fprintf(out, "ID: %d, User: %s, Value: %d\n",
+                record->treasure_id, record->username, record->value);
+            total += record->value;
+        }
+    } else {
+        count = users_lookup(hunt_id, username, &records);
+        if (count == -1) {
+            fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
+            free(rows);
+            return;
+        }
+
+        fprintf(out, "Hunt: %s\n", hunt_id);
+        fprintf(out, "Treasures of %s:\n", username);
+        for (int i = 0; i < count; i++) {
+            fprintf(out, "ID: %d, User: %s, Value: %d\n",
+                records[i].treasure_id, records[i].username, records[i].value);
+            total += records[i].value;
+        }
+    }
+    if (count == 0) {
+        fprintf(out, "No treasures found for this user\n");
+    } else {
+        fprintf(out, "Total: %d treasures, score %lld\n", count, (long long)total);
+    }
+    free(records);
+    free(rows);
+}
+
+void filter_hunt(const char* hunt_id, char* conditions, FILE* out) {
+    TreasureRecord* records = NULL;
+    const HuntColumns* cols;
+    CachedHunt* hunt;
+    uint32_t* rows = NULL;
+    ZoneFilter filter;
+    ZoneStats stats;
+    ColumnRange range;
+    char* saveptr;
+    int count;
+
+    zone_filter_init(&filter);
+    for (char* condition = strtok_r(conditions, " \t", &saveptr); condition != NULL;
+         condition = strtok_r(NULL, " \t", &saveptr)) {
+        if (!zone_filter_parse(&filter, condition)) {
+            fprintf(out, "Invalid condition: %s\n", condition);
+            return;
+        }
+    }
+
+    hunt = hunt_cache_find(&monitor_cache, hunt_id);
+    if (hunt == NULL) {
+        fprintf(out, "Hunt does not exist: %s\n", hunt_id);
+        return;
+    }
+
+    // A loaded hunt is filtered in memory with the column kernels; the zone
+    // maps on disk serve hunts the cache cannot hold.
+    if ((cols = cached_columns(hunt, &rows)) != NULL) {
+        const ColumnKernels* kernels = column_kernels();
+
+        count = 0;
+        if (column_range_from_filter(&filter, &range)) {
+            count = (int)kernels->select_range(cols->ids, cols->values, cols->count, &range, rows);
+        }
+        fprintf(out, "Hunt: %s\n", hunt_id);
+        for (int i = 0; i < count; i++) {
+            const TreasureRecord* record = &hunt->records[cols->slots[rows[i]]];
+            fprintf(out, "ID: %d, User: %s, Value: %d\n",
+                record->treasure_id, record->username, record->value);
+        }
+        if (count == 0) {
+            fprintf(out, "No treasures found matching the filter\n");
+        }
+        fprintf(out, "Rows: %lld scanned in memory (%s)\n", (long long)cols->count, kernels->name);
+        free(rows);
+        return;
+    }
+
+    count = zone_filter_scan(hunt_id, &filter, &records, &stats);
+    if (count == -1) {
+        fprintf(out, "Failed to open treasures file: %s\n", strerror(errno));
+        return;
+    }
+
+    fprintf(out, "Hunt: %s\n", hunt_id);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "ID: %d, User: %s, Value: %d\n",
+            records[i].treasure_id, records[i].username, records[i].value);
+    }
+    if (count == 0) {
+        fprintf(out, "No treasures found matching the filter\n");
+    }
+    fprintf(out, "Blocks: %lld scanned, %lld skipped\n",
+        (long long)stats.blocks_scanned, (long long)stats.blocks_skipped);
+    free(records);
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "treasure_store.h"
+#include "treasure_log.h"
+
+typedef struct {
+    char hunt_id[MAX_PATH];
+    int fd;
+    char* buffer;
+    size_t size;
+    size_t used;
+    struct timespec oldest;     // when the first buffered entry was logged
+    long interval_ms;
+} OpLog;
+
+static OpLog op_log = { .fd = -1 };
+static int flush_policy = -1;
+static int exit_registered = 0;
+
+// strftime(localtime()) costs a tz lookup per call; entries logged within
+// the same second share one formatted timestamp.
+static time_t cached_second = (time_t)-1;
+static char cached_time[32];
+
+LogFlushPolicy log_flush_policy(void) {
+    if (flush_policy == -1) {
+        const char* env = getenv("TREASURE_LOG_FLUSH");
+        if (env && strcmp(env, "always") == 0) {
+            flush_policy = LOG_FLUSH_ALWAYS;
+        } else if (env && strcmp(env, "sync") == 0) {
+            flush_policy = LOG_FLUSH_SYNC;
+        } else {
+            flush_policy = LOG_FLUSH_BATCH;
+        }
+    }
+    return (LogFlushPolicy)flush_policy;
+}
+
+void log_set_flush_policy(LogFlushPolicy policy) {
+    log_flush();
+    flush_policy = policy;
+}
+
+static long env_long(const char* name, long fallback) {
+    const char* env = getenv(name);
+    long value = env ? atol(env) : fallback;
+
+    return value > 0 ? value : fallback;
+}
+
+static long elapsed_ms(const struct timespec* since) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static const char* format_time(void) {
+    time_t now = time(NULL);
+
+    if (now != cached_second) {
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        cached_second = now;
+    }
+    return cached_time;
+}
+
+// Creates logged_hunt-<hunt_id> unless it already points at the log.
+static void ensure_symlink(const char* hunt_id) {
+    char target_path[MAX_PATH];
+    char link_path[MAX_PATH];
+    char current[MAX_PATH];
+    ssize_t len;
+
+    snprintf(target_path, MAX_PATH, "%s/%s", hunt_id, LOG_FILENAME);
+    snprintf(link_path, MAX_PATH, "%s%s", LOG_LINK_PREFIX, hunt_id);
+
+    len = readlink(link_path, current, sizeof(current) - 1);
+    if (len >= 0) {
+        current[len] = '\0';
+        if (strcmp(current, target_path) == 0) {
+            return;
+        }
+        unlink(link_path);
+    } else if (errno != ENOENT) {
+        // A regular file or something else is in the way; replace it like
+        // the symlink has always been replaced.
+        unlink(link_path);
+    }
+
+    if (symlink(target_path, link_path) != 0) {
+        perror("Failed to create symbolic link");
+    }
+}
+
+static int log_open(const char* hunt_id) {
+    char log_path[MAX_PATH];
+
+    snprintf(log_path, MAX_PATH, "%s/%s", hunt_id, LOG_FILENAME);
+
+    op_log.fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (op_log.fd == -1) {
+        perror("Failed to open log file");
+        return 0;
+    }
+    snprintf(op_log.hunt_id, sizeof(op_log.hunt_id), "%s", hunt_id);
+
+    if (op_log.buffer == NULL) {
+        op_log.size = (size_t)env_long("TREASURE_LOG_BUFFER_KB", LOG_BUFFER_KB) * 1024;
+        op_log.interval_ms = env_long("TREASURE_LOG_INTERVAL_MS", LOG_INTERVAL_MS);
+        op_log.buffer = malloc(op_log.size);
+        if (op_log.buffer == NULL) {
+            op_log.size = 0;
+        }
+    }
+    op_log.used = 0;
+
+    if (!exit_registered) {
+        atexit(log_close);
+        exit_registered = 1;
+    }
+
+    ensure_symlink(hunt_id);
+    return 1;
+}
+
+int log_flush(void) {
+    int ok = 1;
+
+    if (op_log.fd == -1 || op_log.used == 0) {
+        return 1;
+    }
+
+    if (!write_all(op_log.fd, op_log.buffer, op_log.used)) {
+        perror("Failed to write log file");
+        ok = 0;
+    }
+    op_log.used = 0;
+    return ok;
+}
+
+void log_close(void) {
+    if (op_log.fd == -1) {
+        return;
+    }
+    log_flush();
+    close(op_log.fd);
+    op_log.fd = -1;
+    op_log.hunt_id[0] = '\0';
+}
+
+int log_write(const char* hunt_id, const char* operation) {
+    char entry[1200];
+    int len;
+    LogFlushPolicy policy = log_flush_policy();
+
+    if (op_log.fd == -1 || strcmp(op_log.hunt_id, hunt_id) != 0) {
+        log_close();
+        if (!log_open(hunt_id)) {
+            return 0;
+        }
+    }
+
+    len = snprintf(entry, sizeof(entry), "[%s] %s\n", format_time(), operation);
+    if (len < 0) {
+        return 0;
+    }
+    if ((size_t)len >= sizeof(entry)) {
+        len = sizeof(entry) - 1;
+        entry[len - 1] = '\n';
+    }
+
+    if (policy != LOG_FLUSH_BATCH || (size_t)len > op_log.size) {
+        if (!log_flush() || !write_all(op_log.fd, entry, len)) {
+            perror("Failed to write log file");
+            return 0;
+        }
+        if (policy == LOG_FLUSH_SYNC) {
+            fdatasync(op_log.fd);
+        }
+        return 1;
+    }
+
+    if (op_log.used + len > op_log.size && !log_flush()) {
+        return 0;
+    }
+    if (op_log.used == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &op_log.oldest);
+    }
+    memcpy(op_log.buffer + op_log.used, entry, len);
+    op_log.used += len;
+
+    if (elapsed_ms(&op_log.oldest) >= op_log.interval_ms) {
+        return log_flush();
+    }
+    return 1;
+}
@@ -0,0 +1,43 @@
+#ifndef TREASURE_LOG_H
+#define TREASURE_LOG_H
+
+// Operation log written by treasure_manager to "<hunt_id>/logged_hunt", with
+// a "logged_hunt-<hunt_id>" symlink next to the hunt directory.
+//
+// The log file stays open for as long as the process works on the same hunt
+// and entries are collected in a buffer that is written out according to
+// the flush policy:
+//   batch   write when the buffer is full, when the oldest buffered entry
+//           is older than the flush interval, or at exit (default)
+//   always  write every entry as it is logged
+//   sync    like always, plus fdatasync after every write
+// The policy comes from TREASURE_LOG_FLUSH, the buffer size from
+// TREASURE_LOG_BUFFER_KB and the interval from TREASURE_LOG_INTERVAL_MS.
+
+#define LOG_FILENAME "logged_hunt"
+#define LOG_LINK_PREFIX "logged_hunt-"
+
+#define LOG_BUFFER_KB 64
+#define LOG_INTERVAL_MS 1000
+
+typedef enum {
+    LOG_FLUSH_BATCH,
+    LOG_FLUSH_ALWAYS,
+    LOG_FLUSH_SYNC
+} LogFlushPolicy;
+
+LogFlushPolicy log_flush_policy(void);
+void log_set_flush_policy(LogFlushPolicy policy);
+
+// Appends "[YYYY-mm-dd HH:MM:SS] operation\n" to the hunt's log. Switching to
+// another hunt flushes and closes the previous one. Returns 1 on success.
+int log_write(const char* hunt_id, const char* operation);
+
+// Writes out buffered entries. Returns 1 on success.
+int log_flush(void);
+
+// Flushes and closes the open log. Must be called before the hunt directory
+// is removed. Runs automatically at exit.
+void log_close(void);
+
+#endif
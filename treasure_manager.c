@@ -7,41 +7,181 @@
 #include <sys/types.h>
 #include <time.h>
 #include <errno.h>
-
-#define MAX_PATH 256
-#define MAX_USERNAME 50
-#define MAX_CLUE_TEXT 500
-#define LOG_FILENAME "logged_hunt"
-
-typedef struct {
-    int treasure_id;
-    char username[MAX_USERNAME];
-    double latitude;
-    double longitude;
-    char clue[MAX_CLUE_TEXT];
-    int value;
-} Treasure;
+#include <limits.h>
+#include <math.h>
+
+#include "treasure_store.h"
+#include "treasure_log.h"
+#include "treasure_spatial.h"
+#include "treasure_search.h"
+#include "treasure_users.h"
+#include "treasure_zones.h"
+#include "treasure_stats.h"
+#include "treasure_ops.h"
+
+#define IMPORT_BATCH 4096
+#define MAX_COMMAND_QUERY 1024
+
+enum {
+    OP_ADD,
+    OP_LIST,
+    OP_VIEW,
+    OP_REMOVE,
+    OP_REMOVE_HUNT,
+    OP_IMPORT,
+    OP_COMPACT,
+    OP_NEARBY,
+    OP_BBOX,
+    OP_LIST_USER,
+    OP_FILTER,
+    OP_SEARCH,
+    OP_COUNT
+};
+
+// Per-command counters, printed on exit when TREASURE_STATS is set. Time
+// spent waiting for the user to type is not counted.
+StatsOp manager_stats[OP_COUNT] = {
+    [OP_ADD] = { .name = "add_treasure" },
+    [OP_LIST] = { .name = "list_treasures" },
+    [OP_VIEW] = { .name = "view_treasure" },
+    [OP_REMOVE] = { .name = "remove_treasure" },
+    [OP_REMOVE_HUNT] = { .name = "remove_hunt" },
+    [OP_IMPORT] = { .name = "import" },
+    [OP_COMPACT] = { .name = "compact" },
+    [OP_NEARBY] = { .name = "nearby" },
+    [OP_BBOX] = { .name = "bbox" },
+    [OP_LIST_USER] = { .name = "list_user" },
+    [OP_FILTER] = { .name = "filter" },
+    [OP_SEARCH] = { .name = "search_clues" },
+};
 
 void add_treasure(const char* hunt_id);
-void list_treasures(const char* hunt_id);
-void view_treasure(const char* hunt_id, int treasure_id);
-void remove_treasure(const char* hunt_id, int treasure_id);
 void remove_hunt(const char* hunt_id);
 void log_operation(const char* hunt_id, const char* operation);
-void create_symlink(const char* hunt_id);
-int get_next_treasure_id(const char* hunt_id);
-int does_hunt_exist(const char* hunt_id);
 int create_hunt_directory(const char* hunt_id);
-
-int main() {
+void import_treasures(const char* hunt_id, const char* file_path);
+void compact_hunt(const char* hunt_id);
+void find_nearby(const char* hunt_id, double latitude, double longitude, double radius_m);
+void find_in_bbox(const char* hunt_id, double min_lat, double min_lon, double max_lat, double max_lon);
+void search_treasures(const char* hunt_id, const char* query);
+void list_user_treasures(const char* hunt_id, const char* username);
+void filter_treasures(const char* hunt_id, const ZoneFilter* filter, const char* description);
+int parse_csv_line(char* line, Treasure* treasure);
+int parse_jsonl_line(const char* line, Treasure* treasure);
+int parse_double(const char* text, double* out);
+int parse_int(const char* text, int* out);
+int parse_coordinates(const char* const* args, int count, double* out);
+
+int main(int argc, char* argv[]) {
     char hunt_id[MAX_PATH];
     int choice;
     int treasure_id;
+    int interactive;
+    StatsTimer timer;
+
+    stats_dump_at_exit(manager_stats, OP_COUNT);
+
+    if (argc > 1) {
+        if (argc == 4 && strcmp(argv[1], "--import") == 0) {
+            stats_begin(&timer);
+            import_treasures(argv[2], argv[3]);
+            stats_end(&manager_stats[OP_IMPORT], &timer);
+            return 0;
+        }
+        if (argc == 3 && strcmp(argv[1], "--compact") == 0) {
+            stats_begin(&timer);
+            compact_hunt(argv[2]);
+            stats_end(&manager_stats[OP_COMPACT], &timer);
+            return 0;
+        }
+        if (argc == 6 && strcmp(argv[1], "--nearby") == 0) {
+            double point[2];
+            double radius_m;
+
+            if (!parse_coordinates((const char* const*)argv + 3, 2, point)) {
+                return 1;
+            }
+            if (!parse_double(argv[5], &radius_m) || radius_m < 0) {
+                fprintf(stderr, "Invalid radius: %s\n", argv[5]);
+                return 1;
+            }
+            stats_begin(&timer);
+            find_nearby(argv[2], point[0], point[1], radius_m);
+            stats_end(&manager_stats[OP_NEARBY], &timer);
+            return 0;
+        }
+        if (argc == 7 && strcmp(argv[1], "--bbox") == 0) {
+            double box[4];
+
+            if (!parse_coordinates((const char* const*)argv + 3, 4, box)) {
+                return 1;
+            }
+            stats_begin(&timer);
+            find_in_bbox(argv[2], box[0], box[1], box[2], box[3]);
+            stats_end(&manager_stats[OP_BBOX], &timer);
+            return 0;
+        }
+        if (argc == 4 && strcmp(argv[1], "--list-user") == 0) {
+            stats_begin(&timer);
+            list_user_treasures(argv[2], argv[3]);
+            stats_end(&manager_stats[OP_LIST_USER], &timer);
+            return 0;
+        }
+        if (argc >= 4 && strcmp(argv[1], "--filter") == 0) {
+            ZoneFilter filter;
+            char description[MAX_COMMAND_QUERY];
+            size_t len = 0;
+
+            zone_filter_init(&filter);
+            description[0] = '\0';
+            for (int i = 3; i < argc; i++) {
+                if (!zone_filter_parse(&filter, argv[i])) {
+                    fprintf(stderr, "Invalid condition: %s\n", argv[i]);
+                    return 1;
+                }
+                if (len < sizeof(description)) {
+                    len += snprintf(description + len, sizeof(description) - len, "%s%s", i > 3 ? " " : "", argv[i]);
+                }
+            }
+            stats_begin(&timer);
+            filter_treasures(argv[2], &filter, description);
+            stats_end(&manager_stats[OP_FILTER], &timer);
+            return 0;
+        }
+        if (argc >= 4 && strcmp(argv[1], "--search-clues") == 0) {
+            char query[MAX_COMMAND_QUERY];
+            size_t len = 0;
+
+            query[0] = '\0';
+            for (int i = 3; i < argc && len < sizeof(query); i++) {
+                len += snprintf(query + len, sizeof(query) - len, "%s%s", i > 3 ? " " : "", argv[i]);
+            }
+            stats_begin(&timer);
+            search_treasures(argv[2], query);
+            stats_end(&manager_stats[OP_SEARCH], &timer);
+            return 0;
+        }
+        fprintf(stderr, "Usage: %s [--import <hunt_id> <file.csv|file.jsonl|->]\n", argv[0]);
+        fprintf(stderr, "       %s [--compact <hunt_id>]\n", argv[0]);
+        fprintf(stderr, "       %s [--nearby <hunt_id> <latitude> <longitude> <radius_m>]\n", argv[0]);
+        fprintf(stderr, "       %s [--bbox <hunt_id> <min_lat> <min_lon> <max_lat> <max_lon>]\n", argv[0]);
+        fprintf(stderr, "       %s [--list-user <hunt_id> <username>]\n", argv[0]);
+        fprintf(stderr, "       %s [--filter <hunt_id> <value|id><op><number>...]\n", argv[0]);
+        fprintf(stderr, "       %s [--search-clues <hunt_id> <terms> [OR <terms>...]]\n", argv[0]);
+        return 1;
+    }
 
     printf("Enter hunt ID: ");
     scanf("%255s", hunt_id);
 
+    interactive = isatty(STDIN_FILENO);
+
     while (1) {
+        // Nothing else would flush the log while we wait for the user.
+        if (interactive) {
+            log_flush();
+        }
+
         printf("\n--- Treasure Hunt Menu ---\n");
         printf("1. Add treasure\n");
         printf("2. List treasures\n");
@@ -57,20 +197,28 @@ int main() {
                 add_treasure(hunt_id);
                 break;
             case 2:
-                list_treasures(hunt_id);
+                stats_begin(&timer);
+                ops_list_treasures(hunt_id, stdout);
+                stats_end(&manager_stats[OP_LIST], &timer);
                 break;
             case 3:
                 printf("Enter treasure ID to view: ");
                 scanf("%d", &treasure_id);
-                view_treasure(hunt_id, treasure_id);
+                stats_begin(&timer);
+                ops_view_treasure(hunt_id, treasure_id, stdout);
+                stats_end(&manager_stats[OP_VIEW], &timer);
                 break;
             case 4:
                 printf("Enter treasure ID to remove: ");
                 scanf("%d", &treasure_id);
-                remove_treasure(hunt_id, treasure_id);
+                stats_begin(&timer);
+                ops_remove_treasure(hunt_id, treasure_id, stdout);
+                stats_end(&manager_stats[OP_REMOVE], &timer);
                 break;
             case 5:
+                stats_begin(&timer);
                 remove_hunt(hunt_id);
+                stats_end(&manager_stats[OP_REMOVE_HUNT], &timer);
                 // After removing hunt, maybe ask for new hunt ID or exit
                 printf("Enter new hunt ID or 'exit' to quit: ");
                 scanf("%255s", hunt_id);
@@ -90,18 +238,6 @@ int main() {
 }
 
 
-int does_hunt_exist(const char* hunt_id) {
-    char path[MAX_PATH];
-    struct stat st;
-
-    snprintf(path, MAX_PATH, "%s", hunt_id);
-
-    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
-        return 1;
-    }
-    return 0;
-}
-
 int create_hunt_directory(const char* hunt_id) {
     char path[MAX_PATH];
 
@@ -114,34 +250,9 @@ int create_hunt_directory(const char* hunt_id) {
     return 1;
 }
 
-int get_next_treasure_id(const char* hunt_id) {
-    char path[MAX_PATH];
-    int fd;
-    Treasure treasure;
-    int max_id = 0;
-
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
-
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        return 1;
-    }
-
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.treasure_id > max_id) {
-            max_id = treasure.treasure_id;
-        }
-    }
-
-    close(fd);
-    return max_id + 1;
-}
-
 void add_treasure(const char* hunt_id) {
-    char path[MAX_PATH];
-    int fd;
     Treasure new_treasure;
-    char log_msg[1024];
+    StatsTimer timer;
 
     if (!does_hunt_exist(hunt_id)) {
         if (!create_hunt_directory(hunt_id)) {
@@ -149,8 +260,6 @@ void add_treasure(const char* hunt_id) {
         }
     }
 
-    new_treasure.treasure_id = get_next_treasure_id(hunt_id);
-
     printf("Enter username: ");
     scanf("%49s", new_treasure.username);
 
@@ -170,34 +279,58 @@ void add_treasure(const char* hunt_id) {
     printf("Enter treasure value: ");
     scanf("%d", &new_treasure.value);
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
+    stats_begin(&timer);
+    if (ops_add_treasure(hunt_id, &new_treasure, stdout) == 1) {
+        stats_end(&manager_stats[OP_ADD], &timer);
+    }
+}
+
+void log_operation(const char* hunt_id, const char* operation) {
+    log_write(hunt_id, operation);
+}
 
-    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (fd == -1) {
-        perror("Failed to open treasures file");
+// Drops tombstoned records regardless of the dead fraction.
+void compact_hunt(const char* hunt_id) {
+    int dropped;
+    char log_msg[1024];
+
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
         return;
     }
 
-    if (write(fd, &new_treasure, sizeof(Treasure)) != sizeof(Treasure)) {
-        perror("Failed to write treasure data");
-        close(fd);
+    dropped = store_compact(hunt_id);
+    if (dropped == -1) {
+        fprintf(stderr, "Failed to compact hunt %s\n", hunt_id);
         return;
     }
 
-    close(fd);
-
-    snprintf(log_msg, sizeof(log_msg), "Added treasure ID %d by user %s",
-        new_treasure.treasure_id, new_treasure.username);
+    snprintf(log_msg, sizeof(log_msg), "Compacted hunt (%d removed records dropped)", dropped);
     log_operation(hunt_id, log_msg);
 
-    printf("Treasure added successfully with ID %d\n", new_treasure.treasure_id);
+    printf("Hunt compacted, %d removed records dropped\n", dropped);
 }
 
-void view_treasure(const char* hunt_id, int treasure_id) {
-    char path[MAX_PATH];
-    int fd;
-    Treasure treasure;
-    int found = 0;
+static void print_matches(const SpatialMatch* matches, int count, int with_distance) {
+    for (int i = 0; i < count; i++) {
+        const TreasureRecord* treasure = &matches[i].record;
+
+        printf("ID: %d, User: %s, Value: %d, Location: %.6f, %.6f",
+            treasure->treasure_id, treasure->username, treasure->value,
+            treasure->latitude, treasure->longitude);
+        if (with_distance) {
+            printf(", Distance: %.0f m", matches[i].distance_m);
+        }
+        printf("\n");
+    }
+    if (count == 0) {
+        printf("No treasures found in this area\n");
+    }
+}
+
+void find_nearby(const char* hunt_id, double latitude, double longitude, double radius_m) {
+    SpatialMatch* matches;
+    int count;
     char log_msg[1024];
 
     if (!does_hunt_exist(hunt_id)) {
@@ -205,83 +338,50 @@ void view_treasure(const char* hunt_id, int treasure_id) {
         return;
     }
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
-
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
-        perror("Failed to open treasures file");
+    count = spatial_nearby(hunt_id, latitude, longitude, radius_m, &matches);
+    if (count == -1) {
+        perror("Failed to search treasures");
         return;
     }
 
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.treasure_id == treasure_id) {
-            printf("Treasure ID: %d\n", treasure.treasure_id);
-            printf("Username: %s\n", treasure.username);
-            printf("Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
-            printf("Clue: %s\n", treasure.clue);
-            printf("Value: %d\n", treasure.value);
-            found = 1;
-            break;
-        }
-    }
-
-    close(fd);
+    printf("Treasures within %.0f m of %.6f, %.6f:\n", radius_m, latitude, longitude);
+    print_matches(matches, count, 1);
+    free(matches);
 
-    if (!found) {
-        fprintf(stderr, "Treasure not found with ID: %d\n", treasure_id);
-    }
-
-    snprintf(log_msg, sizeof(log_msg), "Viewed treasure ID %d (%s)",
-        treasure_id, found ? "found" : "not found");
+    snprintf(log_msg, sizeof(log_msg), "Searched within %.0f m of %.6f, %.6f (%d found)",
+        radius_m, latitude, longitude, count);
     log_operation(hunt_id, log_msg);
 }
 
-void log_operation(const char* hunt_id, const char* operation) {
-    char log_path[MAX_PATH];
-    int log_fd;
-    time_t current_time;
-    char time_str[50];
-    char log_entry[1024];
-
-    snprintf(log_path, MAX_PATH, "%s/%s", hunt_id, LOG_FILENAME);
+void find_in_bbox(const char* hunt_id, double min_lat, double min_lon, double max_lat, double max_lon) {
+    SpatialMatch* matches;
+    int count;
+    char log_msg[1024];
 
-    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (log_fd == -1) {
-        perror("Failed to open log file");
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
         return;
     }
 
-    current_time = time(NULL);
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&current_time));
-
-    snprintf(log_entry, sizeof(log_entry), "[%s] %s\n", time_str, operation);
-    write(log_fd, log_entry, strlen(log_entry));
-
-    close(log_fd);
-
-    create_symlink(hunt_id);
-}
-
-void create_symlink(const char* hunt_id) {
-    char target_path[MAX_PATH];
-    char link_path[MAX_PATH];
-
-    snprintf(target_path, MAX_PATH, "%s/%s", hunt_id, LOG_FILENAME);
-    snprintf(link_path, MAX_PATH, "logged_hunt-%s", hunt_id);
+    count = spatial_bbox(hunt_id, min_lat, min_lon, max_lat, max_lon, &matches);
+    if (count == -1) {
+        perror("Failed to search treasures");
+        return;
+    }
 
-    unlink(link_path);//Deletes any existing symbolic link or file with the same name (logged_hunt-game1) to avoid failure when creating the new one.
+    printf("Treasures in %.6f, %.6f - %.6f, %.6f:\n", min_lat, min_lon, max_lat, max_lon);
+    print_matches(matches, count, 0);
+    free(matches);
 
-    if (symlink(target_path, link_path) != 0) {
-        perror("Failed to create symbolic link");
-    }
+    snprintf(log_msg, sizeof(log_msg), "Searched box %.6f, %.6f - %.6f, %.6f (%d found)",
+        min_lat, min_lon, max_lat, max_lon, count);
+    log_operation(hunt_id, log_msg);
 }
 
-void list_treasures(const char* hunt_id) {
-    char path[MAX_PATH];
-    int fd;
-    Treasure treasure;
-    struct stat file_stat;
-    char time_str[50];
+void list_user_treasures(const char* hunt_id, const char* username) {
+    TreasureRecord* records;
+    int64_t total = 0;
+    int count;
     char log_msg[1024];
 
     if (!does_hunt_exist(hunt_id)) {
@@ -289,57 +389,34 @@ void list_treasures(const char* hunt_id) {
         return;
     }
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
-
-    if (stat(path, &file_stat) == -1) {
-        if (errno == ENOENT) {
-            printf("Hunt: %s\n", hunt_id);
-            printf("No treasures found in this hunt\n");
-
-            snprintf(log_msg, sizeof(log_msg), "Listed treasures (none found)");
-            log_operation(hunt_id, log_msg);
-            return;
-        }
-        perror("Failed to get file information");
-        return;
-    }
-
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&file_stat.st_mtime));
-
-    printf("Hunt: %s\n", hunt_id);
-    printf("File size: %ld bytes\n", (long)file_stat.st_size);
-    printf("Last modification time: %s\n", time_str);
-    printf("\nTreasures:\n");
-
-    fd = open(path, O_RDONLY);
-    if (fd == -1) {
+    count = users_lookup(hunt_id, username, &records);
+    if (count == -1) {
         perror("Failed to open treasures file");
         return;
     }
 
-    int count = 0;
-    while (read(fd, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
+    printf("Hunt: %s\n", hunt_id);
+    printf("Treasures of %s:\n", username);
+    for (int i = 0; i < count; i++) {
         printf("ID: %d, User: %s, Value: %d\n",
-            treasure.treasure_id, treasure.username, treasure.value);
-        count++;
+            records[i].treasure_id, records[i].username, records[i].value);
+        total += records[i].value;
     }
-
-    close(fd);
-
     if (count == 0) {
-        printf("No treasures found in this hunt\n");
+        printf("No treasures found for this user\n");
+    } else {
+        printf("Total: %d treasures, score %lld\n", count, (long long)total);
     }
+    free(records);
 
-    snprintf(log_msg, sizeof(log_msg), "Listed treasures (%d found)", count);
+    snprintf(log_msg, sizeof(log_msg), "Listed treasures of %.60s (%d found)", username, count);
     log_operation(hunt_id, log_msg);
 }
 
-void remove_treasure(const char* hunt_id, int treasure_id) {
-    char path[MAX_PATH];
-    char temp_path[MAX_PATH];
-    int fd_in, fd_out;
-    Treasure treasure;
-    int found = 0;
+void filter_treasures(const char* hunt_id, const ZoneFilter* filter, const char* description) {
+    TreasureRecord* records;
+    ZoneStats stats;
+    int count;
     char log_msg[1024];
 
     if (!does_hunt_exist(hunt_id)) {
@@ -347,54 +424,58 @@ void remove_treasure(const char* hunt_id, int treasure_id) {
         return;
     }
 
-    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
-    snprintf(temp_path, MAX_PATH, "%s/treasures.tmp", hunt_id);
-
-    fd_in = open(path, O_RDONLY);
-    if (fd_in == -1) {
+    count = zone_filter_scan(hunt_id, filter, &records, &stats);
+    if (count == -1) {
         perror("Failed to open treasures file");
         return;
     }
 
-    fd_out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_out == -1) {
-        perror("Failed to create temporary file");
-        close(fd_in);
-        return;
+    printf("Hunt: %s\n", hunt_id);
+    printf("Treasures with %s:\n", description);
+    for (int i = 0; i < count; i++) {
+        printf("ID: %d, User: %s, Value: %d\n",
+            records[i].treasure_id, records[i].username, records[i].value);
     }
-
-    while (read(fd_in, &treasure, sizeof(Treasure)) == sizeof(Treasure)) {
-        if (treasure.treasure_id == treasure_id) {
-            found = 1;
-            continue;
-        }
-        if (write(fd_out, &treasure, sizeof(Treasure)) != sizeof(Treasure)) {
-            perror("Failed to write to temporary file");
-            close(fd_in);
-            close(fd_out);
-            unlink(temp_path);
-            return;
-        }
+    if (count == 0) {
+        printf("No treasures found matching the filter\n");
     }
+    printf("Blocks: %lld scanned, %lld skipped\n",
+        (long long)stats.blocks_scanned, (long long)stats.blocks_skipped);
+    free(records);
 
-    close(fd_in);
-    close(fd_out);
+    snprintf(log_msg, sizeof(log_msg), "Filtered treasures by %.900s (%d found)", description, count);
+    log_operation(hunt_id, log_msg);
+}
 
-    if (!found) {
-        fprintf(stderr, "Treasure not found with ID: %d\n", treasure_id);
-        unlink(temp_path);
+void search_treasures(const char* hunt_id, const char* query) {
+    SearchMatch* matches;
+    int count;
+    char log_msg[1024];
+
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
         return;
     }
 
-    if (rename(temp_path, path) != 0) {
-        perror("Failed to replace treasures file");
+    count = search_clues(hunt_id, query, &matches);
+    if (count == -1) {
+        perror("Failed to search treasures");
         return;
     }
 
-    snprintf(log_msg, sizeof(log_msg), "Removed treasure ID %d", treasure_id);
-    log_operation(hunt_id, log_msg);
+    printf("Treasures with clues matching \"%s\":\n", query);
+    for (int i = 0; i < count; i++) {
+        printf("ID: %d, User: %s, Value: %d, Clue: %s\n",
+            matches[i].record.treasure_id, matches[i].record.username,
+            matches[i].record.value, matches[i].clue);
+    }
+    if (count == 0) {
+        printf("No treasures found matching the search\n");
+    }
+    free(matches);
 
-    printf("Treasure removed successfully\n");
+    snprintf(log_msg, sizeof(log_msg), "Searched clues for \"%.900s\" (%d found)", query, count);
+    log_operation(hunt_id, log_msg);
 }
 
 void remove_hunt(const char* hunt_id) {
@@ -409,12 +490,386 @@ void remove_hunt(const char* hunt_id) {
 
     snprintf(log_msg, sizeof(log_msg), "Removed hunt %s", hunt_id);
     log_operation(hunt_id, log_msg);
+    log_close();
 
-    snprintf(link_path, MAX_PATH, "logged_hunt-%s", hunt_id);
+    snprintf(link_path, MAX_PATH, "%s%s", LOG_LINK_PREFIX, hunt_id);
     unlink(link_path);
 
     snprintf(command, sizeof(command), "rm -rf %s", hunt_id);
     system(command);
 
     printf("Hunt removed successfully\n");
-}
\ No newline at end of file
+}
+
+// CSV columns: username,latitude,longitude,value,clue. The clue is last so it
+// may contain unquoted commas; any field may also be double-quoted.
+static char* csv_field(char** cursor, int rest_of_line) {
+    char* start = *cursor;
+    char* out;
+    char* p;
+
+    while (*start == ' ' || *start == '\t') {
+        start++;
+    }
+
+    if (*start == '"') {
+        out = p = ++start;
+        while (*p) {
+            if (*p == '"' && p[1] == '"') {
+                *out++ = '"';
+                p += 2;
+            } else if (*p == '"') {
+                p++;
+                break;
+            } else {
+                *out++ = *p++;
+            }
+        }
+        while (*p && *p != ',') {
+            p++;
+        }
+        *cursor = *p ? p + 1 : p;
+        *out = '\0';
+        return start;
+    }
+
+    p = rest_of_line ? start + strlen(start) : start + strcspn(start, ",");
+    *cursor = *p ? p + 1 : p;
+    *p = '\0';
+    return start;
+}
+
+// Parses all of text, give or take surrounding blanks, as a finite number.
+int parse_double(const char* text, double* out) {
+    char* end;
+    double number;
+
+    errno = 0;
+    number = strtod(text, &end);
+    if (end == text || errno == ERANGE || !isfinite(number)) {
+        return 0;
+    }
+    if (end[strspn(end, " \t")] != '\0') {
+        return 0;
+    }
+    *out = number;
+    return 1;
+}
+
+// Parses all of text, give or take surrounding blanks, as a base-10 int.
+int parse_int(const char* text, int* out) {
+    char* end;
+    long number;
+
+    errno = 0;
+    number = strtol(text, &end, 10);
+    if (end == text || errno == ERANGE || number < INT_MIN || number > INT_MAX) {
+        return 0;
+    }
+    if (end[strspn(end, " \t")] != '\0') {
+        return 0;
+    }
+    *out = (int)number;
+    return 1;
+}
+
+static int valid_location(double latitude, double longitude) {
+    return latitude >= -90 && latitude <= 90 && longitude >= -180 && longitude <= 180;
+}
+
+// Parses count command line arguments as latitude, longitude pairs,
+// reporting the first bad one.
+int parse_coordinates(const char* const* args, int count, double* out) {
+    for (int i = 0; i < count; i++) {
+        if (!parse_double(args[i], &out[i])) {
+            fprintf(stderr, "Invalid %s: %s\n", i % 2 == 0 ? "latitude" : "longitude", args[i]);
+            return 0;
+        }
+        if (i % 2 == 1 && !valid_location(out[i - 1], out[i])) {
+            fprintf(stderr, "Location out of range: %s, %s\n", args[i - 1], args[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int parse_csv_line(char* line, Treasure* treasure) {
+    char* cursor = line;
+    char* username = csv_field(&cursor, 0);
+    char* latitude = csv_field(&cursor, 0);
+    char* longitude = csv_field(&cursor, 0);
+    char* value = csv_field(&cursor, 0);
+    char* clue = csv_field(&cursor, 1);
+
+    if (*username == '\0') {
+        return 0;
+    }
+
+    snprintf(treasure->username, MAX_USERNAME, "%s", username);
+    snprintf(treasure->clue, MAX_CLUE_TEXT, "%s", clue);
+
+    return parse_double(latitude, &treasure->latitude) &&
+        parse_double(longitude, &treasure->longitude) &&
+        parse_int(value, &treasure->value) &&
+        valid_location(treasure->latitude, treasure->longitude);
+}
+
+// Reads a JSON string starting at the opening quote into out (truncating to
+// size). Returns a pointer past the closing quote, or NULL if malformed.
+static const char* json_string(const char* p, char* out, size_t size) {
+    size_t len = 0;
+
+    if (*p++ != '"') {
+        return NULL;
+    }
+    while (*p && *p != '"') {
+        char c = *p++;
+        if (c == '\\') {
+            c = *p++;
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u':
+                    // Non-ASCII escapes are not representable in the fixed record.
+                    for (int i = 0; i < 4; i++) {
+                        if (*p == '\0') {
+                            return NULL;
+                        }
+                        p++;
+                    }
+                    c = '?';
+                    break;
+                case '\0':
+                    return NULL;
+                default:
+                    break;
+            }
+        }
+        if (len + 1 < size) {
+            out[len++] = c;
+        }
+    }
+    if (*p != '"') {
+        return NULL;
+    }
+    if (size > 0) {
+        out[len] = '\0';
+    }
+    return p + 1;
+}
+
+// Accepts one flat JSON object per line with the keys username, latitude,
+// longitude, clue and value. Unknown keys are ignored.
+int parse_jsonl_line(const char* line, Treasure* treasure) {
+    const char* p = line;
+    char key[32];
+    char* end;
+    int seen = 0;
+
+    p += strspn(p, " \t");
+    if (*p++ != '{') {
+        return 0;
+    }
+
+    while (1) {
+        p += strspn(p, " \t");
+        if (*p == '}') {
+            break;
+        }
+        p = json_string(p, key, sizeof(key));
+        if (p == NULL) {
+            return 0;
+        }
+        p += strspn(p, " \t");
+        if (*p++ != ':') {
+            return 0;
+        }
+        p += strspn(p, " \t");
+
+        if (strcmp(key, "username") == 0) {
+            p = json_string(p, treasure->username, MAX_USERNAME);
+            seen |= 1;
+        } else if (strcmp(key, "clue") == 0) {
+            p = json_string(p, treasure->clue, MAX_CLUE_TEXT);
+        } else if (*p == '"') {
+            char skip[1];
+            p = json_string(p, skip, sizeof(skip));
+        } else {
+            int is_field = strcmp(key, "latitude") == 0 || strcmp(key, "longitude") == 0 ||
+                strcmp(key, "value") == 0;
+            double number;
+
+            errno = 0;
+            number = strtod(p, &end);
+            if (end == p) {
+                // true, false, null and the like, fine for keys we ignore
+                if (is_field) {
+                    return 0;
+                }
+                end = (char*)p + strcspn(p, ",}");
+            } else if (is_field && (errno == ERANGE || !isfinite(number))) {
+                return 0;
+            }
+            if (strcmp(key, "latitude") == 0) {
+                treasure->latitude = number;
+                seen |= 2;
+            } else if (strcmp(key, "longitude") == 0) {
+                treasure->longitude = number;
+                seen |= 4;
+            } else if (strcmp(key, "value") == 0) {
+                if (number != floor(number) || number < INT_MIN || number > INT_MAX) {
+                    return 0;
+                }
+                treasure->value = (int)number;
+                seen |= 8;
+            }
+            p = end;
+        }
+        if (p == NULL) {
+            return 0;
+        }
+
+        p += strspn(p, " \t");
+        if (*p == ',') {
+            p++;
+        } else if (*p != '}') {
+            return 0;
+        }
+    }
+
+    return seen == 15 && treasure->username[0] != '\0' &&
+        valid_location(treasure->latitude, treasure->longitude);
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Streams a CSV or JSONL file into the hunt, appending IMPORT_BATCH records
+// per write and logging a single summary entry.
+void import_treasures(const char* hunt_id, const char* file_path) {
+    FILE* in;
+    Treasure* batch;
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    long line_no = 0;
+    long imported = 0;
+    long skipped = 0;
+    int pending = 0;
+    int first_id = 0;
+    int last_id = 0;
+    int jsonl;
+    const char* ext;
+    struct timespec start;
+    double seconds;
+    char log_msg[1024];
+
+    if (!does_hunt_exist(hunt_id)) {
+        if (!create_hunt_directory(hunt_id)) {
+            return;
+        }
+    }
+
+    in = strcmp(file_path, "-") == 0 ? stdin : fopen(file_path, "r");
+    if (in == NULL) {
+        perror("Failed to open import file");
+        return;
+    }
+
+    batch = malloc(IMPORT_BATCH * sizeof(Treasure));
+    if (batch == NULL) {
+        perror("malloc");
+        if (in != stdin) {
+            fclose(in);
+        }
+        return;
+    }
+
+    // Format by extension; without one, each line is sniffed.
+    ext = strrchr(file_path, '.');
+    jsonl = ext && (strcmp(ext, ".jsonl") == 0 || strcmp(ext, ".json") == 0);
+    if (ext && strcmp(ext, ".csv") == 0) {
+        jsonl = 0;
+    } else if (!jsonl) {
+        jsonl = -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while ((line_len = getline(&line, &line_cap, in)) != -1) {
+        Treasure* treasure = &batch[pending];
+        int ok;
+
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+
+        memset(treasure, 0, sizeof(Treasure));
+        if (jsonl == 1 || (jsonl == -1 && line[strspn(line, " \t")] == '{')) {
+            ok = parse_jsonl_line(line, treasure);
+        } else {
+            // Skip a CSV header row.
+            if (line_no == 1 && strncmp(line, "username", 8) == 0) {
+                continue;
+            }
+            ok = parse_csv_line(line, treasure);
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%ld: skipping malformed record\n", file_path, line_no);
+            skipped++;
+            continue;
+        }
+
+        if (++pending == IMPORT_BATCH) {
+            if (!store_append_batch(hunt_id, batch, pending)) {
+                break;
+            }
+            if (first_id == 0) {
+                first_id = batch[0].treasure_id;
+            }
+            last_id = batch[pending - 1].treasure_id;
+            imported += pending;
+            pending = 0;
+        }
+    }
+
+    if (pending > 0 && store_append_batch(hunt_id, batch, pending)) {
+        if (first_id == 0) {
+            first_id = batch[0].treasure_id;
+        }
+        last_id = batch[pending - 1].treasure_id;
+        imported += pending;
+    }
+
+    seconds = elapsed_seconds(&start);
+
+    free(line);
+    free(batch);
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    if (imported > 0) {
+        snprintf(log_msg, sizeof(log_msg), "Imported %ld treasures (IDs %d-%d) from %s, %ld skipped",
+            imported, first_id, last_id, file_path, skipped);
+    } else {
+        snprintf(log_msg, sizeof(log_msg), "Imported 0 treasures from %s, %ld skipped",
+            file_path, skipped);
+    }
+    log_operation(hunt_id, log_msg);
+
+    printf("Imported %ld treasures into %s (%ld skipped)\n", imported, hunt_id, skipped);
+    if (seconds > 0) {
+        printf("Elapsed: %.3f s, %.0f records/s, %.1f MB/s\n", seconds, imported / seconds,
+            imported * sizeof(Treasure) / seconds / (1024.0 * 1024.0));
+    }
+}
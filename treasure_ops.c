@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <errno.h>
+
+#include "treasure_ops.h"
+#include "treasure_log.h"
+
+int does_hunt_exist(const char* hunt_id) {
+    char path[MAX_PATH];
+    struct stat st;
+
+    snprintf(path, MAX_PATH, "%s", hunt_id);
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        return 1;
+    }
+    return 0;
+}
+
+int ops_add_treasure(const char* hunt_id, Treasure* treasure, FILE* out) {
+    char log_msg[1024];
+
+    // The ID is assigned under the hunt lock, so concurrent managers never
+    // hand out the same one.
+    if (!store_append(hunt_id, treasure)) {
+        return -1;
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Added treasure ID %d by user %s",
+        treasure->treasure_id, treasure->username);
+    log_write(hunt_id, log_msg);
+
+    fprintf(out, "Treasure added successfully with ID %d\n", treasure->treasure_id);
+    return 1;
+}
+
+int ops_view_treasure(const char* hunt_id, int treasure_id, FILE* out) {
+    Treasure treasure;
+    int found;
+    char log_msg[1024];
+
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
+        return 0;
+    }
+
+    found = store_lookup(hunt_id, treasure_id, &treasure);
+    if (found == -1) {
+        perror("Failed to open treasures file");
+        return -1;
+    }
+
+    if (found) {
+        fprintf(out, "Treasure ID: %d\n", treasure.treasure_id);
+        fprintf(out, "Username: %s\n", treasure.username);
+        fprintf(out, "Location: %.6f, %.6f\n", treasure.latitude, treasure.longitude);
+        fprintf(out, "Clue: %s\n", treasure.clue);
+        fprintf(out, "Value: %d\n", treasure.value);
+    } else {
+        fprintf(stderr, "Treasure not found with ID: %d\n", treasure_id);
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Viewed treasure ID %d (%s)",
+        treasure_id, found ? "found" : "not found");
+    log_write(hunt_id, log_msg);
+    return found;
+}
+
+// One segment's lines of the listing, formatted by a scan thread.
+typedef struct {
+    char* text;
+    size_t len;
+    int count;
+} ListPart;
+
+static int format_part(const StorePart* part, void* arg) {
+    ListPart* out = (ListPart*)arg + part->index % store_scan_threads();
+    const TreasureRecord* treasure;
+    StoreIter it;
+    FILE* stream = open_memstream(&out->text, &out->len);
+
+    out->count = 0;
+    if (stream == NULL) {
+        out->text = NULL;
+        return 0;
+    }
+    store_iter_part(&it, part);
+    while ((treasure = store_iter_next(&it)) != NULL) {
+        fprintf(stream, "ID: %d, User: %s, Value: %d\n",
+            treasure->treasure_id, treasure->username, treasure->value);
+        out->count++;
+    }
+    store_iter_close(&it);
+    return fclose(stream) == 0 ? 1 : 0;
+}
+
+int ops_list_treasures(const char* hunt_id, FILE* out) {
+    char path[MAX_PATH];
+    StoreSnapshot snap;
+    ListPart* parts;
+    struct stat file_stat;
+    char time_str[50];
+    char log_msg[1024];
+    int threads = store_scan_threads();
+    int count = 0;
+    int ok = 1;
+
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
+        return 0;
+    }
+
+    snprintf(path, MAX_PATH, "%s/treasures.dat", hunt_id);
+
+    if (stat(path, &file_stat) == -1) {
+        if (errno == ENOENT) {
+            fprintf(out, "Hunt: %s\n", hunt_id);
+            fprintf(out, "No treasures found in this hunt\n");
+
+            snprintf(log_msg, sizeof(log_msg), "Listed treasures (none found)");
+            log_write(hunt_id, log_msg);
+            return 1;
+        }
+        perror("Failed to get file information");
+        return -1;
+    }
+
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        perror("Failed to open treasures file");
+        return -1;
+    }
+    parts = calloc((size_t)threads, sizeof(ListPart));
+    if (parts == NULL) {
+        perror("calloc");
+        store_snapshot_close(&snap);
+        return -1;
+    }
+
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", localtime(&file_stat.st_mtime));
+
+    fprintf(out, "Hunt: %s\n", hunt_id);
+    fprintf(out, "File size: %ld bytes\n", (long)store_data_size(&snap.hdr));
+    fprintf(out, "Last modification time: %s\n", time_str);
+    fprintf(out, "\nTreasures:\n");
+
+    // Segments are formatted in parallel, one round of threads at a time so
+    // only that many segments' text is held, and printed in order.
+    for (int first = 0; ok && first < snap.segment_count; first += threads) {
+        int round = snap.segment_count - first < threads ? snap.segment_count - first : threads;
+
+        ok = store_scan_parts(&snap, first, round, threads, format_part, parts) == 1;
+        for (int i = 0; i < round; i++) {
+            if (ok) {
+                fwrite(parts[i].text, 1, parts[i].len, out);
+                count += parts[i].count;
+            }
+            free(parts[i].text);
+            parts[i].text = NULL;
+        }
+    }
+    free(parts);
+    store_snapshot_close(&snap);
+    if (!ok) {
+        perror("Failed to list treasures");
+        return -1;
+    }
+
+    if (count == 0) {
+        fprintf(out, "No treasures found in this hunt\n");
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Listed treasures (%d found)", count);
+    log_write(hunt_id, log_msg);
+    return 1;
+}
+
+int ops_remove_treasure(const char* hunt_id, int treasure_id, FILE* out) {
+    int removed;
+    char log_msg[1024];
+
+    if (!does_hunt_exist(hunt_id)) {
+        fprintf(stderr, "Hunt does not exist: %s\n", hunt_id);
+        return 0;
+    }
+
+    removed = store_remove(hunt_id, treasure_id);
+    if (removed == -1) {
+        perror("Failed to open treasures file");
+        return -1;
+    }
+    if (removed == 0) {
+        fprintf(stderr, "Treasure not found with ID: %d\n", treasure_id);
+        return 0;
+    }
+
+    snprintf(log_msg, sizeof(log_msg), "Removed treasure ID %d", treasure_id);
+    log_write(hunt_id, log_msg);
+
+    fprintf(out, "Treasure removed successfully\n");
+    return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef TREASURE_OPS_H
+#define TREASURE_OPS_H
+
+#include <stdio.h>
+
+#include "treasure_store.h"
+
+// The treasure commands of treasure_manager, minus the prompts.
+// treasure_bench runs the same functions with out set to /dev/null, so what
+// it times is what the manager runs.
+//
+// Results go to out, failures to stderr, and each command is logged to the
+// hunt's log like before. They return 1 on success, 0 if the hunt or the
+// treasure does not exist and -1 on error.
+
+int does_hunt_exist(const char* hunt_id);
+
+// Appends treasure, which gets its ID assigned, to an existing hunt.
+int ops_add_treasure(const char* hunt_id, Treasure* treasure, FILE* out);
+int ops_view_treasure(const char* hunt_id, int treasure_id, FILE* out);
+// Prints every live treasure, formatting segments in parallel.
+int ops_list_treasures(const char* hunt_id, FILE* out);
+int ops_remove_treasure(const char* hunt_id, int treasure_id, FILE* out);
+
+#endif
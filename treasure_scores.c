@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "treasure_scores.h"
+
+#define SCORES_MIN_SLOTS 64
+
+uint32_t scores_hash(const char* username, size_t* len) {
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+
+    while (i < MAX_USERNAME && username[i] != '\0') {
+        hash ^= (unsigned char)username[i++];
+        hash *= 16777619u;
+    }
+    *len = i;
+    return hash ? hash : 1;
+}
+
+static int read_scores_header(int fd, ScoresHeader* hdr) {
+    return pread(fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+        hdr->magic == SCORES_MAGIC &&
+        hdr->version == SCORES_VERSION &&
+        hdr->header_size == sizeof(ScoresHeader) &&
+        hdr->slot_count >= SCORES_MIN_SLOTS &&
+        (hdr->slot_count & (hdr->slot_count - 1)) == 0;
+}
+
+static off_t slot_offset(uint32_t pos) {
+    return (off_t)sizeof(ScoresHeader) + (off_t)pos * sizeof(ScoreSlot);
+}
+
+// Places entry in an in-memory table of mask + 1 slots.
+static void table_insert(ScoreSlot* table, uint32_t mask, const ScoreSlot* entry) {
+    uint32_t pos = entry->hash & mask;
+
+    while (table[pos].hash != 0) {
+        pos = (pos + 1) & mask;
+    }
+    table[pos] = *entry;
+}
+
+static uint32_t slots_for(int64_t users) {
+    uint32_t slots = SCORES_MIN_SLOTS;
+
+    // Keep the load factor at or below 1/2 after a rebuild.
+    while ((int64_t)slots < users * 2) {
+        slots *= 2;
+    }
+    return slots;
+}
+
+int scores_save(const char* hunt_id, uint32_t generation, const ScoreSlot* entries, int count) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char tmp_name[64];
+    ScoresHeader hdr;
+    ScoreSlot* table;
+    ssize_t len;
+    int fd;
+
+    // A full scan saves without the hunt lock while a writer may be growing
+    // the table under it, so each process writes its own file and the last
+    // rename wins. A sidecar left at an older generation is just stale.
+    snprintf(tmp_name, sizeof(tmp_name), SCORES_FILENAME ".%ld.tmp", (long)getpid());
+    if (!store_path(path, MAX_PATH, hunt_id, SCORES_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, tmp_name)) {
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SCORES_MAGIC;
+    hdr.version = SCORES_VERSION;
+    hdr.header_size = sizeof(ScoresHeader);
+    hdr.generation = generation;
+    hdr.slot_count = slots_for(count);
+    hdr.user_count = count;
+
+    table = calloc(hdr.slot_count, sizeof(ScoreSlot));
+    if (table == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        table_insert(table, hdr.slot_count - 1, &entries[i]);
+    }
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to create scores file");
+        free(table);
+        return 0;
+    }
+
+    len = (ssize_t)(hdr.slot_count * sizeof(ScoreSlot));
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || write(fd, table, (size_t)len) != len) {
+        perror("Failed to write scores file");
+        free(table);
+        close(fd);
+        unlink(tmp_path);
+        return 0;
+    }
+    free(table);
+    close(fd);
+
+    if (rename(tmp_path, path) != 0) {
+        perror("Failed to replace scores file");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Reads every used slot of an open sidecar into a malloc'd array.
+static int read_slots(int fd, const ScoresHeader* hdr, ScoreSlot** slots_out, int* count_out) {
+    ScoreSlot* table;
+    ScoreSlot* used;
+    ssize_t len = (ssize_t)(hdr->slot_count * sizeof(ScoreSlot));
+    int count = 0;
+
+    table = malloc((size_t)len);
+    if (table == NULL) {
+        return -1;
+    }
+    if (pread(fd, table, (size_t)len, slot_offset(0)) != len) {
+        free(table);
+        return 0;
+    }
+
+    // Compact the used slots to the front of the same buffer.
+    used = table;
+    for (uint32_t i = 0; i < hdr->slot_count; i++) {
+        if (table[i].hash != 0 && table[i].treasures > 0) {
+            used[count++] = table[i];
+        }
+    }
+
+    *slots_out = used;
+    *count_out = count;
+    return 1;
+}
+
+// Rewrites the sidecar at twice the size when an insert would push it past
+// 3/4 load.
+static int grow_scores(const char* hunt_id, int fd, const ScoresHeader* hdr) {
+    ScoreSlot* slots;
+    int count;
+    int result;
+
+    if (read_slots(fd, hdr, &slots, &count) != 1) {
+        return 0;
+    }
+    result = scores_save(hunt_id, hdr->generation, slots, count);
+    free(slots);
+    return result;
+}
+
+// Finds username's slot, or the empty slot where it would go. Returns 1 if
+// the user exists, 0 if not, -1 on a read error.
+static int probe(int fd, const ScoresHeader* hdr, const char* username, uint32_t hash,
+    uint32_t* pos_out, ScoreSlot* slot) {
+    uint32_t mask = hdr->slot_count - 1;
+    uint32_t pos = hash & mask;
+
+    for (uint32_t n = 0; n < hdr->slot_count; n++) {
+        if (pread(fd, slot, sizeof(*slot), slot_offset(pos)) != sizeof(*slot)) {
+            return -1;
+        }
+        if (slot->hash == 0) {
+            *pos_out = pos;
+            return 0;
+        }
+        if (slot->hash == hash && strncmp(slot->username, username, MAX_USERNAME) == 0) {
+            *pos_out = pos;
+            return 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return -1;
+}
+
+static int apply_one(const char* hunt_id, int* fd, ScoresHeader* hdr, const TreasureRecord* record, int sign) {
+    char path[MAX_PATH];
+    ScoreSlot slot;
+    uint32_t pos;
+    size_t len;
+    uint32_t hash = scores_hash(record->username, &len);
+    int found = probe(*fd, hdr, record->username, hash, &pos, &slot);
+
+    if (found == -1 || (found == 0 && sign < 0)) {
+        return 0;
+    }
+
+    if (found == 0) {
+        if ((hdr->user_count + 1) * 4 > (int64_t)hdr->slot_count * 3) {
+            if (!grow_scores(hunt_id, *fd, hdr) || !store_path(path, MAX_PATH, hunt_id, SCORES_FILENAME)) {
+                return 0;
+            }
+            close(*fd);
+            *fd = open(path, O_RDWR);
+            if (*fd == -1 || !read_scores_header(*fd, hdr) ||
+                probe(*fd, hdr, record->username, hash, &pos, &slot) != 0) {
+                return 0;
+            }
+        }
+        memset(&slot, 0, sizeof(slot));
+        slot.hash = hash;
+        memcpy(slot.username, record->username, len);
+        hdr->user_count++;
+    }
+
+    slot.total_score += sign * (int64_t)record->value;
+    slot.treasures += sign;
+    return pwrite(*fd, &slot, sizeof(slot), slot_offset(pos)) == sizeof(slot);
+}
+
+int scores_apply(const char* hunt_id, uint32_t old_gen, uint32_t new_gen,
+    const TreasureRecord* records, int count, int sign) {
+    char path[MAX_PATH];
+    ScoresHeader hdr;
+    int fd;
+
+    if (!store_path(path, MAX_PATH, hunt_id, SCORES_FILENAME)) {
+        return 0;
+    }
+
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        // A hunt that was empty before this append starts with an empty table.
+        if (errno != ENOENT || old_gen != 0 || sign < 0 || !scores_save(hunt_id, 0, NULL, 0)) {
+            return 0;
+        }
+        fd = open(path, O_RDWR);
+        if (fd == -1) {
+            return 0;
+        }
+    }
+
+    if (!read_scores_header(fd, &hdr) || hdr.generation != old_gen) {
+        close(fd);
+        return 0;
+    }
+
+    // The generation is written last: a crash part way through leaves the
+    // table one step behind the store, which readers treat as stale.
+    for (int i = 0; i < count; i++) {
+        if (!apply_one(hunt_id, &fd, &hdr, &records[i], sign)) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return 0;
+        }
+    }
+
+    hdr.generation = new_gen;
+    if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+int scores_load(const char* hunt_id, ScoreSlot** slots, int* count) {
+    char path[MAX_PATH];
+    StoreHeader store_hdr;
+    ScoresHeader hdr;
+    int store_fd, fd;
+    int result;
+
+    if (!store_path(path, MAX_PATH, hunt_id, SCORES_FILENAME)) {
+        return -1;
+    }
+
+    store_fd = store_open(hunt_id, O_RDONLY, &store_hdr);
+    if (store_fd == -1) {
+        return -1;
+    }
+    close(store_fd);
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    if (!read_scores_header(fd, &hdr) || hdr.generation != store_hdr.generation) {
+        close(fd);
+        return 0;
+    }
+
+    result = read_slots(fd, &hdr, slots, count);
+    close(fd);
+
+    // Writers bump the store header before touching the sidecar, so if the
+    // store is still at the same generation the slots were read untouched.
+    if (result == 1) {
+        store_fd = store_open(hunt_id, O_RDONLY, &store_hdr);
+        if (store_fd == -1 || store_hdr.generation != hdr.generation) {
+            free(*slots);
+            *slots = NULL;
+            result = store_fd == -1 ? -1 : 0;
+        }
+        if (store_fd != -1) {
+            close(store_fd);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,62 @@
+#ifndef TREASURE_SCORES_H
+#define TREASURE_SCORES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure_store.h"
+
+// Per-hunt "scores" sidecar: username -> (total score, treasure count),
+// kept up to date by every append and remove so score_calculator can answer
+// in time proportional to the number of users instead of rescanning
+// treasures.dat. It is an open-addressing table on disk, so an update
+// touches a handful of slots.
+//
+// The sidecar records the treasures.dat header generation it reflects. An
+// update is only applied when the sidecar is exactly one step behind the
+// store; anything else leaves it stale until the next full rebuild.
+
+#define SCORES_FILENAME "scores"
+#define SCORES_MAGIC 0x53524353u /* "SCRS" */
+#define SCORES_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t generation;    // treasures.dat generation this table reflects
+    uint32_t slot_count;    // power of two
+    int64_t user_count;     // used slots
+    int64_t reserved;
+} ScoresHeader;
+
+// One slot per user. Users whose last treasure was removed keep their slot
+// with treasures == 0 so probe chains stay intact.
+typedef struct {
+    uint32_t hash;          // 0 marks an empty slot
+    uint32_t reserved;
+    int64_t total_score;
+    int64_t treasures;
+    char username[MAX_USERNAME];
+} ScoreSlot;
+
+// FNV-1a over the username up to its NUL or MAX_USERNAME; never returns 0.
+// Stores the length in *len.
+uint32_t scores_hash(const char* username, size_t* len);
+
+// Applies count records to the sidecar, adding (sign 1) or subtracting
+// (sign -1) their values, and moves it from old_gen to new_gen. Returns 1 if
+// the sidecar was updated, 0 if it was missing or stale and left alone.
+int scores_apply(const char* hunt_id, uint32_t old_gen, uint32_t new_gen,
+    const TreasureRecord* records, int count, int sign);
+
+// Loads the sidecar if it matches the hunt's current generation. On success
+// returns 1 with a malloc'd array of used slots in *slots; 0 if it is missing
+// or stale, -1 on error.
+int scores_load(const char* hunt_id, ScoreSlot** slots, int* count);
+
+// Replaces the sidecar with count entries (hash, username, totals set)
+// describing generation. Returns 1 on success.
+int scores_save(const char* hunt_id, uint32_t generation, const ScoreSlot* entries, int count);
+
+#endif
@@ -0,0 +1,467 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "treasure_scoring.h"
+#include "treasure_scores.h"
+#include "treasure_users.h"
+#include "treasure_columns.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define TABLE_INITIAL_CAPACITY 64
+
+// Usernames are copied into large blocks instead of one malloc each.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    char data[ARENA_BLOCK_SIZE];
+} ArenaBlock;
+
+static const char* arena_copy(ScoreTable* table, const char* text, size_t len) {
+    ArenaBlock* block = table->arena;
+    char* copy;
+
+    if (block == NULL || block->used + len + 1 > ARENA_BLOCK_SIZE) {
+        block = malloc(sizeof(ArenaBlock));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = table->arena;
+        block->used = 0;
+        table->arena = block;
+    }
+
+    copy = block->data + block->used;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    return copy;
+}
+
+int score_table_init(ScoreTable* table) {
+    memset(table, 0, sizeof(*table));
+    table->slots = calloc(TABLE_INITIAL_CAPACITY, sizeof(int));
+    table->users = malloc(TABLE_INITIAL_CAPACITY * sizeof(UserScore));
+    if (table->slots == NULL || table->users == NULL) {
+        free(table->slots);
+        free(table->users);
+        return 0;
+    }
+    table->slot_mask = TABLE_INITIAL_CAPACITY - 1;
+    table->user_capacity = TABLE_INITIAL_CAPACITY;
+    return 1;
+}
+
+void score_table_free(ScoreTable* table) {
+    ArenaBlock* block = table->arena;
+
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    free(table->slots);
+    free(table->users);
+    memset(table, 0, sizeof(*table));
+}
+
+// Doubles the slot array, reusing the stored hashes instead of rehashing.
+static int score_table_grow(ScoreTable* table) {
+    uint32_t mask = table->slot_mask * 2 + 1;
+    int* slots = calloc((size_t)mask + 1, sizeof(int));
+
+    if (slots == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < table->user_count; i++) {
+        uint32_t pos = table->users[i].hash & mask;
+        while (slots[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        slots[pos] = i + 1;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_mask = mask;
+    return 1;
+}
+
+static int score_table_add_hashed(ScoreTable* table, const char* username, size_t len, uint32_t hash,
+    int64_t score, int count) {
+    uint32_t pos = hash & table->slot_mask;
+    UserScore* user;
+    int index;
+
+    while ((index = table->slots[pos]) != 0) {
+        user = &table->users[index - 1];
+        if (user->hash == hash && strncmp(user->username, username, MAX_USERNAME) == 0) {
+            user->total_score += score;
+            user->treasures_count += count;
+            return 1;
+        }
+        pos = (pos + 1) & table->slot_mask;
+    }
+
+    if (table->user_count == table->user_capacity) {
+        UserScore* users = realloc(table->users, (size_t)table->user_capacity * 2 * sizeof(UserScore));
+        if (users == NULL) {
+            return 0;
+        }
+        table->users = users;
+        table->user_capacity *= 2;
+    }
+
+    user = &table->users[table->user_count];
+    user->username = arena_copy(table, username, len);
+    if (user->username == NULL) {
+        return 0;
+    }
+    user->hash = hash;
+    user->total_score = score;
+    user->treasures_count = count;
+    table->slots[pos] = ++table->user_count;
+
+    // Keep the load factor under 3/4 so probe chains stay short.
+    if ((uint32_t)table->user_count * 4 > (table->slot_mask + 1) * 3) {
+        return score_table_grow(table);
+    }
+    return 1;
+}
+
+int score_table_add(ScoreTable* table, const char* username, int score, int count) {
+    size_t len;
+    uint32_t hash = scores_hash(username, &len);
+
+    return score_table_add_hashed(table, username, len, hash, score, count);
+}
+
+int score_table_merge(ScoreTable* dst, const ScoreTable* src) {
+    for (int i = 0; i < src->user_count; i++) {
+        const UserScore* user = &src->users[i];
+        if (!score_table_add_hashed(dst, user->username, strlen(user->username), user->hash,
+                user->total_score, user->treasures_count)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Values are compared rather than subtracted so extreme totals cannot overflow.
+int compare_scores(const void* a, const void* b) {
+    const UserScore* score_a = (const UserScore*)a;
+    const UserScore* score_b = (const UserScore*)b;
+
+    if (score_a->total_score != score_b->total_score) {
+        return score_a->total_score < score_b->total_score ? 1 : -1;
+    }
+    if (score_a->treasures_count != score_b->treasures_count) {
+        return score_a->treasures_count > score_b->treasures_count ? 1 : -1;
+    }
+    return strcmp(score_a->username, score_b->username);
+}
+
+// Min-heap on rank: heap[0] is the weakest of the candidates kept so far.
+static void heap_sift_down(UserScore* heap, int size, int i) {
+    while (1) {
+        int weakest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < size && compare_scores(&heap[left], &heap[weakest]) > 0) {
+            weakest = left;
+        }
+        if (right < size && compare_scores(&heap[right], &heap[weakest]) > 0) {
+            weakest = right;
+        }
+        if (weakest == i) {
+            return;
+        }
+
+        UserScore tmp = heap[i];
+        heap[i] = heap[weakest];
+        heap[weakest] = tmp;
+        i = weakest;
+    }
+}
+
+int select_top(UserScore* users, int count, int k) {
+    if (k <= 0 || k >= count) {
+        qsort(users, (size_t)count, sizeof(UserScore), compare_scores);
+        return count;
+    }
+
+    // The first k slots become the heap; each later user replaces the root
+    // only if it outranks it.
+    for (int i = k / 2 - 1; i >= 0; i--) {
+        heap_sift_down(users, k, i);
+    }
+    for (int i = k; i < count; i++) {
+        if (compare_scores(&users[i], &users[0]) < 0) {
+            users[0] = users[i];
+            heap_sift_down(users, k, 0);
+        }
+    }
+
+    qsort(users, (size_t)k, sizeof(UserScore), compare_scores);
+    return k;
+}
+
+static int use_sidecar = 1;
+static int scan_threads = 0;
+
+void scoring_set_sidecar(int use) {
+    use_sidecar = use;
+}
+
+void scoring_set_scan_threads(int threads) {
+    scan_threads = threads;
+}
+
+// Per-user totals of one segment.
+typedef struct {
+    ScoreTable table;
+    HuntTotals totals;
+} ScorePart;
+
+// Loads one segment as columns and sums it per interned user id with the
+// column kernels, so the part's table sees each user once instead of once
+// per treasure.
+static int score_part(const StorePart* part, void* arg) {
+    const ColumnKernels* kernels = column_kernels();
+    ScorePart* out = (ScorePart*)arg + part->index;
+    HuntColumns cols;
+    int64_t* sums;
+    int64_t* counts;
+    int result;
+
+    columns_init(&cols);
+    result = columns_load_part(&cols, part);
+    if (result != 1) {
+        columns_free(&cols);
+        return result;
+    }
+
+    sums = calloc((size_t)cols.user_count + 1, sizeof(int64_t));
+    counts = calloc((size_t)cols.user_count + 1, sizeof(int64_t));
+    if (sums == NULL || counts == NULL) {
+        free(sums);
+        free(counts);
+        columns_free(&cols);
+        return -1;
+    }
+    kernels->group_sum(cols.user_ids, cols.values, cols.count, sums, counts);
+
+    for (uint32_t user = 0; user < cols.user_count; user++) {
+        if (!score_table_add_hashed(&out->table, cols.usernames[user], strlen(cols.usernames[user]),
+                cols.user_hashes[user], sums[user], (int)counts[user])) {
+            result = -1;
+            break;
+        }
+    }
+    out->totals.treasures += cols.count;
+    out->totals.total_score += kernels->sum(cols.values, cols.count);
+    free(sums);
+    free(counts);
+    columns_free(&cols);
+    return result;
+}
+
+// Scans the hunt's segments into table, on scan_threads threads, and writes
+// a fresh scores sidecar for the generation the scan saw. The parts are
+// merged in segment order.
+static int scan_hunt(const char* hunt_id, ScoreTable* table, HuntTotals* totals) {
+    StoreSnapshot snap;
+    ScorePart* parts;
+    ScoreSlot* entries;
+    int initialized = 0;
+    int result = 1;
+
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        return 0;
+    }
+    // Pick the kernels before the parts share them.
+    column_kernels();
+    parts = calloc((size_t)snap.segment_count + 1, sizeof(ScorePart));
+    if (parts == NULL) {
+        store_snapshot_close(&snap);
+        return -1;
+    }
+    while (initialized < snap.segment_count && score_table_init(&parts[initialized].table)) {
+        initialized++;
+    }
+    if (initialized < snap.segment_count ||
+        store_scan_parts(&snap, 0, snap.segment_count, scan_threads, score_part, parts) != 1) {
+        result = -1;
+    }
+    for (int i = 0; i < initialized; i++) {
+        if (result == 1 && !score_table_merge(table, &parts[i].table)) {
+            result = -1;
+        }
+        totals->treasures += parts[i].totals.treasures;
+        totals->total_score += parts[i].totals.total_score;
+        score_table_free(&parts[i].table);
+    }
+    free(parts);
+    if (result != 1) {
+        store_snapshot_close(&snap);
+        return result;
+    }
+
+    // Failing to save only costs the next run another scan.
+    entries = calloc((size_t)table->user_count + 1, sizeof(ScoreSlot));
+    if (entries != NULL) {
+        for (int i = 0; i < table->user_count; i++) {
+            entries[i].hash = table->users[i].hash;
+            entries[i].total_score = table->users[i].total_score;
+            entries[i].treasures = table->users[i].treasures_count;
+            strncpy(entries[i].username, table->users[i].username, MAX_USERNAME - 1);
+        }
+        scores_save(hunt_id, snap.hdr.generation, entries, table->user_count);
+        free(entries);
+    }
+    store_snapshot_close(&snap);
+    return 1;
+}
+
+int score_hunt(const char* hunt_id, ScoreTable* table, HuntTotals* totals) {
+    ScoreSlot* slots;
+    ScoreTable hunt_table;
+    int count;
+    int result;
+
+    if (use_sidecar && scores_load(hunt_id, &slots, &count) == 1) {
+        for (int i = 0; i < count; i++) {
+            if (!score_table_add_hashed(table, slots[i].username, strnlen(slots[i].username, MAX_USERNAME),
+                    slots[i].hash, slots[i].total_score, (int)slots[i].treasures)) {
+                free(slots);
+                return -1;
+            }
+            totals->treasures += slots[i].treasures;
+            totals->total_score += slots[i].total_score;
+        }
+        free(slots);
+        return 1;
+    }
+
+    // The sidecar describes one hunt, so scan into a table of its own.
+    if (!score_table_init(&hunt_table)) {
+        return -1;
+    }
+    result = scan_hunt(hunt_id, &hunt_table, totals);
+    if (result == 1 && !score_table_merge(table, &hunt_table)) {
+        result = -1;
+    }
+    score_table_free(&hunt_table);
+    return result;
+}
+
+void print_scores(ScoreTable* table, int top, int pipe_fd) {
+    int shown = select_top(table->users, table->user_count, top);
+
+    if (table->user_count == 0) {
+        dprintf(pipe_fd, "No users found in this hunt.\n");
+    } else {
+        dprintf(pipe_fd, "%-20s | %-12s | %s\n", "Username", "Total Score", "Treasures");
+        dprintf(pipe_fd, "----------------------------------------------------\n");
+        for (int i = 0; i < shown; i++) {
+            dprintf(pipe_fd, "%-20s | %-12lld | %d\n",
+                table->users[i].username,
+                (long long)table->users[i].total_score,
+                table->users[i].treasures_count);
+        }
+    }
+}
+
+int store_Calculator(const char* hunt_id, int top, int pipe_fd) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/treasures.dat", hunt_id);
+
+    ScoreTable table;
+    HuntTotals totals = { 0, 0 };
+    if (!score_table_init(&table)) {
+        dprintf(pipe_fd, "Error: Out of memory\n");
+        return -1;
+    }
+
+    int result = score_hunt(hunt_id, &table, &totals);
+    if (result == 0) {
+        dprintf(pipe_fd, "Error: Could not open %s\n", path);
+        score_table_free(&table);
+        return result;
+    }
+    if (result == -1) {
+        dprintf(pipe_fd, "Error: Out of memory\n");
+        score_table_free(&table);
+        return result;
+    }
+
+    dprintf(pipe_fd, "Hunt: %s - User Scores\n", hunt_id);
+    dprintf(pipe_fd, "---------------------------\n");
+    print_scores(&table, top, pipe_fd);
+
+    score_table_free(&table);
+    return 1;
+}
+
+// Scores one user of hunt_id from the users sidecar, or with a full scan
+// under --scan.
+void user_Calculator(const char* hunt_id, const char* username, int pipe_fd) {
+    TreasureRecord* records = NULL;
+    int64_t total = 0;
+    int count = 0;
+
+    if (use_sidecar) {
+        count = users_lookup(hunt_id, username, &records);
+        if (count == -1) {
+            dprintf(pipe_fd, "Error: Could not open %s/treasures.dat\n", hunt_id);
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            total += records[i].value;
+        }
+        free(records);
+    } else {
+        HuntColumns cols;
+        uint32_t* rows;
+        int64_t user;
+        int result;
+
+        columns_init(&cols);
+        result = columns_load(&cols, hunt_id, NULL);
+        if (result != 1) {
+            columns_free(&cols);
+            if (result == 0) {
+                dprintf(pipe_fd, "Error: Could not open %s/treasures.dat\n", hunt_id);
+            } else {
+                dprintf(pipe_fd, "Error: Out of memory\n");
+            }
+            return;
+        }
+        rows = malloc((size_t)(cols.count > 0 ? cols.count : 1) * sizeof(uint32_t));
+        if (rows == NULL) {
+            columns_free(&cols);
+            dprintf(pipe_fd, "Error: Out of memory\n");
+            return;
+        }
+        user = columns_find_user(&cols, username);
+        if (user != -1) {
+            count = (int)column_kernels()->select_equal(cols.user_ids, cols.count, (uint32_t)user, rows);
+            for (int i = 0; i < count; i++) {
+                total += cols.values[rows[i]];
+            }
+        }
+        free(rows);
+        columns_free(&cols);
+    }
+
+    dprintf(pipe_fd, "Hunt: %s - User Scores\n", hunt_id);
+    dprintf(pipe_fd, "---------------------------\n");
+    if (count == 0) {
+        dprintf(pipe_fd, "No treasures found for user %s.\n", username);
+        return;
+    }
+    dprintf(pipe_fd, "%-20s | %-12s | %s\n", "Username", "Total Score", "Treasures");
+    dprintf(pipe_fd, "----------------------------------------------------\n");
+    dprintf(pipe_fd, "%-20s | %-12lld | %d\n", username, (long long)total, count);
+}
@@ -0,0 +1,76 @@
+#ifndef TREASURE_SCORING_H
+#define TREASURE_SCORING_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// Per-user score aggregation behind score_calculator, shared with
+// treasure_bench so the benchmark times the same scans the tool runs.
+//
+// A hunt is scored from its scores sidecar when that is current, and
+// otherwise by scanning its segments in parallel, which also rewrites the
+// sidecar for the next run.
+
+typedef struct {
+    const char* username;   // points into the table's arena
+    uint32_t hash;
+    int64_t total_score;    // wide enough that summing int values cannot overflow
+    int treasures_count;
+} UserScore;
+
+// Open-addressing table from username to its entry in users. slots holds
+// index + 1 (0 is empty) and is probed linearly; users stays dense so it can
+// be sorted directly once aggregation is done.
+typedef struct {
+    UserScore* users;
+    int user_count;
+    int user_capacity;
+    int* slots;
+    uint32_t slot_mask;
+    struct ArenaBlock* arena;
+} ScoreTable;
+
+typedef struct {
+    int64_t treasures;
+    int64_t total_score;
+} HuntTotals;
+
+int score_table_init(ScoreTable* table);
+void score_table_free(ScoreTable* table);
+// Adds score and count to username's totals, creating the entry if needed.
+// Returns 0 if memory ran out.
+int score_table_add(ScoreTable* table, const char* username, int score, int count);
+// Folds every entry of src into dst, reusing the hashes computed by src.
+int score_table_merge(ScoreTable* dst, const ScoreTable* src);
+
+// Orders by total score descending. Ties go to the user with fewer
+// treasures, then by username, so the ranking (and any top-K cut) is stable.
+int compare_scores(const void* a, const void* b);
+// Moves the k best users to the front of users, ranked, in O(U log K) using a
+// bounded heap instead of sorting all U users. Returns the number kept.
+int select_top(UserScore* users, int count, int k);
+
+// Whether hunts are scored from their sidecars (the default). Cleared by
+// score_calculator --scan to always rescan and rebuild them.
+void scoring_set_sidecar(int use);
+// Threads a hunt's segments are scanned on; 0 (the default) picks the
+// store's. The global leaderboard already runs one hunt per thread and
+// sets it to 1.
+void scoring_set_scan_threads(int threads);
+
+// Adds the per-user totals of hunt_id to table, from the scores sidecar when
+// it is current and from a full scan otherwise. Returns 1 on success, 0 if
+// the hunt could not be opened and -1 if memory ran out.
+int score_hunt(const char* hunt_id, ScoreTable* table, HuntTotals* totals);
+
+// Prints the top entries of table (all of them when top is 0).
+void print_scores(ScoreTable* table, int top, int pipe_fd);
+
+// The two per-hunt reports of score_calculator: every user's score (the top
+// of them when top is set), or one user's, written to pipe_fd.
+// store_Calculator returns the score_hunt result.
+int store_Calculator(const char* hunt_id, int top, int pipe_fd);
+void user_Calculator(const char* hunt_id, const char* username, int pipe_fd);
+
+#endif
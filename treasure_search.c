@@ -0,0 +1,838 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_search.h"
+
+#define MAX_QUERY_TERMS 64
+// A clue of MAX_CLUE_TEXT bytes has at most this many terms.
+#define MAX_CLUE_TERMS (MAX_CLUE_TEXT / 2 + 1)
+
+typedef struct {
+    int64_t* slots;
+    int64_t count;
+    int64_t capacity;
+} SlotList;
+
+typedef struct {
+    char term[SEARCH_MAX_TERM];
+    size_t length;
+    int group;                  // terms of a group are ANDed, groups are ORed
+    SlotList slots;
+} QueryTerm;
+
+typedef struct {
+    QueryTerm terms[MAX_QUERY_TERMS];
+    int count;
+    int groups;
+    int next_group;
+} Query;
+
+// Posting list under construction while the base is built.
+typedef struct {
+    char term[SEARCH_MAX_TERM];
+    uint16_t length;
+    uint32_t doc_count;
+    int64_t last_slot;
+    uint8_t* postings;
+    size_t postings_length;
+    size_t postings_capacity;
+} TermBuild;
+
+typedef struct {
+    TermBuild** table;
+    size_t capacity;
+    size_t count;
+    int64_t slot;
+    int failed;
+} BuildState;
+
+// Terms of one clue, deduplicated.
+typedef struct {
+    char terms[MAX_CLUE_TERMS][SEARCH_MAX_TERM];
+    uint8_t lengths[MAX_CLUE_TERMS];
+    int count;
+} ClueTerms;
+
+typedef struct {
+    int fd;
+    SearchHeader hdr;
+    char* map;
+    size_t map_len;
+    const SearchTerm* dict;
+} SearchIndex;
+
+static int is_term_byte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+void search_tokenize(const char* text, size_t length,
+    void (*emit)(const char* term, size_t length, void* arg), void* arg) {
+    char term[SEARCH_MAX_TERM];
+    size_t i = 0;
+
+    while (i < length) {
+        size_t n = 0;
+
+        while (i < length && !is_term_byte((unsigned char)text[i])) {
+            i++;
+        }
+        while (i < length && is_term_byte((unsigned char)text[i])) {
+            char c = text[i++];
+            if (n < SEARCH_MAX_TERM) {
+                term[n++] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+            }
+        }
+        if (n > 0) {
+            emit(term, n, arg);
+        }
+    }
+}
+
+static void collect_term(const char* term, size_t length, void* arg) {
+    ClueTerms* clue = arg;
+
+    for (int i = 0; i < clue->count; i++) {
+        if (clue->lengths[i] == length && memcmp(clue->terms[i], term, length) == 0) {
+            return;
+        }
+    }
+    if (clue->count < MAX_CLUE_TERMS) {
+        memcpy(clue->terms[clue->count], term, length);
+        clue->lengths[clue->count++] = (uint8_t)length;
+    }
+}
+
+static size_t put_varint(uint8_t* out, uint64_t value) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+// Returns the bytes consumed, or 0 if the varint runs past end.
+static size_t get_varint(const uint8_t* p, const uint8_t* end, uint64_t* value) {
+    uint64_t result = 0;
+    size_t n = 0;
+
+    for (int shift = 0; shift < 64 && p + n < end; shift += 7) {
+        uint8_t byte = p[n++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return n;
+        }
+    }
+    return 0;
+}
+
+static int slots_add(SlotList* list, int64_t slot) {
+    if (list->count == list->capacity) {
+        int64_t capacity = list->capacity ? list->capacity * 2 : 64;
+        int64_t* grown = realloc(list->slots, (size_t)capacity * sizeof(int64_t));
+        if (grown == NULL) {
+            return 0;
+        }
+        list->slots = grown;
+        list->capacity = capacity;
+    }
+    list->slots[list->count++] = slot;
+    return 1;
+}
+
+static uint32_t term_hash(const char* term, size_t length) {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (uint8_t)term[i]) * 16777619u;
+    }
+    return h;
+}
+
+static TermBuild* build_find(BuildState* state, const char* term, size_t length) {
+    size_t mask;
+    size_t i;
+
+    if (state->count * 10 >= state->capacity * 7) {
+        size_t capacity = state->capacity ? state->capacity * 2 : 4096;
+        TermBuild** table = calloc(capacity, sizeof(TermBuild*));
+        if (table == NULL) {
+            return NULL;
+        }
+        for (size_t j = 0; j < state->capacity; j++) {
+            TermBuild* entry = state->table[j];
+            if (entry != NULL) {
+                i = term_hash(entry->term, entry->length) & (capacity - 1);
+                while (table[i] != NULL) {
+                    i = (i + 1) & (capacity - 1);
+                }
+                table[i] = entry;
+            }
+        }
+        free(state->table);
+        state->table = table;
+        state->capacity = capacity;
+    }
+
+    mask = state->capacity - 1;
+    i = term_hash(term, length) & mask;
+    while (state->table[i] != NULL) {
+        TermBuild* entry = state->table[i];
+        if (entry->length == length && memcmp(entry->term, term, length) == 0) {
+            return entry;
+        }
+        i = (i + 1) & mask;
+    }
+
+    state->table[i] = calloc(1, sizeof(TermBuild));
+    if (state->table[i] == NULL) {
+        return NULL;
+    }
+    memcpy(state->table[i]->term, term, length);
+    state->table[i]->length = (uint16_t)length;
+    state->table[i]->last_slot = -1;
+    state->count++;
+    return state->table[i];
+}
+
+static void build_term(const char* term, size_t length, void* arg) {
+    BuildState* state = arg;
+    TermBuild* entry = build_find(state, term, length);
+    uint8_t varint[10];
+    size_t n;
+
+    if (entry == NULL) {
+        state->failed = 1;
+        return;
+    }
+    // Once per slot, however often the clue repeats it.
+    if (entry->last_slot == state->slot) {
+        return;
+    }
+
+    n = put_varint(varint, (uint64_t)(state->slot - entry->last_slot - 1));
+    if (entry->postings_length + n > entry->postings_capacity) {
+        size_t capacity = entry->postings_capacity ? entry->postings_capacity * 2 : 16;
+        uint8_t* grown = realloc(entry->postings, capacity);
+        if (grown == NULL) {
+            state->failed = 1;
+            return;
+        }
+        entry->postings = grown;
+        entry->postings_capacity = capacity;
+    }
+    memcpy(entry->postings + entry->postings_length, varint, n);
+    entry->postings_length += n;
+    entry->last_slot = state->slot;
+    entry->doc_count++;
+}
+
+static int by_term(const void* a, const void* b) {
+    const TermBuild* x = *(TermBuild* const*)a;
+    const TermBuild* y = *(TermBuild* const*)b;
+    int cmp = memcmp(x->term, y->term, x->length < y->length ? x->length : y->length);
+
+    return cmp != 0 ? cmp : (int)x->length - (int)y->length;
+}
+
+static int write_all_at(int fd, const void* data, size_t length, off_t offset) {
+    const char* p = data;
+
+    while (length > 0) {
+        ssize_t n = pwrite(fd, p, length, offset);
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        length -= (size_t)n;
+        offset += n;
+    }
+    return 1;
+}
+
+// Writes a new sidecar whose base covers every slot of the snapshot.
+static int search_build(const char* hunt_id, const StoreSnapshot* snap) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char tmp_name[64];
+    BuildState state;
+    SearchHeader hdr;
+    SearchTerm* dict = NULL;
+    TermBuild** terms = NULL;
+    const TreasureRecord* record;
+    int64_t strings_len = 0, postings_len = 0;
+    int fd = -1;
+    int ok = 0;
+
+    snprintf(tmp_name, sizeof(tmp_name), SEARCH_FILENAME ".%ld.tmp", (long)getpid());
+    if (!store_path(path, MAX_PATH, hunt_id, SEARCH_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, tmp_name)) {
+        return 0;
+    }
+
+    memset(&state, 0, sizeof(state));
+    for (int i = 0; i < snap->segment_count && !state.failed; i++) {
+        const StoreSegment* seg = &snap->segments[i];
+        size_t heap_len = (size_t)seg->clue_bytes;
+        char* heap = NULL;
+        StorePart part;
+        StoreIter it;
+
+        // Each clue file is read front to back along with its records, so
+        // map it rather than pread every clue.
+        if (seg->clue_fd != -1 && heap_len > 0) {
+            heap = mmap(NULL, heap_len, PROT_READ, MAP_SHARED, seg->clue_fd, 0);
+            if (heap == MAP_FAILED) {
+                state.failed = 1;
+                break;
+            }
+            madvise(heap, heap_len, MADV_SEQUENTIAL);
+        }
+        store_snapshot_part(snap, i, &part);
+        store_iter_part(&it, &part);
+        while (!state.failed && (record = store_iter_next(&it)) != NULL) {
+            uint64_t offset = record->clue_offset - (uint64_t)seg->clue_base;
+
+            if (record->clue_length == 0 || heap == NULL || record->clue_offset < (uint64_t)seg->clue_base ||
+                offset + record->clue_length > heap_len) {
+                continue;
+            }
+            state.slot = it.slot - 1;
+            search_tokenize(heap + offset, record->clue_length, build_term, &state);
+        }
+        store_iter_close(&it);
+        if (heap != NULL) {
+            munmap(heap, heap_len);
+        }
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.base_slots = snap->hdr.slot_count;
+    if (state.failed) {
+        goto done;
+    }
+
+    terms = malloc((state.count + 1) * sizeof(TermBuild*));
+    dict = calloc(state.count + 1, sizeof(SearchTerm));
+    if (terms == NULL || dict == NULL) {
+        goto done;
+    }
+    for (size_t i = 0, n = 0; i < state.capacity; i++) {
+        if (state.table[i] != NULL) {
+            terms[n++] = state.table[i];
+        }
+    }
+    qsort(terms, state.count, sizeof(TermBuild*), by_term);
+    for (size_t i = 0; i < state.count; i++) {
+        dict[i].term_offset = (uint32_t)strings_len;
+        dict[i].term_length = terms[i]->length;
+        dict[i].doc_count = terms[i]->doc_count;
+        dict[i].postings_length = (uint32_t)terms[i]->postings_length;
+        dict[i].postings_start = postings_len;
+        strings_len += terms[i]->length;
+        postings_len += (int64_t)terms[i]->postings_length;
+    }
+
+    hdr.magic = SEARCH_MAGIC;
+    hdr.version = SEARCH_VERSION;
+    hdr.header_size = sizeof(SearchHeader);
+    hdr.clue_gen = snap->hdr.clue_gen;
+    hdr.term_count = (uint32_t)state.count;
+    hdr.covered_slots = hdr.base_slots;
+    hdr.strings_offset = (int64_t)sizeof(SearchHeader) + (int64_t)state.count * (int64_t)sizeof(SearchTerm);
+    hdr.postings_offset = hdr.strings_offset + strings_len;
+    hdr.tail_offset = hdr.postings_offset + postings_len;
+    hdr.tail_end = hdr.tail_offset;
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        goto done;
+    }
+    ok = write_all_at(fd, &hdr, sizeof(hdr), 0) &&
+        write_all_at(fd, dict, state.count * sizeof(SearchTerm), sizeof(hdr));
+    for (size_t i = 0; ok && i < state.count; i++) {
+        ok = write_all_at(fd, terms[i]->term, terms[i]->length, hdr.strings_offset + dict[i].term_offset) &&
+            write_all_at(fd, terms[i]->postings, terms[i]->postings_length,
+                hdr.postings_offset + dict[i].postings_start);
+    }
+    close(fd);
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        ok = 0;
+    }
+
+done:
+    for (size_t i = 0; i < state.capacity; i++) {
+        if (state.table[i] != NULL) {
+            free(state.table[i]->postings);
+            free(state.table[i]);
+        }
+    }
+    free(state.table);
+    free(terms);
+    free(dict);
+    return ok;
+}
+
+void search_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const Treasure* treasures, int count) {
+    char path[MAX_PATH];
+    SearchHeader hdr;
+    ClueTerms* clue;
+    uint8_t* tail;
+    size_t tail_len = 0;
+    int fd;
+
+    if (count <= 0 || !store_path(path, MAX_PATH, hunt_id, SEARCH_FILENAME)) {
+        return;
+    }
+
+    // No sidecar yet: the first query builds one.
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != SEARCH_MAGIC ||
+        hdr.version != SEARCH_VERSION || hdr.clue_gen != clue_gen || hdr.covered_slots != first_slot) {
+        // See spatial_apply: a store that shrank invalidates the sidecar.
+        if (hdr.magic == SEARCH_MAGIC && hdr.clue_gen == clue_gen && hdr.covered_slots > first_slot) {
+            ftruncate(fd, 0);
+        }
+        close(fd);
+        return;
+    }
+
+    // Worst case per record: the slot, the term count and every term with
+    // its length byte.
+    clue = malloc(sizeof(ClueTerms));
+    tail = malloc((size_t)count * (20 + MAX_CLUE_TEXT * 2));
+    if (clue == NULL || tail == NULL) {
+        free(clue);
+        free(tail);
+        close(fd);
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        clue->count = 0;
+        search_tokenize(treasures[i].clue, strlen(treasures[i].clue), collect_term, clue);
+        tail_len += put_varint(tail + tail_len, (uint64_t)(first_slot + i));
+        tail_len += put_varint(tail + tail_len, (uint64_t)clue->count);
+        for (int t = 0; t < clue->count; t++) {
+            tail[tail_len++] = clue->lengths[t];
+            memcpy(tail + tail_len, clue->terms[t], clue->lengths[t]);
+            tail_len += clue->lengths[t];
+        }
+    }
+
+    // Entries go past tail_end first; the header only covers them once they
+    // are written.
+    if (write_all_at(fd, tail, tail_len, hdr.tail_end)) {
+        hdr.covered_slots += count;
+        hdr.tail_end += (int64_t)tail_len;
+        pwrite(fd, &hdr, sizeof(hdr), 0);
+    }
+
+    free(clue);
+    free(tail);
+    close(fd);
+}
+
+static int64_t tail_limit(int64_t base_slots) {
+    return base_slots / 8 > SEARCH_MAX_TAIL ? base_slots / 8 : SEARCH_MAX_TAIL;
+}
+
+// Opens and maps the sidecar if it can answer for the snapshot.
+static int index_open(const char* hunt_id, const StoreSnapshot* snap, SearchIndex* index) {
+    char path[MAX_PATH];
+    struct stat st;
+    SearchHeader* hdr = &index->hdr;
+
+    index->map = NULL;
+    index->fd = -1;
+    if (!store_path(path, MAX_PATH, hunt_id, SEARCH_FILENAME)) {
+        return 0;
+    }
+    index->fd = open(path, O_RDONLY);
+    if (index->fd == -1) {
+        return 0;
+    }
+
+    if (pread(index->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) || hdr->magic != SEARCH_MAGIC ||
+        hdr->version != SEARCH_VERSION || hdr->header_size != sizeof(SearchHeader) ||
+        hdr->clue_gen != snap->hdr.clue_gen ||
+        hdr->base_slots < 0 || hdr->covered_slots < hdr->base_slots ||
+        hdr->strings_offset != (int64_t)sizeof(SearchHeader) + (int64_t)hdr->term_count * (int64_t)sizeof(SearchTerm) ||
+        hdr->postings_offset < hdr->strings_offset || hdr->tail_offset < hdr->postings_offset ||
+        hdr->tail_end < hdr->tail_offset ||
+        snap->hdr.slot_count - hdr->base_slots > tail_limit(hdr->base_slots) ||
+        fstat(index->fd, &st) == -1 || st.st_size < hdr->tail_end) {
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+
+    // Only what the header covers; later appends are not looked at.
+    index->map_len = (size_t)hdr->tail_end;
+    index->map = mmap(NULL, index->map_len, PROT_READ, MAP_SHARED, index->fd, 0);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+    index->dict = (const SearchTerm*)(index->map + sizeof(SearchHeader));
+    return 1;
+}
+
+static void index_close(SearchIndex* index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->map_len);
+    }
+    if (index->fd != -1) {
+        close(index->fd);
+    }
+}
+
+static const SearchTerm* index_find(const SearchIndex* index, const char* term, size_t length) {
+    uint32_t lo = 0, hi = index->hdr.term_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const SearchTerm* entry = &index->dict[mid];
+        const char* text = index->map + index->hdr.strings_offset + entry->term_offset;
+        int cmp;
+
+        if (index->hdr.strings_offset + entry->term_offset + entry->term_length > index->hdr.postings_offset) {
+            return NULL;
+        }
+        cmp = memcmp(text, term, entry->term_length < length ? entry->term_length : length);
+        if (cmp == 0) {
+            cmp = (int)entry->term_length - (int)length;
+        }
+        if (cmp == 0) {
+            return entry;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static int decode_postings(const SearchIndex* index, const SearchTerm* entry, int64_t limit, SlotList* out) {
+    const uint8_t* p;
+    const uint8_t* end;
+    int64_t slot = -1;
+    uint64_t delta;
+    size_t n;
+
+    if (entry->postings_start + (int64_t)entry->postings_length > index->hdr.tail_offset - index->hdr.postings_offset) {
+        return 1;
+    }
+    p = (const uint8_t*)index->map + index->hdr.postings_offset + entry->postings_start;
+    end = p + entry->postings_length;
+    while (p < end && (n = get_varint(p, end, &delta)) > 0) {
+        p += n;
+        slot += (int64_t)delta + 1;
+        if (slot >= limit) {
+            break;
+        }
+        if (!slots_add(out, slot)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void match_terms(Query* q, const char* term, size_t length, int64_t slot, int* failed) {
+    for (int i = 0; i < q->count; i++) {
+        QueryTerm* qt = &q->terms[i];
+        if (qt->length == length && memcmp(qt->term, term, length) == 0 &&
+            (qt->slots.count == 0 || qt->slots.slots[qt->slots.count - 1] != slot) &&
+            !slots_add(&qt->slots, slot)) {
+            *failed = 1;
+        }
+    }
+}
+
+// Tail entries are in slot order, after every slot in the base.
+static int scan_tail(const SearchIndex* index, Query* q, int64_t limit) {
+    const uint8_t* p = (const uint8_t*)index->map + index->hdr.tail_offset;
+    const uint8_t* end = (const uint8_t*)index->map + index->hdr.tail_end;
+    uint64_t slot, terms;
+    size_t n;
+    int failed = 0;
+
+    while (p < end && !failed) {
+        if ((n = get_varint(p, end, &slot)) == 0) {
+            break;
+        }
+        p += n;
+        if ((n = get_varint(p, end, &terms)) == 0) {
+            break;
+        }
+        p += n;
+        for (uint64_t t = 0; t < terms; t++) {
+            if (p >= end || p + 1 + *p > end) {
+                return 1;
+            }
+            if ((int64_t)slot < limit) {
+                match_terms(q, (const char*)p + 1, *p, (int64_t)slot, &failed);
+            }
+            p += 1 + *p;
+        }
+    }
+    return !failed;
+}
+
+typedef struct {
+    Query* q;
+    int64_t slot;
+    int failed;
+} GapScan;
+
+static void gap_term(const char* term, size_t length, void* arg) {
+    GapScan* scan = arg;
+
+    match_terms(scan->q, term, length, scan->slot, &scan->failed);
+}
+
+// Slots past what the sidecar covers: tokenize their clues on the spot.
+static int scan_gap(const StoreSnapshot* snap, Query* q, int64_t from) {
+    StoreIter it;
+    const TreasureRecord* record;
+    char clue[MAX_CLUE_TEXT];
+    GapScan scan = { q, 0, 0 };
+
+    if (from >= snap->hdr.slot_count) {
+        return 1;
+    }
+    if (!store_iter_snapshot(&it, snap)) {
+        return 0;
+    }
+    store_iter_seek(&it, from);
+    while (!scan.failed && (record = store_iter_next(&it)) != NULL) {
+        if (!store_snapshot_clue(snap, record, clue)) {
+            continue;
+        }
+        scan.slot = it.slot - 1;
+        search_tokenize(clue, strlen(clue), gap_term, &scan);
+    }
+    store_iter_close(&it);
+    return !scan.failed;
+}
+
+static void query_term(const char* term, size_t length, void* arg) {
+    Query* q = arg;
+
+    if (q->count < MAX_QUERY_TERMS) {
+        QueryTerm* qt = &q->terms[q->count++];
+        memset(qt, 0, sizeof(*qt));
+        memcpy(qt->term, term, length);
+        qt->length = length;
+        qt->group = q->next_group;
+    }
+}
+
+static void parse_query(const char* text, Query* q) {
+    const char* p = text;
+
+    memset(q, 0, sizeof(*q));
+    while (*p != '\0') {
+        const char* start;
+        size_t length;
+
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        start = p;
+        while (*p != '\0' && *p != ' ' && *p != '\t') {
+            p++;
+        }
+        length = (size_t)(p - start);
+        if (length == 0) {
+            continue;
+        }
+        if (length == 2 && memcmp(start, "OR", 2) == 0) {
+            // Only start a new group if the current one has terms.
+            if (q->count > 0 && q->terms[q->count - 1].group == q->next_group) {
+                q->next_group++;
+            }
+            continue;
+        }
+        if (length == 3 && memcmp(start, "AND", 3) == 0) {
+            continue;
+        }
+        search_tokenize(start, length, query_term, q);
+    }
+    q->groups = q->count > 0 ? q->terms[q->count - 1].group + 1 : 0;
+}
+
+static void intersect(SlotList* acc, const SlotList* other) {
+    int64_t n = 0, j = 0;
+
+    for (int64_t i = 0; i < acc->count; i++) {
+        while (j < other->count && other->slots[j] < acc->slots[i]) {
+            j++;
+        }
+        if (j < other->count && other->slots[j] == acc->slots[i]) {
+            acc->slots[n++] = acc->slots[i];
+        }
+    }
+    acc->count = n;
+}
+
+static int merge(SlotList* acc, const SlotList* other) {
+    SlotList out = { NULL, 0, 0 };
+    int64_t i = 0, j = 0;
+
+    while (i < acc->count || j < other->count) {
+        int64_t slot;
+        if (j >= other->count || (i < acc->count && acc->slots[i] < other->slots[j])) {
+            slot = acc->slots[i++];
+        } else if (i >= acc->count || other->slots[j] < acc->slots[i]) {
+            slot = other->slots[j++];
+        } else {
+            slot = acc->slots[i++];
+            j++;
+        }
+        if (!slots_add(&out, slot)) {
+            free(out.slots);
+            return 0;
+        }
+    }
+    free(acc->slots);
+    *acc = out;
+    return 1;
+}
+
+static int copy_slots(SlotList* out, const SlotList* in) {
+    out->count = 0;
+    for (int64_t i = 0; i < in->count; i++) {
+        if (!slots_add(out, in->slots[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ORs the ANDed groups together.
+static int evaluate(const Query* q, SlotList* result) {
+    SlotList group = { NULL, 0, 0 };
+    int ok = 1;
+
+    for (int g = 0; g < q->groups && ok; g++) {
+        int first = 1;
+        for (int i = 0; i < q->count && ok; i++) {
+            if (q->terms[i].group != g) {
+                continue;
+            }
+            if (first) {
+                ok = copy_slots(&group, &q->terms[i].slots);
+                first = 0;
+            } else {
+                intersect(&group, &q->terms[i].slots);
+            }
+        }
+        if (ok && !first) {
+            ok = merge(result, &group);
+        }
+    }
+    free(group.slots);
+    return ok;
+}
+
+int search_clues(const char* hunt_id, const char* text, SearchMatch** matches) {
+    StoreSnapshot snap;
+    SearchIndex index;
+    SlotList result = { NULL, 0, 0 };
+    SearchMatch* found = NULL;
+    Query* q;
+    int64_t covered = 0;
+    int count = 0;
+    int ok = 1;
+
+    *matches = NULL;
+    q = malloc(sizeof(Query));
+    if (q == NULL) {
+        return -1;
+    }
+    parse_query(text, q);
+    if (q->count == 0) {
+        free(q);
+        return 0;
+    }
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        free(q);
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if (!index_open(hunt_id, &snap, &index) && search_build(hunt_id, &snap)) {
+        index_open(hunt_id, &snap, &index);
+    }
+    if (index.map != NULL) {
+        int64_t base = index.hdr.base_slots < snap.hdr.slot_count ? index.hdr.base_slots : snap.hdr.slot_count;
+
+        for (int i = 0; i < q->count && ok; i++) {
+            const SearchTerm* entry = index_find(&index, q->terms[i].term, q->terms[i].length);
+            if (entry != NULL) {
+                ok = decode_postings(&index, entry, base, &q->terms[i].slots);
+            }
+        }
+        covered = index.hdr.covered_slots < snap.hdr.slot_count ? index.hdr.covered_slots : snap.hdr.slot_count;
+        if (ok) {
+            ok = scan_tail(&index, q, covered);
+        }
+    }
+    index_close(&index);
+
+    if (ok) {
+        ok = scan_gap(&snap, q, covered) && evaluate(q, &result);
+    }
+
+    if (ok && result.count > 0) {
+        found = malloc((size_t)result.count * sizeof(SearchMatch));
+        ok = found != NULL;
+    }
+    for (int64_t i = 0; ok && i < result.count; i++) {
+        int64_t slot = result.slots[i];
+        SearchMatch* match = &found[count];
+
+        if (store_snapshot_is_dead(&snap, slot)) {
+            continue;
+        }
+        if (store_snapshot_read(&snap, slot, 1, &match->record) != 1) {
+            ok = 0;
+            break;
+        }
+        if (!store_snapshot_clue(&snap, &match->record, match->clue)) {
+            match->clue[0] = '\0';
+        }
+        count++;
+    }
+    store_snapshot_close(&snap);
+
+    for (int i = 0; i < q->count; i++) {
+        free(q->terms[i].slots.slots);
+    }
+    free(q);
+    free(result.slots);
+    if (!ok) {
+        free(found);
+        return -1;
+    }
+    *matches = found;
+    return count;
+}
@@ -0,0 +1,83 @@
+#ifndef TREASURE_SEARCH_H
+#define TREASURE_SEARCH_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// Per-hunt "search" sidecar: an inverted index over clue text, so finding
+// treasures by clue words reads a few posting lists instead of every clue.
+//
+// Clues are split into terms: runs of letters, digits and non-ASCII bytes,
+// lowercased and cut to SEARCH_MAX_TERM bytes. Each term is counted once per
+// record.
+//
+// The file has two parts:
+//   base  a term dictionary sorted by term, then one posting list per term
+//         holding the slots that contain it, each stored as the delta from
+//         the previous slot in LEB128 varints
+//   tail  records appended since the base was built, one entry per slot with
+//         the slot and its terms
+// Appends add tail entries under the hunt lock, with the same rules as the
+// spatial sidecar: only when the file covers exactly the slots before them
+// and belongs to the same clue_gen. Removed records stay in the postings and
+// are filtered through the snapshot's tombstones. Queries scan the tail and
+// the slots past the covered ones directly, and rebuild the whole file from
+// their snapshot once that part grows past max(SEARCH_MAX_TAIL, base / 8)
+// slots or the file belongs to another generation. Like the other sidecars,
+// it is first built by a query.
+
+#define SEARCH_FILENAME "search"
+#define SEARCH_MAGIC 0x58444e49u /* "INDX" */
+#define SEARCH_VERSION 1
+
+#define SEARCH_MAX_TERM 32
+#define SEARCH_MAX_TAIL 4096
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t clue_gen;
+    uint32_t term_count;
+    int64_t base_slots;         // slots [0, base_slots) are in the posting lists
+    int64_t covered_slots;      // slots [base_slots, covered_slots) are in the tail
+    int64_t strings_offset;     // term bytes, referenced by the dictionary
+    int64_t postings_offset;
+    int64_t tail_offset;
+    int64_t tail_end;           // end of the last complete tail entry
+} SearchHeader;
+
+// The header is followed by term_count dictionary entries.
+typedef struct {
+    uint32_t term_offset;       // from strings_offset
+    uint16_t term_length;
+    uint16_t reserved;
+    uint32_t doc_count;         // slots in the posting list
+    uint32_t postings_length;   // bytes
+    int64_t postings_start;     // from postings_offset
+} SearchTerm;
+
+typedef struct {
+    TreasureRecord record;
+    char clue[MAX_CLUE_TEXT];
+} SearchMatch;
+
+// Called by the store with the hunt lock held, after treasures were appended
+// at first_slot.
+void search_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const Treasure* treasures, int count);
+
+// Treasures whose clue matches query, in file order. Terms are ANDed;
+// "OR" between terms separates alternatives, so "gold coin OR silver"
+// matches clues with both gold and coin, or with silver. An explicit "AND"
+// is accepted too. Returns how many there are with a malloc'd array in
+// *matches, or -1.
+int search_clues(const char* hunt_id, const char* query, SearchMatch** matches);
+
+// Splits text into terms, handing each one (not NUL terminated) to emit.
+// Duplicates are not removed.
+void search_tokenize(const char* text, size_t length,
+    void (*emit)(const char* term, size_t length, void* arg), void* arg);
+
+#endif
@@ -0,0 +1,613 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_spatial.h"
+
+// Appends of at most this many records update bucket heads one by one;
+// larger batches rewrite the whole head table.
+#define SPATIAL_SMALL_BATCH 16
+// Slots past the covered ones that a query is willing to scan before it
+// rebuilds the sidecar instead.
+#define SPATIAL_MAX_GAP 4096
+
+#define DEG_TO_RAD (M_PI / 180.0)
+
+typedef struct {
+    double min_lat;
+    double max_lat;
+    double min_lon;             // min_lon > max_lon crosses the antimeridian
+    double max_lon;
+    int has_center;
+    double lat;
+    double lon;
+    double radius_m;
+} SpatialQuery;
+
+typedef struct {
+    SpatialMatch* items;
+    int count;
+    int capacity;
+} MatchList;
+
+// An open sidecar: header, chain heads and entries mapped read-only.
+typedef struct {
+    int fd;
+    SpatialHeader hdr;
+    char* map;
+    size_t map_len;
+    const int64_t* heads;
+    int64_t mapped_entries;
+} SpatialIndex;
+
+double spatial_distance(double lat1, double lon1, double lat2, double lon2) {
+    double dlat = (lat2 - lat1) * DEG_TO_RAD;
+    double dlon = (lon2 - lon1) * DEG_TO_RAD;
+    double a = sin(dlat / 2) * sin(dlat / 2) +
+        cos(lat1 * DEG_TO_RAD) * cos(lat2 * DEG_TO_RAD) * sin(dlon / 2) * sin(dlon / 2);
+
+    return 2 * EARTH_RADIUS_M * asin(sqrt(a < 1 ? a : 1));
+}
+
+static int64_t grid_rows(double cell_deg) {
+    return (int64_t)ceil(180.0 / cell_deg);
+}
+
+static int64_t grid_cols(double cell_deg) {
+    return (int64_t)ceil(360.0 / cell_deg);
+}
+
+static int64_t cell_row(double lat, double cell_deg) {
+    int64_t row;
+
+    if (!isfinite(lat)) {
+        return 0;
+    }
+    row = (int64_t)floor((lat + 90.0) / cell_deg);
+    if (row < 0) {
+        return 0;
+    }
+    return row < grid_rows(cell_deg) ? row : grid_rows(cell_deg) - 1;
+}
+
+static int64_t cell_col(double lon, double cell_deg) {
+    int64_t cols = grid_cols(cell_deg);
+    int64_t col;
+
+    if (!isfinite(lon)) {
+        return 0;
+    }
+    col = (int64_t)floor((lon + 180.0) / cell_deg) % cols;
+    return col < 0 ? col + cols : col;
+}
+
+static uint32_t cell_bucket(int64_t row, int64_t col, uint32_t mask) {
+    uint64_t h = (uint64_t)row * 0x9e3779b97f4a7c15ull ^ (uint64_t)col * 0xc2b2ae3d27d4eb4full;
+
+    h ^= h >> 29;
+    return (uint32_t)h & mask;
+}
+
+static double level_deg(const SpatialHeader* hdr, int level) {
+    return level == 0 ? hdr->cell_deg : hdr->coarse_deg;
+}
+
+// Index into the head tables of both grids.
+static uint32_t entry_bucket(const SpatialHeader* hdr, int level, double lat, double lon) {
+    double cell = level_deg(hdr, level);
+
+    return (uint32_t)level * hdr->bucket_count +
+        cell_bucket(cell_row(lat, cell), cell_col(lon, cell), hdr->bucket_count - 1);
+}
+
+static off_t heads_offset(void) {
+    return (off_t)sizeof(SpatialHeader);
+}
+
+static off_t entry_offset(const SpatialHeader* hdr, int64_t slot) {
+    return heads_offset() + (off_t)SPATIAL_LEVELS * hdr->bucket_count * sizeof(int64_t) +
+        (off_t)slot * sizeof(SpatialEntry);
+}
+
+static int read_spatial_header(int fd, SpatialHeader* hdr) {
+    return pread(fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+        hdr->magic == SPATIAL_MAGIC &&
+        hdr->version == SPATIAL_VERSION &&
+        hdr->header_size == sizeof(SpatialHeader) &&
+        hdr->bucket_count >= SPATIAL_MIN_BUCKETS &&
+        (hdr->bucket_count & (hdr->bucket_count - 1)) == 0 &&
+        hdr->cell_deg > 0 && hdr->coarse_deg >= hdr->cell_deg && hdr->covered_slots >= 0;
+}
+
+static uint32_t buckets_for(int64_t slots) {
+    uint32_t buckets = SPATIAL_MIN_BUCKETS;
+
+    while ((int64_t)buckets < slots / 2 && buckets < (1u << 30)) {
+        buckets *= 2;
+    }
+    return buckets;
+}
+
+// Writes a new sidecar covering every slot of the snapshot.
+static int spatial_build(const char* hunt_id, const StoreSnapshot* snap) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char tmp_name[64];
+    SpatialHeader hdr;
+    SpatialEntry* entries;
+    int64_t* heads;
+    StoreIter it;
+    const TreasureRecord* record;
+    size_t heads_len, entries_len;
+    int fd;
+    int ok;
+
+    // Queries in several processes may rebuild at once; each writes its own
+    // file and the last rename wins.
+    snprintf(tmp_name, sizeof(tmp_name), SPATIAL_FILENAME ".%ld.tmp", (long)getpid());
+    if (!store_path(path, MAX_PATH, hunt_id, SPATIAL_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, tmp_name)) {
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SPATIAL_MAGIC;
+    hdr.version = SPATIAL_VERSION;
+    hdr.header_size = sizeof(SpatialHeader);
+    hdr.clue_gen = snap->hdr.clue_gen;
+    hdr.bucket_count = buckets_for(snap->hdr.slot_count);
+    hdr.covered_slots = snap->hdr.slot_count;
+    hdr.cell_deg = SPATIAL_CELL_DEG;
+    hdr.coarse_deg = SPATIAL_COARSE_DEG;
+
+    heads_len = (size_t)SPATIAL_LEVELS * hdr.bucket_count * sizeof(int64_t);
+    entries_len = (size_t)hdr.covered_slots * sizeof(SpatialEntry);
+    heads = calloc((size_t)SPATIAL_LEVELS * hdr.bucket_count, sizeof(int64_t));
+    entries = calloc((size_t)hdr.covered_slots + 1, sizeof(SpatialEntry));
+    if (heads == NULL || entries == NULL || !store_iter_snapshot(&it, snap)) {
+        free(heads);
+        free(entries);
+        return 0;
+    }
+
+    // Removed slots get an entry too, outside every chain, so entry i stays
+    // slot i.
+    for (int64_t slot = 0; slot < hdr.covered_slots; slot++) {
+        entries[slot].latitude = NAN;
+        entries[slot].longitude = NAN;
+    }
+    while ((record = store_iter_next(&it)) != NULL) {
+        int64_t slot = it.slot - 1;
+
+        entries[slot].latitude = record->latitude;
+        entries[slot].longitude = record->longitude;
+        for (int level = 0; level < SPATIAL_LEVELS; level++) {
+            uint32_t bucket = entry_bucket(&hdr, level, record->latitude, record->longitude);
+
+            entries[slot].next[level] = heads[bucket];
+            heads[bucket] = slot + 1;
+        }
+    }
+    if (it.slot < hdr.covered_slots) {
+        hdr.covered_slots = it.slot;
+        entries_len = (size_t)hdr.covered_slots * sizeof(SpatialEntry);
+    }
+    store_iter_close(&it);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(heads);
+        free(entries);
+        return 0;
+    }
+    ok = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        pwrite(fd, heads, heads_len, heads_offset()) == (ssize_t)heads_len &&
+        (entries_len == 0 || pwrite(fd, entries, entries_len, entry_offset(&hdr, 0)) == (ssize_t)entries_len);
+    free(heads);
+    free(entries);
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+void spatial_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count) {
+    char path[MAX_PATH];
+    SpatialHeader hdr;
+    SpatialEntry* entries;
+    int64_t* heads = NULL;
+    uint32_t touched[SPATIAL_SMALL_BATCH * SPATIAL_LEVELS];
+    int64_t touched_head[SPATIAL_SMALL_BATCH * SPATIAL_LEVELS];
+    int touched_count = 0;
+    size_t heads_len, entries_len;
+    int fd;
+
+    if (count <= 0 || !store_path(path, MAX_PATH, hunt_id, SPATIAL_FILENAME)) {
+        return;
+    }
+
+    // No sidecar yet: the first query builds one.
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (!read_spatial_header(fd, &hdr) || hdr.clue_gen != clue_gen || hdr.covered_slots != first_slot) {
+        // Out of step with the store; queries rebuild it when it matters.
+        // A store that shrank (a torn tail was cut) reuses slots the sidecar
+        // still describes, so that one is thrown away.
+        if (hdr.clue_gen == clue_gen && hdr.covered_slots > first_slot) {
+            ftruncate(fd, 0);
+        }
+        close(fd);
+        return;
+    }
+
+    heads_len = (size_t)SPATIAL_LEVELS * hdr.bucket_count * sizeof(int64_t);
+    entries_len = (size_t)count * sizeof(SpatialEntry);
+    entries = malloc(entries_len);
+    if (entries == NULL) {
+        close(fd);
+        return;
+    }
+    if (count > SPATIAL_SMALL_BATCH) {
+        heads = malloc(heads_len);
+        if (heads == NULL || pread(fd, heads, heads_len, heads_offset()) != (ssize_t)heads_len) {
+            free(heads);
+            free(entries);
+            close(fd);
+            return;
+        }
+    }
+
+    // Link the new entries in memory first; heads are only published once
+    // the entries they point to are on file.
+    for (int i = 0; i < count; i++) {
+        int64_t slot = first_slot + i;
+
+        entries[i].latitude = records[i].latitude;
+        entries[i].longitude = records[i].longitude;
+        for (int level = 0; level < SPATIAL_LEVELS; level++) {
+            uint32_t bucket = entry_bucket(&hdr, level, records[i].latitude, records[i].longitude);
+            int64_t head = 0;
+            int t;
+
+            if (heads != NULL) {
+                head = heads[bucket];
+                heads[bucket] = slot + 1;
+            } else {
+                for (t = 0; t < touched_count && touched[t] != bucket; t++) {
+                }
+                if (t == touched_count) {
+                    if (pread(fd, &head, sizeof(head), heads_offset() + (off_t)bucket * sizeof(int64_t)) != sizeof(head)) {
+                        head = 0;
+                    }
+                    touched[touched_count++] = bucket;
+                } else {
+                    head = touched_head[t];
+                }
+                touched_head[t] = slot + 1;
+            }
+            entries[i].next[level] = head;
+        }
+    }
+
+    if (pwrite(fd, entries, entries_len, entry_offset(&hdr, first_slot)) == (ssize_t)entries_len) {
+        int ok = 1;
+
+        if (heads != NULL) {
+            ok = pwrite(fd, heads, heads_len, heads_offset()) == (ssize_t)heads_len;
+        } else {
+            for (int t = 0; t < touched_count && ok; t++) {
+                ok = pwrite(fd, &touched_head[t], sizeof(int64_t),
+                    heads_offset() + (off_t)touched[t] * sizeof(int64_t)) == sizeof(int64_t);
+            }
+        }
+        if (ok) {
+            hdr.covered_slots += count;
+            pwrite(fd, &hdr, sizeof(hdr), 0);
+        }
+    }
+
+    free(heads);
+    free(entries);
+    close(fd);
+}
+
+// Opens and maps the sidecar if it can answer for the snapshot.
+static int index_open(const char* hunt_id, const StoreSnapshot* snap, SpatialIndex* index) {
+    char path[MAX_PATH];
+    struct stat st;
+
+    index->map = NULL;
+    index->fd = -1;
+    if (!store_path(path, MAX_PATH, hunt_id, SPATIAL_FILENAME)) {
+        return 0;
+    }
+    index->fd = open(path, O_RDONLY);
+    if (index->fd == -1) {
+        return 0;
+    }
+
+    if (!read_spatial_header(index->fd, &index->hdr) || index->hdr.clue_gen != snap->hdr.clue_gen ||
+        snap->hdr.slot_count - index->hdr.covered_slots > SPATIAL_MAX_GAP ||
+        fstat(index->fd, &st) == -1 || st.st_size < entry_offset(&index->hdr, 0)) {
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+
+    index->map_len = (size_t)st.st_size;
+    index->map = mmap(NULL, index->map_len, PROT_READ, MAP_SHARED, index->fd, 0);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+    index->heads = (const int64_t*)(index->map + heads_offset());
+    index->mapped_entries = (int64_t)((index->map_len - (size_t)entry_offset(&index->hdr, 0)) / sizeof(SpatialEntry));
+    return 1;
+}
+
+static void index_close(SpatialIndex* index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->map_len);
+    }
+    if (index->fd != -1) {
+        close(index->fd);
+    }
+}
+
+// Entries appended after the file was mapped are read with pread.
+static int index_entry(const SpatialIndex* index, int64_t slot, SpatialEntry* entry) {
+    if (slot < index->mapped_entries) {
+        memcpy(entry, index->map + entry_offset(&index->hdr, slot), sizeof(*entry));
+        return 1;
+    }
+    return pread(index->fd, entry, sizeof(*entry), entry_offset(&index->hdr, slot)) == sizeof(*entry);
+}
+
+static int query_matches(const SpatialQuery* q, double lat, double lon, double* distance) {
+    int in_lon;
+
+    if (!(lat >= q->min_lat && lat <= q->max_lat)) {
+        return 0;
+    }
+    if (q->min_lon <= q->max_lon) {
+        in_lon = lon >= q->min_lon && lon <= q->max_lon;
+    } else {
+        in_lon = lon >= q->min_lon || lon <= q->max_lon;
+    }
+    if (!in_lon) {
+        return 0;
+    }
+    *distance = 0;
+    if (q->has_center) {
+        *distance = spatial_distance(q->lat, q->lon, lat, lon);
+        return *distance <= q->radius_m;
+    }
+    return 1;
+}
+
+static int add_match(MatchList* list, const TreasureRecord* record, double distance) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        SpatialMatch* grown = realloc(list->items, (size_t)capacity * sizeof(SpatialMatch));
+        if (grown == NULL) {
+            return 0;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count].record = *record;
+    list->items[list->count].distance_m = distance;
+    list->count++;
+    return 1;
+}
+
+// Reads the record of a candidate slot and keeps it if it matches.
+static int check_slot(const StoreSnapshot* snap, const SpatialQuery* q, int64_t slot, MatchList* list) {
+    TreasureRecord record;
+    double distance;
+
+    if (store_snapshot_read(snap, slot, 1, &record) != 1) {
+        return 0;
+    }
+    if (!query_matches(q, record.latitude, record.longitude, &distance)) {
+        return 1;
+    }
+    return add_match(list, &record, distance);
+}
+
+// Walks the chains of every cell the query overlaps, on the fine grid or, if
+// the area covers too many fine cells, on the coarse one. Returns 0 if it
+// covers too many coarse cells as well and a scan is cheaper.
+static int walk_cells(const SpatialIndex* index, const StoreSnapshot* snap, const SpatialQuery* q,
+    int64_t covered, MatchList* list) {
+    uint32_t mask = index->hdr.bucket_count - 1;
+    double cell = 0;
+    int64_t cols = 0, r0 = 0, r1 = 0, c0 = 0, span = 0;
+    const int64_t* heads = index->heads;
+    int level;
+
+    for (level = 0; level < SPATIAL_LEVELS; level++) {
+        int64_t c1;
+
+        cell = level_deg(&index->hdr, level);
+        cols = grid_cols(cell);
+        r0 = cell_row(q->min_lat, cell);
+        r1 = cell_row(q->max_lat, cell);
+        c0 = cell_col(q->min_lon, cell);
+        c1 = cell_col(q->max_lon, cell);
+        span = q->min_lon <= q->max_lon ? c1 - c0 + 1 : cols - c0 + c1 + 1;
+        if (span <= 0 || span > cols || (q->min_lon <= q->max_lon && q->max_lon - q->min_lon >= 360.0)) {
+            c0 = 0;
+            span = cols;
+        }
+        if ((r1 - r0 + 1) * span <= 4 * (int64_t)index->hdr.bucket_count) {
+            break;
+        }
+        heads += index->hdr.bucket_count;
+    }
+    if (level == SPATIAL_LEVELS) {
+        return 0;
+    }
+
+    for (int64_t row = r0; row <= r1; row++) {
+        for (int64_t i = 0; i < span; i++) {
+            int64_t col = (c0 + i) % cols;
+            int64_t next = heads[cell_bucket(row, col, mask)];
+            int64_t steps = 0;
+            SpatialEntry entry;
+            double distance;
+
+            while (next > 0 && steps++ <= index->hdr.covered_slots + SPATIAL_MAX_GAP) {
+                int64_t slot = next - 1;
+
+                if (!index_entry(index, slot, &entry)) {
+                    break;
+                }
+                next = entry.next[level];
+                // Newer than the snapshot, removed, or another cell in the
+                // same bucket.
+                if (slot >= covered || store_snapshot_is_dead(snap, slot) ||
+                    cell_row(entry.latitude, cell) != row || cell_col(entry.longitude, cell) != col ||
+                    !query_matches(q, entry.latitude, entry.longitude, &distance)) {
+                    continue;
+                }
+                if (!check_slot(snap, q, slot, list)) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static int by_distance(const void* a, const void* b) {
+    const SpatialMatch* x = a;
+    const SpatialMatch* y = b;
+
+    if (x->distance_m != y->distance_m) {
+        return x->distance_m < y->distance_m ? -1 : 1;
+    }
+    return x->record.treasure_id - y->record.treasure_id;
+}
+
+static int by_id(const void* a, const void* b) {
+    const SpatialMatch* x = a;
+    const SpatialMatch* y = b;
+
+    return (x->record.treasure_id > y->record.treasure_id) - (x->record.treasure_id < y->record.treasure_id);
+}
+
+static int run_query(const char* hunt_id, const SpatialQuery* q, SpatialMatch** matches) {
+    StoreSnapshot snap;
+    SpatialIndex index;
+    StoreIter it;
+    MatchList list = { NULL, 0, 0 };
+    const TreasureRecord* record;
+    int64_t covered = 0;
+    int walked = 0;
+    int failed = 0;
+    double distance;
+
+    *matches = NULL;
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if (!index_open(hunt_id, &snap, &index) && spatial_build(hunt_id, &snap)) {
+        index_open(hunt_id, &snap, &index);
+    }
+    if (index.map != NULL) {
+        covered = index.hdr.covered_slots < snap.hdr.slot_count ? index.hdr.covered_slots : snap.hdr.slot_count;
+        walked = walk_cells(&index, &snap, q, covered, &list);
+        failed = walked == -1;
+    }
+    index_close(&index);
+
+    // Slots the sidecar does not cover yet, or all of them when the area is
+    // too large for either grid to help.
+    if (!failed && store_iter_snapshot(&it, &snap)) {
+        if (walked == 1) {
+            store_iter_seek(&it, covered);
+        }
+        while (!failed && (record = store_iter_next(&it)) != NULL) {
+            if (query_matches(q, record->latitude, record->longitude, &distance) &&
+                !add_match(&list, record, distance)) {
+                failed = 1;
+            }
+        }
+        store_iter_close(&it);
+    }
+    store_snapshot_close(&snap);
+
+    if (failed) {
+        free(list.items);
+        return -1;
+    }
+    qsort(list.items, (size_t)list.count, sizeof(SpatialMatch), q->has_center ? by_distance : by_id);
+    *matches = list.items;
+    return list.count;
+}
+
+static double normalize_lon(double lon) {
+    lon = fmod(lon + 180.0, 360.0);
+    return (lon < 0 ? lon + 360.0 : lon) - 180.0;
+}
+
+int spatial_nearby(const char* hunt_id, double latitude, double longitude, double radius_m,
+    SpatialMatch** matches) {
+    SpatialQuery q;
+    double dlat = radius_m / (EARTH_RADIUS_M * DEG_TO_RAD);
+    double coslat;
+
+    memset(&q, 0, sizeof(q));
+    q.has_center = 1;
+    q.lat = latitude;
+    q.lon = longitude;
+    q.radius_m = radius_m;
+    q.min_lat = latitude - dlat;
+    q.max_lat = latitude + dlat;
+
+    // Near a pole, or with a radius wider than half a meridian, every
+    // longitude can be in range.
+    coslat = cos((fabs(latitude) + dlat) * DEG_TO_RAD);
+    if (q.max_lat >= 90.0 || q.min_lat <= -90.0 || coslat <= 0 || dlat / coslat >= 180.0) {
+        q.min_lon = -180.0;
+        q.max_lon = 180.0;
+    } else {
+        q.min_lon = normalize_lon(longitude - dlat / coslat);
+        q.max_lon = normalize_lon(longitude + dlat / coslat);
+    }
+    return run_query(hunt_id, &q, matches);
+}
+
+int spatial_bbox(const char* hunt_id, double min_lat, double min_lon, double max_lat, double max_lon,
+    SpatialMatch** matches) {
+    SpatialQuery q;
+
+    memset(&q, 0, sizeof(q));
+    q.min_lat = min_lat;
+    q.max_lat = max_lat;
+    if (max_lon - min_lon >= 360.0) {
+        q.min_lon = -180.0;
+        q.max_lon = 180.0;
+    } else {
+        q.min_lon = normalize_lon(min_lon);
+        q.max_lon = max_lon == 180.0 ? 180.0 : normalize_lon(max_lon);
+    }
+    return run_query(hunt_id, &q, matches);
+}
@@ -0,0 +1,81 @@
+#ifndef TREASURE_SPATIAL_H
+#define TREASURE_SPATIAL_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// Per-hunt "spatial" sidecar: a latitude/longitude grid, so nearby and
+// bounding-box queries visit the cells they overlap instead of every record.
+// There are two grids: a fine one of cell_deg cells for the usual few-km
+// queries, and a coarse one of coarse_deg cells that areas covering too many
+// fine cells walk instead, so only continent-sized areas fall back to a scan.
+// The cells of each grid are hashed into their own table of buckets, and each
+// bucket heads a chain through the entries of its cells, newest first. There
+// is one entry per treasures.dat slot, linked into one chain of each grid, so
+// entry i describes slot i and an append writes one entry and two bucket
+// heads per record.
+//
+// Slots only change when a hunt is compacted. The sidecar records the
+// clue_gen it was built for and how many slots it covers. Appends are applied
+// only when it covers exactly the slots before them, the same rule as the ID
+// index. Queries scan the few slots past the covered ones directly, and
+// rebuild the sidecar from their snapshot when it belongs to another
+// generation or has fallen far behind. Removed records stay in their chains
+// and are filtered through the snapshot's tombstones. Like the ID index, the
+// sidecar is first built by a query, so hunts nobody queries pay nothing on
+// writes.
+
+#define SPATIAL_FILENAME "spatial"
+#define SPATIAL_MAGIC 0x54415053u /* "SPAT" */
+#define SPATIAL_VERSION 2
+
+#define SPATIAL_CELL_DEG 0.01       // about 1.1 km of latitude
+#define SPATIAL_COARSE_DEG 1.0      // about 111 km
+#define SPATIAL_LEVELS 2            // the fine grid, then the coarse one
+#define SPATIAL_MIN_BUCKETS 1024
+#define EARTH_RADIUS_M 6371000.0
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t clue_gen;          // treasures.dat file generation the slots refer to
+    uint32_t bucket_count;      // power of two
+    int64_t covered_slots;      // entries exist for slots [0, covered_slots)
+    double cell_deg;
+    double coarse_deg;
+} SpatialHeader;
+
+// The header is followed by bucket_count int64 chain heads per grid (entry +
+// 1, 0 for an empty bucket), fine grid first, and then one entry per slot.
+typedef struct {
+    double latitude;
+    double longitude;
+    int64_t next[SPATIAL_LEVELS];   // entry + 1 of the next entry in the bucket of each grid, 0 ends
+} SpatialEntry;
+
+typedef struct {
+    TreasureRecord record;
+    double distance_m;          // from the query point; 0 for bounding boxes
+} SpatialMatch;
+
+// Called by the store with the hunt lock held, after records were appended
+// at first_slot.
+void spatial_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count);
+
+// Treasures within radius_m metres of (latitude, longitude), nearest first.
+// Returns how many there are with a malloc'd array in *matches, or -1.
+int spatial_nearby(const char* hunt_id, double latitude, double longitude, double radius_m,
+    SpatialMatch** matches);
+
+// Treasures inside a box, in file order. A box with min_lon > max_lon
+// crosses the antimeridian. Returns like spatial_nearby.
+int spatial_bbox(const char* hunt_id, double min_lat, double min_lon, double max_lat, double max_lon,
+    SpatialMatch** matches);
+
+// Great-circle distance in metres.
+double spatial_distance(double lat1, double lon1, double lat2, double lon2);
+
+#endif
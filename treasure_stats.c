@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "treasure_stats.h"
+
+// Per thread, so score_calculator's scan threads never share a cache line.
+static __thread StatsIO io_counters;
+
+static const StatsOp* exit_ops = NULL;
+static int exit_count = 0;
+
+void stats_add_read(size_t bytes, int64_t records) {
+    io_counters.reads++;
+    io_counters.bytes_read += bytes;
+    io_counters.records_read += (uint64_t)records;
+}
+
+void stats_get_io(StatsIO* io) {
+    *io = io_counters;
+}
+
+void stats_add_io(const StatsIO* io) {
+    io_counters.reads += io->reads;
+    io_counters.bytes_read += io->bytes_read;
+    io_counters.records_read += io->records_read;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static int bucket_of(uint64_t value) {
+    int exponent;
+
+    if (value < STATS_SUB_BUCKETS) {
+        return (int)value;
+    }
+    exponent = 63 - __builtin_clzll(value);
+    return STATS_SUB_BUCKETS + (exponent - 3) * STATS_SUB_BUCKETS +
+        (int)((value >> (exponent - 3)) - STATS_SUB_BUCKETS);
+}
+
+// Largest value that falls in bucket.
+static uint64_t bucket_upper(int bucket) {
+    int exponent;
+    uint64_t sub;
+
+    if (bucket < STATS_SUB_BUCKETS) {
+        return (uint64_t)bucket;
+    }
+    exponent = (bucket - STATS_SUB_BUCKETS) / STATS_SUB_BUCKETS + 3;
+    sub = (uint64_t)((bucket - STATS_SUB_BUCKETS) % STATS_SUB_BUCKETS);
+    return ((STATS_SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+}
+
+void stats_begin(StatsTimer* timer) {
+    timer->io = io_counters;
+    timer->start_ns = now_ns();
+}
+
+void stats_end(StatsOp* op, const StatsTimer* timer) {
+    uint64_t elapsed = now_ns() - timer->start_ns;
+
+    op->calls++;
+    op->total_ns += elapsed;
+    if (elapsed > op->max_ns) {
+        op->max_ns = elapsed;
+    }
+    op->buckets[bucket_of(elapsed)]++;
+    op->reads += io_counters.reads - timer->io.reads;
+    op->bytes_read += io_counters.bytes_read - timer->io.bytes_read;
+    op->records_read += io_counters.records_read - timer->io.records_read;
+}
+
+uint64_t stats_percentile(const StatsOp* op, double p) {
+    uint64_t rank = (uint64_t)(p * (double)op->calls + 0.999999);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (int bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        seen += op->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(bucket);
+            return upper < op->max_ns ? upper : op->max_ns;
+        }
+    }
+    return op->max_ns;
+}
+
+// Reads one "name: value" line of /proc/self/io, or returns 0.
+static unsigned long long proc_io_field(const char* text, const char* name) {
+    const char* field = strstr(text, name);
+    return field ? strtoull(field + strlen(name), NULL, 10) : 0;
+}
+
+static void print_process(FILE* out) {
+    char buf[512];
+    struct rusage usage;
+    ssize_t len;
+    int fd = open("/proc/self/io", O_RDONLY);
+
+    len = fd != -1 ? read(fd, buf, sizeof(buf) - 1) : -1;
+    if (fd != -1) {
+        close(fd);
+    }
+    if (len > 0) {
+        buf[len] = '\0';
+        fprintf(out, "Process I/O: %llu read calls, %llu write calls, %llu bytes read, %llu bytes written\n",
+            proc_io_field(buf, "syscr:"), proc_io_field(buf, "syscw:"),
+            proc_io_field(buf, "rchar:"), proc_io_field(buf, "wchar:"));
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(out, "Process: %.3f s user, %.3f s system, max RSS %ld KB\n",
+            usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+            usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, usage.ru_maxrss);
+    }
+}
+
+void stats_print(FILE* out, const StatsOp* ops, int count, int with_cache) {
+    int printed = 0;
+
+    fprintf(out, "%-16s | %8s | %10s | %10s | %10s | %10s | %10s | %8s | %12s | %10s",
+        "Operation", "Calls", "Mean (us)", "p50 (us)", "p90 (us)", "p99 (us)", "Max (us)",
+        "Reads", "Bytes read", "Records");
+    if (with_cache) {
+        fprintf(out, " | %8s | %8s | %9s", "Hits", "Misses", "Refreshes");
+    }
+    fprintf(out, "\n");
+
+    for (int i = 0; i < count; i++) {
+        const StatsOp* op = &ops[i];
+
+        if (op->name == NULL || op->calls == 0) {
+            continue;
+        }
+        fprintf(out, "%-16s | %8llu | %10.1f | %10.1f | %10.1f | %10.1f | %10.1f | %8llu | %12llu | %10llu",
+            op->name, (unsigned long long)op->calls, op->total_ns / 1e3 / (double)op->calls,
+            stats_percentile(op, 0.50) / 1e3, stats_percentile(op, 0.90) / 1e3,
+            stats_percentile(op, 0.99) / 1e3, op->max_ns / 1e3,
+            (unsigned long long)op->reads, (unsigned long long)op->bytes_read,
+            (unsigned long long)op->records_read);
+        if (with_cache) {
+            fprintf(out, " | %8llu | %8llu | %9llu", (unsigned long long)op->cache_hits,
+                (unsigned long long)op->cache_misses, (unsigned long long)op->cache_refreshes);
+        }
+        fprintf(out, "\n");
+        printed++;
+    }
+    if (printed == 0) {
+        fprintf(out, "No operations recorded\n");
+    }
+    print_process(out);
+}
+
+static void dump_at_exit(void) {
+    const char* target = getenv("TREASURE_STATS");
+    FILE* out;
+
+    if (target == NULL || target[0] == '\0' || exit_ops == NULL) {
+        return;
+    }
+    if (strcmp(target, "1") == 0 || strcmp(target, "stderr") == 0) {
+        out = stderr;
+    } else {
+        out = fopen(target, "a");
+        if (out == NULL) {
+            perror(target);
+            return;
+        }
+    }
+    fprintf(out, "Stats for PID %d:\n", (int)getpid());
+    stats_print(out, exit_ops, exit_count, 0);
+    if (out != stderr) {
+        fclose(out);
+    }
+}
+
+void stats_dump_at_exit(const StatsOp* ops, int count) {
+    if (exit_ops == NULL) {
+        atexit(dump_at_exit);
+    }
+    exit_ops = ops;
+    exit_count = count;
+}
@@ -0,0 +1,71 @@
+#ifndef TREASURE_STATS_H
+#define TREASURE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Runtime counters for treasure_manager and the hub's monitor workers.
+//
+// The store counts its own reads (calls, bytes and records) in per-thread
+// counters. A command is timed between stats_begin and stats_end, which add
+// its latency to the command's histogram and charge it the reads made in
+// between. Sidecar indexes are read through their own files and are not
+// counted; the process totals from /proc/self/io printed with the table
+// include everything.
+//
+// Latencies go into HDR-style buckets: exact below 8 ns, then eight linear
+// sub-buckets per power of two, so any value is known to within 12.5%
+// across the whole range without storing samples.
+
+#define STATS_SUB_BUCKETS 8
+#define STATS_BUCKETS (STATS_SUB_BUCKETS + 61 * STATS_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t reads;             // read calls issued by the store
+    uint64_t bytes_read;
+    uint64_t records_read;
+} StatsIO;
+
+typedef struct {
+    const char* name;
+    uint64_t calls;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t reads;
+    uint64_t bytes_read;
+    uint64_t records_read;
+    uint64_t cache_hits;        // filled in by callers that have a cache
+    uint64_t cache_misses;
+    uint64_t cache_refreshes;
+    uint32_t buckets[STATS_BUCKETS];
+} StatsOp;
+
+typedef struct {
+    uint64_t start_ns;
+    StatsIO io;
+} StatsTimer;
+
+// Called by the store after every successful read.
+void stats_add_read(size_t bytes, int64_t records);
+// The calling thread's read counters, and adding a worker thread's counters
+// to them once it is done.
+void stats_get_io(StatsIO* io);
+void stats_add_io(const StatsIO* io);
+
+void stats_begin(StatsTimer* timer);
+void stats_end(StatsOp* op, const StatsTimer* timer);
+
+// Latency at fraction p (0..1) of op's calls, in nanoseconds: the upper
+// bound of the bucket it falls in, capped at the maximum seen.
+uint64_t stats_percentile(const StatsOp* op, double p);
+
+// Prints a table of the ops that were called, then the process totals.
+// with_cache adds the cache columns.
+void stats_print(FILE* out, const StatsOp* ops, int count, int with_cache);
+
+// Prints ops when the process exits if TREASURE_STATS is set: to stderr for
+// "1" or "stderr", otherwise appended to the file it names.
+void stats_dump_at_exit(const StatsOp* ops, int count);
+
+#endif
@@ -0,0 +1,2580 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <errno.h>
+
+#include "treasure_store.h"
+#include "treasure_scores.h"
+#include "treasure_spatial.h"
+#include "treasure_search.h"
+#include "treasure_users.h"
+#include "treasure_zones.h"
+#include "treasure_stats.h"
+
+#define WRITE_BLOCK_BYTES (256 * 1024)
+
+// Pre-split versions stored the whole 576-byte Treasure in treasures.dat.
+#define LEGACY_RECORD_SIZE sizeof(Treasure)
+// Versions 1 to 4 had a 64-byte header with the records right behind it.
+#define INLINE_HEADER_SIZE 64
+// Times a reader re-pins when compactions keep replacing the generation.
+#define SNAPSHOT_RETRIES 16
+#define MAX_SCAN_THREADS 64
+
+static int index_find(const char* hunt_id, StoreSnapshot* snap, int treasure_id, TreasureRecord* out, int64_t* slot,
+    int locked);
+static int index_rebuild(const char* hunt_id, int locked);
+static void index_clear(const char* hunt_id, int treasure_id);
+
+int store_path(char* path, size_t size, const char* hunt_id, const char* name) {
+    int n = snprintf(path, size, "%s/%s", hunt_id, name);
+    return n >= 0 && (size_t)n < size;
+}
+
+// The clue heap of a version 3 or 4 hunt.
+static int heap_path(char* path, size_t size, const char* hunt_id, uint32_t gen) {
+    char name[32];
+
+    snprintf(name, sizeof(name), CLUES_FILENAME_FMT, gen);
+    return store_path(path, size, hunt_id, name);
+}
+
+static int segment_path(char* path, size_t size, const char* hunt_id, uint32_t number, int clues) {
+    char name[40];
+
+    if (clues) {
+        snprintf(name, sizeof(name), SEGMENT_CLUES_FILENAME_FMT, number);
+    } else {
+        snprintf(name, sizeof(name), SEGMENT_FILENAME_FMT, number);
+    }
+    return store_path(path, size, hunt_id, name);
+}
+
+// CRC-32C, four bits at a time.
+static const uint32_t crc_nibbles[16] = {
+    0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+    0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
+
+static uint32_t record_checksum(const TreasureRecord* record) {
+    const unsigned char* p = (const unsigned char*)record;
+    size_t skip = offsetof(TreasureRecord, checksum);
+    uint32_t crc = 0xffffffffu;
+
+    for (size_t i = 0; i < sizeof(*record); i++) {
+        unsigned char byte = (i >= skip && i < skip + sizeof(record->checksum)) ? 0 : p[i];
+        crc ^= byte;
+        crc = (crc >> 4) ^ crc_nibbles[crc & 0x0f];
+        crc = (crc >> 4) ^ crc_nibbles[crc & 0x0f];
+    }
+    crc = ~crc;
+    return crc ? crc : 1;
+}
+
+static void seal_record(TreasureRecord* record) {
+    record->checksum = record_checksum(record);
+}
+
+static int record_is_intact(const TreasureRecord* record) {
+    return record->checksum == record_checksum(record);
+}
+
+static int deletes_path(char* path, size_t size, const char* hunt_id, uint32_t gen) {
+    char name[32];
+
+    snprintf(name, sizeof(name), DELETES_FILENAME_FMT, gen);
+    return store_path(path, size, hunt_id, name);
+}
+
+static void init_header(StoreHeader* hdr) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = STORE_MAGIC;
+    hdr->version = STORE_VERSION;
+    hdr->header_size = sizeof(StoreHeader);
+    hdr->record_size = sizeof(TreasureRecord);
+    hdr->next_id = 1;
+    hdr->clue_gen = 1;
+    hdr->next_segment = 1;
+    hdr->segment_records = store_segment_records();
+}
+
+// Records per segment of the hunt hdr describes. Headers written before
+// the size was recorded take this process's setting, which the caller's
+// next header write records.
+static int64_t segment_capacity(StoreHeader* hdr) {
+    if (hdr->segment_records <= 0) {
+        hdr->segment_records = store_segment_records();
+    }
+    return hdr->segment_records;
+}
+
+static int header_is_valid(const StoreHeader* hdr) {
+    return hdr->magic == STORE_MAGIC &&
+        hdr->version == STORE_VERSION &&
+        hdr->header_size == sizeof(StoreHeader) &&
+        hdr->record_size == sizeof(TreasureRecord);
+}
+
+// Versions 3 and 4 kept the split records in treasures.dat, behind a header
+// that is the first 64 bytes of StoreHeader. Version 3 is version 4 without
+// checksums; its records are trusted as they are.
+static int header_is_inline(StoreHeader* hdr) {
+    if (hdr->magic != STORE_MAGIC || hdr->header_size != INLINE_HEADER_SIZE ||
+        hdr->record_size != sizeof(TreasureRecord)) {
+        return 0;
+    }
+    if (hdr->version == 3) {
+        hdr->synced_slots = (uint32_t)hdr->slot_count;
+        return 1;
+    }
+    return hdr->version == 4;
+}
+
+// Versions 1 and 2 had a header in front of full Treasure records. Their
+// fields line up with StoreHeader; version 1 just leaves slot/dead at zero.
+static int header_is_legacy(StoreHeader* hdr) {
+    if (hdr->magic != STORE_MAGIC || hdr->header_size != INLINE_HEADER_SIZE ||
+        hdr->record_size != LEGACY_RECORD_SIZE) {
+        return 0;
+    }
+    if (hdr->version == 1) {
+        hdr->slot_count = hdr->record_count;
+        hdr->dead_count = 0;
+        return 1;
+    }
+    return hdr->version == 2;
+}
+
+// Older headers are shorter; whatever follows them is read along but only
+// the first 64 bytes are looked at.
+static int read_header(int fd, StoreHeader* hdr) {
+    ssize_t n;
+
+    memset(hdr, 0, sizeof(*hdr));
+    n = pread(fd, hdr, sizeof(*hdr), 0);
+    if (n < INLINE_HEADER_SIZE) {
+        return 0;
+    }
+    stats_add_read((size_t)n, 0);
+    return header_is_valid(hdr);
+}
+
+int store_write_header(int fd, const StoreHeader* hdr) {
+    // One pwrite of a 128-byte block: readers see either the old or the new header.
+    if (pwrite(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr)) {
+        perror("Failed to write treasures header");
+        return 0;
+    }
+    return 1;
+}
+
+// Reads the segment_count manifest entries hdr publishes. *entries stays
+// NULL for a hunt without segments.
+static int read_manifest(int fd, const StoreHeader* hdr, SegmentEntry** entries) {
+    size_t len = (size_t)hdr->segment_count * sizeof(SegmentEntry);
+
+    *entries = NULL;
+    if (hdr->segment_count == 0) {
+        return 1;
+    }
+    *entries = malloc(len);
+    if (*entries == NULL || pread(fd, *entries, len, hdr->header_size) != (ssize_t)len) {
+        free(*entries);
+        *entries = NULL;
+        return 0;
+    }
+    stats_add_read(len, 0);
+    return 1;
+}
+
+// Fills a new treasures file with hdr and its manifest.
+static int write_manifest(int fd, const StoreHeader* hdr, const SegmentEntry* entries) {
+    ssize_t len = (ssize_t)(hdr->segment_count * sizeof(SegmentEntry));
+
+    return (len == 0 || pwrite(fd, entries, (size_t)len, hdr->header_size) == len) &&
+        store_write_header(fd, hdr) &&
+        (store_sync_policy() != SYNC_GROUP || fdatasync(fd) == 0);
+}
+
+int store_open_deletes(const char* hunt_id, uint32_t gen) {
+    char path[MAX_PATH];
+    char legacy_path[MAX_PATH];
+    int fd;
+
+    if (!deletes_path(path, MAX_PATH, hunt_id, gen) ||
+        !store_path(legacy_path, MAX_PATH, hunt_id, LEGACY_DELETES_FILENAME)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd == -1 && errno == ENOENT) {
+        fd = open(legacy_path, O_RDONLY);
+        // A writer may have just renamed it to the generation's name.
+        if (fd == -1 && errno == ENOENT) {
+            fd = open(path, O_RDONLY);
+        }
+    }
+    return fd;
+}
+
+// Moves a pre-generation treasures.dat tombstone file to its generation's
+// name. Called by writers with the hunt lock held.
+static void adopt_legacy_deletes(const char* hunt_id, uint32_t gen) {
+    char path[MAX_PATH];
+    char legacy_path[MAX_PATH];
+
+    if (deletes_path(path, MAX_PATH, hunt_id, gen) &&
+        store_path(legacy_path, MAX_PATH, hunt_id, LEGACY_DELETES_FILENAME) &&
+        access(legacy_path, F_OK) == 0 && access(path, F_OK) == -1 && errno == ENOENT) {
+        rename(legacy_path, path);
+    }
+}
+
+// Reads the first dead_count tombstones from fd into a bitmap indexed by
+// slot. *dead stays NULL when there is nothing to skip. Returns 0 if the
+// file is shorter than the header says.
+static int read_dead(int fd, const StoreHeader* hdr, uint8_t** dead) {
+    uint32_t* slots;
+    uint8_t* bits;
+    ssize_t len;
+
+    *dead = NULL;
+    if (hdr->dead_count <= 0) {
+        return 1;
+    }
+
+    len = (ssize_t)(hdr->dead_count * sizeof(uint32_t));
+    slots = malloc((size_t)len);
+    bits = calloc((size_t)(hdr->slot_count + 7) / 8 + 1, 1);
+    if (slots == NULL || bits == NULL || pread(fd, slots, (size_t)len, 0) != len) {
+        free(slots);
+        free(bits);
+        return 0;
+    }
+    stats_add_read((size_t)len, 0);
+
+    for (int64_t i = 0; i < hdr->dead_count; i++) {
+        if (slots[i] < (uint64_t)hdr->slot_count) {
+            bits[slots[i] / 8] |= (uint8_t)(1u << (slots[i] % 8));
+        }
+    }
+    free(slots);
+    *dead = bits;
+    return 1;
+}
+
+// Loads the tombstones of hdr's generation by name into *dead, which stays
+// NULL when there is nothing to skip. Returns 0 with errno set if they
+// cannot be opened or read.
+static int load_dead(const char* hunt_id, const StoreHeader* hdr, uint8_t** dead) {
+    int fd;
+    int ok;
+
+    *dead = NULL;
+    if (hdr->dead_count <= 0) {
+        return 1;
+    }
+    fd = store_open_deletes(hunt_id, hdr->clue_gen);
+    if (fd == -1) {
+        return 0;
+    }
+    ok = read_dead(fd, hdr, dead);
+    close(fd);
+    if (!ok) {
+        errno = EIO;
+    }
+    return ok;
+}
+
+// Loads the tombstones of snap's generation unless they already are.
+static int snapshot_dead(const char* hunt_id, StoreSnapshot* snap) {
+    return snap->dead != NULL || load_dead(hunt_id, &snap->hdr, &snap->dead);
+}
+
+static int is_dead(const uint8_t* dead, int64_t slot) {
+    return dead && (dead[slot / 8] & (1u << (slot % 8)));
+}
+
+static int scan_backend = -1;
+
+ScanBackend store_scan_backend(void) {
+    if (scan_backend == -1) {
+        const char* env = getenv("TREASURE_SCAN_BACKEND");
+        scan_backend = (env && strcmp(env, "mmap") == 0) ? SCAN_MMAP : SCAN_BLOCK;
+    }
+    return (ScanBackend)scan_backend;
+}
+
+void store_set_scan_backend(ScanBackend backend) {
+    scan_backend = backend;
+}
+
+static int scan_threads = 0;
+
+int store_scan_threads(void) {
+    if (scan_threads == 0) {
+        const char* env = getenv("TREASURE_SCAN_THREADS");
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = env ? atoi(env) : 0;
+
+        if (threads <= 0) {
+            threads = cores > 0 ? (int)cores : 1;
+        }
+        scan_threads = threads < MAX_SCAN_THREADS ? threads : MAX_SCAN_THREADS;
+    }
+    return scan_threads;
+}
+
+static int64_t segment_records = 0;
+
+int64_t store_segment_records(void) {
+    if (segment_records == 0) {
+        const char* env = getenv("TREASURE_SEGMENT_MB");
+        double mb = env ? atof(env) : 0;
+        int64_t records = (int64_t)((mb > 0 ? mb : SEGMENT_MB) * 1024 * 1024) / (int64_t)sizeof(TreasureRecord);
+
+        segment_records = records > 0 ? records : 1;
+    }
+    return segment_records;
+}
+
+int64_t store_data_size(const StoreHeader* hdr) {
+    return hdr->header_size + (int64_t)hdr->segment_count * (int64_t)sizeof(SegmentEntry) +
+        hdr->slot_count * (int64_t)hdr->record_size;
+}
+
+// Points the scan at count records of fd from start on.
+static int iter_run(StoreIter* it, int fd, off_t start, int64_t count) {
+    if (it->backend == SCAN_MMAP && it->data != NULL) {
+        munmap(it->data, it->data_len);
+        it->data = NULL;
+    }
+    it->fd = fd;
+    it->next_offset = start;
+    it->run_remaining = count;
+    it->data_len = 0;
+    it->pos = 0;
+    if (count <= 0) {
+        return 1;
+    }
+
+    if (it->backend == SCAN_MMAP) {
+        size_t len = start + (size_t)count * it->record_size;
+        void* map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            // A mapping is counted as one read of everything it covers.
+            stats_add_read(len - start, count);
+            madvise(map, len, MADV_SEQUENTIAL);
+            it->data = map;
+            it->data_len = len;
+            it->pos = start;
+            return 1;
+        }
+        // Fall back to block reads if the file cannot be mapped.
+        it->backend = SCAN_BLOCK;
+    }
+
+    if (it->data == NULL) {
+        it->data = malloc(SCAN_BLOCK_RECORDS * it->record_size);
+        if (it->data == NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Scans count records of record_size bytes starting at start of one file.
+// The iterator takes ownership of fd only when owns_fd is set.
+static int iter_init(StoreIter* it, int fd, int owns_fd, off_t start, int64_t count, size_t record_size) {
+    memset(it, 0, sizeof(*it));
+    it->backend = store_scan_backend();
+    it->record_size = record_size;
+    it->remaining = count;
+    if (!iter_run(it, fd, start, count)) {
+        return 0;
+    }
+    it->owns_fd = owns_fd;
+    return 1;
+}
+
+// Scans count segments of snap from index on. Each segment is entered when
+// the scan reaches it.
+static void iter_segments(StoreIter* it, const StoreSnapshot* snap, int index, int count) {
+    memset(it, 0, sizeof(*it));
+    it->fd = -1;
+    it->backend = store_scan_backend();
+    it->record_size = snap->hdr.record_size;
+    it->hdr = snap->hdr;
+    it->dead = snap->dead;
+    it->segments = snap->segments + index;
+    it->segment_count = count;
+    if (count > 0) {
+        const StoreSegment* last = &it->segments[count - 1];
+
+        it->slot = it->segments[0].first_slot;
+        it->remaining = last->first_slot + last->slot_count - it->slot;
+    }
+}
+
+// Moves the scan on to the next segment, past any slots a seek skipped.
+// Returns 0 when there is none left.
+static int next_segment(StoreIter* it) {
+    const StoreSegment* seg;
+    int64_t skip, count;
+
+    if (it->segment_count <= 0) {
+        return 0;
+    }
+    seg = it->segments++;
+    it->segment_count--;
+
+    skip = it->slot - seg->first_slot;
+    if (skip < 0) {
+        skip = 0;
+    }
+    count = seg->slot_count - skip;
+    if (count > it->remaining) {
+        count = it->remaining;
+    }
+    if (count <= 0) {
+        return 1;
+    }
+    if (seg->fd == -1) {
+        // Missing from a generation that is served as far as it can be read.
+        it->slot += count;
+        it->remaining -= count;
+        return 1;
+    }
+    return iter_run(it, seg->fd, seg->data_offset + (off_t)skip * (off_t)it->record_size, count);
+}
+
+int store_iter_open(StoreIter* it, const char* hunt_id) {
+    StoreSnapshot* snap = malloc(sizeof(*snap));
+
+    if (snap == NULL) {
+        return 0;
+    }
+    if (!store_snapshot_open(snap, hunt_id)) {
+        free(snap);
+        return 0;
+    }
+    iter_segments(it, snap, 0, snap->segment_count);
+    it->snap = snap;
+    return 1;
+}
+
+static const char* next_slot(StoreIter* it) {
+    const char* record;
+
+    while (it->run_remaining <= 0) {
+        if (it->remaining <= 0 || !next_segment(it)) {
+            it->remaining = 0;
+            return NULL;
+        }
+    }
+
+    if (it->backend == SCAN_BLOCK && it->pos >= it->data_len) {
+        size_t want = SCAN_BLOCK_RECORDS;
+        ssize_t n;
+
+        if ((int64_t)want > it->run_remaining) {
+            want = (size_t)it->run_remaining;
+        }
+        n = pread(it->fd, it->data, want * it->record_size, it->next_offset);
+        if (n < (ssize_t)it->record_size) {
+            it->remaining = 0;
+            it->run_remaining = 0;
+            return NULL;
+        }
+        it->data_len = (size_t)n - (size_t)n % it->record_size;
+        stats_add_read((size_t)n, (int64_t)(it->data_len / it->record_size));
+        it->next_offset += it->data_len;
+        it->pos = 0;
+    }
+
+    record = it->data + it->pos;
+    it->pos += it->record_size;
+    it->run_remaining--;
+    it->remaining--;
+    it->slot++;
+    return record;
+}
+
+static const char* next_live(StoreIter* it) {
+    const char* record;
+
+    do {
+        record = next_slot(it);
+    } while (record != NULL && is_dead(it->dead, it->slot - 1));
+    return record;
+}
+
+const TreasureRecord* store_iter_next(StoreIter* it) {
+    return (const TreasureRecord*)next_live(it);
+}
+
+void store_iter_seek(StoreIter* it, int64_t slot) {
+    int64_t skip = slot - it->slot;
+    int64_t buffered;
+
+    if (skip <= 0) {
+        return;
+    }
+    if (skip > it->remaining) {
+        skip = it->remaining;
+    }
+
+    if (skip >= it->run_remaining) {
+        // Leaves the current segment; next_segment skips the rest.
+        it->run_remaining = 0;
+    } else if (it->backend == SCAN_MMAP) {
+        it->pos += (size_t)skip * it->record_size;
+        it->run_remaining -= skip;
+    } else {
+        buffered = (int64_t)((it->data_len - it->pos) / it->record_size);
+        if (skip <= buffered) {
+            it->pos += (size_t)skip * it->record_size;
+        } else {
+            it->next_offset += (off_t)(skip - buffered) * it->record_size;
+            it->pos = it->data_len;
+        }
+        it->run_remaining -= skip;
+    }
+    it->remaining -= skip;
+    it->slot += skip;
+}
+
+void store_iter_close(StoreIter* it) {
+    if (it->backend == SCAN_MMAP) {
+        if (it->data) {
+            munmap(it->data, it->data_len);
+        }
+    } else {
+        free(it->data);
+    }
+    if (it->owns_dead) {
+        free(it->dead);
+    }
+    if (it->owns_fd && it->fd != -1) {
+        close(it->fd);
+    }
+    if (it->snap != NULL) {
+        store_snapshot_close(it->snap);
+        free(it->snap);
+    }
+    it->data = NULL;
+    it->dead = NULL;
+    it->snap = NULL;
+    it->fd = -1;
+}
+
+// Fills snap->segments from the manifest of the generation snap->hdr
+// describes, without opening any segment yet.
+static int read_segments(StoreSnapshot* snap) {
+    SegmentEntry* entries;
+    uint32_t count = snap->hdr.segment_count;
+
+    snap->segments = NULL;
+    snap->segment_count = 0;
+    if (!read_manifest(snap->fd, &snap->hdr, &entries)) {
+        return 0;
+    }
+    if (count == 0) {
+        return 1;
+    }
+    snap->segments = calloc(count, sizeof(StoreSegment));
+    if (snap->segments == NULL) {
+        free(entries);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        StoreSegment* seg = &snap->segments[i];
+        int last = i + 1 == count;
+
+        seg->number = entries[i].number;
+        seg->fd = -1;
+        seg->clue_fd = -1;
+        seg->data_offset = entries[i].data_offset;
+        seg->first_slot = entries[i].first_slot;
+        seg->slot_count = (last ? snap->hdr.slot_count : entries[i + 1].first_slot) - seg->first_slot;
+        seg->clue_base = entries[i].clue_base;
+        seg->clue_bytes = (last ? snap->hdr.clue_bytes : entries[i + 1].clue_base) - seg->clue_base;
+    }
+    snap->segment_count = (int)count;
+    free(entries);
+    return 1;
+}
+
+// Opens treasures.dat and reads its manifest; the caller opens segments as
+// it needs them.
+static int open_manifest(const char* hunt_id, int flags, StoreSnapshot* snap) {
+    snap->segments = NULL;
+    snap->segment_count = 0;
+    snap->dead = NULL;
+    snap->fd = store_open(hunt_id, flags, &snap->hdr);
+    if (snap->fd == -1) {
+        return 0;
+    }
+    if (!read_segments(snap)) {
+        close(snap->fd);
+        snap->fd = -1;
+        errno = EIO;
+        return 0;
+    }
+    return 1;
+}
+
+// Opens the files of one segment. Every segment has a clue file, and
+// compaction unlinks it after the record file, so opening it first means
+// failing on either one is a segment that has been replaced.
+static int open_segment(const char* hunt_id, StoreSegment* seg) {
+    char path[MAX_PATH];
+
+    if (seg->fd != -1) {
+        return 1;
+    }
+    if (!segment_path(path, MAX_PATH, hunt_id, seg->number, 1)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    seg->clue_fd = open(path, O_RDONLY);
+    if (seg->clue_fd == -1) {
+        return 0;
+    }
+    segment_path(path, MAX_PATH, hunt_id, seg->number, 0);
+    seg->fd = open(path, O_RDONLY);
+    if (seg->fd == -1) {
+        close(seg->clue_fd);
+        seg->clue_fd = -1;
+        return 0;
+    }
+    return 1;
+}
+
+// Index of the last segment starting at or before key, a slot or with
+// by_clue a clue offset.
+static int find_segment(const StoreSnapshot* snap, int64_t key, int by_clue) {
+    int lo = 0;
+    int hi = snap->segment_count - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        int64_t start = by_clue ? snap->segments[mid].clue_base : snap->segments[mid].first_slot;
+
+        if (start <= key) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Pins every segment of the generation that snap->hdr (read from snap->fd)
+// describes.
+static int pin_generation(const char* hunt_id, StoreSnapshot* snap) {
+    int pinned = 1;
+
+    if (!read_segments(snap)) {
+        return 0;
+    }
+    for (int i = 0; i < snap->segment_count; i++) {
+        if (!open_segment(hunt_id, &snap->segments[i])) {
+            pinned = 0;
+        }
+    }
+    return snapshot_dead(hunt_id, snap) && pinned;
+}
+
+// Whether fd is still the file published as treasures.dat.
+static int is_published(const char* hunt_id, int fd) {
+    char path[MAX_PATH];
+    struct stat opened, current;
+
+    return store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) &&
+        fstat(fd, &opened) == 0 && stat(path, &current) == 0 &&
+        opened.st_ino == current.st_ino && opened.st_dev == current.st_dev;
+}
+
+int store_snapshot_open(StoreSnapshot* snap, const char* hunt_id) {
+    for (int attempt = 0; attempt < SNAPSHOT_RETRIES; attempt++) {
+        snap->segments = NULL;
+        snap->segment_count = 0;
+        snap->dead = NULL;
+        snap->fd = store_open(hunt_id, O_RDONLY, &snap->hdr);
+        if (snap->fd == -1) {
+            return 0;
+        }
+        if (pin_generation(hunt_id, snap)) {
+            return 1;
+        }
+        // Nothing newer was published, the files are simply missing. Serve
+        // what can be read, as readers always have, but only a missing
+        // tombstone file means there is nothing to skip: one that cannot be
+        // read would bring removed records back.
+        if (is_published(hunt_id, snap->fd)) {
+            if (!snapshot_dead(hunt_id, snap) && errno != ENOENT) {
+                store_snapshot_close(snap);
+                return 0;
+            }
+            return 1;
+        }
+        // A compaction replaced the generation under us: pin the new one.
+        store_snapshot_close(snap);
+    }
+    errno = EAGAIN;
+    return 0;
+}
+
+void store_snapshot_close(StoreSnapshot* snap) {
+    if (snap->fd != -1) {
+        close(snap->fd);
+    }
+    for (int i = 0; i < snap->segment_count; i++) {
+        if (snap->segments[i].fd != -1) {
+            close(snap->segments[i].fd);
+        }
+        if (snap->segments[i].clue_fd != -1) {
+            close(snap->segments[i].clue_fd);
+        }
+    }
+    free(snap->segments);
+    free(snap->dead);
+    snap->fd = -1;
+    snap->segments = NULL;
+    snap->segment_count = 0;
+    snap->dead = NULL;
+}
+
+int64_t store_snapshot_read(const StoreSnapshot* snap, int64_t slot, int64_t count, TreasureRecord* out) {
+    int64_t done = 0;
+
+    if (slot < 0) {
+        return 0;
+    }
+    if (count > snap->hdr.slot_count - slot) {
+        count = snap->hdr.slot_count - slot;
+    }
+    while (done < count) {
+        const StoreSegment* seg = &snap->segments[find_segment(snap, slot + done, 0)];
+        int64_t skip = slot + done - seg->first_slot;
+        int64_t want = seg->slot_count - skip;
+        ssize_t n;
+
+        if (want > count - done) {
+            want = count - done;
+        }
+        if (seg->fd == -1 || want <= 0) {
+            break;
+        }
+        n = pread(seg->fd, out + done, (size_t)want * sizeof(TreasureRecord),
+            seg->data_offset + (off_t)skip * (off_t)sizeof(TreasureRecord));
+        if (n < (ssize_t)sizeof(TreasureRecord)) {
+            break;
+        }
+        stats_add_read((size_t)n, n / (ssize_t)sizeof(TreasureRecord));
+        done += n / (ssize_t)sizeof(TreasureRecord);
+    }
+    return done;
+}
+
+static int read_clue(int clue_fd, off_t offset, const TreasureRecord* record, char* clue) {
+    clue[0] = '\0';
+    if (record->clue_length == 0) {
+        return 1;
+    }
+    if (clue_fd == -1 || record->clue_length >= MAX_CLUE_TEXT ||
+        pread(clue_fd, clue, record->clue_length, offset) != (ssize_t)record->clue_length) {
+        return 0;
+    }
+    stats_add_read(record->clue_length, 0);
+    clue[record->clue_length] = '\0';
+    return 1;
+}
+
+int store_snapshot_clue(const StoreSnapshot* snap, const TreasureRecord* record, char* clue) {
+    const StoreSegment* seg;
+
+    clue[0] = '\0';
+    if (record->clue_length == 0) {
+        return 1;
+    }
+    if (snap->segment_count == 0) {
+        return 0;
+    }
+    seg = &snap->segments[find_segment(snap, (int64_t)record->clue_offset, 1)];
+    return read_clue(seg->clue_fd, (off_t)(record->clue_offset - (uint64_t)seg->clue_base), record, clue);
+}
+
+// store_snapshot_clue for a snapshot whose segments are opened as needed.
+// Returns -1 if the segment holding the clue cannot be opened.
+static int snapshot_clue_lazy(const char* hunt_id, StoreSnapshot* snap, const TreasureRecord* record, char* clue) {
+    clue[0] = '\0';
+    if (record->clue_length == 0) {
+        return 1;
+    }
+    if (snap->segment_count == 0) {
+        return 0;
+    }
+    if (!open_segment(hunt_id, &snap->segments[find_segment(snap, (int64_t)record->clue_offset, 1)])) {
+        return -1;
+    }
+    return store_snapshot_clue(snap, record, clue);
+}
+
+int store_snapshot_is_dead(const StoreSnapshot* snap, int64_t slot) {
+    return is_dead(snap->dead, slot);
+}
+
+int store_iter_snapshot(StoreIter* it, const StoreSnapshot* snap) {
+    iter_segments(it, snap, 0, snap->segment_count);
+    return 1;
+}
+
+void store_snapshot_part(const StoreSnapshot* snap, int index, StorePart* part) {
+    part->snap = snap;
+    part->index = index;
+    part->first_slot = snap->segments[index].first_slot;
+    part->end_slot = part->first_slot + snap->segments[index].slot_count;
+}
+
+int store_iter_part(StoreIter* it, const StorePart* part) {
+    iter_segments(it, part->snap, part->index, 1);
+    return 1;
+}
+
+typedef struct {
+    const StoreSnapshot* snap;
+    StorePartFn fn;
+    void* arg;
+    int next_part;          // next part to hand out, taken atomically
+    int end_part;
+    int failed;
+} PartJob;
+
+typedef struct {
+    pthread_t thread;
+    PartJob* job;
+    StatsIO io;
+} PartWorker;
+
+static void run_parts(PartJob* job) {
+    StorePart part;
+    int index;
+
+    while ((index = __atomic_fetch_add(&job->next_part, 1, __ATOMIC_RELAXED)) < job->end_part) {
+        store_snapshot_part(job->snap, index, &part);
+        if (job->fn(&part, job->arg) != 1) {
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void* part_worker(void* arg) {
+    PartWorker* worker = (PartWorker*)arg;
+
+    run_parts(worker->job);
+    // Read counters are per thread; the caller charges these to itself.
+    stats_get_io(&worker->io);
+    return NULL;
+}
+
+int store_scan_parts(const StoreSnapshot* snap, int first, int count, int threads, StorePartFn fn, void* arg) {
+    PartWorker workers[MAX_SCAN_THREADS];
+    PartJob job = { snap, fn, arg, first, first + count, 0 };
+    int started = 0;
+
+    if (threads <= 0) {
+        threads = store_scan_threads();
+    }
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads > MAX_SCAN_THREADS) {
+        threads = MAX_SCAN_THREADS;
+    }
+    // Settle the backend before the workers' iterators read it.
+    store_scan_backend();
+    for (; started < threads - 1; started++) {
+        workers[started].job = &job;
+        if (pthread_create(&workers[started].thread, NULL, part_worker, &workers[started]) != 0) {
+            // The threads already running, this one included, take the rest.
+            break;
+        }
+    }
+    run_parts(&job);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        stats_add_io(&workers[i].io);
+    }
+    return job.failed ? -1 : 1;
+}
+
+static int sync_policy = -1;
+
+SyncPolicy store_sync_policy(void) {
+    if (sync_policy == -1) {
+        const char* env = getenv("TREASURE_SYNC");
+        sync_policy = (env && strcmp(env, "none") == 0) ? SYNC_NONE : SYNC_GROUP;
+    }
+    return (SyncPolicy)sync_policy;
+}
+
+void store_set_sync_policy(SyncPolicy policy) {
+    sync_policy = policy;
+}
+
+// Takes an exclusive flock on <hunt_id>/<name>. Returns the fd that holds
+// it, or -1. Closing the fd releases the lock.
+static int lock_hunt(const char* hunt_id, const char* name) {
+    char path[MAX_PATH];
+    int fd;
+
+    if (!store_path(path, MAX_PATH, hunt_id, name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+static void unlock_hunt(int fd) {
+    if (fd != -1) {
+        close(fd);
+    }
+}
+
+static void sync_directory(const char* hunt_id) {
+    int fd = open(hunt_id, O_RDONLY | O_DIRECTORY);
+
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// fdatasyncs both files of a segment. A segment that is gone was replaced
+// by a compaction, which synced what replaced it.
+static int sync_segment(const char* hunt_id, uint32_t number) {
+    char path[MAX_PATH];
+    int ok = 1;
+
+    for (int clues = 0; clues < 2 && ok; clues++) {
+        int fd = segment_path(path, MAX_PATH, hunt_id, number, clues) ? open(path, O_RDONLY) : -1;
+
+        if (fd != -1) {
+            ok = fdatasync(fd) == 0;
+            close(fd);
+        }
+    }
+    return ok;
+}
+
+// Buffered appender used by the rewrite paths.
+typedef struct {
+    int fd;
+    char* buf;
+    size_t len;
+} BlockWriter;
+
+static int writer_flush(BlockWriter* w) {
+    if (w->len > 0 && write(w->fd, w->buf, w->len) != (ssize_t)w->len) {
+        return 0;
+    }
+    w->len = 0;
+    return 1;
+}
+
+static int writer_put(BlockWriter* w, const void* data, size_t len) {
+    if (w->len + len > WRITE_BLOCK_BYTES && !writer_flush(w)) {
+        return 0;
+    }
+    if (len > WRITE_BLOCK_BYTES) {
+        return write(w->fd, data, len) == (ssize_t)len;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return 1;
+}
+
+static int writer_init(BlockWriter* w, int fd) {
+    w->fd = fd;
+    w->len = 0;
+    w->buf = malloc(WRITE_BLOCK_BYTES);
+    return w->buf != NULL;
+}
+
+// Writes records into new segment files of capacity records each,
+// for migration and compaction. Existing segments can be taken over as they
+// are in between, so the entries collected form the new manifest.
+typedef struct {
+    const char* hunt_id;
+    int durable;
+    int64_t capacity;
+    BlockWriter records;
+    BlockWriter clues;
+    int64_t count;          // records in the open segment, -1 if none is open
+    SegmentEntry* entries;
+    int entry_count;
+    uint32_t first_number;  // segments from here on were created by the writer
+    uint32_t next_number;
+    int64_t slot;           // slot of the next record
+    int64_t clue_bytes;     // clue offset of the next record's clue
+} SegmentWriter;
+
+static void segment_writer_init(SegmentWriter* w, const char* hunt_id, int64_t capacity, uint32_t next_number,
+    int64_t clue_bytes) {
+    memset(w, 0, sizeof(*w));
+    w->hunt_id = hunt_id;
+    w->durable = store_sync_policy() == SYNC_GROUP;
+    w->capacity = capacity;
+    w->records.fd = -1;
+    w->clues.fd = -1;
+    w->count = -1;
+    w->first_number = next_number;
+    w->next_number = next_number;
+    w->clue_bytes = clue_bytes;
+}
+
+static int segment_writer_add(SegmentWriter* w, SegmentEntry entry) {
+    SegmentEntry* entries = realloc(w->entries, (size_t)(w->entry_count + 1) * sizeof(SegmentEntry));
+
+    if (entries == NULL) {
+        return 0;
+    }
+    w->entries = entries;
+    w->entries[w->entry_count++] = entry;
+    return 1;
+}
+
+static void segment_writer_close(SegmentWriter* w) {
+    free(w->records.buf);
+    free(w->clues.buf);
+    if (w->records.fd != -1) {
+        close(w->records.fd);
+    }
+    if (w->clues.fd != -1) {
+        close(w->clues.fd);
+    }
+    w->records.buf = w->clues.buf = NULL;
+    w->records.fd = w->clues.fd = -1;
+    w->count = -1;
+}
+
+// Flushes and closes the open segment, if any.
+static int segment_writer_seal(SegmentWriter* w) {
+    int ok;
+
+    if (w->count == -1) {
+        return 1;
+    }
+    ok = writer_flush(&w->records) && writer_flush(&w->clues);
+    // The rename that publishes the segment makes it the only copy.
+    if (ok && w->durable) {
+        ok = fdatasync(w->records.fd) == 0 && fdatasync(w->clues.fd) == 0;
+    }
+    segment_writer_close(w);
+    return ok;
+}
+
+static int segment_writer_start(SegmentWriter* w) {
+    char data_path[MAX_PATH];
+    char clues_path[MAX_PATH];
+    SegmentEntry entry = { w->next_number, 0, w->slot, w->clue_bytes };
+
+    if (!segment_path(data_path, MAX_PATH, w->hunt_id, entry.number, 0) ||
+        !segment_path(clues_path, MAX_PATH, w->hunt_id, entry.number, 1) ||
+        !segment_writer_add(w, entry)) {
+        return 0;
+    }
+    w->next_number++;
+    w->records.fd = open(data_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    w->clues.fd = open(clues_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->records.fd == -1 || w->clues.fd == -1 ||
+        !writer_init(&w->records, w->records.fd) || !writer_init(&w->clues, w->clues.fd)) {
+        perror("Failed to create segment");
+        return 0;
+    }
+    w->count = 0;
+    return 1;
+}
+
+// Appends record as the next slot, with its clue_length bytes of clue taken
+// from clue. The clue offset and checksum are recomputed.
+static int segment_writer_put(SegmentWriter* w, const TreasureRecord* record, const char* clue) {
+    TreasureRecord moved = *record;
+
+    if (w->count >= w->capacity && !segment_writer_seal(w)) {
+        return 0;
+    }
+    if (w->count == -1 && !segment_writer_start(w)) {
+        return 0;
+    }
+    moved.clue_offset = (uint64_t)w->clue_bytes;
+    seal_record(&moved);
+    if ((moved.clue_length > 0 && !writer_put(&w->clues, clue, moved.clue_length)) ||
+        !writer_put(&w->records, &moved, sizeof(moved))) {
+        return 0;
+    }
+    w->clue_bytes += moved.clue_length;
+    w->slot++;
+    w->count++;
+    return 1;
+}
+
+// Takes over seg unchanged as the next segment.
+static int segment_writer_keep(SegmentWriter* w, const StoreSegment* seg) {
+    SegmentEntry entry = { seg->number, (uint32_t)seg->data_offset, w->slot, seg->clue_base };
+
+    if (!segment_writer_seal(w) || !segment_writer_add(w, entry)) {
+        return 0;
+    }
+    w->slot += seg->slot_count;
+    w->clue_bytes = seg->clue_base + seg->clue_bytes;
+    return 1;
+}
+
+// Drops every segment the writer created.
+static void segment_writer_abort(SegmentWriter* w) {
+    char path[MAX_PATH];
+
+    segment_writer_close(w);
+    for (int i = 0; i < w->entry_count; i++) {
+        if (w->entries[i].number < w->first_number) {
+            continue;
+        }
+        for (int clues = 0; clues < 2; clues++) {
+            if (segment_path(path, MAX_PATH, w->hunt_id, w->entries[i].number, clues)) {
+                unlink(path);
+            }
+        }
+    }
+    free(w->entries);
+    w->entries = NULL;
+    w->entry_count = 0;
+}
+
+static size_t clue_length(const Treasure* treasure) {
+    return strnlen(treasure->clue, MAX_CLUE_TEXT - 1);
+}
+
+static void split_treasure(const Treasure* treasure, uint64_t clue_offset, TreasureRecord* record) {
+    memset(record, 0, sizeof(*record));
+    record->treasure_id = treasure->treasure_id;
+    record->value = treasure->value;
+    record->latitude = treasure->latitude;
+    record->longitude = treasure->longitude;
+    record->clue_offset = clue_offset;
+    record->clue_length = (uint32_t)clue_length(treasure);
+    memcpy(record->username, treasure->username, MAX_USERNAME);
+    record->username[MAX_USERNAME - 1] = '\0';
+    seal_record(record);
+}
+
+// Converts a pre-split treasures.dat (headerless, or version 1/2 with a
+// header) into hot records and clues in fresh segments. Tombstoned records
+// of a version 2 file are dropped on the way.
+static int migrate_legacy(const char* hunt_id, int fd, StoreHeader* old) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char legacy_del_path[MAX_PATH];
+    char idx_path[MAX_PATH];
+    StoreHeader hdr;
+    SegmentWriter w;
+    StoreIter it;
+    const Treasure* treasure;
+    TreasureRecord record;
+    struct stat st;
+    off_t start = 0;
+    int64_t count;
+    int out = -1;
+    int failed = 0;
+
+    if (!store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, "treasures.tmp") ||
+        !store_path(legacy_del_path, MAX_PATH, hunt_id, LEGACY_DELETES_FILENAME) ||
+        !store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME) ||
+        fstat(fd, &st) == -1) {
+        return 0;
+    }
+
+    count = st.st_size / (off_t)LEGACY_RECORD_SIZE;
+    if (old) {
+        start = old->header_size;
+        count = old->slot_count;
+    }
+
+    init_header(&hdr);
+    segment_writer_init(&w, hunt_id, hdr.segment_records, hdr.next_segment, 0);
+    if (!iter_init(&it, fd, 0, start, count, LEGACY_RECORD_SIZE)) {
+        return 0;
+    }
+    // Migrating without the tombstones would bring removed records back
+    // for good.
+    it.owns_dead = 1;
+    if (old && !load_dead(hunt_id, old, &it.dead)) {
+        perror("Failed to read tombstones");
+        store_iter_close(&it);
+        return 0;
+    }
+
+    while ((treasure = (const Treasure*)next_live(&it)) != NULL) {
+        split_treasure(treasure, 0, &record);
+        if (!segment_writer_put(&w, &record, treasure->clue)) {
+            failed = 1;
+            break;
+        }
+        hdr.record_count++;
+        if (treasure->treasure_id >= hdr.next_id) {
+            hdr.next_id = (int64_t)treasure->treasure_id + 1;
+        }
+    }
+    if (it.remaining > 0) {
+        failed = 1;
+    }
+    store_iter_close(&it);
+
+    // Never hand out an ID the old file had already used.
+    if (old && old->next_id > hdr.next_id) {
+        hdr.next_id = old->next_id;
+    }
+    hdr.slot_count = w.slot;
+    hdr.clue_bytes = w.clue_bytes;
+    hdr.synced_slots = (uint32_t)hdr.slot_count;
+
+    if (!failed && segment_writer_seal(&w)) {
+        hdr.segment_count = (uint32_t)w.entry_count;
+        hdr.next_segment = w.next_number;
+        out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (out == -1 || !write_manifest(out, &hdr, w.entries)) {
+        perror("Failed to write to temporary file");
+        if (out != -1) {
+            close(out);
+        }
+        unlink(tmp_path);
+        segment_writer_abort(&w);
+        return 0;
+    }
+    close(out);
+
+    if (rename(tmp_path, path) != 0) {
+        perror("Failed to replace treasures file");
+        unlink(tmp_path);
+        segment_writer_abort(&w);
+        return 0;
+    }
+    free(w.entries);
+    unlink(legacy_del_path);
+    // The old index held file offsets; the next lookup builds one of slots.
+    unlink(idx_path);
+    return 1;
+}
+
+// Versions 3 and 4 kept the records in treasures.dat behind the header and
+// the clues in clues-<clue_gen>.dat. Both become segment 1 through hard
+// links, so only a new treasures.dat with the header and manifest is
+// written. Slots, clue offsets and clue_gen stay the same, and so do the
+// sidecar indexes.
+static int migrate_inline(const char* hunt_id, const StoreHeader* old) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char old_heap_path[MAX_PATH];
+    char idx_path[MAX_PATH];
+    char data_path[MAX_PATH];
+    char clues_path[MAX_PATH];
+    SegmentEntry entry = { 1, INLINE_HEADER_SIZE, 0, 0 };
+    StoreHeader hdr = *old;
+    int fd;
+
+    if (!store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, "treasures.tmp") ||
+        !store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME) ||
+        !heap_path(old_heap_path, MAX_PATH, hunt_id, old->clue_gen) ||
+        !segment_path(data_path, MAX_PATH, hunt_id, entry.number, 0) ||
+        !segment_path(clues_path, MAX_PATH, hunt_id, entry.number, 1)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+
+    // Left behind by an interrupted migration; nothing published names them.
+    unlink(data_path);
+    unlink(clues_path);
+    if (link(path, data_path) != 0) {
+        perror("Failed to link segment");
+        return 0;
+    }
+    if (link(old_heap_path, clues_path) != 0) {
+        // A hunt that never had a clue still gets an empty clue file.
+        fd = errno == ENOENT ? open(clues_path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+        if (fd == -1) {
+            perror("Failed to link segment clues");
+            unlink(data_path);
+            return 0;
+        }
+        close(fd);
+    }
+
+    memset((char*)&hdr + INLINE_HEADER_SIZE, 0, sizeof(hdr) - INLINE_HEADER_SIZE);
+    hdr.version = STORE_VERSION;
+    hdr.header_size = sizeof(StoreHeader);
+    hdr.segment_count = 1;
+    hdr.next_segment = entry.number + 1;
+    hdr.segment_records = store_segment_records();
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || !write_manifest(fd, &hdr, &entry)) {
+        perror("Failed to write to temporary file");
+        if (fd != -1) {
+            close(fd);
+        }
+        unlink(tmp_path);
+        unlink(data_path);
+        unlink(clues_path);
+        return 0;
+    }
+    close(fd);
+
+    if (rename(tmp_path, path) != 0) {
+        perror("Failed to replace treasures file");
+        unlink(tmp_path);
+        unlink(data_path);
+        unlink(clues_path);
+        return 0;
+    }
+    if (store_sync_policy() == SYNC_GROUP) {
+        sync_directory(hunt_id);
+    }
+    unlink(old_heap_path);
+    // The old index held file offsets; the next lookup builds one of slots.
+    unlink(idx_path);
+    return 1;
+}
+
+// Brings a treasures.dat written by an older version up to date, under the
+// hunt lock unless the caller already holds it. Returns 1 if it is current
+// afterwards.
+static int migrate(const char* hunt_id, int locked) {
+    char path[MAX_PATH];
+    StoreHeader hdr;
+    struct stat st;
+    int lock_fd = -1;
+    int fd;
+    int ok;
+
+    if (!locked && (lock_fd = lock_hunt(hunt_id, LOCK_FILENAME)) == -1) {
+        return 0;
+    }
+    fd = store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) ? open(path, O_RDONLY) : -1;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+
+    if (read_header(fd, &hdr)) {
+        // Another process migrated it while we waited for the lock.
+        ok = 1;
+    } else if (header_is_inline(&hdr)) {
+        ok = migrate_inline(hunt_id, &hdr);
+    } else if (st.st_size >= INLINE_HEADER_SIZE && header_is_legacy(&hdr)) {
+        ok = migrate_legacy(hunt_id, fd, &hdr);
+    } else if (st.st_size >= INLINE_HEADER_SIZE && hdr.magic == STORE_MAGIC) {
+        // Written by a newer version we do not understand.
+        errno = EINVAL;
+        ok = 0;
+    } else {
+        ok = migrate_legacy(hunt_id, fd, NULL);
+    }
+    close(fd);
+    unlock_hunt(lock_fd);
+    return ok;
+}
+
+// Forgets the tombstones of slots at or past keep. Returns how many of them
+// there were; the tombstone file is only rewritten when writable.
+static int64_t drop_tombstones(const char* hunt_id, const StoreHeader* hdr, int64_t keep, int writable) {
+    char del_path[MAX_PATH];
+    uint32_t* slots;
+    ssize_t len;
+    int64_t kept = 0;
+    int fd;
+
+    if (hdr->dead_count <= 0 || !deletes_path(del_path, MAX_PATH, hunt_id, hdr->clue_gen)) {
+        return 0;
+    }
+    fd = writable ? open(del_path, O_RDWR) : store_open_deletes(hunt_id, hdr->clue_gen);
+    if (fd == -1) {
+        return 0;
+    }
+
+    len = (ssize_t)(hdr->dead_count * sizeof(uint32_t));
+    slots = malloc((size_t)len);
+    if (slots == NULL || pread(fd, slots, (size_t)len, 0) != len) {
+        free(slots);
+        close(fd);
+        return 0;
+    }
+    stats_add_read((size_t)len, 0);
+    for (int64_t i = 0; i < hdr->dead_count; i++) {
+        if (slots[i] < (uint64_t)keep) {
+            slots[kept++] = slots[i];
+        }
+    }
+    if (writable && kept < hdr->dead_count &&
+        pwrite(fd, slots, (size_t)kept * sizeof(uint32_t), 0) != (ssize_t)(kept * sizeof(uint32_t))) {
+        perror("Failed to rewrite tombstones");
+    }
+    free(slots);
+    close(fd);
+    return hdr->dead_count - kept;
+}
+
+// The header is written after the records it accounts for, and records from
+// synced_slots on may not have reached the disk if the machine went down
+// before they were synced. Only the last segment is ever appended to, and a
+// segment is synced before the next one is started, so only it is checked:
+// the first record from synced_slots on with a bad checksum ends it; usually
+// only the last few records are checked.
+// Whole records past slot_count are left by a writer that died before
+// publishing them. Writers, who hold the hunt lock, pick them up. Readers
+// ignore them, since they may belong to a writer that is still running.
+static void reconcile_header(const char* hunt_id, int fd, StoreHeader* hdr, int writable) {
+    char seg_path[MAX_PATH];
+    SegmentEntry active;
+    StoreIter it;
+    const TreasureRecord* record;
+    struct stat st;
+    int64_t count, first, good;
+    int64_t lost_dead = 0;
+    off_t size, end;
+    int seg_fd;
+
+    // A reader has nothing to check once everything it sees was synced.
+    if (hdr->segment_count == 0 || (!writable && hdr->synced_slots >= hdr->slot_count)) {
+        return;
+    }
+    if (pread(fd, &active, sizeof(active),
+            hdr->header_size + (off_t)(hdr->segment_count - 1) * (off_t)sizeof(active)) != sizeof(active) ||
+        !segment_path(seg_path, MAX_PATH, hunt_id, active.number, 0)) {
+        return;
+    }
+    stats_add_read(sizeof(active), 0);
+    seg_fd = open(seg_path, writable ? O_RDWR : O_RDONLY);
+    if (seg_fd == -1) {
+        return;
+    }
+    if (fstat(seg_fd, &st) == -1) {
+        close(seg_fd);
+        return;
+    }
+
+    size = st.st_size;
+    count = active.first_slot;
+    if (size > (off_t)active.data_offset) {
+        count += (size - active.data_offset) / hdr->record_size;
+    }
+    if (!writable && count > hdr->slot_count) {
+        count = hdr->slot_count;
+        size = active.data_offset + (count - active.first_slot) * hdr->record_size;
+    }
+    first = hdr->synced_slots < hdr->slot_count ? hdr->synced_slots : hdr->slot_count;
+    if (first < active.first_slot) {
+        first = active.first_slot;
+    }
+    if (first > count) {
+        first = count;
+    }
+    if (first == hdr->slot_count && count == hdr->slot_count &&
+        size == (off_t)(active.data_offset + (count - active.first_slot) * hdr->record_size)) {
+        close(seg_fd);
+        return;
+    }
+
+    good = first;
+    if (count > first && iter_init(&it, seg_fd, 0, active.data_offset + (first - active.first_slot) * hdr->record_size,
+            count - first, hdr->record_size)) {
+        while ((record = (const TreasureRecord*)next_slot(&it)) != NULL && record_is_intact(record)) {
+            if (good >= hdr->slot_count) {
+                if (record->treasure_id >= hdr->next_id) {
+                    hdr->next_id = (int64_t)record->treasure_id + 1;
+                }
+                if ((int64_t)(record->clue_offset + record->clue_length) > hdr->clue_bytes) {
+                    hdr->clue_bytes = (int64_t)(record->clue_offset + record->clue_length);
+                }
+            }
+            good++;
+        }
+        store_iter_close(&it);
+    }
+
+    end = active.data_offset + (good - active.first_slot) * hdr->record_size;
+    if (good == hdr->slot_count && end == size) {
+        close(seg_fd);
+        return;
+    }
+
+    // next_id stays where it is, so IDs of lost records are not reused.
+    if (good < hdr->slot_count) {
+        lost_dead = drop_tombstones(hunt_id, hdr, good, writable);
+        hdr->record_count -= hdr->slot_count - good - lost_dead;
+        if (writable) {
+            hdr->dead_count -= lost_dead;
+        }
+    } else {
+        hdr->record_count += good - hdr->slot_count;
+    }
+    hdr->slot_count = good;
+    if (hdr->synced_slots > good) {
+        hdr->synced_slots = (uint32_t)good;
+    }
+    hdr->generation++;
+
+    if (writable) {
+        if (end != size && ftruncate(seg_fd, end) == -1) {
+            perror("Failed to truncate segment");
+        }
+        store_write_header(fd, hdr);
+    }
+    close(seg_fd);
+}
+
+int store_open(const char* hunt_id, int flags, StoreHeader* hdr) {
+    char path[MAX_PATH];
+    int access_mode = flags & O_ACCMODE;
+    int writable = access_mode != O_RDONLY;
+    struct stat st;
+    int fd;
+
+    if (!store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    fd = open(path, access_mode);
+    if (fd == -1 && errno == ENOENT && (flags & O_CREAT)) {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd != -1) {
+            init_header(hdr);
+            if (!store_write_header(fd, hdr)) {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+        if (errno == EEXIST) {
+            fd = open(path, access_mode);
+        }
+    }
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (read_header(fd, hdr)) {
+        if (writable) {
+            adopt_legacy_deletes(hunt_id, hdr->clue_gen);
+        }
+        reconcile_header(hunt_id, fd, hdr, writable);
+        return fd;
+    }
+
+    if (!writable && fstat(fd, &st) == 0 && st.st_size == 0) {
+        // Empty file from an older version: nothing to read.
+        init_header(hdr);
+        return fd;
+    }
+    close(fd);
+
+    // Writers hold the hunt lock already; readers take it to migrate.
+    if (!migrate(hunt_id, writable)) {
+        return -1;
+    }
+    fd = open(path, access_mode);
+    if (fd == -1) {
+        return -1;
+    }
+    if (!read_header(fd, hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    reconcile_header(hunt_id, fd, hdr, writable);
+    return fd;
+}
+
+int store_count(const char* hunt_id) {
+    StoreHeader hdr;
+    int fd = store_open(hunt_id, O_RDONLY, &hdr);
+
+    if (fd == -1) {
+        return 0;
+    }
+    close(fd);
+    return (int)hdr.record_count;
+}
+
+int store_next_id(const char* hunt_id) {
+    StoreHeader hdr;
+    int fd = store_open(hunt_id, O_RDONLY, &hdr);
+
+    if (fd == -1) {
+        return 1;
+    }
+    close(fd);
+    return (int)hdr.next_id;
+}
+
+// Makes everything up to generation durable. Whoever takes the commit lock
+// first syncs the files as they are at that moment, which covers every
+// writer that updated the header before it; writers queued behind it find
+// their generation already synced and return without an fsync of their own.
+// Only the last segment can hold unsynced records: appends sync a segment
+// before they start the next one.
+static int group_commit(const char* hunt_id, uint32_t generation) {
+    char path[MAX_PATH];
+    SegmentEntry active;
+    StoreHeader hdr;
+    uint32_t durable;
+    int64_t synced;
+    int commit_fd, lock_fd, fd, del_fd;
+    int ok = 1;
+
+    commit_fd = lock_hunt(hunt_id, COMMIT_FILENAME);
+    if (commit_fd == -1) {
+        perror("Failed to lock commit file");
+        return 0;
+    }
+    if (pread(commit_fd, &durable, sizeof(durable), 0) == sizeof(durable) &&
+        (int32_t)(durable - generation) >= 0) {
+        unlock_hunt(commit_fd);
+        return 1;
+    }
+
+    if (!store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) ||
+        (fd = open(path, O_RDWR)) == -1) {
+        unlock_hunt(commit_fd);
+        return 0;
+    }
+    if (!read_header(fd, &hdr)) {
+        close(fd);
+        unlock_hunt(commit_fd);
+        return 0;
+    }
+    durable = hdr.generation;
+    synced = hdr.slot_count;
+
+    if (hdr.segment_count > 0 &&
+        pread(fd, &active, sizeof(active),
+            hdr.header_size + (off_t)(hdr.segment_count - 1) * (off_t)sizeof(active)) == sizeof(active)) {
+        ok = sync_segment(hunt_id, active.number);
+    }
+    if (ok && hdr.dead_count > 0 && (del_fd = store_open_deletes(hunt_id, hdr.clue_gen)) != -1) {
+        ok = fdatasync(del_fd) == 0;
+        close(del_fd);
+    }
+    if (!ok || fdatasync(fd) == -1) {
+        perror("Failed to sync treasures file");
+        close(fd);
+        unlock_hunt(commit_fd);
+        return 0;
+    }
+
+    // Record how far the file is known to be on disk so opening it only
+    // verifies what came after. The mark itself needs no fsync: losing it
+    // just means a few more checksums are checked.
+    lock_fd = lock_hunt(hunt_id, LOCK_FILENAME);
+    if (lock_fd != -1 && read_header(fd, &hdr) && hdr.synced_slots < synced && synced <= hdr.slot_count) {
+        hdr.synced_slots = (uint32_t)synced;
+        store_write_header(fd, &hdr);
+    }
+    unlock_hunt(lock_fd);
+    close(fd);
+
+    if (pwrite(commit_fd, &durable, sizeof(durable), 0) != sizeof(durable)) {
+        perror("Failed to update commit file");
+    }
+    unlock_hunt(commit_fd);
+    return 1;
+}
+
+// Called with the hunt lock held, after the header was written.
+static int commit_write(const char* hunt_id, int lock_fd, uint32_t generation) {
+    unlock_hunt(lock_fd);
+    if (store_sync_policy() == SYNC_NONE) {
+        return 1;
+    }
+    return group_commit(hunt_id, generation);
+}
+
+// Starts segment next_segment behind the last one, which is synced first
+// under SYNC_GROUP since group commits only sync the last segment. The entry
+// is written past the published ones; the caller's header update publishes
+// it.
+static int start_segment(const char* hunt_id, int fd, StoreHeader* hdr, SegmentEntry** entries) {
+    char data_path[MAX_PATH];
+    char clues_path[MAX_PATH];
+    SegmentEntry entry = { hdr->next_segment, 0, hdr->slot_count, hdr->clue_bytes };
+    SegmentEntry* grown;
+    int data_fd, clue_fd;
+
+    if (hdr->segment_count > 0 && store_sync_policy() == SYNC_GROUP &&
+        !sync_segment(hunt_id, (*entries)[hdr->segment_count - 1].number)) {
+        perror("Failed to sync segment");
+        return 0;
+    }
+    grown = realloc(*entries, (size_t)(hdr->segment_count + 1) * sizeof(SegmentEntry));
+    if (grown == NULL) {
+        return 0;
+    }
+    *entries = grown;
+    if (!segment_path(data_path, MAX_PATH, hunt_id, entry.number, 0) ||
+        !segment_path(clues_path, MAX_PATH, hunt_id, entry.number, 1)) {
+        return 0;
+    }
+
+    // Truncated in case a writer died after creating it but before publishing.
+    data_fd = open(data_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    clue_fd = open(clues_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+    if (clue_fd != -1) {
+        close(clue_fd);
+    }
+    if (data_fd == -1 || clue_fd == -1) {
+        perror("Failed to create segment");
+        return 0;
+    }
+    if (pwrite(fd, &entry, sizeof(entry),
+            hdr->header_size + (off_t)hdr->segment_count * (off_t)sizeof(entry)) != sizeof(entry)) {
+        perror("Failed to write segment manifest");
+        return 0;
+    }
+    grown[hdr->segment_count++] = entry;
+    hdr->next_segment++;
+    return 1;
+}
+
+// Writes count records, the slots right after hdr's, into segment entry:
+// their clues with one pwrite, then the records with another.
+static int write_segment(const char* hunt_id, const SegmentEntry* entry, const StoreHeader* hdr,
+    const TreasureRecord* records, int count, const char* clues, size_t clue_len) {
+    char data_path[MAX_PATH];
+    char clues_path[MAX_PATH];
+    off_t offset = entry->data_offset + (off_t)(hdr->slot_count - entry->first_slot) * hdr->record_size;
+    ssize_t len = (ssize_t)((size_t)count * sizeof(TreasureRecord));
+    int data_fd, clue_fd = -1;
+    int ok;
+
+    if (!segment_path(data_path, MAX_PATH, hunt_id, entry->number, 0) ||
+        !segment_path(clues_path, MAX_PATH, hunt_id, entry->number, 1)) {
+        return 0;
+    }
+    data_fd = open(data_path, O_WRONLY);
+    if (clue_len > 0) {
+        clue_fd = open(clues_path, O_WRONLY | O_CREAT, 0644);
+    }
+    ok = data_fd != -1 &&
+        (clue_len == 0 ||
+         (clue_fd != -1 &&
+          pwrite(clue_fd, clues, clue_len, hdr->clue_bytes - entry->clue_base) == (ssize_t)clue_len)) &&
+        pwrite(data_fd, records, (size_t)len, offset) == len;
+    if (!ok) {
+        perror("Failed to write treasure data");
+    }
+    if (data_fd != -1) {
+        close(data_fd);
+    }
+    if (clue_fd != -1) {
+        close(clue_fd);
+    }
+    return ok;
+}
+
+// Writes the batch into the last segment, starting a new one whenever it is
+// full. hdr is advanced past what was written, for the caller to publish.
+static int write_records(const char* hunt_id, int fd, StoreHeader* hdr, SegmentEntry** entries,
+    const TreasureRecord* records, const char* clues, int count) {
+    int64_t capacity = segment_capacity(hdr);
+    int done = 0;
+
+    while (done < count) {
+        const SegmentEntry* active = hdr->segment_count > 0 ? &(*entries)[hdr->segment_count - 1] : NULL;
+        int64_t room = active ? capacity - (hdr->slot_count - active->first_slot) : 0;
+        size_t clue_len = 0;
+        int n;
+
+        if (room <= 0) {
+            if (!start_segment(hunt_id, fd, hdr, entries)) {
+                return 0;
+            }
+            continue;
+        }
+        n = (int64_t)(count - done) < room ? count - done : (int)room;
+        for (int i = done; i < done + n; i++) {
+            clue_len += records[i].clue_length;
+        }
+        if (!write_segment(hunt_id, active, hdr, records + done, n, clues, clue_len)) {
+            return 0;
+        }
+        hdr->slot_count += n;
+        hdr->clue_bytes += (int64_t)clue_len;
+        clues += clue_len;
+        done += n;
+    }
+    return 1;
+}
+
+// Writes the batch behind the last record, one pwrite of clues and one of
+// records per segment it lands in, then the header. With assign_ids the
+// batch gets a contiguous ID range taken from the header.
+static int append_records(const char* hunt_id, Treasure* treasures, int count, int assign_ids) {
+    StoreHeader hdr;
+    SegmentEntry* entries = NULL;
+    TreasureRecord* records;
+    char* clue_buf;
+    size_t clue_total = 0;
+    int64_t first_slot;
+    int fd, lock_fd;
+
+    if (count <= 0) {
+        return 1;
+    }
+
+    lock_fd = lock_hunt(hunt_id, LOCK_FILENAME);
+    if (lock_fd == -1) {
+        perror("Failed to lock hunt");
+        return 0;
+    }
+
+    fd = store_open(hunt_id, O_RDWR | O_CREAT, &hdr);
+    if (fd == -1) {
+        perror("Failed to open treasures file");
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+    if (!read_manifest(fd, &hdr, &entries)) {
+        perror("Failed to read segment manifest");
+        close(fd);
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (assign_ids) {
+            treasures[i].treasure_id = (int)hdr.next_id + i;
+        }
+        clue_total += clue_length(&treasures[i]);
+    }
+
+    records = malloc((size_t)count * sizeof(TreasureRecord));
+    clue_buf = malloc(clue_total + 1);
+    if (records == NULL || clue_buf == NULL) {
+        perror("malloc");
+        free(records);
+        free(clue_buf);
+        free(entries);
+        close(fd);
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+
+    clue_total = 0;
+    for (int i = 0; i < count; i++) {
+        split_treasure(&treasures[i], (uint64_t)hdr.clue_bytes + clue_total, &records[i]);
+        memcpy(clue_buf + clue_total, treasures[i].clue, records[i].clue_length);
+        clue_total += records[i].clue_length;
+    }
+
+    first_slot = hdr.slot_count;
+    if (!write_records(hunt_id, fd, &hdr, &entries, records, clue_buf, count)) {
+        free(records);
+        free(clue_buf);
+        free(entries);
+        close(fd);
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+    free(clue_buf);
+    free(entries);
+
+    hdr.record_count += count;
+    hdr.generation++;
+    if (store_sync_policy() == SYNC_NONE) {
+        hdr.synced_slots = (uint32_t)hdr.slot_count;
+    }
+    for (int i = 0; i < count; i++) {
+        if (treasures[i].treasure_id >= hdr.next_id) {
+            hdr.next_id = (int64_t)treasures[i].treasure_id + 1;
+        }
+    }
+    if (!store_write_header(fd, &hdr)) {
+        free(records);
+        close(fd);
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+    close(fd);
+
+    // Still under the lock, so the incremental updates see the generations
+    // in order.
+    if (!store_index_set(hunt_id, treasures[0].treasure_id, count, first_slot)) {
+        index_rebuild(hunt_id, 1);
+    }
+    scores_apply(hunt_id, hdr.generation - 1, hdr.generation, records, count, 1);
+    spatial_apply(hunt_id, hdr.clue_gen, first_slot, records, count);
+    search_apply(hunt_id, hdr.clue_gen, first_slot, treasures, count);
+    users_apply(hunt_id, hdr.clue_gen, first_slot, records, count);
+    zones_apply(hunt_id, hdr.clue_gen, first_slot, records, count);
+    free(records);
+    return commit_write(hunt_id, lock_fd, hdr.generation);
+}
+
+int store_append(const char* hunt_id, Treasure* treasure) {
+    return append_records(hunt_id, treasure, 1, 1);
+}
+
+int store_append_batch(const char* hunt_id, Treasure* treasures, int count) {
+    return append_records(hunt_id, treasures, count, 1);
+}
+
+int store_remove(const char* hunt_id, int treasure_id) {
+    char del_path[MAX_PATH];
+    StoreSnapshot snap;
+    TreasureRecord record;
+    int64_t slot;
+    uint32_t dead_slot;
+    uint32_t generation;
+    int del_fd, lock_fd;
+    int found;
+
+    lock_fd = lock_hunt(hunt_id, LOCK_FILENAME);
+    if (lock_fd == -1) {
+        return -1;
+    }
+
+    if (!open_manifest(hunt_id, O_RDWR, &snap)) {
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+    if (!deletes_path(del_path, MAX_PATH, hunt_id, snap.hdr.clue_gen)) {
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+
+    // A slot that is already dead reads as not found, so a stale index
+    // entry cannot remove a record twice.
+    found = index_find(hunt_id, &snap, treasure_id, &record, &slot, 1);
+    if (found != 1) {
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return found;
+    }
+
+    del_fd = open(del_path, O_WRONLY | O_CREAT, 0644);
+    if (del_fd == -1) {
+        perror("Failed to open tombstone file");
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+
+    // Entries past dead_count are leftovers from before the last compaction
+    // and are simply overwritten.
+    dead_slot = (uint32_t)slot;
+    if (pwrite(del_fd, &dead_slot, sizeof(dead_slot), (off_t)snap.hdr.dead_count * sizeof(dead_slot)) !=
+        sizeof(dead_slot)) {
+        perror("Failed to write tombstone");
+        close(del_fd);
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+    close(del_fd);
+
+    // next_id is kept as-is so a removed ID is never handed out again.
+    snap.hdr.dead_count++;
+    snap.hdr.record_count--;
+    snap.hdr.generation++;
+    generation = snap.hdr.generation;
+    if (!store_write_header(snap.fd, &snap.hdr)) {
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+    store_snapshot_close(&snap);
+
+    index_clear(hunt_id, treasure_id);
+    scores_apply(hunt_id, generation - 1, generation, &record, 1, -1);
+    return commit_write(hunt_id, lock_fd, generation) ? 1 : -1;
+}
+
+double store_compact_threshold(void) {
+    const char* env = getenv("TREASURE_COMPACT_THRESHOLD");
+    double threshold = env ? atof(env) : COMPACT_THRESHOLD;
+
+    return threshold > 0 ? threshold : COMPACT_THRESHOLD;
+}
+
+// Copies the live records of segment index, with their clues, into w.
+static int copy_segment(const char* hunt_id, StoreSnapshot* snap, int index, SegmentWriter* w) {
+    StoreSegment* seg = &snap->segments[index];
+    StoreIter it;
+    const TreasureRecord* record;
+    TreasureRecord moved;
+    struct stat st;
+    char* heap = MAP_FAILED;
+    size_t heap_len = 0;
+    int ok = 1;
+
+    if (!open_segment(hunt_id, seg)) {
+        return 0;
+    }
+    // The clue file is mapped whole; compaction is rare and copies it once.
+    if (seg->clue_bytes > 0 && fstat(seg->clue_fd, &st) == 0 && st.st_size > 0) {
+        heap_len = (size_t)(st.st_size < seg->clue_bytes ? st.st_size : seg->clue_bytes);
+        heap = mmap(NULL, heap_len, PROT_READ, MAP_SHARED, seg->clue_fd, 0);
+        if (heap == MAP_FAILED) {
+            perror("Failed to map segment clues");
+            return 0;
+        }
+    }
+
+    iter_segments(&it, snap, index, 1);
+    while (ok && (record = store_iter_next(&it)) != NULL) {
+        const char* clue = NULL;
+
+        moved = *record;
+        if (record->clue_offset < (uint64_t)seg->clue_base ||
+            record->clue_offset - (uint64_t)seg->clue_base + record->clue_length > heap_len) {
+            moved.clue_length = 0;
+        } else {
+            clue = heap + (record->clue_offset - (uint64_t)seg->clue_base);
+        }
+        ok = segment_writer_put(w, &moved, clue);
+    }
+    // A short read must not pass for the end of the segment.
+    if (it.slot != seg->first_slot + seg->slot_count) {
+        ok = 0;
+    }
+    store_iter_close(&it);
+    if (heap != MAP_FAILED) {
+        munmap(heap, heap_len);
+    }
+    return ok;
+}
+
+// Rewrites the segments that qualify: with a threshold, those whose dead
+// fraction is over it; without one, those holding any dead record or more
+// records than a segment should. Runs of rewritten segments are packed
+// together. The other segments keep their files and only get new first
+// slots, and their tombstones move to the new generation. Returns the number
+// of records dropped, or -1 on error.
+static int compact_segments(const char* hunt_id, double threshold) {
+    char path[MAX_PATH];
+    char temp_path[MAX_PATH];
+    char del_path[MAX_PATH];
+    char new_del_path[MAX_PATH];
+    char seg_path[MAX_PATH];
+    StoreSnapshot snap;
+    StoreHeader hdr;
+    SegmentWriter w;
+    int64_t* dead_counts = NULL;
+    uint32_t* tombstones = NULL;
+    char* rewrite = NULL;
+    int64_t carried = 0;
+    int64_t dropped = 0;
+    int64_t capacity;
+    int durable = store_sync_policy() == SYNC_GROUP;
+    int count, lock_fd, fd;
+    int any = 0;
+    int failed = 0;
+    int result = -1;
+
+    lock_fd = lock_hunt(hunt_id, LOCK_FILENAME);
+    if (lock_fd == -1) {
+        return -1;
+    }
+    if (!open_manifest(hunt_id, O_RDWR, &snap)) {
+        unlock_hunt(lock_fd);
+        return -1;
+    }
+    hdr = snap.hdr;
+    count = snap.segment_count;
+    capacity = segment_capacity(&hdr);
+    if (!snapshot_dead(hunt_id, &snap)) {
+        perror("Failed to read tombstones");
+    }
+
+    dead_counts = calloc((size_t)count + 1, sizeof(int64_t));
+    rewrite = calloc((size_t)count + 1, 1);
+    tombstones = malloc((size_t)hdr.dead_count * sizeof(uint32_t) + 1);
+    if (!store_path(path, MAX_PATH, hunt_id, TREASURES_FILENAME) ||
+        !store_path(temp_path, MAX_PATH, hunt_id, "treasures.tmp") ||
+        !deletes_path(del_path, MAX_PATH, hunt_id, hdr.clue_gen) ||
+        !deletes_path(new_del_path, MAX_PATH, hunt_id, hdr.clue_gen + 1) ||
+        dead_counts == NULL || rewrite == NULL || tombstones == NULL ||
+        (hdr.dead_count > 0 && snap.dead == NULL)) {
+        goto done;
+    }
+
+    for (int i = 0; i < count; i++) {
+        const StoreSegment* seg = &snap.segments[i];
+
+        for (int64_t s = 0; snap.dead != NULL && s < seg->slot_count; s++) {
+            dead_counts[i] += is_dead(snap.dead, seg->first_slot + s);
+        }
+        if (threshold > 0) {
+            rewrite[i] = dead_counts[i] > 0 && dead_counts[i] > threshold * (double)seg->slot_count;
+        } else {
+            rewrite[i] = dead_counts[i] > 0 || seg->slot_count > capacity;
+        }
+        any |= rewrite[i];
+    }
+    if (!any) {
+        result = 0;
+        goto done;
+    }
+
+    segment_writer_init(&w, hunt_id, capacity, hdr.next_segment, snap.segments[0].clue_base);
+    for (int i = 0; i < count && !failed; i++) {
+        StoreSegment* seg = &snap.segments[i];
+
+        if (rewrite[i]) {
+            failed = !copy_segment(hunt_id, &snap, i, &w);
+            dropped += dead_counts[i];
+            continue;
+        }
+        for (int64_t s = 0; snap.dead != NULL && s < seg->slot_count; s++) {
+            if (is_dead(snap.dead, seg->first_slot + s)) {
+                tombstones[carried++] = (uint32_t)(w.slot + s);
+            }
+        }
+        failed = !segment_writer_keep(&w, seg);
+    }
+    if (!failed) {
+        failed = !segment_writer_seal(&w);
+    }
+    // A kept last segment may hold records no group commit has synced yet.
+    if (!failed && durable && !rewrite[count - 1]) {
+        failed = !sync_segment(hunt_id, snap.segments[count - 1].number);
+    }
+
+    hdr.slot_count = w.slot;
+    hdr.dead_count = carried;
+    if (rewrite[count - 1]) {
+        hdr.clue_bytes = w.clue_bytes;
+    }
+    hdr.clue_gen++;
+    hdr.segment_count = (uint32_t)w.entry_count;
+    hdr.next_segment = w.next_number;
+    hdr.synced_slots = (uint32_t)hdr.slot_count;
+
+    if (!failed && carried > 0) {
+        fd = open(new_del_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed = fd == -1 ||
+            write(fd, tombstones, (size_t)carried * sizeof(uint32_t)) != (ssize_t)(carried * sizeof(uint32_t)) ||
+            (durable && fdatasync(fd) == -1);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    if (!failed) {
+        fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        failed = fd == -1 || !write_manifest(fd, &hdr, w.entries);
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    // The new treasures.dat names the new generation's segments and
+    // tombstones, so the swap is the rename. Snapshots of the old generation
+    // keep their files open; the unlinks below only drop the names.
+    if (failed || rename(temp_path, path) != 0) {
+        perror("Failed to write compacted segments");
+        segment_writer_abort(&w);
+        unlink(temp_path);
+        unlink(new_del_path);
+        goto done;
+    }
+    if (durable) {
+        sync_directory(hunt_id);
+    }
+    free(w.entries);
+    for (int i = 0; i < count; i++) {
+        for (int clues = 0; rewrite[i] && clues < 2; clues++) {
+            if (segment_path(seg_path, MAX_PATH, hunt_id, snap.segments[i].number, clues)) {
+                unlink(seg_path);
+            }
+        }
+    }
+    unlink(del_path);
+
+    // Slots shifted, so the ID index has to be regenerated.
+    index_rebuild(hunt_id, 1);
+    result = (int)dropped;
+
+done:
+    free(dead_counts);
+    free(rewrite);
+    free(tombstones);
+    store_snapshot_close(&snap);
+    unlock_hunt(lock_fd);
+    return result;
+}
+
+int store_compact(const char* hunt_id) {
+    return compact_segments(hunt_id, 0);
+}
+
+int store_maybe_compact(const char* hunt_id) {
+    StoreHeader hdr;
+    double threshold = store_compact_threshold();
+    int fd = store_open(hunt_id, O_RDONLY, &hdr);
+
+    if (fd == -1) {
+        return 0;
+    }
+    close(fd);
+
+    if (hdr.slot_count == 0 || (double)hdr.dead_count / hdr.slot_count <= threshold) {
+        return 0;
+    }
+    return compact_segments(hunt_id, threshold);
+}
+
+int store_index_set(const char* hunt_id, int first_id, int count, int64_t first_slot) {
+    char idx_path[MAX_PATH];
+    int64_t covered = 0;
+    int64_t* slots;
+    ssize_t len;
+    int fd;
+
+    if (first_id <= 0 || count <= 0 || !store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME)) {
+        return 0;
+    }
+
+    // No index yet: the caller rebuilds it.
+    fd = open(idx_path, O_RDWR);
+    if (fd == -1) {
+        return 0;
+    }
+
+    // Only extend an index that covers everything before this record,
+    // otherwise leave it for the caller to rebuild.
+    if (pread(fd, &covered, sizeof(covered), 0) != sizeof(covered) || covered != first_slot) {
+        close(fd);
+        return 0;
+    }
+
+    slots = malloc((size_t)count * sizeof(int64_t));
+    if (slots == NULL) {
+        close(fd);
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        slots[i] = first_slot + i + 1;
+    }
+
+    len = (ssize_t)((size_t)count * sizeof(int64_t));
+    covered = first_slot + count;
+    if (pwrite(fd, slots, (size_t)len, (off_t)first_id * sizeof(int64_t)) != len ||
+        pwrite(fd, &covered, sizeof(covered), 0) != sizeof(covered)) {
+        perror("Failed to update treasure index");
+        free(slots);
+        close(fd);
+        return 0;
+    }
+
+    free(slots);
+    close(fd);
+    return 1;
+}
+
+// Builds the index from a snapshot, under the hunt lock unless the caller
+// already holds it: an index built before a removal must not be renamed
+// over one the removal has already cleared. Only writers rebuild; lookups
+// that find the index missing or stale scan instead.
+static int index_rebuild(const char* hunt_id, int locked) {
+    char idx_path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    StoreSnapshot snap;
+    StoreIter it;
+    const TreasureRecord* record;
+    int64_t* slots;
+    int64_t slot_count;
+    ssize_t len;
+    int idx_fd;
+    int lock_fd = -1;
+    int ok = 0;
+
+    if (!store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, INDEX_FILENAME ".tmp")) {
+        return 0;
+    }
+    if (!locked && (lock_fd = lock_hunt(hunt_id, LOCK_FILENAME)) == -1) {
+        return 0;
+    }
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+
+    // IDs are below next_id, so the whole index fits in one array written at once.
+    slot_count = snap.hdr.next_id > 0 ? snap.hdr.next_id : 1;
+    slots = calloc((size_t)slot_count, sizeof(int64_t));
+    if (slots == NULL) {
+        store_snapshot_close(&snap);
+        unlock_hunt(lock_fd);
+        return 0;
+    }
+
+    store_iter_snapshot(&it, &snap);
+    while ((record = store_iter_next(&it)) != NULL) {
+        if (record->treasure_id > 0 && record->treasure_id < slot_count) {
+            slots[record->treasure_id] = it.slot;
+        }
+    }
+    store_iter_close(&it);
+    slots[0] = snap.hdr.slot_count;
+    store_snapshot_close(&snap);
+
+    idx_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (idx_fd == -1) {
+        perror("Failed to create treasure index");
+        goto done;
+    }
+
+    len = (ssize_t)(slot_count * sizeof(int64_t));
+    if (write(idx_fd, slots, (size_t)len) != len) {
+        perror("Failed to write treasure index");
+        close(idx_fd);
+        unlink(tmp_path);
+        goto done;
+    }
+    close(idx_fd);
+
+    // Publish atomically so concurrent lookups never see a half-built index.
+    if (rename(tmp_path, idx_path) != 0) {
+        perror("Failed to replace treasure index");
+        unlink(tmp_path);
+        goto done;
+    }
+    ok = 1;
+
+done:
+    free(slots);
+    unlock_hunt(lock_fd);
+    return ok;
+}
+
+int store_index_rebuild(const char* hunt_id) {
+    return index_rebuild(hunt_id, 0);
+}
+
+// A miss is only trusted if the index covers every slot of the generation.
+static int index_is_current(int idx_fd, const StoreHeader* hdr) {
+    int64_t covered;
+
+    if (pread(idx_fd, &covered, sizeof(covered), 0) != sizeof(covered)) {
+        return 0;
+    }
+    return covered >= hdr->slot_count;
+}
+
+static void index_clear(const char* hunt_id, int treasure_id) {
+    char idx_path[MAX_PATH];
+    int64_t slot = 0;
+    int fd;
+
+    if (!store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME)) {
+        return;
+    }
+    fd = open(idx_path, O_WRONLY);
+    if (fd == -1) {
+        return;
+    }
+    if (pwrite(fd, &slot, sizeof(slot), (off_t)treasure_id * sizeof(slot)) != sizeof(slot)) {
+        perror("Failed to update treasure index");
+    }
+    close(fd);
+}
+
+// Finds treasure_id by scanning the live records of snap, for lookups the
+// index cannot answer. Returns like index_find.
+static int scan_find(const char* hunt_id, StoreSnapshot* snap, int treasure_id, TreasureRecord* out, int64_t* slot) {
+    StoreIter it;
+    const TreasureRecord* record;
+    int result = 0;
+
+    for (int i = 0; i < snap->segment_count; i++) {
+        if (!open_segment(hunt_id, &snap->segments[i])) {
+            return -1;
+        }
+    }
+    if (!snapshot_dead(hunt_id, snap)) {
+        return -1;
+    }
+
+    store_iter_snapshot(&it, snap);
+    while ((record = store_iter_next(&it)) != NULL) {
+        if (record->treasure_id == treasure_id) {
+            *out = *record;
+            *slot = it.slot - 1;
+            result = 1;
+            break;
+        }
+    }
+    store_iter_close(&it);
+    return result;
+}
+
+// Resolves treasure_id through the index against snap, opening the segment
+// holding the slot. The index is only a hint: the record must carry the ID
+// and must not be tombstoned in snap. Returns 1 and fills *out and *slot if
+// found, 0 if not, -1 on error, including a segment that has been compacted
+// away. locked says whether the caller holds the hunt lock; only then is a
+// missing or stale index rebuilt. Otherwise snap is scanned, so lookups never
+// wait on a writer or need to write to the hunt.
+static int index_find(const char* hunt_id, StoreSnapshot* snap, int treasure_id, TreasureRecord* out, int64_t* slot,
+    int locked) {
+    char idx_path[MAX_PATH];
+    int idx_fd;
+    int64_t entry;
+    int answered = 0;
+    int result = 0;
+
+    if (treasure_id <= 0) {
+        return 0;
+    }
+
+    if (!store_path(idx_path, MAX_PATH, hunt_id, INDEX_FILENAME)) {
+        return -1;
+    }
+
+    idx_fd = open(idx_path, O_RDONLY);
+    if (idx_fd == -1 && locked && index_rebuild(hunt_id, 1)) {
+        idx_fd = open(idx_path, O_RDONLY);
+    }
+
+    for (int attempt = 0; attempt < 2 && idx_fd != -1 && !answered; attempt++) {
+        entry = 0;
+        answered = 1;
+        if (pread(idx_fd, &entry, sizeof(entry), (off_t)treasure_id * sizeof(entry)) == sizeof(entry) && entry > 0) {
+            stats_add_read(sizeof(entry), 0);
+            if (entry <= snap->hdr.slot_count) {
+                if (!open_segment(hunt_id, &snap->segments[find_segment(snap, entry - 1, 0)])) {
+                    result = -1;
+                    break;
+                }
+                if (store_snapshot_read(snap, entry - 1, 1, out) == 1 && out->treasure_id == treasure_id) {
+                    // An ID only ever has one slot per generation, so a dead
+                    // one means it was removed, whatever the index says.
+                    if (!snapshot_dead(hunt_id, snap)) {
+                        result = -1;
+                    } else if (!is_dead(snap->dead, entry - 1)) {
+                        *slot = entry - 1;
+                        result = 1;
+                    }
+                    break;
+                }
+            } else if (index_is_current(idx_fd, &snap->hdr)) {
+                // Appended after the snapshot was taken.
+                break;
+            }
+        } else if (index_is_current(idx_fd, &snap->hdr)) {
+            break;
+        }
+
+        // Stale index (slots renumbered or appended by an older tool).
+        answered = 0;
+        close(idx_fd);
+        idx_fd = -1;
+        if (attempt == 0 && locked && index_rebuild(hunt_id, 1)) {
+            idx_fd = open(idx_path, O_RDONLY);
+        }
+    }
+
+    if (idx_fd != -1) {
+        close(idx_fd);
+    }
+    if (!answered) {
+        result = scan_find(hunt_id, snap, treasure_id, out, slot);
+    }
+    return result;
+}
+
+int store_lookup(const char* hunt_id, int treasure_id, Treasure* out) {
+    StoreSnapshot snap;
+    TreasureRecord record;
+    int64_t slot;
+    int result;
+
+    if (treasure_id <= 0) {
+        return 0;
+    }
+
+    // Only the segment holding the record is opened, not the whole generation.
+    for (int attempt = 0; attempt < SNAPSHOT_RETRIES; attempt++) {
+        if (!open_manifest(hunt_id, O_RDONLY, &snap)) {
+            return errno == ENOENT ? 0 : -1;
+        }
+        result = index_find(hunt_id, &snap, treasure_id, &record, &slot, 0);
+        if (result == 1) {
+            // Reassemble the full treasure from the hot record and its clue.
+            memset(out, 0, sizeof(*out));
+            out->treasure_id = record.treasure_id;
+            out->value = record.value;
+            out->latitude = record.latitude;
+            out->longitude = record.longitude;
+            memcpy(out->username, record.username, MAX_USERNAME);
+            result = snapshot_clue_lazy(hunt_id, &snap, &record, out->clue) == 1 ? 1 : -1;
+        }
+        if (result != -1 || is_published(hunt_id, snap.fd)) {
+            store_snapshot_close(&snap);
+            return result;
+        }
+        // A compaction replaced the segment under us: look again.
+        store_snapshot_close(&snap);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+int store_read_clue(const char* hunt_id, uint32_t clue_gen, const TreasureRecord* record, char* clue) {
+    StoreSnapshot snap;
+    int ok;
+
+    clue[0] = '\0';
+    if (record->clue_length == 0) {
+        return 1;
+    }
+    if (!open_manifest(hunt_id, O_RDONLY, &snap)) {
+        return 0;
+    }
+    ok = snap.hdr.clue_gen == clue_gen && snapshot_clue_lazy(hunt_id, &snap, record, clue) == 1;
+    store_snapshot_close(&snap);
+    return ok;
+}
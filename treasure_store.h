@@ -0,0 +1,296 @@
+#ifndef TREASURE_STORE_H
+#define TREASURE_STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Shared on-disk storage for treasure_manager, treasure_hub and score_calculator.
+// Build each tool together with treasure_store.c, e.g.
+//   gcc -o treasure_manager treasure_manager.c treasure_ops.c treasure_log.c treasure_store.c treasure_scores.c treasure_spatial.c treasure_search.c treasure_users.c treasure_zones.c treasure_stats.c -pthread -lm
+//   gcc -o score_calculator score_calculator.c treasure_scoring.c treasure_store.c treasure_scores.c treasure_spatial.c treasure_search.c treasure_users.c treasure_zones.c treasure_stats.c treasure_columns.c -pthread -lm
+//   gcc -o treasure_hub treasure_hub.c hub_protocol.c hub_hunts.c hunt_cache.c treasure_store.c treasure_scores.c treasure_spatial.c treasure_search.c treasure_users.c treasure_zones.c treasure_stats.c treasure_columns.c -pthread -lm
+//   gcc -o treasure_bench treasure_bench.c treasure_ops.c treasure_scoring.c hub_hunts.c hunt_cache.c treasure_log.c treasure_store.c treasure_scores.c treasure_spatial.c treasure_search.c treasure_users.c treasure_zones.c treasure_stats.c treasure_columns.c -pthread -lm
+//   gcc -o hub_load hub_load.c treasure_store.c treasure_scores.c treasure_spatial.c treasure_search.c treasure_users.c treasure_zones.c treasure_stats.c -pthread -lm
+
+#define MAX_PATH 256
+#define MAX_USERNAME 50
+#define MAX_CLUE_TEXT 500
+
+#define TREASURES_FILENAME "treasures.dat"
+#define INDEX_FILENAME "treasures.idx"
+#define DELETES_FILENAME_FMT "deletes-%u.dat"
+#define SEGMENT_FILENAME_FMT "segment-%u.dat"
+#define SEGMENT_CLUES_FILENAME_FMT "segment-%u.clues"
+// Versions 3 and 4 kept one clue heap per generation next to treasures.dat.
+#define CLUES_FILENAME_FMT "clues-%u.dat"
+// Tombstones were kept in a single file before they were per generation.
+// It is still read, and renamed to the generation's name on the next write.
+#define LEGACY_DELETES_FILENAME "treasures.del"
+#define LOCK_FILENAME "treasures.lock"
+#define COMMIT_FILENAME "treasures.commit"
+
+#define STORE_MAGIC 0x54485254u /* "TRHT" */
+#define STORE_VERSION 5
+
+// Default dead/total ratio above which a hunt is compacted, overridable with
+// TREASURE_COMPACT_THRESHOLD.
+#define COMPACT_THRESHOLD 0.25
+
+// Default size of a segment file for new hunts, overridable with
+// TREASURE_SEGMENT_MB.
+#define SEGMENT_MB 64
+
+// A full treasure as entered by users and shown by view_treasure.
+typedef struct {
+    int treasure_id;
+    char username[MAX_USERNAME];
+    double latitude;
+    double longitude;
+    char clue[MAX_CLUE_TEXT];
+    int value;
+} Treasure;
+
+// The hot part of a treasure, stored fixed-width in the segment files. The
+// clue text lives in the segment's clue file at clue_offset, so listing and
+// scoring scans read 96 bytes per record instead of 576.
+typedef struct {
+    int32_t treasure_id;
+    int32_t value;
+    double latitude;
+    double longitude;
+    uint64_t clue_offset;
+    uint32_t clue_length;
+    uint32_t checksum;      // CRC-32C of the record with this field zeroed, never 0
+    char username[MAX_USERNAME];
+} TreasureRecord;
+
+// Fixed 128-byte header at the start of treasures.dat. It is rewritten with a
+// single pwrite after every add or remove, so counting treasures and picking
+// the next ID never have to scan the records.
+// Records are numbered by slot across the hunt's segments. Removed records
+// stay in place as tombstones: their slot numbers are appended to
+// deletes-<clue_gen>.dat and only the first dead_count entries count.
+// Records from synced_slots on may not have reached the disk yet, so their
+// checksums are verified when the file is opened.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t record_size;
+    uint32_t synced_slots;  // slots known to be on disk
+    int64_t record_count;   // live records
+    int64_t next_id;
+    int64_t slot_count;     // records in the segments, live or dead
+    int64_t dead_count;     // entries in deletes-<clue_gen>.dat
+    int64_t clue_bytes;     // end of the clue offsets handed out so far
+    uint32_t clue_gen;      // generation of the manifest and tombstones, bumped by compaction
+    uint32_t generation;    // bumped by every add or remove, see treasure_scores.h
+    uint32_t segment_count; // manifest entries following the header
+    uint32_t next_segment;  // number the next new segment file gets
+    int64_t segment_records; // records per segment file, fixed when the hunt is created
+    int64_t reserved[6];
+} StoreHeader;
+
+// The records live in segment files of at most segment_records records each,
+// listed by the manifest that follows the header in treasures.dat. The size
+// comes from TREASURE_SEGMENT_MB when the hunt is created (or migrated) and
+// is kept in the header, so every writer rolls segments at the same size;
+// hunts whose header has none adopt the first writer's setting. Only the
+// last segment is appended to; when it is full a new one is started and its
+// entry appended past segment_count before the header publishes it. The
+// other segments never change until compaction rewrites them.
+// segment-<number>.clues holds the clue bytes from clue_base on, so a clue is
+// found by its offset alone.
+typedef struct {
+    uint32_t number;        // names segment-<number>.dat and .clues
+    uint32_t data_offset;   // bytes in front of the first record
+    int64_t first_slot;
+    int64_t clue_base;
+} SegmentEntry;
+
+// Builds "<hunt_id>/<name>" into path. Returns 0 if it did not fit.
+int store_path(char* path, size_t size, const char* hunt_id, const char* name);
+
+// Opens treasures.dat (O_RDONLY or O_RDWR, optionally | O_CREAT) and returns an
+// fd, or -1. Files written by older versions (records in treasures.dat,
+// headerless, or full 576-byte records) are migrated to segments under the
+// hunt lock the first time they are opened. A torn tail left by a crashed
+// writer is cut off: in memory for O_RDONLY, on disk for O_RDWR.
+int store_open(const char* hunt_id, int flags, StoreHeader* hdr);
+int store_write_header(int fd, const StoreHeader* hdr);
+
+int store_count(const char* hunt_id);
+int store_next_id(const char* hunt_id);
+// Bytes of treasures.dat plus the records of every segment; clues excluded.
+int64_t store_data_size(const StoreHeader* hdr);
+// Records per segment file for new hunts, from TREASURE_SEGMENT_MB.
+int64_t store_segment_records(void);
+
+// Writers (append, remove, compact) serialize on an flock of treasures.lock,
+// so ID allocation and header updates never interleave between processes.
+// Durability of appends and removes comes from TREASURE_SYNC:
+//   group  (default) the write is on disk when the call returns; writers
+//          committing at the same time share one fsync through
+//          treasures.commit, which holds the last generation synced
+//   none   flushing is left to the kernel
+typedef enum {
+    SYNC_GROUP,
+    SYNC_NONE
+} SyncPolicy;
+
+SyncPolicy store_sync_policy(void);
+void store_set_sync_policy(SyncPolicy policy);
+
+// Assigns the next free ID to the treasure under the hunt lock, appends it
+// and updates the header and ID index. Returns 1 on success.
+int store_append(const char* hunt_id, Treasure* treasure);
+
+// Assigns consecutive IDs to the batch, then writes all records with one
+// pwrite per segment they land in and one header update. Returns 1 on success.
+int store_append_batch(const char* hunt_id, Treasure* treasures, int count);
+
+// Tombstones a record in O(1). Returns 1 if the record was removed, 0 if the
+// ID does not exist, -1 on error.
+int store_remove(const char* hunt_id, int treasure_id);
+
+// Rewrites the segments that hold dead records, or are larger than a segment
+// should be, leaving the others in place. Returns the number of records
+// dropped, or -1 on error.
+int store_compact(const char* hunt_id);
+double store_compact_threshold(void);
+// Runs when the hunt's dead fraction exceeds store_compact_threshold(), and
+// then only rewrites the segments over it.
+int store_maybe_compact(const char* hunt_id);
+
+// Lock-free reads. The treasures.dat header and manifest describe a
+// generation: how many records, clue bytes and tombstones it has, and which
+// segment files hold them. Writers only append past what a published header
+// covers, so those prefixes never change. Compaction publishes a new
+// generation by renaming a new treasures.dat into place and then unlinks the
+// segments it replaced.
+//
+// A snapshot pins a generation by holding descriptors for treasures.dat and
+// every segment, plus the tombstones read at pin time. If a compaction
+// unlinks a segment between reading the manifest and opening it, the pin is
+// retried on the new generation. Readers never take the hunt lock, and the
+// kernel reclaims an unlinked segment once the last snapshot holding it is
+// closed.
+typedef struct {
+    uint32_t number;
+    int fd;                 // segment-<number>.dat
+    int clue_fd;            // segment-<number>.clues
+    off_t data_offset;
+    int64_t first_slot;
+    int64_t slot_count;
+    int64_t clue_base;
+    int64_t clue_bytes;     // clue bytes of this segment the generation uses
+} StoreSegment;
+
+typedef struct {
+    StoreHeader hdr;
+    int fd;                 // treasures.dat
+    int segment_count;
+    StoreSegment* segments;
+    uint8_t* dead;          // tombstone bitmap, NULL if nothing was removed
+} StoreSnapshot;
+
+// Returns 1 on success, 0 (with errno set) if the hunt cannot be opened.
+int store_snapshot_open(StoreSnapshot* snap, const char* hunt_id);
+void store_snapshot_close(StoreSnapshot* snap);
+// Reads up to count records from slot on into out, across segments. Returns
+// the number read.
+int64_t store_snapshot_read(const StoreSnapshot* snap, int64_t slot, int64_t count, TreasureRecord* out);
+// Reads a record's clue through the pinned segments. Returns 1 on success.
+int store_snapshot_clue(const StoreSnapshot* snap, const TreasureRecord* record, char* clue);
+// Whether a slot of the snapshot has been removed.
+int store_snapshot_is_dead(const StoreSnapshot* snap, int64_t slot);
+
+// Sequential record scan shared by every tool. Records are handed out as
+// pointers into a large read buffer or into an mmap of the segment, so a
+// scan costs one syscall per block instead of one per record. The pointer is
+// only valid until the next call to store_iter_next.
+typedef enum {
+    SCAN_BLOCK,
+    SCAN_MMAP
+} ScanBackend;
+
+#define SCAN_BLOCK_RECORDS 4096
+
+typedef struct {
+    int fd;
+    int owns_fd;
+    ScanBackend backend;
+    size_t record_size;
+    off_t next_offset;
+    int64_t run_remaining;  // records left in the current segment
+    int64_t remaining;      // records left in the scan
+    int64_t slot;
+    StoreHeader hdr;        // header of the generation the scan reflects
+    uint8_t* dead;
+    int owns_dead;
+    char* data;
+    size_t data_len;
+    size_t pos;
+    const StoreSegment* segments;   // segments still to be scanned
+    int segment_count;
+    StoreSnapshot* snap;    // pinned by store_iter_open
+} StoreIter;
+
+// Default comes from TREASURE_SCAN_BACKEND ("block" or "mmap").
+ScanBackend store_scan_backend(void);
+void store_set_scan_backend(ScanBackend backend);
+
+// Returns 1 on success, 0 (with errno set) if treasures.dat cannot be opened.
+// Tombstoned records are skipped. The scan covers one pinned snapshot.
+int store_iter_open(StoreIter* it, const char* hunt_id);
+const TreasureRecord* store_iter_next(StoreIter* it);
+// Skips ahead so the next record returned is at slot or later.
+void store_iter_seek(StoreIter* it, int64_t slot);
+void store_iter_close(StoreIter* it);
+// Scans a pinned snapshot. The iterator borrows the snapshot's descriptors
+// and tombstones, so the snapshot must stay open until the iterator is closed.
+int store_iter_snapshot(StoreIter* it, const StoreSnapshot* snap);
+
+// Parallel scans. Each segment of a snapshot is one part, numbered in slot
+// order. store_scan_parts runs fn on parts first .. first + count - 1 on up
+// to threads threads, the calling thread included; 0 threads picks
+// TREASURE_SCAN_THREADS, or one per core. Callers keep a result per part and
+// combine them in part order afterwards, so the output matches a serial
+// scan. Returns 1 if every call returned 1, otherwise -1.
+typedef struct {
+    const StoreSnapshot* snap;
+    int index;
+    int64_t first_slot;
+    int64_t end_slot;
+} StorePart;
+
+typedef int (*StorePartFn)(const StorePart* part, void* arg);
+
+int store_scan_threads(void);
+void store_snapshot_part(const StoreSnapshot* snap, int index, StorePart* part);
+int store_scan_parts(const StoreSnapshot* snap, int first, int count, int threads, StorePartFn fn, void* arg);
+// Scans the records of one part, like store_iter_snapshot.
+int store_iter_part(StoreIter* it, const StorePart* part);
+
+// Opens the tombstone file of generation gen for reading, or returns -1.
+int store_open_deletes(const char* hunt_id, uint32_t gen);
+
+// treasure_id -> slot index kept next to treasures.dat.
+// The index is a flat array of 64-bit entries addressed by treasure_id,
+// holding slot + 1, so a lookup is one pread into the index and one into the
+// segment holding the slot. Entry 0 is never a valid ID and holds the number
+// of slots the index covers. Points count consecutive IDs starting at
+// first_id at consecutive slots from first_slot.
+int store_index_set(const char* hunt_id, int first_id, int count, int64_t first_slot);
+int store_index_rebuild(const char* hunt_id);
+
+// Returns 1 and fills *out (clue included) if found, 0 if the ID does not
+// exist, -1 on error.
+int store_lookup(const char* hunt_id, int treasure_id, Treasure* out);
+
+// Reads record's clue from generation clue_gen into clue (at least
+// MAX_CLUE_TEXT bytes) and NUL-terminates it. Returns 1 on success, 0 if
+// the generation has been replaced since.
+int store_read_clue(const char* hunt_id, uint32_t clue_gen, const TreasureRecord* record, char* clue);
+
+#endif
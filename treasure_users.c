@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_users.h"
+#include "treasure_scores.h"
+
+// Appends of at most this many records update bucket heads one by one;
+// larger batches rewrite the whole head table.
+#define USERS_SMALL_BATCH 16
+
+typedef struct {
+    int fd;
+    UsersHeader hdr;
+    char* map;
+    size_t map_len;
+    const int64_t* heads;
+    int64_t mapped_entries;
+} UsersIndex;
+
+typedef struct {
+    TreasureRecord* items;
+    int count;
+    int capacity;
+} RecordList;
+
+static off_t heads_offset(void) {
+    return (off_t)sizeof(UsersHeader);
+}
+
+static off_t entry_offset(const UsersHeader* hdr, int64_t slot) {
+    return heads_offset() + (off_t)hdr->bucket_count * sizeof(int64_t) + (off_t)slot * sizeof(UserEntry);
+}
+
+static int read_users_header(int fd, UsersHeader* hdr) {
+    return pread(fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+        hdr->magic == USERS_MAGIC &&
+        hdr->version == USERS_VERSION &&
+        hdr->header_size == sizeof(UsersHeader) &&
+        hdr->bucket_count >= USERS_MIN_BUCKETS &&
+        (hdr->bucket_count & (hdr->bucket_count - 1)) == 0 &&
+        hdr->covered_slots >= 0;
+}
+
+static uint32_t buckets_for(int64_t slots) {
+    uint32_t buckets = USERS_MIN_BUCKETS;
+
+    while ((int64_t)buckets < slots / 2 && buckets < (1u << 30)) {
+        buckets *= 2;
+    }
+    return buckets;
+}
+
+// Writes a new sidecar covering every slot of the snapshot.
+static int users_build(const char* hunt_id, const StoreSnapshot* snap) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char tmp_name[64];
+    UsersHeader hdr;
+    UserEntry* entries;
+    int64_t* heads;
+    StoreIter it;
+    const TreasureRecord* record;
+    size_t heads_len, entries_len, len;
+    int fd;
+    int ok;
+
+    // Concurrent rebuilds each write their own file; the last rename wins.
+    snprintf(tmp_name, sizeof(tmp_name), USERS_FILENAME ".%ld.tmp", (long)getpid());
+    if (!store_path(path, MAX_PATH, hunt_id, USERS_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, tmp_name)) {
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = USERS_MAGIC;
+    hdr.version = USERS_VERSION;
+    hdr.header_size = sizeof(UsersHeader);
+    hdr.clue_gen = snap->hdr.clue_gen;
+    hdr.bucket_count = buckets_for(snap->hdr.slot_count);
+    hdr.covered_slots = snap->hdr.slot_count;
+
+    heads_len = (size_t)hdr.bucket_count * sizeof(int64_t);
+    heads = calloc(hdr.bucket_count, sizeof(int64_t));
+    entries = calloc((size_t)hdr.covered_slots + 1, sizeof(UserEntry));
+    if (heads == NULL || entries == NULL || !store_iter_snapshot(&it, snap)) {
+        free(heads);
+        free(entries);
+        return 0;
+    }
+
+    // Removed slots keep a zeroed entry outside every chain.
+    while ((record = store_iter_next(&it)) != NULL) {
+        int64_t slot = it.slot - 1;
+        uint32_t hash = scores_hash(record->username, &len);
+        uint32_t bucket = hash & (hdr.bucket_count - 1);
+
+        entries[slot].hash = hash;
+        entries[slot].next = heads[bucket];
+        heads[bucket] = slot + 1;
+    }
+    if (it.slot < hdr.covered_slots) {
+        hdr.covered_slots = it.slot;
+    }
+    store_iter_close(&it);
+    entries_len = (size_t)hdr.covered_slots * sizeof(UserEntry);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(heads);
+        free(entries);
+        return 0;
+    }
+    ok = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        pwrite(fd, heads, heads_len, heads_offset()) == (ssize_t)heads_len &&
+        (entries_len == 0 || pwrite(fd, entries, entries_len, entry_offset(&hdr, 0)) == (ssize_t)entries_len);
+    free(heads);
+    free(entries);
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+void users_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count) {
+    char path[MAX_PATH];
+    UsersHeader hdr;
+    UserEntry* entries;
+    int64_t* heads = NULL;
+    uint32_t touched[USERS_SMALL_BATCH];
+    int64_t touched_head[USERS_SMALL_BATCH];
+    int touched_count = 0;
+    size_t heads_len, entries_len, len;
+    int fd;
+
+    if (count <= 0 || !store_path(path, MAX_PATH, hunt_id, USERS_FILENAME)) {
+        return;
+    }
+
+    // No sidecar yet: the first lookup builds one.
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (!read_users_header(fd, &hdr) || hdr.clue_gen != clue_gen || hdr.covered_slots != first_slot) {
+        // See spatial_apply: a store that shrank invalidates the sidecar.
+        if (hdr.clue_gen == clue_gen && hdr.covered_slots > first_slot) {
+            ftruncate(fd, 0);
+        }
+        close(fd);
+        return;
+    }
+
+    heads_len = (size_t)hdr.bucket_count * sizeof(int64_t);
+    entries_len = (size_t)count * sizeof(UserEntry);
+    entries = malloc(entries_len);
+    if (entries == NULL) {
+        close(fd);
+        return;
+    }
+    if (count > USERS_SMALL_BATCH) {
+        heads = malloc(heads_len);
+        if (heads == NULL || pread(fd, heads, heads_len, heads_offset()) != (ssize_t)heads_len) {
+            free(heads);
+            free(entries);
+            close(fd);
+            return;
+        }
+    }
+
+    // Entries are written before the heads that point to them.
+    for (int i = 0; i < count; i++) {
+        uint32_t hash = scores_hash(records[i].username, &len);
+        uint32_t bucket = hash & (hdr.bucket_count - 1);
+        int64_t slot = first_slot + i;
+        int64_t head = 0;
+        int t;
+
+        if (heads != NULL) {
+            head = heads[bucket];
+            heads[bucket] = slot + 1;
+        } else {
+            for (t = 0; t < touched_count && touched[t] != bucket; t++) {
+            }
+            if (t == touched_count) {
+                if (pread(fd, &head, sizeof(head), heads_offset() + (off_t)bucket * sizeof(int64_t)) != sizeof(head)) {
+                    head = 0;
+                }
+                touched[touched_count++] = bucket;
+            } else {
+                head = touched_head[t];
+            }
+            touched_head[t] = slot + 1;
+        }
+        entries[i].hash = hash;
+        entries[i].reserved = 0;
+        entries[i].next = head;
+    }
+
+    if (pwrite(fd, entries, entries_len, entry_offset(&hdr, first_slot)) == (ssize_t)entries_len) {
+        int ok = 1;
+
+        if (heads != NULL) {
+            ok = pwrite(fd, heads, heads_len, heads_offset()) == (ssize_t)heads_len;
+        } else {
+            for (int t = 0; t < touched_count && ok; t++) {
+                ok = pwrite(fd, &touched_head[t], sizeof(int64_t),
+                    heads_offset() + (off_t)touched[t] * sizeof(int64_t)) == sizeof(int64_t);
+            }
+        }
+        if (ok) {
+            hdr.covered_slots += count;
+            pwrite(fd, &hdr, sizeof(hdr), 0);
+        }
+    }
+
+    free(heads);
+    free(entries);
+    close(fd);
+}
+
+// Opens and maps the sidecar if it can answer for the snapshot.
+static int index_open(const char* hunt_id, const StoreSnapshot* snap, UsersIndex* index) {
+    char path[MAX_PATH];
+    struct stat st;
+
+    index->map = NULL;
+    index->fd = -1;
+    if (!store_path(path, MAX_PATH, hunt_id, USERS_FILENAME)) {
+        return 0;
+    }
+    index->fd = open(path, O_RDONLY);
+    if (index->fd == -1) {
+        return 0;
+    }
+
+    if (!read_users_header(index->fd, &index->hdr) || index->hdr.clue_gen != snap->hdr.clue_gen ||
+        snap->hdr.slot_count - index->hdr.covered_slots > USERS_MAX_GAP ||
+        fstat(index->fd, &st) == -1 || st.st_size < entry_offset(&index->hdr, 0)) {
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+
+    index->map_len = (size_t)st.st_size;
+    index->map = mmap(NULL, index->map_len, PROT_READ, MAP_SHARED, index->fd, 0);
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        close(index->fd);
+        index->fd = -1;
+        return 0;
+    }
+    index->heads = (const int64_t*)(index->map + heads_offset());
+    index->mapped_entries = (int64_t)((index->map_len - (size_t)entry_offset(&index->hdr, 0)) / sizeof(UserEntry));
+    return 1;
+}
+
+static void index_close(UsersIndex* index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->map_len);
+    }
+    if (index->fd != -1) {
+        close(index->fd);
+    }
+}
+
+// Entries appended after the file was mapped are read with pread.
+static int index_entry(const UsersIndex* index, int64_t slot, UserEntry* entry) {
+    if (slot < index->mapped_entries) {
+        memcpy(entry, index->map + entry_offset(&index->hdr, slot), sizeof(*entry));
+        return 1;
+    }
+    return pread(index->fd, entry, sizeof(*entry), entry_offset(&index->hdr, slot)) == sizeof(*entry);
+}
+
+static int add_record(RecordList* list, const TreasureRecord* record) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        TreasureRecord* grown = realloc(list->items, (size_t)capacity * sizeof(TreasureRecord));
+        if (grown == NULL) {
+            return 0;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *record;
+    return 1;
+}
+
+// Walks the username's bucket, newest first, and appends the matches in file
+// order.
+static int walk_chain(const UsersIndex* index, const StoreSnapshot* snap, const char* username,
+    uint32_t hash, int64_t covered, RecordList* list) {
+    int64_t next = index->heads[hash & (index->hdr.bucket_count - 1)];
+    int64_t steps = 0;
+    int first = list->count;
+    UserEntry entry;
+    TreasureRecord record;
+
+    while (next > 0 && steps++ <= index->hdr.covered_slots + USERS_MAX_GAP) {
+        int64_t slot = next - 1;
+
+        if (!index_entry(index, slot, &entry)) {
+            break;
+        }
+        next = entry.next;
+        if (slot >= covered || entry.hash != hash || store_snapshot_is_dead(snap, slot)) {
+            continue;
+        }
+        if (store_snapshot_read(snap, slot, 1, &record) != 1) {
+            return 0;
+        }
+        if (strncmp(record.username, username, MAX_USERNAME) == 0 && !add_record(list, &record)) {
+            return 0;
+        }
+    }
+
+    for (int i = first, j = list->count - 1; i < j; i++, j--) {
+        TreasureRecord tmp = list->items[i];
+        list->items[i] = list->items[j];
+        list->items[j] = tmp;
+    }
+    return 1;
+}
+
+int users_lookup(const char* hunt_id, const char* username, TreasureRecord** records) {
+    StoreSnapshot snap;
+    UsersIndex index;
+    StoreIter it;
+    RecordList list = { NULL, 0, 0 };
+    const TreasureRecord* record;
+    int64_t covered = 0;
+    uint32_t hash;
+    size_t len;
+    int ok = 1;
+
+    *records = NULL;
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    hash = scores_hash(username, &len);
+    if (!index_open(hunt_id, &snap, &index) && users_build(hunt_id, &snap)) {
+        index_open(hunt_id, &snap, &index);
+    }
+    if (index.map != NULL) {
+        covered = index.hdr.covered_slots < snap.hdr.slot_count ? index.hdr.covered_slots : snap.hdr.slot_count;
+        ok = walk_chain(&index, &snap, username, hash, covered, &list);
+    }
+    index_close(&index);
+
+    // Slots the sidecar does not cover yet, or all of them without one.
+    if (ok && covered < snap.hdr.slot_count) {
+        ok = store_iter_snapshot(&it, &snap);
+        if (ok) {
+            store_iter_seek(&it, covered);
+            while (ok && (record = store_iter_next(&it)) != NULL) {
+                if (strncmp(record->username, username, MAX_USERNAME) == 0) {
+                    ok = add_record(&list, record);
+                }
+            }
+            store_iter_close(&it);
+        }
+    }
+    store_snapshot_close(&snap);
+
+    if (!ok) {
+        free(list.items);
+        return -1;
+    }
+    *records = list.items;
+    return list.count;
+}
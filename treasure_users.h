@@ -0,0 +1,55 @@
+#ifndef TREASURE_USERS_H
+#define TREASURE_USERS_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// Per-hunt "users" sidecar: username -> the slots of that user's records, so
+// listing or scoring one user reads only their records. Usernames are hashed
+// (scores_hash) into a table of buckets, and each bucket heads a chain
+// through one entry per treasures.dat slot, newest first, like the spatial
+// sidecar. Entries keep the full hash so other users sharing a bucket are
+// skipped without reading their records.
+//
+// It follows the spatial sidecar's rules: appends are linked in under the
+// hunt lock when the file covers exactly the slots before them, removed
+// records are filtered through the snapshot's tombstones, and queries scan
+// uncovered slots directly and rebuild the file after a compaction or when it
+// falls more than USERS_MAX_GAP slots behind.
+
+#define USERS_FILENAME "users"
+#define USERS_MAGIC 0x52535555u /* "UUSR" */
+#define USERS_VERSION 1
+
+#define USERS_MIN_BUCKETS 1024
+#define USERS_MAX_GAP 4096
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t clue_gen;          // treasures.dat file generation the slots refer to
+    uint32_t bucket_count;      // power of two
+    int64_t covered_slots;      // entries exist for slots [0, covered_slots)
+    int64_t reserved;
+} UsersHeader;
+
+// The header is followed by bucket_count int64 chain heads (entry + 1, 0 for
+// an empty bucket) and then one entry per slot.
+typedef struct {
+    uint32_t hash;              // scores_hash of the username, 0 for removed slots at build time
+    uint32_t reserved;
+    int64_t next;               // entry + 1 of the next entry in the bucket, 0 ends
+} UserEntry;
+
+// Called by the store with the hunt lock held, after records were appended
+// at first_slot.
+void users_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count);
+
+// Records of username in file order. Returns how many there are with a
+// malloc'd array in *records, or -1.
+int users_lookup(const char* hunt_id, const char* username, TreasureRecord** records);
+
+#endif
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "treasure_zones.h"
+
+typedef struct {
+    TreasureRecord* items;
+    int count;
+    int capacity;
+} RecordList;
+
+static void zone_empty(ZoneEntry* zone) {
+    zone->min_value = INT32_MAX;
+    zone->max_value = INT32_MIN;
+    zone->min_id = INT32_MAX;
+    zone->max_id = INT32_MIN;
+}
+
+static void zone_add(ZoneEntry* zone, const TreasureRecord* record) {
+    if (record->value < zone->min_value) {
+        zone->min_value = record->value;
+    }
+    if (record->value > zone->max_value) {
+        zone->max_value = record->value;
+    }
+    if (record->treasure_id < zone->min_id) {
+        zone->min_id = record->treasure_id;
+    }
+    if (record->treasure_id > zone->max_id) {
+        zone->max_id = record->treasure_id;
+    }
+}
+
+// An empty block (min > max) never overlaps.
+static int zone_overlaps(const ZoneEntry* zone, const ZoneFilter* filter) {
+    return zone->min_value <= zone->max_value &&
+        zone->max_value >= filter->min_value && zone->min_value <= filter->max_value &&
+        zone->max_id >= filter->min_id && zone->min_id <= filter->max_id;
+}
+
+static int record_matches(const TreasureRecord* record, const ZoneFilter* filter) {
+    return record->value >= filter->min_value && record->value <= filter->max_value &&
+        record->treasure_id >= filter->min_id && record->treasure_id <= filter->max_id;
+}
+
+void zone_filter_init(ZoneFilter* filter) {
+    filter->min_value = INT32_MIN;
+    filter->max_value = INT32_MAX;
+    filter->min_id = INT32_MIN;
+    filter->max_id = INT32_MAX;
+}
+
+int zone_filter_parse(ZoneFilter* filter, const char* condition) {
+    int64_t* min;
+    int64_t* max;
+    const char* p;
+    char* end;
+    long long number;
+    int op_length;
+
+    if (strncmp(condition, "value", 5) == 0) {
+        min = &filter->min_value;
+        max = &filter->max_value;
+        p = condition + 5;
+    } else if (strncmp(condition, "id", 2) == 0) {
+        min = &filter->min_id;
+        max = &filter->max_id;
+        p = condition + 2;
+    } else {
+        return 0;
+    }
+
+    if (strncmp(p, ">=", 2) == 0 || strncmp(p, "<=", 2) == 0 || strncmp(p, "==", 2) == 0) {
+        op_length = 2;
+    } else if (*p == '>' || *p == '<' || *p == '=') {
+        op_length = 1;
+    } else {
+        return 0;
+    }
+    errno = 0;
+    number = strtoll(p + op_length, &end, 10);
+    if (end == p + op_length || *end != '\0' || errno == ERANGE) {
+        return 0;
+    }
+
+    if (strncmp(p, ">=", 2) == 0) {
+        if (number > *min) {
+            *min = number;
+        }
+    } else if (strncmp(p, "<=", 2) == 0) {
+        if (number < *max) {
+            *max = number;
+        }
+    } else if (*p == '>') {
+        if (number + 1 > *min) {
+            *min = number + 1;
+        }
+    } else if (*p == '<') {
+        if (number - 1 < *max) {
+            *max = number - 1;
+        }
+    } else {
+        if (number > *min) {
+            *min = number;
+        }
+        if (number < *max) {
+            *max = number;
+        }
+    }
+    return 1;
+}
+
+static int read_zones_header(int fd, ZonesHeader* hdr) {
+    return pread(fd, hdr, sizeof(*hdr), 0) == sizeof(*hdr) &&
+        hdr->magic == ZONES_MAGIC &&
+        hdr->version == ZONES_VERSION &&
+        hdr->header_size == sizeof(ZonesHeader) &&
+        hdr->block_records > 0 &&
+        hdr->covered_slots >= 0;
+}
+
+static int64_t block_count(int64_t slots, uint32_t block_records) {
+    return (slots + block_records - 1) / block_records;
+}
+
+// Writes a new sidecar covering every slot of the snapshot.
+static int zones_build(const char* hunt_id, const StoreSnapshot* snap) {
+    char path[MAX_PATH];
+    char tmp_path[MAX_PATH];
+    char tmp_name[64];
+    ZonesHeader hdr;
+    ZoneEntry* zones;
+    StoreIter it;
+    const TreasureRecord* record;
+    int64_t blocks;
+    size_t zones_len;
+    int fd;
+    int ok;
+
+    // Concurrent rebuilds each write their own file; the last rename wins.
+    snprintf(tmp_name, sizeof(tmp_name), ZONES_FILENAME ".%ld.tmp", (long)getpid());
+    if (!store_path(path, MAX_PATH, hunt_id, ZONES_FILENAME) ||
+        !store_path(tmp_path, MAX_PATH, hunt_id, tmp_name)) {
+        return 0;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = ZONES_MAGIC;
+    hdr.version = ZONES_VERSION;
+    hdr.header_size = sizeof(ZonesHeader);
+    hdr.clue_gen = snap->hdr.clue_gen;
+    hdr.block_records = ZONE_BLOCK_RECORDS;
+    hdr.covered_slots = snap->hdr.slot_count;
+
+    blocks = block_count(hdr.covered_slots, hdr.block_records);
+    zones = malloc((size_t)(blocks + 1) * sizeof(ZoneEntry));
+    if (zones == NULL || !store_iter_snapshot(&it, snap)) {
+        free(zones);
+        return 0;
+    }
+    for (int64_t b = 0; b < blocks; b++) {
+        zone_empty(&zones[b]);
+    }
+    // Removed records are left out, so their blocks start out narrower.
+    while ((record = store_iter_next(&it)) != NULL) {
+        zone_add(&zones[(it.slot - 1) / hdr.block_records], record);
+    }
+    if (it.slot < hdr.covered_slots) {
+        hdr.covered_slots = it.slot;
+        blocks = block_count(hdr.covered_slots, hdr.block_records);
+    }
+    store_iter_close(&it);
+    zones_len = (size_t)blocks * sizeof(ZoneEntry);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(zones);
+        return 0;
+    }
+    ok = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        (zones_len == 0 || pwrite(fd, zones, zones_len, sizeof(hdr)) == (ssize_t)zones_len);
+    free(zones);
+    close(fd);
+
+    if (!ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+void zones_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count) {
+    char path[MAX_PATH];
+    ZonesHeader hdr;
+    ZoneEntry* zones;
+    int64_t first_block, blocks;
+    size_t zones_len;
+    off_t offset;
+    int fd;
+
+    if (count <= 0 || !store_path(path, MAX_PATH, hunt_id, ZONES_FILENAME)) {
+        return;
+    }
+
+    // No sidecar yet: the first filter builds one.
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        return;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    if (!read_zones_header(fd, &hdr) || hdr.clue_gen != clue_gen || hdr.covered_slots != first_slot) {
+        // See spatial_apply: a store that shrank invalidates the sidecar.
+        if (hdr.clue_gen == clue_gen && hdr.covered_slots > first_slot) {
+            ftruncate(fd, 0);
+        }
+        close(fd);
+        return;
+    }
+
+    first_block = first_slot / hdr.block_records;
+    blocks = (first_slot + count - 1) / hdr.block_records - first_block + 1;
+    zones_len = (size_t)blocks * sizeof(ZoneEntry);
+    offset = (off_t)sizeof(hdr) + (off_t)first_block * sizeof(ZoneEntry);
+    zones = malloc(zones_len);
+    if (zones == NULL) {
+        close(fd);
+        return;
+    }
+    for (int64_t b = 0; b < blocks; b++) {
+        zone_empty(&zones[b]);
+    }
+    // The first block may already hold records; widen its range.
+    if (first_slot % hdr.block_records != 0 &&
+        pread(fd, &zones[0], sizeof(ZoneEntry), offset) != sizeof(ZoneEntry)) {
+        free(zones);
+        close(fd);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        zone_add(&zones[(first_slot + i) / hdr.block_records - first_block], &records[i]);
+    }
+
+    if (pwrite(fd, zones, zones_len, offset) == (ssize_t)zones_len) {
+        hdr.covered_slots += count;
+        pwrite(fd, &hdr, sizeof(hdr), 0);
+    }
+    free(zones);
+    close(fd);
+}
+
+// Reads the zone entries if the sidecar can answer for the snapshot.
+static int zones_load(const char* hunt_id, const StoreSnapshot* snap, ZonesHeader* hdr, ZoneEntry** zones) {
+    char path[MAX_PATH];
+    size_t zones_len;
+    int fd;
+
+    *zones = NULL;
+    if (!store_path(path, MAX_PATH, hunt_id, ZONES_FILENAME)) {
+        return 0;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    if (!read_zones_header(fd, hdr) || hdr->clue_gen != snap->hdr.clue_gen ||
+        snap->hdr.slot_count - hdr->covered_slots > ZONE_MAX_GAP) {
+        close(fd);
+        return 0;
+    }
+
+    zones_len = (size_t)block_count(hdr->covered_slots, hdr->block_records) * sizeof(ZoneEntry);
+    *zones = malloc(zones_len + sizeof(ZoneEntry));
+    if (*zones == NULL ||
+        (zones_len > 0 && pread(fd, *zones, zones_len, sizeof(*hdr)) != (ssize_t)zones_len)) {
+        free(*zones);
+        *zones = NULL;
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    return 1;
+}
+
+static int add_record(RecordList* list, const TreasureRecord* record) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        TreasureRecord* grown = realloc(list->items, (size_t)capacity * sizeof(TreasureRecord));
+        if (grown == NULL) {
+            return 0;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = *record;
+    return 1;
+}
+
+// Reads slots [start, end), one pread per segment they span, and keeps the
+// live matches.
+static int scan_block(const StoreSnapshot* snap, const ZoneFilter* filter, int64_t start, int64_t end,
+    char* buffer, RecordList* list) {
+    int64_t n = store_snapshot_read(snap, start, end - start, (TreasureRecord*)buffer);
+
+    for (int64_t slot = start; slot < start + n; slot++) {
+        const TreasureRecord* record = (const TreasureRecord*)buffer + (slot - start);
+
+        if (!store_snapshot_is_dead(snap, slot) && record_matches(record, filter) && !add_record(list, record)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int zone_filter_scan(const char* hunt_id, const ZoneFilter* filter, TreasureRecord** records,
+    ZoneStats* stats) {
+    StoreSnapshot snap;
+    ZonesHeader hdr;
+    ZoneEntry* zones = NULL;
+    RecordList list = { NULL, 0, 0 };
+    ZoneStats counts = { 0, 0 };
+    uint32_t block_records = ZONE_BLOCK_RECORDS;
+    int64_t covered = 0;
+    char* buffer;
+    int ok = 1;
+
+    *records = NULL;
+    if (stats != NULL) {
+        *stats = counts;
+    }
+    if (!store_snapshot_open(&snap, hunt_id)) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    if (!zones_load(hunt_id, &snap, &hdr, &zones) && zones_build(hunt_id, &snap)) {
+        zones_load(hunt_id, &snap, &hdr, &zones);
+    }
+    if (zones != NULL) {
+        block_records = hdr.block_records;
+        covered = hdr.covered_slots < snap.hdr.slot_count ? hdr.covered_slots : snap.hdr.slot_count;
+    }
+
+    buffer = malloc((size_t)block_records * snap.hdr.record_size);
+    if (buffer == NULL) {
+        free(zones);
+        store_snapshot_close(&snap);
+        return -1;
+    }
+
+    for (int64_t start = 0; ok && start < covered; start += block_records) {
+        int64_t end = start + block_records < covered ? start + block_records : covered;
+
+        if (!zone_overlaps(&zones[start / block_records], filter)) {
+            counts.blocks_skipped++;
+            continue;
+        }
+        counts.blocks_scanned++;
+        ok = scan_block(&snap, filter, start, end, buffer, &list);
+    }
+    // Slots past the zone map (or all of them without one) are read in
+    // blocks of the same size.
+    for (int64_t start = covered; ok && start < snap.hdr.slot_count; start += block_records) {
+        int64_t end = start + block_records < snap.hdr.slot_count ? start + block_records : snap.hdr.slot_count;
+
+        counts.blocks_scanned++;
+        ok = scan_block(&snap, filter, start, end, buffer, &list);
+    }
+
+    free(buffer);
+    free(zones);
+    store_snapshot_close(&snap);
+
+    if (!ok) {
+        free(list.items);
+        return -1;
+    }
+    if (stats != NULL) {
+        *stats = counts;
+    }
+    *records = list.items;
+    return list.count;
+}
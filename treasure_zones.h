@@ -0,0 +1,77 @@
+#ifndef TREASURE_ZONES_H
+#define TREASURE_ZONES_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// Per-hunt "zones" sidecar: a zone map over treasures.dat. Slots are grouped
+// into blocks of ZONE_BLOCK_RECORDS and each block keeps the min and max
+// value and treasure_id of its records, so a range filter reads only the
+// blocks whose ranges can match.
+//
+// Appends widen the entry of the last block and add entries for new blocks
+// under the hunt lock, with the same rules as the spatial sidecar. Ranges only
+// ever widen, so a reader racing an append still sees a range that holds
+// every slot the header covered. Removals leave ranges as they are: a
+// block's range may be wider than its live records but never narrower.
+// Queries scan uncovered slots as one more block, and rebuild the file after
+// a compaction or when it falls more than ZONE_MAX_GAP slots behind.
+
+#define ZONES_FILENAME "zones"
+#define ZONES_MAGIC 0x534e4f5au /* "ZONS" */
+#define ZONES_VERSION 1
+
+#define ZONE_BLOCK_RECORDS 1024
+#define ZONE_MAX_GAP 4096
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t clue_gen;          // treasures.dat file generation the slots refer to
+    uint32_t block_records;
+    int64_t covered_slots;      // blocks describe slots [0, covered_slots)
+    int64_t reserved;
+} ZonesHeader;
+
+// The header is followed by one entry per block.
+typedef struct {
+    int32_t min_value;
+    int32_t max_value;
+    int32_t min_id;
+    int32_t max_id;
+} ZoneEntry;
+
+// Inclusive bounds; a filter matches records inside all of them.
+typedef struct {
+    int64_t min_value;
+    int64_t max_value;
+    int64_t min_id;
+    int64_t max_id;
+} ZoneFilter;
+
+typedef struct {
+    int64_t blocks_scanned;
+    int64_t blocks_skipped;
+} ZoneStats;
+
+// Called by the store with the hunt lock held, after records were appended
+// at first_slot.
+void zones_apply(const char* hunt_id, uint32_t clue_gen, int64_t first_slot,
+    const TreasureRecord* records, int count);
+
+// Sets filter to match everything.
+void zone_filter_init(ZoneFilter* filter);
+
+// Narrows filter by one condition such as "value>=100", "id<50" or
+// "value=7" (fields value and id; operators <, <=, =, ==, >=, >). Returns 1
+// on success, 0 if the condition cannot be parsed.
+int zone_filter_parse(ZoneFilter* filter, const char* condition);
+
+// Records matching filter in file order. Returns how many there are with a
+// malloc'd array in *records, or -1. Fills stats if it is not NULL.
+int zone_filter_scan(const char* hunt_id, const ZoneFilter* filter, TreasureRecord** records,
+    ZoneStats* stats);
+
+#endif